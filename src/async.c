@@ -31,6 +31,11 @@
 #include "gui.h"
 #include "sftp-panel.h"
 #include "main.h"
+#include "async.h"
+#include "deadline.h"
+#include "keepalive.h"
+#include "key_cache.h"
+#include "transfer_compression.h"
 
 extern Globals globals;
 extern Prefs prefs;
@@ -47,6 +52,14 @@ GPtrArray *transferArray;
 
 gboolean gIsTransferring;
 
+/* Directories to be read in background */
+typedef struct PrefetchRequest {
+  struct SSH_Node *p_node;
+  char path[1024];
+} SPrefetchRequest;
+
+GAsyncQueue *prefetchQueue = NULL;
+
 void
 lockSSH (char *caller, gboolean flagLock)
 {
@@ -60,6 +73,21 @@ lockSSH (char *caller, gboolean flagLock)
   }
 }
 
+/**
+ * trylockSSH() - locks the ssh mutex only if free, for the main loop that can't wait
+ * @return TRUE if locked
+ */
+gboolean
+trylockSSH (char *caller)
+{
+  if (pthread_mutex_trylock (&mutexSSH) != 0)
+    return (FALSE);
+
+  log_debug ("[%s] locked SSH mutex\n", caller);
+
+  return (TRUE);
+}
+
 void
 lockSFTPQueue (char *caller, gboolean flagLock)
 {
@@ -116,6 +144,15 @@ async_lterm_loop(gpointer data)
     // Check remote open files
     sftp_panel_check_inotify ();
 
+    // Stop stuck ssh operations
+    deadline_check_watched ();
+
+    // Keep ssh connections alive
+    keepalive_tick ();
+
+    // Forget expired unlocked keys
+    key_cache_check ();
+
     g_usleep (G_USEC_PER_SEC);
   }
 
@@ -195,7 +232,7 @@ async_sftp_transfer (gpointer userdata)
             {
               log_write ("Uploading to %s: %s\n", pTi->p_ssh->ssh_node->host, pTi->filename);
 
-              rc = sftp_copy_file_upload (pTi->p_ssh->ssh_node->sftp, pTi);
+              rc = transfer_copy_file (pTi->p_ssh, pTi);
               
               log_write ("Uploaded %d bytes\n", pTi->worked);
             }
@@ -218,7 +255,7 @@ async_sftp_transfer (gpointer userdata)
               
               //pTi->sourceIsDir = TRUE;
               
-              rc = sftp_copy_file_download (pTi->p_ssh->ssh_node->sftp, pTi);
+              rc = transfer_copy_file (pTi->p_ssh, pTi);
 
               log_write ("Downloaded %d bytes\n", pTi->worked);
             }
@@ -227,6 +264,14 @@ async_sftp_transfer (gpointer userdata)
       if (pTi->result)
         log_write ("%s %s\n", pTi->shortenedFilename, pTi->errorDesc);
 
+      /* a long transfer doesn't make the session look idle */
+      lockSSH (__func__, TRUE);
+
+      if (pTi->p_ssh->ssh_node)
+        ssh_node_update_time (pTi->p_ssh->ssh_node);
+
+      lockSSH (__func__, FALSE);
+
       // Desktop notification
 
       char message[2048];
@@ -247,4 +292,101 @@ async_sftp_transfer (gpointer userdata)
   //g_thread_exit (0);
 }
 
+/**
+ * async_prefetch_request() - asks to read path in background (urgent requests are served first)
+ */
+void
+async_prefetch_request (struct SSH_Node *p_node, char *path, gboolean urgent)
+{
+  SPrefetchRequest *pReq;
+
+  if (prefs.sftp_prefetch_dirs <= 0 || p_node == NULL)
+    return;
+
+  if (prefetchQueue == NULL)
+    {
+      prefetchQueue = g_async_queue_new_full (g_free);
+      g_thread_new ("prefetch", async_prefetch_loop, NULL);
+    }
+
+  /* user is moving faster than prefetch */
+  if (g_async_queue_length (prefetchQueue) >= 4 * prefs.sftp_prefetch_dirs)
+    return;
 
+  pReq = g_new0 (SPrefetchRequest, 1);
+  pReq->p_node = p_node;
+  strncpy (pReq->path, path, sizeof (pReq->path) - 1);
+
+#if GLIB_CHECK_VERSION(2, 46, 0)
+  if (urgent)
+    g_async_queue_push_front (prefetchQueue, pReq);
+  else
+#endif
+    g_async_queue_push (prefetchQueue, pReq);
+}
+
+/**
+ * async_prefetch_subdirectories() - asks to read the first subdirectories of the current listing
+ */
+void
+async_prefetch_subdirectories (struct SSH_Info *p_ssh)
+{
+  struct Directory_Entry *e;
+  char path[2048];
+  int n = 0;
+
+  if (prefs.sftp_prefetch_dirs <= 0)
+    return;
+
+  for (e = p_ssh->dirlist.head; e && n < prefs.sftp_prefetch_dirs; e = e->next)
+    {
+      if (!is_directory (e) || !strcmp (e->name, ".") || !strcmp (e->name, ".."))
+        continue;
+
+      if (!p_ssh->dirlist.show_hidden_files && is_hidden_file (e))
+        continue;
+
+      sprintf (path, "%s/%s", strcmp (p_ssh->directory, "/") ? p_ssh->directory : "", e->name);
+      async_prefetch_request (p_ssh->ssh_node, path, FALSE);
+      n ++;
+    }
+}
+
+gpointer
+async_prefetch_loop (gpointer data)
+{
+  SPrefetchRequest *pReq;
+
+  log_write ("%s BEGIN THREAD 0x%08x\n", __func__, pthread_self ());
+
+  while (globals.running) {
+    if ((pReq = (SPrefetchRequest *) g_async_queue_timeout_pop (prefetchQueue, G_USEC_PER_SEC)) == NULL)
+      continue;
+
+    /* transfers use the same sftp sessions */
+    if (!async_is_transferring ())
+      {
+        lockSSH (__func__, TRUE);
+
+        /* the node could have been released while the request was waiting */
+        if (ssh_list_contains (&globals.ssh_list, pReq->p_node)
+            && ssh_node_get_validity (pReq->p_node) && pReq->p_node->sftp
+            && !dir_cache_contains (pReq->p_node, pReq->path)
+            && ssh_node_prefetch_allowed (pReq->p_node))
+          {
+            sftp_prefetch_directory (pReq->p_node, pReq->path);
+          }
+
+        lockSSH (__func__, FALSE);
+      }
+
+    g_free (pReq);
+
+    /* low priority: leave the ssh mutex to the user between requests */
+    g_usleep (G_USEC_PER_SEC / 20);
+  }
+
+  log_write ("%s END\n", __func__);
+
+  return (NULL);
+}
@@ -9,6 +9,7 @@
 #define UNLOCK_SSH lockSSH(__func__, FALSE);
 
 void lockSSH (char *caller, gboolean flagLock);
+gboolean trylockSSH (char *caller);
 void lockSFTPQueue (char *caller, gboolean flagLock);
 
 void asyncInit();
@@ -17,5 +18,9 @@ gpointer async_lterm_loop(gpointer data);
 gboolean async_is_transferring ();
 int async_sftp_transfer (gpointer userdata);
 
+void async_prefetch_request (struct SSH_Node *p_node, char *path, gboolean urgent);
+void async_prefetch_subdirectories (struct SSH_Info *p_ssh);
+gpointer async_prefetch_loop (gpointer data);
+
 #endif
 
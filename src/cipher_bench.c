@@ -0,0 +1,284 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file cipher_bench.c
+ * @brief Measures the sftp throughput of each cipher against a host and keeps the fastest
+ */
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+#include "main.h"
+#include "gui.h"
+#include "ssh.h"
+#include "connection_list.h"
+#include "sftp-panel.h"
+#include "cipher_bench.h"
+
+extern Globals globals;
+extern GtkWidget *main_window;
+extern struct Connection_List conn_list;
+
+/**
+ * cipher_bench_measure() - downloads CIPHER_BENCH_BYTES in a new session using only the cipher of r
+ * Data is read as the sftp panel does, so the result is what transfers will get.
+ * @return 0 if ok, 1 otherwise (r->error is set)
+ */
+int
+cipher_bench_measure (struct SSH_Auth_Data *p_auth, SCipherBenchResult *r, gboolean *cancel)
+{
+  struct SSH_Auth_Data auth;
+  struct SSH_Node node;
+  sftp_file file;
+  char *buffer;
+  gint64 start, elapsed;
+  long total = 0;
+  int nbytes;
+
+  memcpy (&auth, p_auth, sizeof (struct SSH_Auth_Data));
+  strcpy (auth.ciphers, r->cipher);
+  auth.sftp_enabled = 1;
+  auth.cancel = cancel;
+
+  r->mbps = 0;
+  memset (&node, 0, sizeof (struct SSH_Node));
+
+  /* private session, nobody else is using it */
+  if (ssh_node_establish (&node, &auth, FALSE) != 0)
+    {
+      strcpy (r->error, auth.error_s);
+      return (1);
+    }
+
+  if (node.sftp == NULL || (file = sftp_open (node.sftp, CIPHER_BENCH_FILE, O_RDONLY, 0)) == NULL)
+    {
+      sprintf (r->error, "Can't read %s", CIPHER_BENCH_FILE);
+      ssh_node_free (&node);
+      return (1);
+    }
+
+  buffer = g_malloc (SFTP_BUFFER_SIZE);
+  start = g_get_monotonic_time ();
+
+  while (total < CIPHER_BENCH_BYTES && !*cancel)
+    {
+      if ((nbytes = sftp_read (file, buffer, SFTP_BUFFER_SIZE)) <= 0)
+        break;
+
+      total += nbytes;
+    }
+
+  elapsed = g_get_monotonic_time () - start;
+
+  g_free (buffer);
+  sftp_close (file);
+  ssh_node_free (&node);
+
+  if (total < CIPHER_BENCH_BYTES)
+    {
+      strcpy (r->error, *cancel ? "Cancelled" : "Read error");
+      return (1);
+    }
+
+  r->mbps = (double) total / (1024 * 1024) / ((double) elapsed / G_USEC_PER_SEC);
+
+  log_write ("cipher_bench host=%s cipher=%s mbps=%.1f\n", p_auth->host, r->cipher, r->mbps);
+
+  return (0);
+}
+
+gpointer
+cipher_bench_thread (gpointer data)
+{
+  SCipherBenchJob *job = (SCipherBenchJob *) data;
+
+  for (job->current = 0; job->current < job->n && !job->cancel; job->current ++)
+    cipher_bench_measure (&job->auth, &job->results[job->current], &job->cancel);
+
+  job->finished = TRUE;
+
+  return (NULL);
+}
+
+gboolean
+cipher_bench_refresh_cb (gpointer data)
+{
+  SCipherBenchJob *job = (SCipherBenchJob *) data;
+  char text[256];
+  int i = MIN (job->current, job->n - 1);
+
+  if (job->finished)
+    {
+      gtk_dialog_response (GTK_DIALOG (job->dialog), GTK_RESPONSE_OK);
+      return (FALSE);
+    }
+
+  sprintf (text, "%s (%d/%d)", job->results[i].cipher, i + 1, job->n);
+  gtk_progress_bar_set_text (GTK_PROGRESS_BAR (job->progress), text);
+  gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (job->progress), (double) i / job->n);
+
+  return (TRUE);
+}
+
+int
+cipher_bench_compare (const void *a, const void *b)
+{
+  double d = ((SCipherBenchResult *) b)->mbps - ((SCipherBenchResult *) a)->mbps;
+
+  return (d > 0 ? 1 : d < 0 ? -1 : 0);
+}
+
+/**
+ * cipher_bench_record() - saves the ciphers that worked in the connection, fastest first
+ * The others are kept in the list so that a server changing its configuration is still reachable.
+ */
+void
+cipher_bench_record (SCipherBenchJob *job, struct ConnectionTab *p_ct)
+{
+  struct Connection *p_conn;
+  char ciphers[256];
+  int i;
+
+  ciphers[0] = 0;
+
+  for (i = 0; i < job->n && job->results[i].mbps > 0; i++)
+    {
+      if (strlen (ciphers) + strlen (job->results[i].cipher) + 2 > sizeof (ciphers))
+        break;
+
+      if (ciphers[0])
+        strcat (ciphers, ",");
+
+      strcat (ciphers, job->results[i].cipher);
+    }
+
+  if (ciphers[0] == 0)
+    return;
+
+  if ((p_conn = cl_get_by_name (&conn_list, job->connection)) != NULL)
+    strcpy (p_conn->sshOptions.ciphers, ciphers);
+
+  strcpy (p_ct->connection.sshOptions.ciphers, ciphers);
+
+  log_write ("Ciphers of %s: %s\n", job->connection, ciphers);
+}
+
+/**
+ * cipher_bench_tab() - measures the candidate ciphers against the host of a tab and records the fastest
+ */
+void
+cipher_bench_tab (struct ConnectionTab *p_ct)
+{
+  SCipherBenchJob *job;
+  GThread *thread;
+  GtkWidget *label;
+  GString *report;
+  gchar **candidates;
+  char text[512];
+  guint timeout_id;
+  int i;
+
+  if (p_ct == NULL || p_ct->type != CONNECTION_REMOTE || p_ct->ssh_info.ssh_node == NULL)
+    {
+      msgbox_info (_("Cipher benchmark needs a tab connected with ssh"));
+      return;
+    }
+
+  job = g_new0 (SCipherBenchJob, 1);
+
+  strcpy (job->connection, p_ct->connection.name);
+  strcpy (job->auth.host, p_ct->connection.host);
+  job->auth.port = p_ct->connection.port;
+  job->auth.mode = p_ct->connection.auth_mode;
+  strcpy (job->auth.identityFile, p_ct->connection.identityFile);
+  strcpy (job->auth.macs, p_ct->connection.sshOptions.macs);
+  strcpy (job->auth.kex, p_ct->connection.sshOptions.kex);
+  strcpy (job->auth.jump, p_ct->connection.sshOptions.jumpHost);
+
+  /* credentials already accepted by the server */
+  lockSSH (__func__, TRUE);
+  strcpy (job->auth.user, p_ct->ssh_info.ssh_node->user);
+  strcpy (job->auth.password, p_ct->ssh_info.ssh_node->password);
+  lockSSH (__func__, FALSE);
+
+  candidates = g_strsplit (CIPHER_BENCH_CANDIDATES, ",", CIPHER_BENCH_MAX);
+
+  for (i = 0; candidates[i]; i++)
+    strcpy (job->results[job->n ++].cipher, candidates[i]);
+
+  g_strfreev (candidates);
+
+  job->dialog = gtk_dialog_new_with_buttons (_("Cipher benchmark"), GTK_WINDOW (main_window), GTK_DIALOG_MODAL,
+                                             GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+                                             NULL);
+
+  sprintf (text, _("Downloading %d MB from %s with each cipher..."), CIPHER_BENCH_BYTES / (1024 * 1024), job->auth.host);
+  label = gtk_label_new (text);
+  job->progress = gtk_progress_bar_new ();
+#if (GTK_MAJOR_VERSION == 3)
+  gtk_progress_bar_set_show_text (GTK_PROGRESS_BAR (job->progress), TRUE);
+#endif
+
+  gtk_container_set_border_width (GTK_CONTAINER (job->dialog), 10);
+  gtk_box_pack_start (GTK_BOX (gtk_dialog_get_content_area (GTK_DIALOG (job->dialog))), label, FALSE, FALSE, 5);
+  gtk_box_pack_start (GTK_BOX (gtk_dialog_get_content_area (GTK_DIALOG (job->dialog))), job->progress, FALSE, FALSE, 5);
+  gtk_widget_show_all (gtk_dialog_get_content_area (GTK_DIALOG (job->dialog)));
+
+  thread = g_thread_new ("cipher-bench", cipher_bench_thread, job);
+  timeout_id = gdk_threads_add_timeout (CIPHER_BENCH_REFRESH_MSECS, cipher_bench_refresh_cb, job);
+
+  /* OK is sent by cipher_bench_refresh_cb() when done, removing itself */
+  if (gtk_dialog_run (GTK_DIALOG (job->dialog)) != GTK_RESPONSE_OK)
+    {
+      g_source_remove (timeout_id);
+      job->cancel = TRUE;
+    }
+
+  g_thread_join (thread);
+  gtk_widget_destroy (job->dialog);
+
+  if (!job->cancel)
+    {
+      qsort (job->results, job->n, sizeof (SCipherBenchResult), cipher_bench_compare);
+
+      report = g_string_new ("");
+
+      for (i = 0; i < job->n; i++)
+        {
+          if (job->results[i].mbps > 0)
+            g_string_append_printf (report, "%s: %.1f MB/s\n", job->results[i].cipher, job->results[i].mbps);
+          else
+            g_string_append_printf (report, "%s: %s\n", job->results[i].cipher, job->results[i].error);
+        }
+
+      cipher_bench_record (job, p_ct);
+
+      if (job->results[0].mbps > 0)
+        g_string_append_printf (report, _("\n%s will be used by next connections to %s"), job->results[0].cipher, job->auth.host);
+
+      msgbox_info ("%s", report->str);
+      g_string_free (report, TRUE);
+    }
+
+  g_free (job);
+}
+
@@ -0,0 +1,51 @@
+
+#ifndef _CIPHER_BENCH_H
+#define _CIPHER_BENCH_H
+
+#include <gtk/gtk.h>
+#include "ssh.h"
+#include "gui.h"
+
+/* Ciphers measured, the ones not supported by libssh or the server are skipped */
+#define CIPHER_BENCH_CANDIDATES "chacha20-poly1305@openssh.com,aes128-gcm@openssh.com,aes256-gcm@openssh.com,aes128-ctr,aes192-ctr,aes256-ctr"
+#define CIPHER_BENCH_MAX 16
+
+/* Bytes downloaded with each cipher */
+#define CIPHER_BENCH_BYTES (16 * 1024 * 1024)
+
+/* Remote file read by the benchmark, endless on every unix */
+#define CIPHER_BENCH_FILE "/dev/zero"
+
+#define CIPHER_BENCH_REFRESH_MSECS 200
+
+/**
+ * struct CipherBenchResult
+ * throughput measured with a cipher
+ */
+typedef struct CipherBenchResult {
+  char cipher[64];
+  double mbps;      /* MB/s, 0 if the cipher can't be used */
+  char error[512];
+} SCipherBenchResult;
+
+/**
+ * struct CipherBenchJob
+ * benchmark running in a thread while the dialog shows its progress
+ */
+typedef struct CipherBenchJob {
+  struct SSH_Auth_Data auth;
+  char connection[256];  /* name of the connection recording the fastest cipher */
+  SCipherBenchResult results[CIPHER_BENCH_MAX];
+  int n;
+  int current;           /* cipher being measured */
+  gboolean cancel;
+  gboolean finished;
+  GtkWidget *dialog;
+  GtkWidget *progress;
+} SCipherBenchJob;
+
+int cipher_bench_measure (struct SSH_Auth_Data *p_auth, SCipherBenchResult *r, gboolean *cancel);
+void cipher_bench_tab (struct ConnectionTab *p_ct);
+
+#endif
+
@@ -0,0 +1,309 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file conn_stats.c
+ * @brief Time spent by the phases of connections, per host
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <glib.h>
+#include "main.h"
+#include "conn_stats.h"
+
+char *connPhaseNames[] = { "dns", "tcp", "kex", "hostkey", "auth", "sftp" };
+
+/* SHostStats by host:port, written by connecting threads and the keepalive loop */
+GHashTable *hostStats = NULL;
+pthread_mutex_t mutexConnStats = PTHREAD_MUTEX_INITIALIZER;
+
+void
+conn_timing_start (SConnTiming *t)
+{
+  memset (t, 0, sizeof (SConnTiming));
+  t->mark = g_get_monotonic_time ();
+}
+
+/**
+ * conn_timing_mark() - ends a phase, the next one starts now
+ */
+void
+conn_timing_mark (SConnTiming *t, int phase)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  t->usec[phase] += now - t->mark;
+  t->mark = now;
+}
+
+gint64
+conn_timing_total (SConnTiming *t)
+{
+  gint64 total = 0;
+  int i;
+
+  for (i = 0; i < CONN_PHASES; i++)
+    total += t->usec[i];
+
+  return (total);
+}
+
+/* call with stats mutex locked */
+SHostStats *
+conn_stats_get (char *host, int port, gboolean create)
+{
+  SHostStats *s;
+  char key[320];
+
+  sprintf (key, "%.255s:%d", host, port);
+
+  if (hostStats == NULL)
+    hostStats = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+
+  if ((s = (SHostStats *) g_hash_table_lookup (hostStats, key)) == NULL && create)
+    {
+      s = g_new0 (SHostStats, 1);
+      strcpy (s->key, key);
+      g_hash_table_insert (hostStats, s->key, s);
+    }
+
+  return (s);
+}
+
+double
+rolling_average (double avg, double value, int samples)
+{
+  return (samples <= 1 ? value : avg + CONN_STATS_WEIGHT * (value - avg));
+}
+
+/**
+ * conn_stats_add() - records a connection and writes its phases to the log as key=value pairs
+ * Failed connections are logged but don't change the averages.
+ */
+void
+conn_stats_add (char *host, int port, SConnTiming *t, int ok)
+{
+  SHostStats *s;
+  char line[512], item[64];
+  double total_ms;
+  int i;
+
+  total_ms = conn_timing_total (t) / 1000.0;
+
+  sprintf (line, "conn_stats host=%s port=%d result=%s", host, port, ok ? "ok" : "error");
+
+  for (i = 0; i < CONN_PHASES; i++)
+    {
+      sprintf (item, " %s_ms=%.1f", connPhaseNames[i], t->usec[i] / 1000.0);
+      strcat (line, item);
+    }
+
+  sprintf (item, " total_ms=%.1f", total_ms);
+  strcat (line, item);
+
+  log_write ("%s\n", line);
+
+  pthread_mutex_lock (&mutexConnStats);
+
+  s = conn_stats_get (host, port, TRUE);
+
+  if (ok)
+    {
+      s->samples ++;
+
+      for (i = 0; i < CONN_PHASES; i++)
+        {
+          s->last_ms[i] = t->usec[i] / 1000.0;
+          s->avg_ms[i] = rolling_average (s->avg_ms[i], s->last_ms[i], s->samples);
+        }
+
+      if (s->samples == 1 || total_ms < s->min_total_ms)
+        s->min_total_ms = total_ms;
+
+      if (total_ms > s->max_total_ms)
+        s->max_total_ms = total_ms;
+    }
+  else
+    s->failures ++;
+
+  pthread_mutex_unlock (&mutexConnStats);
+}
+
+/**
+ * conn_stats_add_rtt() - records the round trip time measured after a keepalive
+ */
+void
+conn_stats_add_rtt (char *host, int port, double rtt_ms)
+{
+  SHostStats *s;
+
+  pthread_mutex_lock (&mutexConnStats);
+
+  s = conn_stats_get (host, port, TRUE);
+  s->rtt_samples ++;
+  s->rtt_last_ms = rtt_ms;
+  s->rtt_avg_ms = rolling_average (s->rtt_avg_ms, rtt_ms, s->rtt_samples);
+
+  pthread_mutex_unlock (&mutexConnStats);
+
+  log_debug ("rtt host=%s port=%d rtt_ms=%.1f\n", host, port, rtt_ms);
+}
+
+/**
+ * conn_stats_add_transfer() - records the throughput of an sftp transfer, with or without compression
+ */
+void
+conn_stats_add_transfer (char *host, int port, int compressed, guint64 bytes, gint64 usec)
+{
+  SHostStats *s;
+  double mbps;
+
+  if (bytes < CONN_STATS_MIN_TRANSFER || usec <= 0)
+    return;
+
+  mbps = (double) bytes / (1024 * 1024) / ((double) usec / G_USEC_PER_SEC);
+
+  pthread_mutex_lock (&mutexConnStats);
+
+  s = conn_stats_get (host, port, TRUE);
+  s->xfer_samples[compressed] ++;
+  s->xfer_avg_mbps[compressed] = rolling_average (s->xfer_avg_mbps[compressed], mbps, s->xfer_samples[compressed]);
+
+  pthread_mutex_unlock (&mutexConnStats);
+
+  log_write ("conn_stats host=%s port=%d transfer compressed=%d bytes=%llu mbps=%.2f\n",
+             host, port, compressed, (unsigned long long) bytes, mbps);
+}
+
+/**
+ * conn_stats_transfer_rates() - average throughput of transfers without (index 0) and with (index 1) compression
+ * @return 0 if found, 1 if nothing has been recorded for the host
+ */
+int
+conn_stats_transfer_rates (char *host, int port, double *mbps, int *samples)
+{
+  SHostStats *s;
+  int i;
+
+  pthread_mutex_lock (&mutexConnStats);
+
+  if ((s = conn_stats_get (host, port, FALSE)) == NULL)
+    {
+      pthread_mutex_unlock (&mutexConnStats);
+      return (1);
+    }
+
+  for (i = 0; i < 2; i++)
+    {
+      mbps[i] = s->xfer_avg_mbps[i];
+      samples[i] = s->xfer_samples[i];
+    }
+
+  pthread_mutex_unlock (&mutexConnStats);
+
+  return (0);
+}
+
+/* call with stats mutex locked */
+void
+conn_stats_format (SHostStats *s, GString *text)
+{
+  double total = 0;
+  int i;
+
+  if (s->samples > 0)
+    {
+      for (i = 0; i < CONN_PHASES; i++)
+        total += s->last_ms[i];
+
+      g_string_append_printf (text, "Last connection: %.0f ms (", total);
+
+      for (i = 0; i < CONN_PHASES; i++)
+        g_string_append_printf (text, "%s%s %.0f", i ? ", " : "", connPhaseNames[i], s->last_ms[i]);
+
+      g_string_append_printf (text, ")\nAverage of %d: ", s->samples);
+
+      for (i = 0; i < CONN_PHASES; i++)
+        g_string_append_printf (text, "%s%s %.0f", i ? ", " : "", connPhaseNames[i], s->avg_ms[i]);
+
+      g_string_append_printf (text, "\nTotal min/max: %.0f/%.0f ms", s->min_total_ms, s->max_total_ms);
+    }
+
+  if (s->failures > 0)
+    g_string_append_printf (text, "%sFailed connections: %d", text->len ? "\n" : "", s->failures);
+
+  if (s->rtt_samples > 0)
+    g_string_append_printf (text, "%sRound trip: %.1f ms (average %.1f)", text->len ? "\n" : "", s->rtt_last_ms, s->rtt_avg_ms);
+
+  if (s->xfer_samples[0] > 0 || s->xfer_samples[1] > 0)
+    g_string_append_printf (text, "%sTransfers: %.1f MB/s plain (%d), %.1f MB/s compressed (%d)", text->len ? "\n" : "",
+                            s->xfer_avg_mbps[0], s->xfer_samples[0], s->xfer_avg_mbps[1], s->xfer_samples[1]);
+}
+
+/**
+ * conn_stats_describe() - text describing the connections to a host
+ * @return a string to be freed with g_free(), NULL if no connection has been recorded
+ */
+char *
+conn_stats_describe (char *host, int port)
+{
+  SHostStats *s;
+  GString *text;
+
+  pthread_mutex_lock (&mutexConnStats);
+
+  if ((s = conn_stats_get (host, port, FALSE)) == NULL)
+    {
+      pthread_mutex_unlock (&mutexConnStats);
+      return (NULL);
+    }
+
+  text = g_string_new ("");
+  conn_stats_format (s, text);
+
+  pthread_mutex_unlock (&mutexConnStats);
+
+  return (g_string_free (text, FALSE));
+}
+
+void
+conn_stats_dump ()
+{
+  GHashTableIter iter;
+  SHostStats *s;
+  GString *text;
+
+  pthread_mutex_lock (&mutexConnStats);
+
+  if (hostStats)
+    {
+      g_hash_table_iter_init (&iter, hostStats);
+
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &s))
+        {
+          text = g_string_new ("");
+          conn_stats_format (s, text);
+          log_debug ("%s\n%s\n", s->key, text->str);
+          g_string_free (text, TRUE);
+        }
+    }
+
+  pthread_mutex_unlock (&mutexConnStats);
+}
+
@@ -0,0 +1,62 @@
+
+#ifndef _CONN_STATS_H
+#define _CONN_STATS_H
+
+#include <glib.h>
+
+/* Phases of a connection */
+#define CONN_PHASE_DNS 0
+#define CONN_PHASE_TCP 1
+#define CONN_PHASE_KEX 2
+#define CONN_PHASE_HOSTKEY 3
+#define CONN_PHASE_AUTH 4
+#define CONN_PHASE_SFTP 5
+#define CONN_PHASES 6
+
+/* Weight of a new sample in the rolling averages */
+#define CONN_STATS_WEIGHT 0.2
+
+/* Smaller transfers measure latency more than throughput and aren't recorded */
+#define CONN_STATS_MIN_TRANSFER (1024 * 1024)
+
+/**
+ * struct ConnTiming
+ * duration of the phases of a single connection
+ */
+typedef struct ConnTiming {
+  gint64 usec[CONN_PHASES];
+  gint64 mark;       /* monotonic time the current phase started */
+} SConnTiming;
+
+/**
+ * struct HostStats
+ * rolling statistics of the connections to a host
+ */
+typedef struct HostStats {
+  char key[320];     /* host:port */
+  int samples;
+  int failures;
+  double avg_ms[CONN_PHASES];
+  double last_ms[CONN_PHASES];
+  double min_total_ms;
+  double max_total_ms;
+  int rtt_samples;
+  double rtt_avg_ms;
+  double rtt_last_ms;
+  int xfer_samples[2];    /* sftp transfers without and with compression */
+  double xfer_avg_mbps[2];
+} SHostStats;
+
+void conn_timing_start (SConnTiming *t);
+void conn_timing_mark (SConnTiming *t, int phase);
+gint64 conn_timing_total (SConnTiming *t);
+
+void conn_stats_add (char *host, int port, SConnTiming *t, int ok);
+void conn_stats_add_rtt (char *host, int port, double rtt_ms);
+void conn_stats_add_transfer (char *host, int port, int compressed, guint64 bytes, gint64 usec);
+int conn_stats_transfer_rates (char *host, int port, double *mbps, int *samples);
+char *conn_stats_describe (char *host, int port);
+void conn_stats_dump ();
+
+#endif
+
@@ -37,6 +37,7 @@
 #include "main.h"
 #include "utils.h"
 #include "xml.h"
+#include "conn_stats.h"
 
 #define SEARCH_BY_NAME "Search by name"
 #define SEARCH_BY_HOST "Search by host"
@@ -68,6 +69,7 @@ GtkWidget *connections_dialog;
 GtkWidget *port_spin_button;
 GtkWidget *check_x11, *check_agentForwarding;
 GtkWidget *check_disable_key_checking, *check_keepAliveInterval, *spin_keepAliveInterval;
+GtkWidget *entry_ciphers, *entry_macs, *entry_kex, *combo_compression, *entry_jumpHost;
 
 struct _AuthWidgets {
   GtkWidget *user_entry, *password_entry;
@@ -475,6 +477,11 @@ write_connection_node (FILE *fp, struct Connection *p_conn, int indent)
                            "%*s    <property name='agentForwarding'>%d</property>\n"
                            "%*s    <property name='disableStrictKeyChecking'>%d</property>\n"
                            "%*s    <property name='keepAliveInterval' enabled='%d'>%d</property>\n"
+                           "%*s    <property name='ciphers'>%s</property>\n"
+                           "%*s    <property name='macs'>%s</property>\n"
+                           "%*s    <property name='kex'>%s</property>\n"
+                           "%*s    <property name='compression'>%d</property>\n"
+                           "%*s    <property name='jumpHost'>%s</property>\n"
                            "%*s  </options>\n",
                         indent, " ", p_conn->name, NVL(p_conn->host, ""), NVL(p_conn->protocol, ""), p_conn->port, p_conn->flags,
                         //indent, " ", p_conn->emulation,
@@ -498,6 +505,11 @@ write_connection_node (FILE *fp, struct Connection *p_conn, int indent)
                         indent, " ", p_conn->sshOptions.agentForwarding,
                         indent, " ", p_conn->sshOptions.disableStrictKeyChecking,
                         indent, " ", p_conn->sshOptions.flagKeepAlive, p_conn->sshOptions.keepAliveInterval,
+                        indent, " ", p_conn->sshOptions.ciphers,
+                        indent, " ", p_conn->sshOptions.macs,
+                        indent, " ", p_conn->sshOptions.kex,
+                        indent, " ", p_conn->sshOptions.compression,
+                        indent, " ", p_conn->sshOptions.jumpHost[0] ? g_markup_escape_text (p_conn->sshOptions.jumpHost, strlen (p_conn->sshOptions.jumpHost)) : "",
                         indent, " "
                       );
                         
@@ -844,6 +856,16 @@ read_connection_node (XMLNode *node, struct Connection *pConn)
           pConn->sshOptions.flagKeepAlive = atoi (NVL(xml_node_get_attribute (propNode, "enabled"), "0"));
           pConn->sshOptions.keepAliveInterval = atoi (propertyValue);
         }
+        else if (!strcmp(propertyName, "ciphers"))
+          strcpy (pConn->sshOptions.ciphers, NVL(xml_node_get_value (propNode), ""));
+        else if (!strcmp(propertyName, "macs"))
+          strcpy (pConn->sshOptions.macs, NVL(xml_node_get_value (propNode), ""));
+        else if (!strcmp(propertyName, "kex"))
+          strcpy (pConn->sshOptions.kex, NVL(xml_node_get_value (propNode), ""));
+        else if (!strcmp(propertyName, "compression"))
+          pConn->sshOptions.compression = atoi (propertyValue);
+        else if (!strcmp(propertyName, "jumpHost"))
+          strcpy (pConn->sshOptions.jumpHost, NVL(xml_node_get_value (propNode), ""));
   
         propNode = propNode->next;
       }
@@ -1198,6 +1220,11 @@ change_protocol_cb (GtkWidget *entry, gpointer user_data)
       gtk_widget_set_sensitive (check_disable_key_checking, sensitive);
       gtk_widget_set_sensitive (check_keepAliveInterval, sensitive);
       gtk_widget_set_sensitive (spin_keepAliveInterval, sensitive);
+      gtk_widget_set_sensitive (entry_ciphers, sensitive);
+      gtk_widget_set_sensitive (entry_macs, sensitive);
+      gtk_widget_set_sensitive (entry_kex, sensitive);
+      gtk_widget_set_sensitive (combo_compression, sensitive);
+      gtk_widget_set_sensitive (entry_jumpHost, sensitive);
       gtk_widget_set_sensitive (authWidgets.radio_auth_key, sensitive);
 //#endif
 
@@ -1595,6 +1622,27 @@ add_update_connection (struct GroupNode *p_node, struct Connection *p_conn_model
     gtk_spin_button_set_value (GTK_SPIN_BUTTON (spin_keepAliveInterval), p_conn->sshOptions.keepAliveInterval);
   }
 
+  // Algorithms
+  entry_ciphers = GTK_WIDGET (gtk_builder_get_object (builder, "entry_ciphers"));
+  entry_macs = GTK_WIDGET (gtk_builder_get_object (builder, "entry_macs"));
+  entry_kex = GTK_WIDGET (gtk_builder_get_object (builder, "entry_kex"));
+
+  if (p_conn) {
+    gtk_entry_set_text (GTK_ENTRY (entry_ciphers), p_conn->sshOptions.ciphers);
+    gtk_entry_set_text (GTK_ENTRY (entry_macs), p_conn->sshOptions.macs);
+    gtk_entry_set_text (GTK_ENTRY (entry_kex), p_conn->sshOptions.kex);
+  }
+
+  // Jump host
+  entry_jumpHost = GTK_WIDGET (gtk_builder_get_object (builder, "entry_jumpHost"));
+
+  if (p_conn)
+    gtk_entry_set_text (GTK_ENTRY (entry_jumpHost), p_conn->sshOptions.jumpHost);
+
+  // Compression
+  combo_compression = GTK_WIDGET (gtk_builder_get_object (builder, "combo_compression"));
+  gtk_combo_box_set_active (GTK_COMBO_BOX (combo_compression), p_conn ? p_conn->sshOptions.compression : CONN_COMPRESSION_OFF);
+
   // Key authentication (need to be created before sig_handler_prot)
   authWidgets.radio_auth_key = GTK_WIDGET (gtk_builder_get_object (builder, "radio_auth_key"));
   authWidgets.user_entry = GTK_WIDGET (gtk_builder_get_object (builder, "entry_user"));
@@ -1880,6 +1928,15 @@ add_update_connection (struct GroupNode *p_node, struct Connection *p_conn_model
           conn_new.sshOptions.disableStrictKeyChecking = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (check_disable_key_checking)) ? 1 : 0;
           conn_new.sshOptions.flagKeepAlive = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (check_keepAliveInterval)) ? 1 : 0;
           conn_new.sshOptions.keepAliveInterval = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (spin_keepAliveInterval));
+          strcpy (conn_new.sshOptions.ciphers, gtk_entry_get_text (GTK_ENTRY (entry_ciphers)));
+          strcpy (conn_new.sshOptions.macs, gtk_entry_get_text (GTK_ENTRY (entry_macs)));
+          strcpy (conn_new.sshOptions.kex, gtk_entry_get_text (GTK_ENTRY (entry_kex)));
+          trim (conn_new.sshOptions.ciphers);
+          trim (conn_new.sshOptions.macs);
+          trim (conn_new.sshOptions.kex);
+          conn_new.sshOptions.compression = gtk_combo_box_get_active (GTK_COMBO_BOX (combo_compression));
+          strcpy (conn_new.sshOptions.jumpHost, gtk_entry_get_text (GTK_ENTRY (entry_jumpHost)));
+          trim (conn_new.sshOptions.jumpHost);
 
           //conn_new.flags |= (CONN_FLAG_MASK & gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (ignore_warnings_check)) ? 1 : 0);
           conn_new.flags = (conn_new.flags & ~(CONN_FLAG_IGNORE_WARNINGS)) | ((gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (ignore_warnings_check)) ? 1 : 0) << 0);
@@ -2388,7 +2445,7 @@ row_activated_quick_cb (GtkTreeView *tree_view, GtkTreePath *path, GtkTreeViewCo
   gint sel_port;
   gchar *sel_name;
   struct ConnectionTab *p_connection_tab;
-  int connect_it = 0, retcode;
+  int connect_it = 0;
 
   
 
@@ -2410,14 +2467,11 @@ row_activated_quick_cb (GtkTreeView *tree_view, GtkTreePath *path, GtkTreeViewCo
 
       log_debug ("connecting to '%s' ...\n", p_connection_tab->connection.name);
 
-      retcode = log_on (p_connection_tab);
+      /* the tab is shown while connecting in background */
+      connection_tab_prepare (p_connection_tab);
+      gtk_widget_grab_focus (p_current_connection_tab->hbox_terminal);
 
-      if (retcode == 0)
-        {
-          connection_tab_add (p_connection_tab);
-          p_current_connection_tab = p_connection_tab;
-          gtk_widget_grab_focus (p_current_connection_tab->hbox_terminal);
-        }
+      connection_tab_log_on (p_connection_tab);
         
       update_screen_info ();
     }
@@ -2505,9 +2559,15 @@ cell_tooltip_callback (GtkWidget *widget, gint x, gint y,
     
           if (p_conn)
             {
-              if (p_conn->note[0])
+              char *stats = conn_stats_describe (p_conn->host, p_conn->port);
+
+              if (p_conn->note[0] || stats)
                 {
-                  gtk_tooltip_set_text (tooltip, p_conn->note);
+                  gchar *text = g_strdup_printf ("%s%s%s", p_conn->note, p_conn->note[0] && stats ? "\n\n" : "", stats ? stats : "");
+
+                  gtk_tooltip_set_text (tooltip, text);
+                  g_free (text);
+                  g_free (stats);
                   return TRUE;
                 }
             }
@@ -37,12 +37,21 @@ struct Bookmarks {
 #define CONN_AUTH_MODE_SAVE 1
 #define CONN_AUTH_MODE_KEY 2
 
+#define CONN_COMPRESSION_OFF 0
+#define CONN_COMPRESSION_ON 1
+#define CONN_COMPRESSION_AUTO 2 /* compressed session only for transfers of compressible files */
+
 typedef struct _SSH_Options {
   int x11Forwarding;
   int agentForwarding;
   int disableStrictKeyChecking;
   int flagKeepAlive;
   int keepAliveInterval;
+  char ciphers[256]; /* comma separated, in order of preference, empty for defaults */
+  char macs[256];
+  char kex[256];
+  int compression; /* CONN_COMPRESSION_* */
+  char jumpHost[256]; /* name of a connection or [user@]host[:port] */
 } SSH_Options;
 
 typedef struct Connection
@@ -89,6 +98,7 @@ struct Connection_List
   };
 
 void connection_init (SConnection *);
+void connection_copy (struct Connection *p_dst, struct Connection *p_src);
 
 void cl_init (struct Connection_List *p_cl);
 void cl_release (struct Connection_List *p_cl);
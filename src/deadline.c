@@ -0,0 +1,238 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file deadline.c
+ * @brief Time limits for ssh operations
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include <libssh/libssh.h>
+#include "main.h"
+#include "deadline.h"
+
+/* Blocking calls in progress (sftp requests can't be made non-blocking) */
+GList *watchedDeadlines = NULL;
+pthread_mutex_t mutexDeadlines = PTHREAD_MUTEX_INITIALIZER;
+
+void
+deadline_start (SDeadline *d, int msecs)
+{
+  d->expires = msecs > 0 ? g_get_monotonic_time () + (gint64) msecs * 1000 : 0;
+  d->fired = 0;
+}
+
+/**
+ * deadline_remaining() - milliseconds left before d expires
+ * @return -1 if d has no limit
+ */
+int
+deadline_remaining (SDeadline *d)
+{
+  gint64 left;
+
+  if (d->expires == 0)
+    return (-1);
+
+  left = d->expires - g_get_monotonic_time ();
+
+  return (left > 0 ? (int) ((left + 999) / 1000) : 0);
+}
+
+int
+deadline_expired (SDeadline *d)
+{
+  return (d->expires && g_get_monotonic_time () >= d->expires);
+}
+
+/**
+ * ssh_deadline_poll() - waits until the session socket is ready for the pending non-blocking operation
+ * @return SSH_OK if ready, SSH_AGAIN if d expired, SSH_ERROR on errors
+ */
+int
+ssh_deadline_poll (ssh_session session, SDeadline *d)
+{
+  struct pollfd pfd;
+  int rc;
+
+  if ((pfd.fd = ssh_get_fd (session)) < 0)
+    return (SSH_ERROR);
+
+  /* replies are always awaited, writing only if libssh has data queued */
+  pfd.events = POLLIN;
+
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 7, 0)
+  if (ssh_get_poll_flags (session) & SSH_WRITE_PENDING)
+    pfd.events |= POLLOUT;
+#endif
+
+  do
+    {
+      if (deadline_expired (d))
+        return (SSH_AGAIN);
+
+      pfd.revents = 0;
+      rc = poll (&pfd, 1, deadline_remaining (d));
+    }
+  while (rc < 0 && errno == EINTR);
+
+  if (rc < 0 || (pfd.revents & (POLLERR | POLLNVAL)))
+    return (SSH_ERROR);
+
+  return (rc == 0 ? SSH_AGAIN : SSH_OK);
+}
+
+/**
+ * ssh_channel_open_session_deadline() - opens a session channel giving up after msecs
+ * (call with ssh mutex locked)
+ */
+int
+ssh_channel_open_session_deadline (ssh_channel channel, int msecs)
+{
+  ssh_session session = ssh_channel_get_session (channel);
+  SDeadline d;
+  int rc;
+
+  deadline_start (&d, msecs);
+  ssh_set_blocking (session, 0);
+
+  while ((rc = ssh_channel_open_session (channel)) == SSH_AGAIN)
+    {
+      if ((rc = ssh_deadline_poll (session, &d)) != SSH_OK)
+        break;
+    }
+
+  ssh_set_blocking (session, 1);
+
+  if (rc == SSH_AGAIN)
+    {
+      log_write ("Timeout opening channel (%d ms)\n", msecs);
+      rc = SSH_ERROR;
+    }
+
+  return (rc);
+}
+
+/**
+ * ssh_channel_request_exec_deadline() - starts command on channel giving up after msecs
+ * (call with ssh mutex locked)
+ */
+int
+ssh_channel_request_exec_deadline (ssh_channel channel, const char *command, int msecs)
+{
+  ssh_session session = ssh_channel_get_session (channel);
+  SDeadline d;
+  int rc;
+
+  deadline_start (&d, msecs);
+  ssh_set_blocking (session, 0);
+
+  while ((rc = ssh_channel_request_exec (channel, command)) == SSH_AGAIN)
+    {
+      if ((rc = ssh_deadline_poll (session, &d)) != SSH_OK)
+        break;
+    }
+
+  ssh_set_blocking (session, 1);
+
+  if (rc == SSH_AGAIN)
+    {
+      log_write ("Timeout executing command (%d ms)\n", msecs);
+      rc = SSH_ERROR;
+    }
+
+  return (rc);
+}
+
+/**
+ * deadline_watch() - limits the duration of a blocking call on session
+ * If the call is still running when d expires, the socket is shut down by deadline_check_watched()
+ * so that the call fails and the session is no longer used.
+ */
+void
+deadline_watch (SDeadline *d, ssh_session session, const char *operation, int msecs)
+{
+  deadline_start (d, msecs);
+
+  d->fd = ssh_get_fd (session);
+  strncpy (d->operation, operation, sizeof (d->operation) - 1);
+  d->operation[sizeof (d->operation) - 1] = 0;
+
+  if (d->expires == 0)
+    return;
+
+  pthread_mutex_lock (&mutexDeadlines);
+  watchedDeadlines = g_list_prepend (watchedDeadlines, d);
+  pthread_mutex_unlock (&mutexDeadlines);
+}
+
+/**
+ * deadline_unwatch() - to be called as soon as the watched call returns
+ * @return 1 if the call has been stopped by the deadline
+ */
+int
+deadline_unwatch (SDeadline *d)
+{
+  int fired;
+
+  pthread_mutex_lock (&mutexDeadlines);
+  watchedDeadlines = g_list_remove (watchedDeadlines, d);
+  fired = d->fired;
+  pthread_mutex_unlock (&mutexDeadlines);
+
+  if (fired)
+    log_write ("Timeout: %s\n", d->operation);
+
+  return (fired);
+}
+
+/**
+ * deadline_check_watched() - stops the blocking calls beyond their deadline
+ * (called periodically by the background loop)
+ */
+void
+deadline_check_watched ()
+{
+  GList *item;
+  SDeadline *d;
+
+  pthread_mutex_lock (&mutexDeadlines);
+
+  for (item = watchedDeadlines; item; item = g_list_next (item))
+    {
+      d = (SDeadline *) item->data;
+
+      if (d->fired || !deadline_expired (d))
+        continue;
+
+      log_write ("%s is taking too long, closing connection\n", d->operation);
+
+      if (d->fd >= 0)
+        shutdown (d->fd, SHUT_RDWR);
+
+      d->fired = 1;
+    }
+
+  pthread_mutex_unlock (&mutexDeadlines);
+}
+
@@ -0,0 +1,34 @@
+
+#ifndef _DEADLINE_H
+#define _DEADLINE_H
+
+#include <glib.h>
+#include <libssh/libssh.h>
+
+/**
+ * struct Deadline
+ * time limit of a single ssh operation, any number can be active at the same time
+ */
+typedef struct Deadline {
+  gint64 expires;        /* monotonic time in microseconds, 0 if no limit */
+  char operation[64];
+
+  /* set for blocking calls watched by deadline_check_watched() */
+  socket_t fd;
+  int fired;
+} SDeadline;
+
+void deadline_start (SDeadline *d, int msecs);
+int deadline_remaining (SDeadline *d);
+int deadline_expired (SDeadline *d);
+
+int ssh_deadline_poll (ssh_session session, SDeadline *d);
+int ssh_channel_open_session_deadline (ssh_channel channel, int msecs);
+int ssh_channel_request_exec_deadline (ssh_channel channel, const char *command, int msecs);
+
+void deadline_watch (SDeadline *d, ssh_session session, const char *operation, int msecs);
+int deadline_unwatch (SDeadline *d);
+void deadline_check_watched ();
+
+#endif
+
@@ -0,0 +1,392 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file disk_usage.c
+ * @brief Computes sizes of remote directories in background
+ * Sizes are apparent sizes (sum of the file sizes, as in the listing), not the disk space allocated.
+ */
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include "main.h"
+#include "gui.h"
+#include "utils.h"
+#include "ssh.h"
+#include "sftp-panel.h"
+#include "async.h"
+#include "ssh_reaper.h"
+#include "disk_usage.h"
+
+extern Globals globals;
+extern Prefs prefs;
+extern struct SSH_Info *p_ssh_current;
+extern struct SFTP_Panel sftp_panel;
+
+/* job running, used in the main loop only */
+SDiskUsageJob *gDuJob = NULL;
+
+GtkWidget *gDuStopButton = NULL;
+
+gboolean
+du_cancelled (SDiskUsageJob *job)
+{
+  return (g_atomic_int_get (&job->cancel));
+}
+
+void
+du_stop_cb (GtkButton *button, gpointer user_data)
+{
+  if (gDuJob == NULL)
+    return;
+
+  log_write ("Computing sizes stopped by user\n");
+
+  g_atomic_int_set (&gDuJob->cancel, TRUE);
+}
+
+/**
+ * du_stop_button_show() - shows the stop button of the job, next to the one of the panel
+ * Panel operations hide their own button when done, so the job has its own.
+ */
+void
+du_stop_button_show (gboolean show)
+{
+  GtkWidget *box;
+
+  if (gDuStopButton == NULL)
+    {
+      if ((box = gtk_widget_get_parent (sftp_panel.button_stop)) == NULL)
+        return;
+
+      gDuStopButton = gtk_button_new ();
+      gtk_button_set_image (GTK_BUTTON (gDuStopButton), gtk_image_new_from_icon_name ("process-stop", GTK_ICON_SIZE_BUTTON));
+      gtk_button_set_relief (GTK_BUTTON (gDuStopButton), GTK_RELIEF_NONE);
+      gtk_widget_set_tooltip_text (gDuStopButton, _("Stop computing folder sizes"));
+      g_signal_connect (G_OBJECT (gDuStopButton), "clicked", G_CALLBACK (du_stop_cb), NULL);
+      gtk_box_pack_end (GTK_BOX (box), gDuStopButton, FALSE, FALSE, 0);
+    }
+
+  if (show)
+    gtk_widget_show_all (gDuStopButton);
+  else
+    gtk_widget_hide (gDuStopButton);
+}
+
+/**
+ * du_result_cb() - stores a computed size and shows it if the directory is in the panel
+ * (runs in the main loop)
+ */
+gboolean
+du_result_cb (gpointer data)
+{
+  SDiskUsageResult *r = (SDiskUsageResult *) data;
+  struct Directory_Entry *e;
+  char dir[2048];
+
+  /* the node could have been released in the meantime */
+  if (ssh_list_contains (&globals.ssh_list, r->p_node))
+    {
+      if (r->path[0])
+        {
+          du_cache_put (r->p_node, r->path, r->size);
+
+          strcpy (dir, r->path);
+          strcpy (dir, dirname (dir));
+
+          if (p_ssh_current && p_ssh_current->ssh_node == r->p_node && !strcmp (dir, p_ssh_current->directory)
+              && (e = dl_search_by_name (&p_ssh_current->dirlist, strrchr (r->path, '/') + 1)) != NULL)
+            {
+              e->size = r->size;
+              sftp_panel_update_entry (p_ssh_current, e);
+            }
+        }
+
+      if (p_ssh_current && p_ssh_current->ssh_node == r->p_node)
+        {
+          if (r->finished)
+            sftp_set_status ("Computed sizes of %d folder%s", r->done, r->done == 1 ? "" : "s");
+          else
+            sftp_set_status ("Computing sizes %d/%d...", r->done, r->total);
+        }
+    }
+
+  if (r->finished)
+    {
+      gDuJob = NULL;
+      sftp_spinner_stop ();
+      du_stop_button_show (FALSE);
+
+      g_ptr_array_free (r->job->paths, TRUE);
+      g_free (r->job);
+    }
+
+  g_free (r);
+
+  return (FALSE);
+}
+
+void
+du_post (SDiskUsageJob *job, char *path, long long unsigned int size, int finished)
+{
+  SDiskUsageResult *r;
+
+  r = g_new0 (SDiskUsageResult, 1);
+  r->job = job;
+  r->p_node = job->p_node;
+  strcpy (r->path, path ? path : "");
+  r->size = size;
+  r->done = job->done;
+  r->total = job->total;
+  r->finished = finished;
+
+  gdk_threads_add_idle (du_result_cb, r);
+}
+
+/**
+ * du_line() - parses a line printed by DU_COMMAND
+ */
+void
+du_line (char *line, gpointer data)
+{
+  SDiskUsageJob *job = (SDiskUsageJob *) data;
+  long long unsigned int size;
+  char *path;
+
+  size = strtoull (line, &path, 10);
+
+  if (path == line || *path != '\t')
+    return;
+
+  job->done ++;
+  du_post (job, path + 1, size, FALSE);
+}
+
+/**
+ * du_remote() - measures paths from first with du on the remote host, many directories for each command
+ * @return index of the first path not measured, first if du is not available
+ */
+int
+du_remote (SDiskUsageJob *job, int first)
+{
+  char command[DU_COMMAND_MAX + 16], quoted[8192];
+  int i = first, batch, status, done;
+
+  while (i < job->paths->len && !du_cancelled (job))
+    {
+      batch = i;
+      strcpy (command, DU_COMMAND);
+
+      while (i < job->paths->len)
+        {
+          shell_quote (quoted, (char *) g_ptr_array_index (job->paths, i));
+
+          if (strlen (command) + strlen (quoted) + 1 > DU_COMMAND_MAX && strcmp (command, DU_COMMAND))
+            break;
+
+          strcat (command, " ");
+          strcat (command, quoted);
+          i ++;
+        }
+
+      strcat (command, " 2>/dev/null");
+
+      done = job->done;
+      /* the stop button of the job cancels the command */
+      status = ssh_node_exec_lines (job->p_node, command, du_line, job, &job->cancel);
+
+      log_debug ("du exit status %d\n", status);
+
+      /* du not available or not GNU: the sftp walk will continue from here */
+      if (status != 0 && job->done == done)
+        return (batch);
+    }
+
+  return (i);
+}
+
+/**
+ * du_walk() - adds the sizes of the entries under path reading directories with sftp
+ * Directories count with their own size and symbolic links with the size of the link, as with du -b.
+ * The ssh mutex is held while reading one directory, so that other operations can run between them
+ */
+int
+du_walk (SDiskUsageJob *job, char *path, long long unsigned int *size)
+{
+  GQueue *queue;
+  char *dirpath, subpath[2048];
+  sftp_dir dir;
+  sftp_attributes attributes;
+  int rc = 0, first = 1;
+
+  *size = 0;
+
+  queue = g_queue_new ();
+  g_queue_push_tail (queue, g_strdup (path));
+
+  while ((dirpath = (char *) g_queue_pop_head (queue)) != NULL)
+    {
+      if (du_cancelled (job) || rc != 0)
+        {
+          g_free (dirpath);
+          continue;
+        }
+
+      /* transfers use the same sftp sessions */
+      while (async_is_transferring () && !du_cancelled (job))
+        g_usleep (G_USEC_PER_SEC / 5);
+
+      lockSSH (__func__, TRUE);
+
+      if (!ssh_list_contains (&globals.ssh_list, job->p_node) || !ssh_node_get_validity (job->p_node) || job->p_node->sftp == NULL)
+        rc = 1;
+      else
+        {
+          /* the other directories are counted while reading their parent */
+          if (first && (attributes = sftp_lstat (job->p_node->sftp, dirpath)) != NULL)
+            {
+              *size += attributes->size;
+              sftp_attributes_free (attributes);
+            }
+
+          first = 0;
+        }
+
+      if (rc == 0 && (dir = sftp_opendir (job->p_node->sftp, dirpath)) != NULL)
+        {
+          while ((attributes = sftp_readdir (job->p_node->sftp, dir)) != NULL)
+            {
+              if (strcmp (attributes->name, ".") && strcmp (attributes->name, ".."))
+                {
+                  /* symbolic links are not followed */
+                  if (attributes->type == SSH_FILEXFER_TYPE_DIRECTORY)
+                    {
+                      snprintf (subpath, sizeof (subpath), "%s/%s", strcmp (dirpath, "/") ? dirpath : "", attributes->name);
+                      g_queue_push_tail (queue, g_strdup (subpath));
+                    }
+
+                  *size += attributes->size;
+                }
+
+              sftp_attributes_free (attributes);
+            }
+
+          sftp_closedir (dir);
+          ssh_node_update_time (job->p_node);
+        }
+
+      lockSSH (__func__, FALSE);
+
+      g_free (dirpath);
+    }
+
+  g_queue_free (queue);
+
+  return (rc);
+}
+
+gpointer
+du_thread (gpointer data)
+{
+  SDiskUsageJob *job = (SDiskUsageJob *) data;
+  long long unsigned int size;
+  int i = 0;
+
+  log_write ("%s BEGIN THREAD 0x%08x\n", __func__, pthread_self ());
+
+  if (job->use_du)
+    i = du_remote (job, 0);
+
+  for (; i < job->paths->len && !du_cancelled (job); i++)
+    {
+      if (du_walk (job, (char *) g_ptr_array_index (job->paths, i), &size) != 0)
+        break;
+
+      if (du_cancelled (job))
+        break;
+
+      job->done ++;
+      du_post (job, (char *) g_ptr_array_index (job->paths, i), size, FALSE);
+    }
+
+  log_write ("%s END: %d/%d directories\n", __func__, job->done, job->total);
+
+  /* the job is released with its last result */
+  du_post (job, NULL, 0, TRUE);
+
+  return (NULL);
+}
+
+/**
+ * sftp_panel_compute_sizes() - computes in background the size of every folder of the current listing
+ */
+void
+sftp_panel_compute_sizes ()
+{
+  SDiskUsageJob *job;
+  struct Directory_Entry *e;
+  char path[2048];
+
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_panel_compute_sizes) || p_ssh_current->ssh_node == NULL)
+    return;
+
+  if (gDuJob)
+    {
+      sftp_set_status ("Already computing sizes");
+      return;
+    }
+
+  job = g_new0 (SDiskUsageJob, 1);
+  job->p_node = p_ssh_current->ssh_node;
+  job->paths = g_ptr_array_new_with_free_func (g_free);
+  job->use_du = prefs.sftp_du_remote;
+
+  for (e = p_ssh_current->dirlist.head; e; e = e->next)
+    {
+      if (!is_directory (e) || !strcmp (e->name, ".") || !strcmp (e->name, ".."))
+        continue;
+
+      if (!p_ssh_current->dirlist.show_hidden_files && is_hidden_file (e))
+        continue;
+
+      sprintf (path, "%s/%s", strcmp (p_ssh_current->directory, "/") ? p_ssh_current->directory : "", e->name);
+      g_ptr_array_add (job->paths, g_strdup (path));
+    }
+
+  job->total = job->paths->len;
+
+  if (job->total == 0)
+    {
+      g_ptr_array_free (job->paths, TRUE);
+      g_free (job);
+      return;
+    }
+
+  log_write ("Computing sizes of %d folders in %s\n", job->total, p_ssh_current->directory);
+
+  gDuJob = job;
+
+  sftp_set_status ("Computing sizes...");
+  sftp_spinner_start ();
+  du_stop_button_show (TRUE);
+
+  g_thread_unref (g_thread_new ("du", du_thread, job));
+}
+
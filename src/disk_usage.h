@@ -0,0 +1,39 @@
+
+#ifndef _DISK_USAGE_H
+#define _DISK_USAGE_H
+
+#include <gtk/gtk.h>
+#include "ssh.h"
+
+/* Maximum length of a du command line */
+#define DU_COMMAND_MAX 8192
+
+/* Sizes are apparent sizes in bytes, as the sum of st_size read by the sftp walk:
+   -b is GNU only, other du implementations fail and the walk is used instead.
+   -l counts hard links each time, as the walk does */
+#define DU_COMMAND "du -sbl"
+
+typedef struct DiskUsageJob {
+  struct SSH_Node *p_node;
+  GPtrArray *paths; /* directories to be measured */
+  int use_du;
+  int done;
+  int total;
+  gboolean cancel;  /* set by the stop button of the job, read with g_atomic_int_get() */
+} SDiskUsageJob;
+
+/* Size computed by the background thread, passed to the main loop */
+typedef struct DiskUsageResult {
+  SDiskUsageJob *job; /* released by the main loop with the last result */
+  struct SSH_Node *p_node;
+  char path[2048];
+  long long unsigned int size;
+  int done;
+  int total;
+  int finished;
+} SDiskUsageResult;
+
+void sftp_panel_compute_sizes ();
+
+#endif
+
@@ -0,0 +1,196 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file filter.c
+ * @brief Name filters (substring/wildcards, regular expressions, fuzzy)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <glib.h>
+#include "main.h"
+#include "filter.h"
+
+/**
+ * fuzzy_match() - checks if the characters of pattern appear in text in the same order (case insensitive)
+ * Matches at the beginning of words and consecutive matches get a higher score.
+ */
+gboolean
+fuzzy_match (const char *pattern, const char *text, int *score)
+{
+  const char *p = pattern, *t = text;
+  int s = 0, consecutive = 0;
+
+  while (*p && *t)
+    {
+      if (g_ascii_tolower (*p) == g_ascii_tolower (*t))
+        {
+          s += 1;
+
+          if (*p == *t)
+            s += 1;
+
+          if (t == text || strchr ("._- ", *(t-1)))
+            s += 8;
+
+          s += 4 * consecutive;
+
+          consecutive ++;
+          p ++;
+        }
+      else
+        {
+          /* gaps inside the match lower the score */
+          if (p != pattern)
+            s --;
+
+          consecutive = 0;
+        }
+
+      t ++;
+    }
+
+  if (score)
+    *score = s;
+
+  return (*p == 0);
+}
+
+/**
+ * filter_compile() - prepares pFilter for matching
+ * @return 0 if ok, 1 if pattern is not valid (see error_s)
+ */
+int
+filter_compile (SFilter *pFilter, int mode, const char *pattern)
+{
+  GError *error = NULL;
+
+  memset (pFilter, 0, sizeof (SFilter));
+
+  pFilter->mode = mode;
+  strncpy (pFilter->pattern, pattern, sizeof (pFilter->pattern) - 1);
+
+  if (pFilter->pattern[0] == 0)
+    return (0);
+
+  switch (mode)
+    {
+      case FILTER_MODE_REGEX:
+        pFilter->regex = g_regex_new (pFilter->pattern, G_REGEX_OPTIMIZE, 0, &error);
+
+        if (pFilter->regex == NULL)
+          {
+            sprintf (pFilter->error_s, "%s", error ? error->message : "invalid regular expression");
+
+            if (error)
+              g_error_free (error);
+
+            return (1);
+          }
+
+        break;
+
+      case FILTER_MODE_FUZZY:
+        break;
+
+      default:
+        pFilter->mode = FILTER_MODE_SUBSTRING;
+        pFilter->glob = strpbrk (pFilter->pattern, "*?[") != NULL;
+        sprintf (pFilter->glob_pattern, "*%s*", pFilter->pattern);
+        break;
+    }
+
+  return (0);
+}
+
+void
+filter_free (SFilter *pFilter)
+{
+  if (pFilter->regex)
+    g_regex_unref (pFilter->regex);
+
+  pFilter->regex = NULL;
+}
+
+/**
+ * filter_match() - checks if text matches the compiled filter
+ * @param score set to the rank of the match (fuzzy mode only, 0 otherwise)
+ */
+gboolean
+filter_match (SFilter *pFilter, const char *text, int *score)
+{
+  gboolean match;
+  int s = 0;
+
+  if (pFilter->pattern[0] == 0)
+    match = TRUE;
+  else
+    {
+      switch (pFilter->mode)
+        {
+          case FILTER_MODE_REGEX:
+            match = pFilter->regex ? g_regex_match (pFilter->regex, text, 0, NULL) : TRUE;
+            break;
+
+          case FILTER_MODE_FUZZY:
+            match = fuzzy_match (pFilter->pattern, text, &s);
+            break;
+
+          default:
+            if (pFilter->glob)
+              match = fnmatch (pFilter->glob_pattern, text, FNM_PATHNAME) == 0;
+            else
+              match = strstr (text, pFilter->pattern) != NULL;
+
+            break;
+        }
+    }
+
+  if (score)
+    *score = s;
+
+  return (match);
+}
+
+/**
+ * filter_narrows() - checks if every name matching pFilter also matches pPrevious,
+ * so that pFilter can be applied to the names previously matched instead of all of them
+ */
+gboolean
+filter_narrows (SFilter *pFilter, SFilter *pPrevious)
+{
+  if (pPrevious->pattern[0] == 0)
+    return (TRUE);
+
+  if (pFilter->mode != pPrevious->mode)
+    return (FALSE);
+
+  switch (pFilter->mode)
+    {
+      case FILTER_MODE_SUBSTRING:
+        return (!pFilter->glob && !pPrevious->glob && strstr (pFilter->pattern, pPrevious->pattern) != NULL);
+
+      case FILTER_MODE_FUZZY:
+        return (fuzzy_match (pPrevious->pattern, pFilter->pattern, NULL));
+
+      default:
+        return (FALSE);
+    }
+}
@@ -0,0 +1,30 @@
+
+#ifndef _FILTER_H
+#define _FILTER_H
+
+#include <glib.h>
+
+#define FILTER_MODE_SUBSTRING 0
+#define FILTER_MODE_REGEX 1
+#define FILTER_MODE_FUZZY 2
+
+/**
+ * struct Filter
+ * pattern typed by the user, compiled once and matched against many names
+ */
+typedef struct Filter {
+  int mode;
+  char pattern[1024];   /* as typed, empty matches everything */
+  int glob;             /* substring pattern contains wildcards */
+  char glob_pattern[1040];
+  GRegex *regex;
+  char error_s[512];
+} SFilter;
+
+int filter_compile (SFilter *pFilter, int mode, const char *pattern);
+void filter_free (SFilter *pFilter);
+gboolean filter_match (SFilter *pFilter, const char *text, int *score);
+gboolean filter_narrows (SFilter *pFilter, SFilter *pPrevious);
+
+#endif
+
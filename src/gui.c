@@ -25,7 +25,6 @@
 #include <libssh/libssh.h> 
 #include <vte/vte.h>
 #include <openssl/opensslv.h>
-#include <openssl/md5.h>
 #include <sys/utsname.h>
 #include <string.h>
 #include <time.h>
@@ -43,6 +42,11 @@
 #include "terminal.h"
 #include "connection_list.h"
 #include "transfer_window.h"
+#include "ssh_terminal.h"
+#include "key_cache.h"
+#include "cipher_bench.h"
+#include "ssh_reaper.h"
+#include "prompt_matcher.h"
 
 #ifndef MAC_INTEGRATION
 #include <gdk/gdkx.h>
@@ -96,6 +100,9 @@ int ifr_index_insert = 1;
 struct Iteration_Function_Request ifr[ITERATION_MAX];
 
 GtkWidget *main_window;
+
+/* Thread running gtk, set by start_gtk() */
+GThread *guiThread = NULL;
 GtkWidget *hpaned;
 
 GtkUIManager *ui_manager;
@@ -117,6 +124,11 @@ GdkScreen *g_screen;
 /* pointer to the list of open connections or NULL if there's no open connection */
 GList *connection_tab_list;
 struct ConnectionTab *p_current_connection_tab;
+
+GHashTable *tabsDirty = NULL; /* tabs with work waiting for the next frame, see tabMarkDirty() */
+guint tabsFlushSource = 0;
+guint tabsFlushTick = 0;
+
 struct QuickLaunchWindow g_quick_launch_window;
 
 GList *g_recent_connections_list; /* mantain a list of connection structs */
@@ -157,6 +169,7 @@ GtkActionEntry main_menu_items[] = {
   { "LogOnRecent", NULL, N_("Log on _recent") }, /* not used at the moment */
   { "Log off", NULL, N_("Log o_ff"), NULL, NULL, G_CALLBACK (connection_log_off) },
   { "Duplicate", MY_STOCK_DUPLICATE, N_("_Duplicate"), "<shift><ctrl>D", "Duplicate connection", G_CALLBACK (connection_duplicate) },
+  { "BenchmarkCiphers", NULL, N_("_Benchmark ciphers"), NULL, NULL, G_CALLBACK (connection_benchmark_ciphers) },
   { "Edit protocols", NULL, N_("_Edit protocols"), NULL, NULL, G_CALLBACK (connection_edit_protocols) },
   { "Open terminal", MY_STOCK_TERMINAL, N_("Open _terminal"), "<ctrl>T", "Open terminal", G_CALLBACK (connection_new_terminal) },
   { "ExportMenu", NULL, N_("_Export bookmarks") },
@@ -230,6 +243,7 @@ const gchar ui_main_desc[] =
   //"      <menu action='LogOnRecent' />" /* filled later */
   "      <menuitem action='Log off' />"
   "      <menuitem action='Duplicate' />"
+  "      <menuitem action='BenchmarkCiphers' />"
   "      <separator />"
   "      <menuitem action='Open terminal' />"
   "      <separator />"
@@ -471,10 +485,112 @@ ifr_dump ()
 }
 #endif
 
+/**
+ * gui_is_main_thread() - checks if the caller can use gtk
+ */
+gboolean
+gui_is_main_thread ()
+{
+  return (guiThread == NULL || guiThread == g_thread_self ());
+}
+
+gboolean
+main_call_cb (gpointer data)
+{
+  SMainCall *call = (SMainCall *) data;
+  gboolean result;
+
+  result = call->func (call->data);
+
+  pthread_mutex_lock (&call->mutex);
+  call->result = result;
+  call->done = 1;
+  pthread_cond_signal (&call->cond);
+  pthread_mutex_unlock (&call->mutex);
+
+  return (FALSE);
+}
+
+/**
+ * gui_call_sync() - runs func in the main loop and waits for its result
+ * Called from the main thread, func is simply called.
+ */
+gboolean
+gui_call_sync (GSourceFunc func, gpointer data)
+{
+  SMainCall call;
+
+  if (gui_is_main_thread ())
+    return (func (data));
+
+  memset (&call, 0, sizeof (SMainCall));
+  call.func = func;
+  call.data = data;
+  pthread_mutex_init (&call.mutex, NULL);
+  pthread_cond_init (&call.cond, NULL);
+
+  /* not gdk_threads_add_idle(): the main thread could be waiting in a callback holding the gdk lock */
+  g_idle_add (main_call_cb, &call);
+
+  pthread_mutex_lock (&call.mutex);
+
+  while (!call.done)
+    pthread_cond_wait (&call.cond, &call.mutex);
+
+  pthread_mutex_unlock (&call.mutex);
+
+  pthread_cond_destroy (&call.cond);
+  pthread_mutex_destroy (&call.mutex);
+
+  return (call.result);
+}
+
+/* message box built by msgbox_show_cb() */
+typedef struct MsgBox {
+  GtkMessageType type;
+  GtkButtonsType buttons;
+  char *msg;
+  gint result;
+} SMsgBox;
+
+gboolean
+msgbox_show_cb (gpointer data)
+{
+  SMsgBox *box = (SMsgBox *) data;
+  GtkWidget *dialog;
+
+  dialog = gtk_message_dialog_new (GTK_WINDOW (main_window), GTK_DIALOG_DESTROY_WITH_PARENT, box->type, box->buttons, box->msg, 0);
+
+  if (box->type != GTK_MESSAGE_QUESTION)
+    gtk_window_set_title (GTK_WINDOW (dialog), PACKAGE);
+
+  box->result = gtk_dialog_run (GTK_DIALOG (dialog));
+  gtk_widget_destroy (dialog);
+
+  return (FALSE);
+}
+
+/**
+ * msgbox_show() - shows a message box in the main loop, whatever the calling thread
+ */
+gint
+msgbox_show (GtkMessageType type, GtkButtonsType buttons, char *msg)
+{
+  SMsgBox box;
+
+  box.type = type;
+  box.buttons = buttons;
+  box.msg = msg;
+  box.result = GTK_RESPONSE_NONE;
+
+  gui_call_sync (msgbox_show_cb, &box);
+
+  return (box.result);
+}
+
 void
 msgbox_error (const char *fmt, ...)
 {
-  GtkWidget *dialog;
   va_list ap;
   char msg[2048];
 
@@ -482,11 +598,7 @@ msgbox_error (const char *fmt, ...)
   vsprintf (msg, fmt, ap);
   va_end (ap);
 
-  dialog = gtk_message_dialog_new (GTK_WINDOW (main_window), GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, msg, 0);
-
-  gtk_window_set_title (GTK_WINDOW (dialog), PACKAGE);
-  gtk_dialog_run (GTK_DIALOG (dialog));
-  gtk_widget_destroy (dialog);
+  msgbox_show (GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, msg);
   
   log_write ("%s\n", msg);
 }
@@ -494,7 +606,6 @@ msgbox_error (const char *fmt, ...)
 void
 msgbox_info (const char *fmt, ...)
 {
-  GtkWidget *dialog;
   va_list ap;
   char msg[1024];
 
@@ -502,17 +613,12 @@ msgbox_info (const char *fmt, ...)
   vsprintf (msg, fmt, ap);
   va_end (ap);
 
-  dialog = gtk_message_dialog_new (GTK_WINDOW (main_window),
-                            GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_INFO, GTK_BUTTONS_OK, msg, 0);
-  gtk_window_set_title (GTK_WINDOW (dialog), PACKAGE);
-  gtk_dialog_run (GTK_DIALOG (dialog));
-  gtk_widget_destroy (dialog);
+  msgbox_show (GTK_MESSAGE_INFO, GTK_BUTTONS_OK, msg);
 }
 
 gint
 msgbox_yes_no (const char *fmt, ...)
 {
-  GtkWidget *dialog;
   va_list ap;
   char msg[1024];
 
@@ -520,13 +626,7 @@ msgbox_yes_no (const char *fmt, ...)
   vsprintf (msg, fmt, ap);
   va_end (ap);
 
-  dialog = gtk_message_dialog_new (GTK_WINDOW (main_window),
-                            GTK_DIALOG_DESTROY_WITH_PARENT,
-                            GTK_MESSAGE_QUESTION, GTK_BUTTONS_YES_NO, msg, 0);
-  gint result = gtk_dialog_run (GTK_DIALOG (dialog));
-  gtk_widget_destroy (dialog);
-
-  return result;
+  return (msgbox_show (GTK_MESSAGE_QUESTION, GTK_BUTTONS_YES_NO, msg));
 }
 
 /**
@@ -1072,10 +1172,15 @@ connection_tab_close (struct ConnectionTab *p_ct)
 
   if (can_close)
     {
+      /* the connection in progress is released when it ends */
+      terminal_connect_cancel (p_ct);
+
       // Regroup this tab to adjust the view
       if (p_ct->notebook != notebook)
         terminal_attach_to_main(p_ct);
 
+      ssh_terminal_close (p_ct);
+
       if (p_ct->type == CONNECTION_REMOTE && /*p_ct->connected*/tabIsConnected(p_ct))
         {
           /*int fd = vte_pty_get_fd (vte_terminal_get_pty (VTE_TERMINAL (p_ct->vte)));
@@ -1086,6 +1191,8 @@ connection_tab_close (struct ConnectionTab *p_ct)
           //refresh_sftp_panel (&p_ct->ssh_info);
         }
 
+      sftp_panel_release_model (&p_ct->ssh_info);
+
       page = gtk_notebook_page_num (GTK_NOTEBOOK (p_ct->notebook), p_ct->hbox_terminal);
 
       log_write ("page = %d\n", page);
@@ -1098,6 +1205,14 @@ connection_tab_close (struct ConnectionTab *p_ct)
 
           connection_tab_list = g_list_remove (connection_tab_list, p_ct);
 
+          if (tabsDirty)
+            g_hash_table_remove (tabsDirty, p_ct);
+
+          p_ct->dirty = 0;
+
+          prompt_matcher_free (p_ct->prompt_matcher);
+          p_ct->prompt_matcher = NULL;
+
           if (gtk_notebook_get_n_pages (GTK_NOTEBOOK (notebook)) == 0)
             p_current_connection_tab = NULL;
         }
@@ -1298,7 +1413,19 @@ connection_tab_add (struct ConnectionTab *connection_tab)
   gtk_box_pack_start (GTK_BOX (tab_hbox), close_button, FALSE, FALSE, 0);
 */
 
+  /* stops a connection in progress */
+  connection_tab->cancel_button = gtk_button_new ();
+  gtk_button_set_relief (GTK_BUTTON (connection_tab->cancel_button), GTK_RELIEF_NONE);
+  gtk_container_set_border_width (GTK_CONTAINER (connection_tab->cancel_button), 0);
+  gtk_container_add (GTK_CONTAINER (connection_tab->cancel_button), gtk_image_new_from_icon_name ("process-stop", GTK_ICON_SIZE_MENU));
+  gtk_widget_set_tooltip_text (connection_tab->cancel_button, _("Cancel connection"));
+  g_signal_connect (connection_tab->cancel_button, "clicked", G_CALLBACK (cancel_button_clicked_cb), connection_tab);
+  gtk_widget_show_all (connection_tab->cancel_button);
+  gtk_widget_set_no_show_all (connection_tab->cancel_button, TRUE);
+  gtk_widget_hide (connection_tab->cancel_button);
+
   gtk_box_pack_end (GTK_BOX (tab_label), close_button, FALSE, FALSE, 0);
+  gtk_box_pack_end (GTK_BOX (tab_label), connection_tab->cancel_button, FALSE, FALSE, 0);
   gtk_box_pack_end (GTK_BOX (tab_label), connection_tab->label, FALSE, FALSE, 0);
   gtk_box_pack_end (GTK_BOX (tab_label), image_type, FALSE, FALSE, 0);
 
@@ -1485,6 +1612,78 @@ connection_tab_getcwd (struct ConnectionTab *p_ct, char *directory)
   return 0;
 }
 
+/**
+ * connection_tab_prepare() - adds a remote tab for a connection, before logging on
+ */
+void
+connection_tab_prepare (struct ConnectionTab *p_connection_tab)
+{
+  if (p_connection_tab->connection.auth_mode == CONN_AUTH_MODE_SAVE && p_connection_tab->connection.auth_user[0])
+    strcpy (p_connection_tab->connection.user, p_connection_tab->connection.auth_user);
+
+  if (p_connection_tab->connection.auth_mode == CONN_AUTH_MODE_SAVE && p_connection_tab->connection.auth_password[0])
+    strcpy (p_connection_tab->connection.password, p_connection_tab->connection.auth_password);
+
+  /* Add the new tab */ 
+  log_debug ("Adding new tab...\n");
+  connection_tab_add (p_connection_tab);
+  p_current_connection_tab = p_connection_tab;  
+  //connection_tab_set_status (p_current_connection_tab, TAB_STATUS_NORMAL);
+  tabMarkDirty (p_current_connection_tab, TAB_DIRTY_STATUS);
+}
+
+/**
+ * connection_tab_log_on() - logs on a tab added by connection_tab_prepare()
+ * The tab is updated by connection_tab_logged_on() when done.
+ * @return LOG_ON_PENDING while connecting, 0 if ok, not zero otherwise
+ */
+int
+connection_tab_log_on (struct ConnectionTab *p_connection_tab)
+{
+  int retcode;
+
+  log_write ("Log on...\n");
+
+  retcode = log_on (p_connection_tab);
+  
+  log_debug ("log_on() returns %d\n", retcode);
+
+  return (retcode);
+}
+
+/**
+ * connection_tab_logged_on() - updates a tab at the end of log_on(), also when connected in background
+ */
+void
+connection_tab_logged_on (struct ConnectionTab *p_connection_tab, int retcode)
+{
+  /* restored tabs on the same host go on */
+  session_restore_logged_on (p_connection_tab);
+
+  /* closed while connecting */
+  if (g_list_find (connection_tab_list, p_connection_tab) == NULL)
+    return;
+
+  if (retcode == 0)
+    {
+      if (lt_ssh_is_connected (&p_connection_tab->ssh_info))
+        {
+          sftp_refresh_directory_list (&p_connection_tab->ssh_info);
+
+          /* tabs restored in background could not be the current one */
+          if (p_connection_tab == p_current_connection_tab)
+            {
+              refresh_sftp_panel (&p_connection_tab->ssh_info);
+              refresh_panel_history ();
+            }
+        }
+    }
+
+  //connection_tab_set_status (p_current_connection_tab, TAB_STATUS_NORMAL);
+  tabMarkDirty (p_connection_tab, TAB_DIRTY_STATUS);
+  update_screen_info ();
+}
+
 void
 connection_log_on_param (struct Connection *p_conn)
 {
@@ -1515,44 +1714,8 @@ connection_log_on_param (struct Connection *p_conn)
 
   if (retcode == 0)
     {
-      if (p_connection_tab->connection.auth_mode == CONN_AUTH_MODE_SAVE && p_connection_tab->connection.auth_user[0])
-        strcpy (p_connection_tab->connection.user, p_connection_tab->connection.auth_user);
-
-      if (p_connection_tab->connection.auth_mode == CONN_AUTH_MODE_SAVE && p_connection_tab->connection.auth_password[0])
-        strcpy (p_connection_tab->connection.password, p_connection_tab->connection.auth_password);
-
-      /* Add the new tab */ 
-      log_debug ("Adding new tab...\n");
-      connection_tab_add (p_connection_tab);
-      p_current_connection_tab = p_connection_tab;  
-      //connection_tab_set_status (p_current_connection_tab, TAB_STATUS_NORMAL);
-      refreshTabStatus (p_current_connection_tab);
-
-      log_write ("Log on...\n");
-
-      retcode = log_on (p_connection_tab);
-      
-      log_debug ("log_on() returns %d\n", retcode);
-
-      if (retcode == 0)
-        {
-          /*
-          log_debug ("user=%s last_user=%s\n", p_connection_tab->connection.user, p_connection_tab->connection.last_user);
-          
-          connection_tab_add (p_connection_tab);
-          p_current_connection_tab = p_connection_tab;  
-          connection_tab_set_status (p_current_connection_tab, TAB_STATUS_NORMAL);
-          */
-          if (lt_ssh_is_connected (&p_current_connection_tab->ssh_info))
-            {
-              sftp_refresh_directory_list (&p_current_connection_tab->ssh_info);
-              refresh_sftp_panel (&p_current_connection_tab->ssh_info);
-              refresh_panel_history ();
-            }
-        }
-
-      //connection_tab_set_status (p_current_connection_tab, TAB_STATUS_NORMAL);
-      refreshTabStatus (p_current_connection_tab);
+      connection_tab_prepare (p_connection_tab);
+      connection_tab_log_on (p_connection_tab);
     }
 
   update_screen_info ();
@@ -1586,7 +1749,11 @@ connection_log_off ()
     {
       //vte_pty_close (vte_terminal_get_pty (VTE_TERMINAL (p_current_connection_tab->vte))); // Dangerous!
       //close (vte_terminal_get_pty (VTE_TERMINAL (p_current_connection_tab->vte)));
-      kill (p_current_connection_tab->pid, SIGTERM);
+      if (p_current_connection_tab->ssh_terminal)
+        ssh_terminal_close (p_current_connection_tab);
+      else
+        kill (p_current_connection_tab->pid, SIGTERM);
+
       lt_ssh_disconnect (&p_current_connection_tab->ssh_info);
       refresh_sftp_panel (&p_current_connection_tab->ssh_info);
 
@@ -1606,6 +1773,15 @@ connection_log_off ()
   update_screen_info ();
 }
 
+/**
+ * connection_benchmark_ciphers() - measures the ciphers against the host of the current tab
+ */
+void
+connection_benchmark_ciphers ()
+{
+  cipher_bench_tab (p_current_connection_tab);
+}
+
 void
 connection_duplicate ()
 {
@@ -3741,6 +3917,9 @@ Debug ()
 
   lockSSH (__func__, FALSE);
 
+  log_debug ("Connection times:\n");
+  conn_stats_dump ();
+
   for (i=0; i<g_list_length (connection_tab_list); i++)
     {
       item = g_list_nth (connection_tab_list, i);
@@ -4791,12 +4970,17 @@ child_exited_cb (VteTerminal *vteterminal,
                gpointer     user_data)
 #endif
 {
-  struct ConnectionTab *p_ct;
-  struct Protocol *p_prot;
-  int code;
-
   //code = vte_terminal_get_child_exit_status (vteterminal);
-  p_ct = (struct ConnectionTab *) user_data;
+  connection_tab_exited ((struct ConnectionTab *) user_data);
+}
+
+/**
+ * connection_tab_exited() - updates a tab whose ssh client or shell channel has terminated
+ */
+void
+connection_tab_exited (struct ConnectionTab *p_ct)
+{
+  struct Protocol *p_prot;
 
   log_debug ("ptr = %ld\n", (unsigned int) p_ct);
 
@@ -4816,9 +5000,10 @@ child_exited_cb (VteTerminal *vteterminal,
       connection_copy (&p_ct->last_connection, &p_ct->connection);
   
       //connection_tab_set_status (p_ct, TAB_STATUS_DISCONNECTED);
-      refreshTabStatus (p_ct);
+      tabMarkDirty (p_ct, TAB_DIRTY_STATUS);
       
       log_debug ("Disconnecting\n");
+      ssh_terminal_close (p_ct);
       lt_ssh_disconnect (&p_ct->ssh_info);
        
       if (p_current_connection_tab == p_ct) {
@@ -4875,7 +5060,7 @@ eof_cb (VteTerminal *vteterminal, gpointer user_data)
   update_screen_info ();
   
   //connection_tab_set_status (p_ct, TAB_STATUS_DISCONNECTED);
-  refreshTabStatus (p_ct);
+  tabMarkDirty (p_ct, TAB_DIRTY_STATUS);
   
   lt_ssh_disconnect (&p_ct->ssh_info);
   
@@ -4990,11 +5175,8 @@ window_title_changed_cb (VteTerminal *vteterminal, gpointer user_data)
     }
   else
     {
-      if (lt_ssh_is_connected (&p_ct->ssh_info))
-        {
-          if (p_ct->ssh_info.follow_terminal_folder)
-            follow_terminal_folder ();
-        }
+      if (p_ct->ssh_info.follow_terminal_folder && lt_ssh_ensure_connected (&p_ct->ssh_info, sftp_follow_terminal_resume))
+        follow_terminal_folder ();
     }
 
   update_title ();
@@ -5009,77 +5191,99 @@ selection_changed_cb (VteTerminal *vteterminal, gpointer user_data)
     vte_terminal_copy_clipboard (vteterminal);
 }
 
-void
-contents_changed_cb (VteTerminal *vteterminal, gpointer user_data)
+/**
+ * tab_activity_hash() - hash of the characters on the screen of a terminal, blanks excluded
+ * Only the rows of the screen are read, so the cost doesn't depend on the scrollback.
+ */
+guint64
+tab_activity_hash (VteTerminal *vte)
 {
-  struct ConnectionTab *p_ct;
-  glong _cx, _cy, last_x, last_y;
-  int nLines, i;
-  //GArray *attrs;
+  GtkAdjustment *adj;
+  glong top, rows, cols;
+  char *text, *p;
+  guint64 hash = 14695981039346656037ULL; /* FNV-1a offset basis */
 
-  if (p_current_connection_tab == NULL)
-    return;
+#if (VTE_CHECK_VERSION(0,38,3) == 1)
+  adj = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (vte));
+#else
+  adj = vte_terminal_get_adjustment (vte);
+#endif
 
-  p_ct = (struct ConnectionTab *) user_data;
-  
-  //log_debug ("%s\n", p_ct->connection.name);
+  rows = vte_terminal_get_row_count (vte);
+  cols = vte_terminal_get_column_count (vte);
 
-  //p_prot = get_protocol (&g_prot_list, p_ct->connection.protocol);
-  
-  /* save terminal buffer */
-  
-  p_ct->buffer = vte_terminal_get_text (vteterminal, NULL, NULL, NULL);
-  
-  //log_debug ("Buffer read: %d bytes\n", strlen (p_ct->buffer));
-  //log_debug ("p_ct->buffer = '%s'\n", p_ct->buffer);
+  /* output goes to the screen at the bottom, wherever the user has scrolled */
+  top = (glong) gtk_adjustment_get_upper (adj) - rows;
 
-  char *bufferTmp, *tmp1, *tmp2;
-  tmp1 = replace_str (p_ct->buffer, "\n", "");
-  tmp2 = replace_str (tmp1, "\r", "");
-  bufferTmp = replace_str (tmp2, " ", "");
+  if (top < 0)
+    top = 0;
 
-  //log_debug ("bufferTmp = '%s'\n", bufferTmp);
+  if ((text = vte_terminal_get_text_range (vte, top, 0, top + rows - 1, cols - 1, NULL, NULL, NULL)) == NULL)
+    return (0);
 
-  unsigned char digest[MD5_DIGEST_LENGTH];
-  MD5_CTX mdContext;
+  /* blanks are skipped, as lines are padded differently after resizing */
+  for (p = text; *p; p++)
+    {
+      if (*p == '\n' || *p == '\r' || *p == ' ')
+        continue;
 
-  MD5_Init (&mdContext);
-  MD5_Update (&mdContext, bufferTmp, strlen(bufferTmp));
-  MD5_Final (digest, &mdContext);
-  
-  char md5string[1024];
-  for (i = 0; i < 16; ++i)
-    sprintf(&md5string[i*2], "%02x", (unsigned int)digest[i]);
+      hash ^= (unsigned char) *p;
+      hash *= 1099511628211ULL; /* FNV-1a prime */
+    }
 
-  free (tmp1);
-  free (tmp2);
-  free (bufferTmp);
+  g_free (text);
 
-  //log_debug ("MD5 = %s\n", md5string);
+  return (hash);
+}
+
+/**
+ * tab_check_activity() - marks a tab as changed if its screen is different since last check
+ * @return TRUE if the status of the tab has to be refreshed
+ */
+gboolean
+tab_check_activity (struct ConnectionTab *p_ct, gboolean resized)
+{
+  guint64 hash;
+
+  hash = tab_activity_hash (VTE_TERMINAL (p_ct->vte));
+
+  if (hash == p_ct->activity_hash)
+    return (FALSE);
+
+  p_ct->activity_hash = hash;
+
+  /* a resized screen is only redrawn */
+  if (resized || !tabIsConnected (p_ct))
+    return (FALSE);
+
+  //log_debug ("%s has changed\n", p_ct->connection.name); 
+  tabSetFlag (p_ct, TAB_CHANGED);
+
+  return (TRUE);
+}
+
+/**
+ * tab_check_log_in() - answers the prompts on the cursor line of a tab logging in
+ * Only the cursor line is read, and only until the tab is logged.
+ * @return 0 if the tab has been logged off
+ */
+int
+tab_check_log_in (struct ConnectionTab *p_ct)
+{
+  struct Protocol *p_prot;
+  glong _cx, _cy, last_x, last_y;
+  char *line;
+  unsigned int prompts;
 
-  /* remove extra new line at the end of buffer */
-  
-  //////if (p_ct->buffer[strlen (p_ct->buffer)-1] == '\n')
-  //  p_ct->buffer[strlen (p_ct->buffer)-1] = 0;
-  
   // Get cursor position and current line 
   // FIXME: sometimes gives the wrong row, eg. relogging by enter key
   
-  vte_terminal_get_cursor_position (vteterminal, &_cx, &_cy);
+  vte_terminal_get_cursor_position (VTE_TERMINAL (p_ct->vte), &_cx, &_cy);
 
   int cursorLine = _cy;
   
   //log_debug ("_cx=%ld _cy=%ld\n", _cx, _cy);
   
-  //////if (_cy > list_count (p_ct->buffer, '\n')-1)
-  //  _cy = list_count (p_ct->buffer, '\n')-1;
-  
-  /* if cursor didn't move don't do anything (e.g. resizing window) */
-  /*
-  if (_cx == p_ct->cx && _cy == p_ct->cy)
-    return;
-  */
-  
   last_x = p_ct->cx;
   last_y = p_ct->cy;
   p_ct->cx = _cx;
@@ -5087,83 +5291,152 @@ contents_changed_cb (VteTerminal *vteterminal, gpointer user_data)
 
   //log_debug ("cursorLine=%d p_ct->cx=%d p_ct->cy=%d\n", cursorLine, p_ct->cx, p_ct->cy);
 
-  // Alloc line here so can contain the full buffer
-  //char line[strlen (p_ct->buffer)+1];
-  //list_get_nth (p_ct->buffer, p_ct->cy+1, '\n', line);
+  if (p_ct->type != CONNECTION_REMOTE || tabGetFlag (p_ct, TAB_LOGGED) || (p_ct->cx == last_x && p_ct->cy == last_y))
+    return (1);
 
-  char **lines = 
-    splitString (p_ct->buffer, "\n", FALSE, NULL, FALSE, &nLines);
+  if (p_ct->prompt_matcher == NULL && (p_prot = get_protocol (&g_prot_list, p_ct->connection.protocol)) != NULL)
+    p_ct->prompt_matcher = prompt_matcher_new (p_prot->user_prompts, p_prot->password_prompts);
 
-  //log_debug ("nLines = %d\n", nLines);
+  line = vte_terminal_get_text_range (VTE_TERMINAL (p_ct->vte), cursorLine, 0, cursorLine,
+                                      vte_terminal_get_column_count (VTE_TERMINAL (p_ct->vte)) - 1, NULL, NULL, NULL);
 
-  //for (int i=0; i<nLines; i++)
-  //  log_debug ("%2d: %s %s %d\n", i, lines[i], i == cursorLine ? "(*)" : "", i == cursorLine ? cursorLine : -1);
+  //log_debug ("line %d = '%s'\n", p_ct->cy+1, line); // Beware: crash with very long lines
 
-  if (cursorLine < nLines) {
-    char line[strlen (lines[cursorLine])+1];
-    //char *line = lines[nLines-1];
-    strcpy(line, lines[cursorLine]);
+  prompts = line && p_ct->prompt_matcher ? prompt_matcher_scan (p_ct->prompt_matcher, line) : 0;
 
-    //log_debug ("line %d = '%s'\n", p_ct->cy+1, line); // Beware: crash with very long lines
-    
-    // normalize line for analysis
-    
-    lower (line);
-    trim (line);
-    
-    //feed_child = 0;
+  g_free (line);
 
-    //log_debug ("%s : logged=%d, type=%d\n", p_ct->connection.name, p_ct->logged, p_current_connection_tab->type);
+  //log_debug ("%s : logged=%d, type=%d\n", p_ct->connection.name, p_ct->logged, p_current_connection_tab->type);
 
-    if (p_ct->type == CONNECTION_REMOTE)
-      {
-        if (/*!p_ct->logged*/!tabGetFlag (p_ct, TAB_LOGGED) && (p_ct->cx != last_x || p_ct->cy != last_y) && !check_log_in_state (p_ct, line))
-          {
-            //connection_log_off ();
-            return;
-          }
-      }
-  }
+  return (check_log_in_state (p_ct, prompts));
+}
+
+/**
+ * tabs_flush() - does the work collected on tabs since the previous frame
+ */
+void
+tabs_flush ()
+{
+  GHashTable *dirty;
+  GHashTableIter iter;
+  gpointer key;
+  struct ConnectionTab *p_ct;
+  unsigned int what;
+
+  if (tabsFlushSource)
+    g_source_remove (tabsFlushSource);
+
+  tabsFlushSource = 0;
+
+#if GTK_CHECK_VERSION(3, 8, 0)
+  if (tabsFlushTick)
+    gtk_widget_remove_tick_callback (main_window, tabsFlushTick);
+
+  tabsFlushTick = 0;
+#endif
 
-  free (lines);
+  if (tabsDirty == NULL)
+    return;
+
+  /* tabs marked while flushing wait for the next frame */
+  dirty = tabsDirty;
+  tabsDirty = g_hash_table_new (g_direct_hash, g_direct_equal);
 
-  //log_debug ("setting status...\n", line);
+  g_hash_table_iter_init (&iter, dirty);
 
-  //log_debug ("p_ct != p_current_connection_tab = %d\n", p_ct != p_current_connection_tab);
-  //log_debug ("p_ct->window_resized = %d\n", p_ct->window_resized);
-/* 
-  if ((p_ct != p_current_connection_tab) && !p_ct->window_resized)
+  while (g_hash_table_iter_next (&iter, &key, NULL))
     {
-      //log_debug ("check %s\n", p_ct->connection.name)
-      
-      if ((p_ct->type == CONNECTION_REMOTE && p_ct->status != TAB_STATUS_DISCONNECTED)
-          || p_ct->type == CONNECTION_LOCAL) 
+      p_ct = (struct ConnectionTab *) key;
+
+      /* closed by the work on a previous tab */
+      if (g_list_find (connection_tab_list, p_ct) == NULL)
+        continue;
+
+      what = p_ct->dirty;
+      p_ct->dirty = 0;
+
+      if (what & TAB_DIRTY_CONTENTS)
         {
-          //log_debug ("%s has changed\n", p_ct->connection.name); 
-          connection_tab_set_status (p_ct, TAB_STATUS_CHANGED); 
+          if (!tab_check_log_in (p_ct))
+            {
+              //connection_log_off ();
+              continue;
+            }
+
+          if (tab_check_activity (p_ct, (what & TAB_DIRTY_RESIZED) != 0))
+            what |= TAB_DIRTY_STATUS;
         }
+
+      if (what & TAB_DIRTY_STATUS)
+        refreshTabStatus (p_ct);
     }
-*/
 
-  if (!p_ct->window_resized && tabIsConnected (p_ct)) {
-    /*if ((p_ct->type == CONNECTION_REMOTE && p_ct->status != TAB_STATUS_DISCONNECTED)
-        || p_ct->type == CONNECTION_LOCAL) 
-      {*/
-        if (strcmp (p_ct->md5Buffer, md5string)) {
-          //log_debug ("%s has changed\n", p_ct->connection.name); 
-
-          strcpy (p_ct->md5Buffer, md5string);
-          //connection_tab_set_status (p_ct, TAB_STATUS_CHANGED);
-          tabSetFlag (p_ct, TAB_CHANGED);
-          refreshTabStatus (p_ct);
-        } 
-      //}
-  }
+  g_hash_table_destroy (dirty);
+}
+
+gboolean
+tabs_flush_timeout_cb (gpointer user_data)
+{
+  tabsFlushSource = 0;
+  tabs_flush ();
+
+  return (FALSE);
+}
+
+#if GTK_CHECK_VERSION(3, 8, 0)
+gboolean
+tabs_flush_tick_cb (GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data)
+{
+  tabsFlushTick = 0;
+  tabs_flush ();
+
+  return (G_SOURCE_REMOVE);
+}
+#endif
+
+/**
+ * tabMarkDirty() - asks for work on a tab at the next frame (TAB_DIRTY_*)
+ * However many times a tab is marked in a frame, its work is done once.
+ */
+void
+tabMarkDirty (SConnectionTab *pTab, unsigned int what)
+{
+  if (tabsDirty == NULL)
+    tabsDirty = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  pTab->dirty |= what;
+  g_hash_table_insert (tabsDirty, pTab, pTab);
+
+#if GTK_CHECK_VERSION(3, 8, 0)
+  if (tabsFlushTick == 0 && gtk_widget_get_mapped (main_window))
+    tabsFlushTick = gtk_widget_add_tick_callback (main_window, tabs_flush_tick_cb, NULL, NULL);
+
+  /* the frame clock stops while the window isn't drawn */
+  if (tabsFlushSource == 0)
+    tabsFlushSource = gdk_threads_add_timeout (TAB_FLUSH_HIDDEN_MSECS, tabs_flush_timeout_cb, NULL);
+#else
+  if (tabsFlushSource == 0)
+    tabsFlushSource = gdk_threads_add_timeout (TAB_FLUSH_MSECS, tabs_flush_timeout_cb, NULL);
+#endif
+}
+
+void
+contents_changed_cb (VteTerminal *vteterminal, gpointer user_data)
+{
+  struct ConnectionTab *p_ct;
+
+  if (p_current_connection_tab == NULL)
+    return;
+
+  p_ct = (struct ConnectionTab *) user_data;
+  
+  //log_debug ("%s\n", p_ct->connection.name);
+
+  /* prompts and changes are checked once per frame, however many changes arrive */
+  tabMarkDirty (p_ct, p_ct->window_resized ? TAB_DIRTY_CONTENTS | TAB_DIRTY_RESIZED : TAB_DIRTY_CONTENTS);
 
   /* Reset the resize flag */
   p_ct->window_resized = 0;
-
-  //log_debug ("end\n");
 }
 
 gboolean
@@ -5341,6 +5614,8 @@ key_press_event_cb (GtkWidget *widget, GdkEventKey *event, gpointer user_data)
   keyReturn = GDK_KEY_Return;
   keyEnter = GDK_KEY_KP_Enter;
 #endif
+
+  key_cache_user_active ();
     
   //log_debug("keyval=%d\n", event->keyval);
     
@@ -5381,16 +5656,9 @@ key_press_event_cb (GtkWidget *widget, GdkEventKey *event, gpointer user_data)
           tabInitConnection (p_current_connection_tab);
           p_current_connection_tab->enter_key_relogging = 1;
           
-          log_on (p_current_connection_tab);
-          //connection_tab_set_status (p_current_connection_tab, TAB_STATUS_NORMAL); 
-          refreshTabStatus (p_current_connection_tab); 
+          /* the sftp panel is refreshed by connection_tab_logged_on() */
+          connection_tab_log_on (p_current_connection_tab);
           update_screen_info ();
-          
-          if (lt_ssh_is_connected (&p_current_connection_tab->ssh_info))
-            {
-              sftp_refresh_directory_list (&p_current_connection_tab->ssh_info);
-              refresh_sftp_panel (&p_current_connection_tab->ssh_info);
-            }
         }
     }
 
@@ -5421,7 +5689,7 @@ update_by_tab(struct ConnectionTab *pTab)
   update_screen_info ();
   
   //connection_tab_set_status (pTab, TAB_STATUS_NORMAL);
-  refreshTabStatus (pTab);
+  tabMarkDirty (pTab, TAB_DIRTY_STATUS);
 
   select_current_profile_menu_item (pTab);
 
@@ -5743,6 +6011,8 @@ start_gtk (int argc, char **argv)
   int font_size;
   struct Iteration_Function_Request ifr_function;
 
+  guiThread = g_thread_self ();
+
   signal (SIGCHLD, child_exit); /* a child process ends */
   signal (SIGSEGV, segv_handler); /* Segmentation fault */
 
@@ -9,6 +9,7 @@
 #include <gtk/gtk.h>
 #include <vte/vte.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "connection_list.h"
 #include "ssh.h"
 
@@ -43,8 +44,24 @@ enum { TAB_CONN_STATUS_DISCONNECTED = 0, TAB_CONN_STATUS_CONNECTING, TAB_CONN_ST
 #define TAB_CHANGED 1
 #define TAB_LOGGED 2
 
+// Work on a tab waiting for the next frame (see tabMarkDirty())
+#define TAB_DIRTY_CONTENTS 1
+#define TAB_DIRTY_RESIZED 2
+#define TAB_DIRTY_STATUS 4
+
+/* Tabs are updated at most once in this time without a frame clock (a frame at 60 Hz) */
+#define TAB_FLUSH_MSECS 16
+
+/* Tabs are updated anyway after this time when the window isn't drawn, e.g. iconified */
+#define TAB_FLUSH_HIDDEN_MSECS 100
+
 //#define GET_UI_ELEMENT(TYPE, ELEMENT) TYPE *ELEMENT = (TYPE *) gtk_builder_get_object (builder, #ELEMENT);
 
+struct SshTerminal;
+struct ConnectJob;
+struct RestoreRequest;
+struct PromptMatcher;
+
 typedef struct ConnectionTab
   {
     struct Connection connection;
@@ -61,8 +78,9 @@ typedef struct ConnectionTab
     int type;
     //int status; // DEPRECATED: use flags
     unsigned int flags; // logged, changed
-    char *buffer;
-    char md5Buffer[1024];
+    guint64 activity_hash;  /* hash of the screen when last checked */
+    unsigned int dirty;     /* TAB_DIRTY_* to be done at the next frame */
+    struct PromptMatcher *prompt_matcher; /* prompts of the protocol, built while logging in */
     int cx, cy; /* cursor position */
     int window_resized;
     int profile_id;
@@ -75,6 +93,10 @@ typedef struct ConnectionTab
     GtkWidget *notebook; // Notebook containing the terminal
 
     pid_t pid;
+    struct SshTerminal *ssh_terminal; /* shell channel of the sftp session, NULL if running the ssh client */
+    struct ConnectJob *connect_job;   /* connection in progress */
+    struct RestoreRequest *restore;   /* restored tabs waiting for this one to log on */
+    GtkWidget *cancel_button;         /* on the label, shown while connecting */
   } SConnectionTab;
 
 struct QuickLaunchWindow
@@ -137,6 +159,19 @@ struct Match
     char *matched_string;
   };
 
+/* function called in the main loop on behalf of another thread */
+typedef struct MainCall {
+  GSourceFunc func;
+  gpointer data;
+  gboolean result;
+  int done;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} SMainCall;
+
+gboolean gui_is_main_thread ();
+gboolean gui_call_sync (GSourceFunc func, gpointer data);
+gint msgbox_show (GtkMessageType type, GtkButtonsType buttons, char *msg);
 void msgbox_error (const char *fmt, ...);
 void msgbox_info (const char *fmt, ...);
 gint msgbox_yes_no (const char *fmt, ...);
@@ -152,6 +187,7 @@ int tabIsConnected(SConnectionTab *pConn);
 void tabSetFlag (SConnectionTab *pConn, unsigned int bitmask);
 void tabResetFlag (SConnectionTab *pConn, unsigned int bitmask);
 unsigned int tabGetFlag (SConnectionTab *pConn, unsigned int bitmask);
+void tabMarkDirty (SConnectionTab *pTab, unsigned int what);
 
 void resize_window_cb (VteTerminal *terminal, guint width, guint height, gpointer user_data);
 void maximize_window_cb (VteTerminal *terminal, gpointer user_data);
@@ -169,6 +205,8 @@ void child_exited_cb (VteTerminal *vteterminal, gint status, gpointer user_data)
 void child_exited_cb (VteTerminal *vteterminal, gpointer user_data);
 #endif
 
+void connection_tab_exited (struct ConnectionTab *p_ct);
+
 void size_allocate_cb (GtkWidget *widget, GtkAllocation *allocation, gpointer user_data);
 gint delete_event_cb (GtkWidget *window, GdkEventAny *e, gpointer data);
 void terminal_popup_menu (GdkEventButton *event);
@@ -180,10 +218,14 @@ void
 terminal_focus_cb (GtkWidget       *widget,
                 gpointer         user_data);
 
+void connection_tab_prepare (struct ConnectionTab *p_connection_tab);
+int connection_tab_log_on (struct ConnectionTab *p_connection_tab);
+void connection_tab_logged_on (struct ConnectionTab *p_connection_tab, int retcode);
 void connection_log_on_param (struct Connection *p_conn);
 void connection_log_on ();
 void connection_log_off ();
 void connection_duplicate ();
+void connection_benchmark_ciphers ();
 void connection_edit_protocols ();
 void connection_new_terminal_dir (char *directory);
 void connection_new_terminal ();
@@ -0,0 +1,536 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file jump_host.c
+ * @brief Sessions to target hosts carried by direct-tcpip channels of a shared jump host (ProxyJump)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+#include "main.h"
+#include "ssh.h"
+#include "connection_list.h"
+#include "keepalive.h"
+#include "deadline.h"
+#include "jump_host.h"
+
+extern Globals globals;
+extern Prefs prefs;
+extern struct Connection_List conn_list;
+
+/* SJumpHost open or being closed */
+GList *jumpHosts = NULL;
+pthread_mutex_t mutexJumpHosts = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * jump_auth() - parameters to authenticate on the jump host of a connection
+ * jump is the name of a connection, whose credentials are used, or [user@]host[:port]
+ * authenticated like the target.
+ * @return 0 if ok, 1 if jump is empty or not valid
+ */
+int
+jump_auth (char *jump, struct SSH_Auth_Data *p_target, struct SSH_Auth_Data *p_jump)
+{
+  struct Connection *p_conn;
+  char spec[256], *host, *p;
+
+  if (jump == NULL || jump[0] == 0 || strlen (jump) >= sizeof (spec))
+    return (1);
+
+  memset (p_jump, 0, sizeof (struct SSH_Auth_Data));
+  p_jump->keepalive_interval = 0;
+
+  if ((p_conn = cl_get_by_name (&conn_list, jump)) != NULL)
+    {
+      strcpy (p_jump->host, p_conn->host);
+      p_jump->port = p_conn->port;
+      p_jump->mode = p_conn->auth_mode;
+      strcpy (p_jump->identityFile, p_conn->identityFile);
+
+      /* same credentials used by connection_log_on_param() */
+      strcpy (p_jump->user, p_conn->auth_mode == CONN_AUTH_MODE_SAVE && p_conn->auth_user[0] ? p_conn->auth_user : p_conn->user);
+      strcpy (p_jump->password, p_conn->auth_mode == CONN_AUTH_MODE_SAVE && p_conn->auth_password[0] ? p_conn->auth_password : p_conn->password);
+      strcpy (p_jump->ciphers, p_conn->sshOptions.ciphers);
+      strcpy (p_jump->macs, p_conn->sshOptions.macs);
+      strcpy (p_jump->kex, p_conn->sshOptions.kex);
+
+      return (p_jump->user[0] == 0);
+    }
+
+  strcpy (spec, jump);
+  strcpy (p_jump->user, p_target->user);
+  strcpy (p_jump->password, p_target->password);
+  strcpy (p_jump->identityFile, p_target->identityFile);
+  p_jump->mode = p_target->mode;
+  p_jump->port = 22;
+
+  if ((host = strrchr (spec, '@')) != NULL)
+    {
+      *host = 0;
+      strncpy (p_jump->user, spec, sizeof (p_jump->user) - 1);
+      host ++;
+    }
+  else
+    host = spec;
+
+  /* [address]:port for IPv6 */
+  if (host[0] == '[' && (p = strchr (host, ']')) != NULL)
+    {
+      *p = 0;
+      host ++;
+      p = p[1] == ':' ? p + 1 : NULL;
+    }
+  else
+    p = strchr (host, ':');
+
+  if (p)
+    {
+      *p = 0;
+      p_jump->port = atoi (p + 1);
+    }
+
+  if (host[0] == 0 || strlen (host) >= sizeof (p_jump->host) || p_jump->port <= 0)
+    return (1);
+
+  strcpy (p_jump->host, host);
+
+  return (0);
+}
+
+/* call with the jump host locked */
+void
+jump_tunnel_free (SJumpHost *jh, SJumpTunnel *tunnel)
+{
+  log_write ("Tunnel to %s through %s closed\n", tunnel->target, jh->key);
+
+  if (jh->node.session && ssh_is_connected (jh->node.session) && ssh_channel_is_open (tunnel->channel))
+    {
+      ssh_channel_send_eof (tunnel->channel);
+      ssh_channel_close (tunnel->channel);
+    }
+
+  ssh_channel_free (tunnel->channel);
+  close (tunnel->fd);
+
+  jh->tunnels = g_list_remove (jh->tunnels, tunnel);
+  g_free (tunnel);
+}
+
+/**
+ * jump_tunnel_pump() - moves data between the socket and the channel of a tunnel (call with the jump host locked)
+ * Data read from the channel is kept until the socket accepts it, so the channel
+ * isn't read again while the target session is slow.
+ */
+void
+jump_tunnel_pump (SJumpTunnel *tunnel, short revents)
+{
+  char buffer[JUMP_BUFFER_SIZE];
+  int n;
+
+  /* socket to channel */
+  if (revents & (POLLIN | POLLHUP | POLLERR))
+    {
+      if ((n = read (tunnel->fd, buffer, sizeof (buffer))) > 0)
+        {
+          if (ssh_channel_write (tunnel->channel, buffer, n) != n)
+            tunnel->closed = TRUE;
+        }
+      else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+        tunnel->closed = TRUE;
+    }
+
+  /* channel to socket */
+  while (!tunnel->closed)
+    {
+      if (tunnel->pending_len == 0)
+        {
+          n = ssh_channel_read_nonblocking (tunnel->channel, tunnel->pending, sizeof (tunnel->pending), 0);
+
+          if (n < 0 || (n == 0 && ssh_channel_is_eof (tunnel->channel)))
+            tunnel->closed = TRUE;
+
+          if (n <= 0)
+            break;
+
+          tunnel->pending_len = n;
+        }
+
+      if ((n = write (tunnel->fd, tunnel->pending, tunnel->pending_len)) < 0)
+        {
+          if (errno != EAGAIN && errno != EINTR)
+            tunnel->closed = TRUE;
+
+          break;
+        }
+
+      memmove (tunnel->pending, tunnel->pending + n, tunnel->pending_len - n);
+      tunnel->pending_len -= n;
+
+      if (tunnel->pending_len > 0)
+        break;
+    }
+}
+
+/**
+ * jump_host_loop() - forwards the tunnels of a jump host until it's unused for JUMP_LINGER_SECS
+ */
+gpointer
+jump_host_loop (gpointer data)
+{
+  SJumpHost *jh = (SJumpHost *) data;
+  SJumpTunnel **tunnels = NULL;
+  struct pollfd *pfds = NULL;
+  GList *item;
+  char c;
+  int i, n, wait;
+
+  log_write ("Jump host %s ready\n", jh->key);
+
+  while (TRUE)
+    {
+      pthread_mutex_lock (&mutexJumpHosts);
+      pthread_mutex_lock (&jh->mutex);
+
+      if (jh->node.valid && (keepalive_socket_closed (jh->node.session)
+                             || (time (NULL) - jh->last_keepalive >= JUMP_KEEPALIVE_SECS && keepalive_send (jh->node.session) != SSH_OK)))
+        {
+          log_write ("Connection to jump host %s lost\n", jh->key);
+          jh->node.valid = 0;
+        }
+
+      if (time (NULL) - jh->last_keepalive >= JUMP_KEEPALIVE_SECS)
+        jh->last_keepalive = time (NULL);
+
+      /* target sessions fail as soon as their sockets are closed */
+      if (!jh->node.valid || !globals.running)
+        while (jh->tunnels)
+          jump_tunnel_free (jh, (SJumpTunnel *) jh->tunnels->data);
+
+      if (jh->tunnels || jh->opening)
+        jh->idle_since = 0;
+      else if (jh->idle_since == 0)
+        jh->idle_since = time (NULL);
+
+      if (jh->idle_since && (!jh->node.valid || !globals.running || time (NULL) - jh->idle_since >= JUMP_LINGER_SECS))
+        {
+          jh->closing = TRUE;
+          jumpHosts = g_list_remove (jumpHosts, jh);
+        }
+
+      pthread_mutex_unlock (&jh->mutex);
+      pthread_mutex_unlock (&mutexJumpHosts);
+
+      if (jh->closing)
+        break;
+
+      /* only this thread removes tunnels, others can be appended meanwhile */
+      pthread_mutex_lock (&jh->mutex);
+
+      n = g_list_length (jh->tunnels);
+      tunnels = g_renew (SJumpTunnel *, tunnels, n + 1);
+      pfds = g_renew (struct pollfd, pfds, n + 2);
+      wait = JUMP_MAX_WAIT_MSECS;
+
+      for (i = 0, item = jh->tunnels; item; i++, item = g_list_next (item))
+        {
+          tunnels[i] = (SJumpTunnel *) item->data;
+          pfds[i].fd = tunnels[i]->fd;
+          pfds[i].events = POLLIN | (tunnels[i]->pending_len ? POLLOUT : 0);
+          pfds[i].revents = 0;
+
+          /* data already read by libssh, e.g. while writing, doesn't wake up poll() */
+          if (tunnels[i]->pending_len == 0 && ssh_channel_poll (tunnels[i]->channel, 0) != 0)
+            wait = 0;
+        }
+
+      pfds[n].fd = ssh_get_fd (jh->node.session);
+      pfds[n].events = POLLIN;
+      pfds[n].revents = 0;
+      pfds[n + 1].fd = jh->wake[0];
+      pfds[n + 1].events = POLLIN;
+      pfds[n + 1].revents = 0;
+
+      pthread_mutex_unlock (&jh->mutex);
+
+      poll (pfds, n + 2, wait);
+
+      if (pfds[n + 1].revents & POLLIN)
+        while (read (jh->wake[0], &c, 1) > 0);
+
+      pthread_mutex_lock (&jh->mutex);
+
+      for (i = 0; i < n; i++)
+        {
+          jump_tunnel_pump (tunnels[i], pfds[i].revents);
+
+          if (tunnels[i]->closed)
+            jump_tunnel_free (jh, tunnels[i]);
+        }
+
+      pthread_mutex_unlock (&jh->mutex);
+    }
+
+  log_write ("Closing jump host %s\n", jh->key);
+
+  ssh_node_free (&jh->node);
+  close (jh->wake[0]);
+  close (jh->wake[1]);
+  pthread_mutex_destroy (&jh->mutex);
+  g_free (jh);
+  g_free (tunnels);
+  g_free (pfds);
+
+  return (NULL);
+}
+
+/* call with jump hosts locked */
+SJumpHost *
+jump_host_find (char *key)
+{
+  GList *item;
+
+  for (item = jumpHosts; item; item = g_list_next (item))
+    {
+      if (!strcmp (((SJumpHost *) item->data)->key, key) && !((SJumpHost *) item->data)->closing
+          && ((SJumpHost *) item->data)->node.valid)
+        return ((SJumpHost *) item->data);
+    }
+
+  return (NULL);
+}
+
+/**
+ * jump_host_get() - authenticated session to a jump host, opened if not shared yet
+ * The caller must decrement jh->opening (with jump hosts locked) when its tunnel is ready.
+ * @return the jump host, NULL if it can't be reached (error in p_jump)
+ */
+SJumpHost *
+jump_host_get (struct SSH_Auth_Data *p_jump, gboolean interactive)
+{
+  SJumpHost *jh, *other;
+  char key[320];
+
+  sprintf (key, "%s@%s:%d", p_jump->user, p_jump->host, p_jump->port);
+
+  pthread_mutex_lock (&mutexJumpHosts);
+
+  if ((jh = jump_host_find (key)) != NULL)
+    {
+      jh->opening ++;
+      pthread_mutex_unlock (&mutexJumpHosts);
+
+      log_write ("Reusing jump host %s\n", key);
+      return (jh);
+    }
+
+  pthread_mutex_unlock (&mutexJumpHosts);
+
+  jh = g_new0 (SJumpHost, 1);
+  strcpy (jh->key, key);
+
+  if (ssh_node_establish (&jh->node, p_jump, interactive) != 0)
+    {
+      g_free (jh);
+      return (NULL);
+    }
+
+  /* only channels are opened on it */
+  if (jh->node.sftp)
+    {
+      sftp_free (jh->node.sftp);
+      jh->node.sftp = NULL;
+    }
+
+  strcpy (jh->node.user, p_jump->user);
+  strcpy (jh->node.host, p_jump->host);
+  jh->node.port = p_jump->port;
+  jh->node.valid = 1;
+
+  pthread_mutex_lock (&mutexJumpHosts);
+
+  /* opened by another connection in the meantime */
+  if ((other = jump_host_find (key)) != NULL)
+    {
+      other->opening ++;
+      pthread_mutex_unlock (&mutexJumpHosts);
+
+      ssh_node_free (&jh->node);
+      g_free (jh);
+      return (other);
+    }
+
+  if (pipe (jh->wake) != 0)
+    {
+      pthread_mutex_unlock (&mutexJumpHosts);
+
+      strcpy (p_jump->error_s, strerror (errno));
+      ssh_node_free (&jh->node);
+      g_free (jh);
+      return (NULL);
+    }
+
+  fcntl (jh->wake[0], F_SETFL, O_NONBLOCK);
+  fcntl (jh->wake[1], F_SETFL, O_NONBLOCK);
+  pthread_mutex_init (&jh->mutex, NULL);
+  jh->last_keepalive = time (NULL);
+  jh->opening = 1;
+  jumpHosts = g_list_append (jumpHosts, jh);
+
+  pthread_mutex_unlock (&mutexJumpHosts);
+
+  g_thread_unref (g_thread_new ("jump-host", jump_host_loop, jh));
+
+  return (jh);
+}
+
+/**
+ * jump_open_forward() - opens a direct-tcpip channel to host giving up after msecs
+ * (call with the jump host locked)
+ * The jump host is unlocked between polls, so its tunnels keep flowing while the target is slow.
+ */
+int
+jump_open_forward (SJumpHost *jh, ssh_channel channel, char *host, int port, gboolean *cancel, int msecs)
+{
+  struct pollfd pfd;
+  SDeadline d;
+  int rc;
+
+  deadline_start (&d, msecs);
+
+  while (TRUE)
+    {
+      /* the forwarding thread needs blocking writes */
+      ssh_set_blocking (jh->node.session, 0);
+      rc = ssh_channel_open_forward (channel, host, port, "127.0.0.1", 0);
+      ssh_set_blocking (jh->node.session, 1);
+
+      if (rc != SSH_AGAIN || deadline_expired (&d) || !jh->node.valid || (cancel && *cancel))
+        break;
+
+      if ((pfd.fd = ssh_get_fd (jh->node.session)) < 0)
+        {
+          rc = SSH_ERROR;
+          break;
+        }
+
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      pthread_mutex_unlock (&jh->mutex);
+      poll (&pfd, 1, deadline_remaining (&d) < 0 ? JUMP_OPEN_POLL_MSECS : MIN (deadline_remaining (&d), JUMP_OPEN_POLL_MSECS));
+      pthread_mutex_lock (&jh->mutex);
+    }
+
+  if (rc == SSH_AGAIN)
+    {
+      log_write ("Timeout opening tunnel to %s:%d through %s (%d ms)\n", host, port, jh->key, msecs);
+      rc = SSH_ERROR;
+    }
+
+  return (rc);
+}
+
+/**
+ * jump_connect() - opens a tunnel to the target through its jump host, connecting to the jump host if needed
+ * @return the socket for the target session, closed by libssh with it, or -1 (error in p_auth)
+ */
+int
+jump_connect (struct SSH_Auth_Data *p_auth, gboolean interactive, SConnTiming *t)
+{
+  struct SSH_Auth_Data jump;
+  SJumpHost *jh;
+  SJumpTunnel *tunnel;
+  ssh_channel channel;
+  int sv[2], rc;
+
+  conn_timing_mark (t, CONN_PHASE_DNS);
+
+  if (jump_auth (p_auth->jump, p_auth, &jump) != 0)
+    {
+      sprintf (p_auth->error_s, "Not a valid jump host: %s", p_auth->jump);
+      return (-1);
+    }
+
+  jump.progress = p_auth->progress;
+  jump.progress_data = p_auth->progress_data;
+  jump.cancel = p_auth->cancel;
+
+  if ((jh = jump_host_get (&jump, interactive)) == NULL)
+    {
+      sprintf (p_auth->error_s, "Jump host %s: %s", jump.host, jump.error_s);
+      return (-1);
+    }
+
+  pthread_mutex_lock (&jh->mutex);
+
+  rc = -1;
+
+  if ((channel = ssh_channel_new (jh->node.session)) == NULL)
+    sprintf (p_auth->error_s, "Can't open a channel on %s", jump.host);
+  else if (jump_open_forward (jh, channel, p_auth->host, p_auth->port, p_auth->cancel, prefs.ssh_timeout * 1000) != SSH_OK)
+    {
+      sprintf (p_auth->error_s, "Can't reach %s:%d from %s: %s", p_auth->host, p_auth->port, jump.host, ssh_get_error (jh->node.session));
+      ssh_channel_free (channel);
+
+      if (!ssh_is_connected (jh->node.session))
+        jh->node.valid = 0;
+    }
+  else if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    {
+      strcpy (p_auth->error_s, strerror (errno));
+      ssh_channel_close (channel);
+      ssh_channel_free (channel);
+    }
+  else
+    {
+      fcntl (sv[0], F_SETFL, O_NONBLOCK);
+
+      tunnel = g_new0 (SJumpTunnel, 1);
+      tunnel->channel = channel;
+      tunnel->fd = sv[0];
+      sprintf (tunnel->target, "%s:%d", p_auth->host, p_auth->port);
+      jh->tunnels = g_list_append (jh->tunnels, tunnel);
+
+      log_write ("Tunnel to %s through %s opened\n", tunnel->target, jh->key);
+
+      write (jh->wake[1], "", 1);
+      rc = sv[1];
+    }
+
+  pthread_mutex_unlock (&jh->mutex);
+
+  pthread_mutex_lock (&mutexJumpHosts);
+  jh->opening --;
+  pthread_mutex_unlock (&mutexJumpHosts);
+
+  conn_timing_mark (t, CONN_PHASE_TCP);
+
+  return (rc);
+}
+
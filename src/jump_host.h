@@ -0,0 +1,59 @@
+
+#ifndef _JUMP_HOST_H
+#define _JUMP_HOST_H
+
+#include <time.h>
+#include <pthread.h>
+#include <glib.h>
+#include <libssh/libssh.h>
+#include "ssh.h"
+#include "conn_stats.h"
+
+/* Longest wait of the forwarding thread, which is woken by the sockets */
+#define JUMP_MAX_WAIT_MSECS 1000
+
+/* Milliseconds between checks while a tunnel is being opened, the reply can be read by the forwarding thread */
+#define JUMP_OPEN_POLL_MSECS 50
+
+/* Seconds a jump host is kept open after its last tunnel closes */
+#define JUMP_LINGER_SECS 60
+
+/* Seconds between keepalives sent to a jump host */
+#define JUMP_KEEPALIVE_SECS 30
+
+#define JUMP_BUFFER_SIZE 32768
+
+/**
+ * struct JumpTunnel
+ * direct-tcpip channel of a jump host carrying the session of a target host
+ */
+typedef struct JumpTunnel {
+  ssh_channel channel;
+  int fd;                /* our end of the socket pair, the other one is the socket of the target session */
+  char target[300];      /* host:port */
+  char pending[JUMP_BUFFER_SIZE]; /* read from the channel, not yet accepted by the socket */
+  int pending_len;
+  gboolean closed;
+} SJumpTunnel;
+
+/**
+ * struct JumpHost
+ * authenticated session to a bastion shared by all the tunnels through it
+ */
+typedef struct JumpHost {
+  char key[320];         /* user@host:port */
+  struct SSH_Node node;
+  pthread_mutex_t mutex; /* the session is used only with this locked, never with the ssh mutex */
+  GList *tunnels;
+  int opening;           /* tunnels being opened, the host can't be closed meanwhile */
+  time_t idle_since;
+  time_t last_keepalive;
+  int wake[2];           /* pipe waking up the forwarding thread when a tunnel is added */
+  gboolean closing;
+} SJumpHost;
+
+int jump_auth (char *jump, struct SSH_Auth_Data *p_target, struct SSH_Auth_Data *p_jump);
+int jump_connect (struct SSH_Auth_Data *p_auth, gboolean interactive, SConnTiming *t);
+
+#endif
+
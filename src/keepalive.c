@@ -0,0 +1,266 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file keepalive.c
+ * @brief Protocol keepalives of ssh nodes
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <glib.h>
+#include <libssh/libssh.h>
+#include "main.h"
+#include "keepalive.h"
+#include "conn_stats.h"
+
+extern Globals globals;
+
+/* Timer wheel: the slot under the cursor expires every second */
+GList *keepaliveWheel[KEEPALIVE_WHEEL_SLOTS];
+int keepaliveCursor = 0;
+pthread_mutex_t mutexKeepalive = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * keepalive_send() - sends SSH_MSG_IGNORE, discarded by the server without replying
+ * Nothing is waited and no reply is left unread on idle sessions: a dropped connection
+ * makes the send fail or the socket report an error at the next tick.
+ */
+int
+keepalive_send (ssh_session session)
+{
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 7, 0)
+  return (ssh_send_ignore (session, "keepalive"));
+#else
+  return (ssh_is_connected (session) ? SSH_OK : SSH_ERROR);
+#endif
+}
+
+/**
+ * keepalive_socket_closed() - checks without waiting if the connection has been dropped
+ */
+int
+keepalive_socket_closed (ssh_session session)
+{
+  struct pollfd pfd;
+
+  if (!ssh_is_connected (session) || (pfd.fd = ssh_get_fd (session)) < 0)
+    return (1);
+
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  if (poll (&pfd, 1, 0) < 0)
+    return (0);
+
+  return ((pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) != 0);
+}
+
+/**
+ * keepalive_rtt() - round trip time estimated by the kernel, updated by the acks of keepalives
+ * @return milliseconds, negative if not available
+ */
+double
+keepalive_rtt (ssh_session session)
+{
+#ifdef TCP_INFO
+  struct tcp_info info;
+  socklen_t len = sizeof (info);
+
+  if (getsockopt (ssh_get_fd (session), IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && info.tcpi_rtt > 0)
+    return (info.tcpi_rtt / 1000.0);
+#endif
+
+  return (-1);
+}
+
+/**
+ * keepalive_node_exists() - checks that a node, or the compressed session of one, has not been released
+ * (call with ssh mutex locked)
+ */
+int
+keepalive_node_exists (struct SSH_Node *p_node)
+{
+  struct SSH_Node *node;
+
+  for (node = globals.ssh_list.head; node; node = node->next)
+    {
+      if (node == p_node || node->compressed == p_node)
+        return (1);
+    }
+
+  return (0);
+}
+
+/* call with keepalive mutex locked */
+void
+keepalive_insert (SKeepaliveTimer *t)
+{
+  t->rounds = (t->interval - 1) / KEEPALIVE_WHEEL_SLOTS;
+
+  keepaliveWheel[(keepaliveCursor + t->interval) % KEEPALIVE_WHEEL_SLOTS] =
+    g_list_prepend (keepaliveWheel[(keepaliveCursor + t->interval) % KEEPALIVE_WHEEL_SLOTS], t);
+}
+
+/* call with keepalive mutex locked */
+SKeepaliveTimer *
+keepalive_find (struct SSH_Node *p_node, int *slot)
+{
+  GList *item;
+  int i;
+
+  for (i = 0; i < KEEPALIVE_WHEEL_SLOTS; i++)
+    for (item = keepaliveWheel[i]; item; item = g_list_next (item))
+      {
+        if (((SKeepaliveTimer *) item->data)->p_node == p_node)
+          {
+            *slot = i;
+            return ((SKeepaliveTimer *) item->data);
+          }
+      }
+
+  return (NULL);
+}
+
+/**
+ * keepalive_schedule() - sends keepalives to a node every interval seconds (0 to stop)
+ */
+void
+keepalive_schedule (struct SSH_Node *p_node, int interval)
+{
+  SKeepaliveTimer *t;
+  int slot;
+
+  pthread_mutex_lock (&mutexKeepalive);
+
+  if ((t = keepalive_find (p_node, &slot)) != NULL)
+    {
+      keepaliveWheel[slot] = g_list_remove (keepaliveWheel[slot], t);
+
+      /* the shortest interval wins when tabs on the same node ask different ones */
+      if (interval > 0 && t->interval < interval)
+        interval = t->interval;
+
+      g_free (t);
+    }
+
+  if (interval > 0)
+    {
+      t = g_new0 (SKeepaliveTimer, 1);
+      t->p_node = p_node;
+      t->interval = interval;
+      keepalive_insert (t);
+    }
+
+  pthread_mutex_unlock (&mutexKeepalive);
+}
+
+void
+keepalive_cancel (struct SSH_Node *p_node)
+{
+  SKeepaliveTimer *t;
+  int slot;
+
+  pthread_mutex_lock (&mutexKeepalive);
+
+  if ((t = keepalive_find (p_node, &slot)) != NULL)
+    {
+      keepaliveWheel[slot] = g_list_remove (keepaliveWheel[slot], t);
+      g_free (t);
+    }
+
+  pthread_mutex_unlock (&mutexKeepalive);
+}
+
+/**
+ * keepalive_tick() - sends the keepalives expired in the current second
+ * (called every second by the background loop)
+ * The ssh mutex is never requested while holding the keepalive one, as nodes are freed with ssh mutex locked.
+ */
+void
+keepalive_tick ()
+{
+  GList *item, *next, *expired = NULL;
+  SKeepaliveTimer *t;
+  double rtt;
+  int slot;
+
+  pthread_mutex_lock (&mutexKeepalive);
+
+  keepaliveCursor = (keepaliveCursor + 1) % KEEPALIVE_WHEEL_SLOTS;
+
+  for (item = keepaliveWheel[keepaliveCursor]; item; item = next)
+    {
+      next = g_list_next (item);
+      t = (SKeepaliveTimer *) item->data;
+
+      if (t->rounds > 0)
+        {
+          t->rounds --;
+          continue;
+        }
+
+      keepaliveWheel[keepaliveCursor] = g_list_delete_link (keepaliveWheel[keepaliveCursor], item);
+      expired = g_list_prepend (expired, t);
+    }
+
+  pthread_mutex_unlock (&mutexKeepalive);
+
+  for (item = expired; item; item = g_list_next (item))
+    {
+      t = (SKeepaliveTimer *) item->data;
+
+      /* transfers take the ssh mutex for each request, so keepalives are sent between them */
+      lockSSH (__func__, TRUE);
+
+      /* released in the meantime */
+      if (!keepalive_node_exists (t->p_node) || !ssh_node_get_validity (t->p_node) || t->p_node->session == NULL)
+        {
+          g_free (t);
+        }
+      else if (keepalive_socket_closed (t->p_node->session) || keepalive_send (t->p_node->session) != SSH_OK)
+        {
+          log_write ("Connection to %s@%s lost\n", t->p_node->user, t->p_node->host);
+          ssh_node_set_validity (t->p_node, 0);
+          g_free (t);
+        }
+      else
+        {
+          if ((rtt = keepalive_rtt (t->p_node->session)) >= 0)
+            conn_stats_add_rtt (t->p_node->host, t->p_node->port, rtt);
+
+          pthread_mutex_lock (&mutexKeepalive);
+
+          /* a new node could have been created at the same address */
+          if (keepalive_find (t->p_node, &slot))
+            g_free (t);
+          else
+            keepalive_insert (t);
+
+          pthread_mutex_unlock (&mutexKeepalive);
+        }
+
+      lockSSH (__func__, FALSE);
+    }
+
+  g_list_free (expired);
+}
+
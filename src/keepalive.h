@@ -0,0 +1,29 @@
+
+#ifndef _KEEPALIVE_H
+#define _KEEPALIVE_H
+
+#include <libssh/libssh.h>
+#include "ssh.h"
+
+/* Slots of the timer wheel, one per second */
+#define KEEPALIVE_WHEEL_SLOTS 64
+
+/**
+ * struct KeepaliveTimer
+ * next keepalive of a node, stored in the slot of the wheel where it expires
+ */
+typedef struct KeepaliveTimer {
+  struct SSH_Node *p_node;
+  int interval; /* seconds */
+  int rounds;   /* turns of the wheel left before expiring */
+} SKeepaliveTimer;
+
+int keepalive_send (ssh_session session);
+int keepalive_socket_closed (ssh_session session);
+double keepalive_rtt (ssh_session session);
+void keepalive_schedule (struct SSH_Node *p_node, int interval);
+void keepalive_cancel (struct SSH_Node *p_node);
+void keepalive_tick ();
+
+#endif
+
@@ -0,0 +1,284 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file key_cache.c
+ * @brief Private keys kept unlocked in memory, so identity files are read and decrypted once
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <gio/gio.h>
+#include <glib.h>
+#include <libssh/libssh.h>
+#include "main.h"
+#include "key_cache.h"
+
+extern Prefs prefs;
+
+/* SKeyCacheEntry by identity file path */
+GHashTable *keyCache = NULL;
+pthread_mutex_t mutexKeyCache = PTHREAD_MUTEX_INITIALIZER;
+
+/* last keyboard activity in the main window (monotonic time) */
+gint64 keyCacheLastActivity = 0;
+
+void
+key_cache_entry_free (SKeyCacheEntry *e)
+{
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 6, 0)
+  /* the key material is overwritten by libssh when the key is freed */
+  if (e->key)
+    ssh_key_free (e->key);
+#endif
+
+  g_free (e);
+}
+
+/* call with cache mutex locked */
+void
+key_cache_remove (SKeyCacheEntry *e)
+{
+  g_hash_table_steal (keyCache, e->path);
+
+  if (-- e->refcount == 0)
+    key_cache_entry_free (e);
+}
+
+/**
+ * key_cache_get() - private key of an identity file, imported if not cached or changed on disk
+ * The entry must be released with key_cache_release() after the authentication.
+ * @return the entry, or NULL if the key can't be imported (error is set)
+ */
+SKeyCacheEntry *
+key_cache_get (char *path, char *passphrase, char *error)
+{
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 6, 0)
+  SKeyCacheEntry *e;
+  struct stat st;
+  ssh_key key = NULL;
+  int rc;
+
+  if (stat (path, &st) != 0)
+    {
+      sprintf (error, "Can't access %s: %s", path, strerror (errno));
+      log_write ("%s\n", error);
+      return (NULL);
+    }
+
+  pthread_mutex_lock (&mutexKeyCache);
+
+  if (keyCache == NULL)
+    keyCache = g_hash_table_new (g_str_hash, g_str_equal);
+
+  if ((e = (SKeyCacheEntry *) g_hash_table_lookup (keyCache, path)) != NULL)
+    {
+      if (e->mtime == st.st_mtime && (e->expires == 0 || g_get_monotonic_time () < e->expires))
+        {
+          e->refcount ++;
+          pthread_mutex_unlock (&mutexKeyCache);
+          log_debug ("Using cached key %s\n", path);
+          return (e);
+        }
+
+      key_cache_remove (e);
+    }
+
+  pthread_mutex_unlock (&mutexKeyCache);
+
+  /* unencrypted keys don't need the passphrase */
+  rc = ssh_pki_import_privkey_file (path, NULL, NULL, NULL, &key);
+
+  if (rc != SSH_OK && passphrase && passphrase[0])
+    rc = ssh_pki_import_privkey_file (path, passphrase, NULL, NULL, &key);
+
+  if (rc != SSH_OK)
+    {
+      sprintf (error, "Can't import private key %s", path);
+      log_write ("%s\n", error);
+      return (NULL);
+    }
+
+  e = g_new0 (SKeyCacheEntry, 1);
+  e->key = key;
+  e->mtime = st.st_mtime;
+  e->refcount = 1;
+
+  if (!prefs.ssh_key_cache || strlen (path) >= sizeof (e->path))
+    return (e);
+
+  strcpy (e->path, path);
+  e->expires = prefs.ssh_key_cache_ttl > 0 ? g_get_monotonic_time () + (gint64) prefs.ssh_key_cache_ttl * G_USEC_PER_SEC : 0;
+  e->refcount ++;
+
+  pthread_mutex_lock (&mutexKeyCache);
+
+  /* another connection could have imported the same key in the meantime */
+  if (g_hash_table_lookup (keyCache, path) == NULL)
+    g_hash_table_insert (keyCache, e->path, e);
+  else
+    e->refcount --;
+
+  pthread_mutex_unlock (&mutexKeyCache);
+
+  log_write ("Key %s imported\n", path);
+
+  return (e);
+#else
+  strcpy (error, "Private keys can't be imported with this version of libssh");
+  return (NULL);
+#endif
+}
+
+void
+key_cache_release (SKeyCacheEntry *e)
+{
+  pthread_mutex_lock (&mutexKeyCache);
+
+  /* removed from the cache while in use */
+  if (-- e->refcount == 0)
+    key_cache_entry_free (e);
+
+  pthread_mutex_unlock (&mutexKeyCache);
+}
+
+/**
+ * key_cache_clear() - forgets all the unlocked keys, the next connections will read them again
+ */
+void
+key_cache_clear (char *reason)
+{
+  GHashTableIter iter;
+  gpointer value;
+  int n = 0;
+
+  pthread_mutex_lock (&mutexKeyCache);
+
+  if (keyCache)
+    {
+      g_hash_table_iter_init (&iter, keyCache);
+
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          g_hash_table_iter_steal (&iter);
+
+          if (-- ((SKeyCacheEntry *) value)->refcount == 0)
+            key_cache_entry_free ((SKeyCacheEntry *) value);
+
+          n ++;
+        }
+    }
+
+  pthread_mutex_unlock (&mutexKeyCache);
+
+  if (n)
+    log_write ("Key cache cleared (%s): %d keys\n", reason, n);
+}
+
+void
+key_cache_user_active ()
+{
+  keyCacheLastActivity = g_get_monotonic_time ();
+}
+
+/**
+ * key_cache_check() - removes expired keys and clears the cache when the user is idle
+ * (called every second by the background loop)
+ */
+void
+key_cache_check ()
+{
+  GHashTableIter iter;
+  gpointer value;
+  gint64 now = g_get_monotonic_time ();
+
+  if (prefs.ssh_key_cache_idle > 0 && keyCacheLastActivity
+      && now - keyCacheLastActivity > (gint64) prefs.ssh_key_cache_idle * G_USEC_PER_SEC)
+    {
+      key_cache_clear ("idle");
+      keyCacheLastActivity = 0;
+      return;
+    }
+
+  pthread_mutex_lock (&mutexKeyCache);
+
+  if (keyCache)
+    {
+      g_hash_table_iter_init (&iter, keyCache);
+
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          if (((SKeyCacheEntry *) value)->expires == 0 || now < ((SKeyCacheEntry *) value)->expires)
+            continue;
+
+          log_debug ("Key %s expired\n", ((SKeyCacheEntry *) value)->path);
+          g_hash_table_iter_steal (&iter);
+
+          if (-- ((SKeyCacheEntry *) value)->refcount == 0)
+            key_cache_entry_free ((SKeyCacheEntry *) value);
+        }
+    }
+
+  pthread_mutex_unlock (&mutexKeyCache);
+}
+
+void
+key_cache_screensaver_cb (GDBusConnection *connection, const gchar *sender_name, const gchar *object_path,
+                          const gchar *interface_name, const gchar *signal_name, GVariant *parameters,
+                          gpointer user_data)
+{
+  gboolean active = FALSE;
+
+  if (g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(b)")))
+    g_variant_get (parameters, "(b)", &active);
+
+  if (active)
+    key_cache_clear ("screen locked");
+}
+
+/**
+ * key_cache_start() - clears the cache when the screen saver activates, if configured
+ */
+void
+key_cache_start ()
+{
+  GDBusConnection *bus;
+  GError *error = NULL;
+
+  key_cache_user_active ();
+
+  if (!prefs.ssh_key_cache || !prefs.ssh_key_cache_clear_on_lock)
+    return;
+
+  if ((bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error)) == NULL)
+    {
+      log_write ("Can't watch screen lock: %s\n", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  /* desktops send the signal on one of the two interfaces */
+  g_dbus_connection_signal_subscribe (bus, NULL, "org.freedesktop.ScreenSaver", "ActiveChanged", NULL, NULL,
+                                      G_DBUS_SIGNAL_FLAGS_NONE, key_cache_screensaver_cb, NULL, NULL);
+  g_dbus_connection_signal_subscribe (bus, NULL, "org.gnome.ScreenSaver", "ActiveChanged", NULL, NULL,
+                                      G_DBUS_SIGNAL_FLAGS_NONE, key_cache_screensaver_cb, NULL, NULL);
+}
+
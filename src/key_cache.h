@@ -0,0 +1,31 @@
+
+#ifndef _KEY_CACHE_H
+#define _KEY_CACHE_H
+
+#include <time.h>
+#include <glib.h>
+#include <libssh/libssh.h>
+
+/**
+ * struct KeyCacheEntry
+ * private key imported and decrypted from an identity file
+ */
+typedef struct KeyCacheEntry {
+  char path[1024];
+  time_t mtime;    /* of the file when imported, the key is imported again if changed */
+  gint64 expires;  /* monotonic time, 0 if never */
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 6, 0)
+  ssh_key key;
+#endif
+  int refcount;    /* held by the cache and by authentications in progress */
+} SKeyCacheEntry;
+
+SKeyCacheEntry *key_cache_get (char *path, char *passphrase, char *error);
+void key_cache_release (SKeyCacheEntry *e);
+void key_cache_clear (char *reason);
+void key_cache_user_active ();
+void key_cache_check ();
+void key_cache_start ();
+
+#endif
+
@@ -45,6 +45,9 @@
 #include "utils.h"
 #include "config.h"
 #include "async.h"
+#include "ssh_pool.h"
+#include "ssh_reaper.h"
+#include "key_cache.h"
 
 #ifdef __APPLE__
 #include <sys/event.h>
@@ -285,56 +288,6 @@ notifyMessage (char *message)
 #endif
 }
 
-
-int sTimeout = 0;
-pthread_t tidAlarm = 0; // Thread that must receive alarms
-
-// A thread requests receive alarm
-void
-threadRequestAlarm ()
-{
-  tidAlarm = pthread_self ();
-  log_debug ("0x%08x\n", tidAlarm);
-}
-
-void
-threadResetAlarm ()
-{
-  tidAlarm = 0;
-}
-
-void 
-AlarmHandler (int sig) 
-{
-  log_debug ("[thread 0x%08x] %d\n", pthread_self (), sig);
-  sTimeout = 1;
-
-  if (tidAlarm && tidAlarm != pthread_self ()) {
-    log_debug ("Send alarm to thread 0x%08x\n", tidAlarm);
-    pthread_kill (tidAlarm, sig);
-  }
-} 
-
-void
-timerStart (int seconds)
-{
-  signal (SIGALRM, AlarmHandler); 
-  sTimeout = 0; 
-  alarm (seconds); 
-  log_debug ("Timer started: %d\n", seconds);
-}
-
-void
-timerStop ()
-{
-  signal (SIGALRM, SIG_DFL);
-  sTimeout = 0; 
-  alarm (0);
-  log_debug ("Timer stopped\n");
-}
-
-int timedOut () { return (sTimeout == 1); }
-
 int
 main (int argc, char *argv[])
 {
@@ -631,6 +584,15 @@ return (0);
     exit (1);
   }
 
+  // Open sessions for recent connections in background
+  ssh_pool_start ();
+
+  // Close sessions left idle by tabs
+  ssh_reaper_start ();
+
+  // Forget unlocked keys when the screen is locked
+  key_cache_start ();
+
   log_write ("Starting main loop\n");
 
   while (globals.running)
@@ -638,6 +600,9 @@ return (0);
       lterm_iteration ();
     }
 
+  ssh_pool_stop ();
+  key_cache_clear ("exit");
+
   log_write ("Saving session...\n");
   save_session_file (NULL); /* update session file */
   
@@ -716,6 +681,7 @@ load_settings ()
   profile_load_string (globals.conf_file, "general", "warnings_error_color", prefs.warnings_error_color, "red");
   profile_load_string (globals.conf_file, "general", "local_start_directory", prefs.local_start_directory, "");
   prefs.save_session = profile_load_int (globals.conf_file, "general", "save_session", 0);
+  prefs.session_restore_parallel = profile_load_int (globals.conf_file, "general", "session_restore_parallel", 8);
   prefs.max_recent_connections = profile_load_int (globals.conf_file, "general", "max_recent_connections", 10);
   prefs.max_recent_sessions = profile_load_int (globals.conf_file, "general", "max_recent_sessions", 10);
   prefs.checkpoint_interval = profile_load_int (globals.conf_file, "general", "checkpoint_interval", 5);
@@ -785,6 +751,25 @@ load_settings ()
   prefs.ssh_keepalive = profile_load_int (globals.conf_file, "SFTP", "ssh_keepalive", 10);
   prefs.ssh_timeout = profile_load_int (globals.conf_file, "SFTP", "ssh_timeout", 3);
   profile_load_string (globals.conf_file, "SFTP", "sftp_panel_background", prefs.sftp_panel_background, "white");
+  prefs.sftp_natural_sort = profile_load_int (globals.conf_file, "SFTP", "sftp_natural_sort", 1);
+  prefs.sftp_filter_mode = profile_load_int (globals.conf_file, "SFTP", "sftp_filter_mode", 0);
+  prefs.sftp_prefetch_dirs = profile_load_int (globals.conf_file, "SFTP", "sftp_prefetch_dirs", 0);
+  prefs.sftp_prefetch_per_minute = profile_load_int (globals.conf_file, "SFTP", "sftp_prefetch_per_minute", 60);
+  prefs.sftp_prefetch_ttl = profile_load_int (globals.conf_file, "SFTP", "sftp_prefetch_ttl", 30);
+  prefs.sftp_du_remote = profile_load_int (globals.conf_file, "SFTP", "sftp_du_remote", 1);
+  prefs.sftp_du_cache_ttl = profile_load_int (globals.conf_file, "SFTP", "sftp_du_cache_ttl", 600);
+  prefs.sftp_timeout = profile_load_int (globals.conf_file, "SFTP", "sftp_timeout", 30);
+  prefs.ssh_pool_size = profile_load_int (globals.conf_file, "SFTP", "ssh_pool_size", 0);
+  prefs.ssh_pool_idle_timeout = profile_load_int (globals.conf_file, "SFTP", "ssh_pool_idle_timeout", 300);
+  prefs.ssh_session_idle_timeout = profile_load_int (globals.conf_file, "SFTP", "ssh_session_idle_timeout", 0);
+  prefs.ssh_max_sessions = profile_load_int (globals.conf_file, "SFTP", "ssh_max_sessions", 0);
+  prefs.ssh_helper_channel = profile_load_int (globals.conf_file, "SFTP", "ssh_helper_channel", 0);
+  prefs.ssh_terminal_channel = profile_load_int (globals.conf_file, "SFTP", "ssh_terminal_channel", 0);
+  prefs.ssh_dns_cache_ttl = profile_load_int (globals.conf_file, "SFTP", "ssh_dns_cache_ttl", 60);
+  prefs.ssh_key_cache = profile_load_int (globals.conf_file, "SFTP", "ssh_key_cache", 1);
+  prefs.ssh_key_cache_ttl = profile_load_int (globals.conf_file, "SFTP", "ssh_key_cache_ttl", 0);
+  prefs.ssh_key_cache_idle = profile_load_int (globals.conf_file, "SFTP", "ssh_key_cache_idle", 0);
+  prefs.ssh_key_cache_clear_on_lock = profile_load_int (globals.conf_file, "SFTP", "ssh_key_cache_clear_on_lock", 1);
   //profile_load_string (globals.conf_file, "SFTP", "last_upload_dir", prefs.last_upload_dir, "");
   //profile_load_string (globals.conf_file, "SFTP", "last_download_dir", prefs.last_download_dir, "");
 }
@@ -805,6 +790,7 @@ save_settings ()
   profile_modify_string (PROFILE_SAVE, globals.conf_file, "general", "warnings_color", prefs.warnings_color);
   profile_modify_string (PROFILE_SAVE, globals.conf_file, "general", "local_start_directory", prefs.local_start_directory);
   profile_modify_int (PROFILE_SAVE, globals.conf_file, "general", "save_session", prefs.save_session);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "general", "session_restore_parallel", prefs.session_restore_parallel);
   profile_modify_int (PROFILE_SAVE, globals.conf_file, "general", "max_recent_connections", prefs.max_recent_connections);
   profile_modify_int (PROFILE_SAVE, globals.conf_file, "general", "max_recent_sessions", prefs.max_recent_sessions);
   profile_modify_int (PROFILE_SAVE, globals.conf_file, "general", "checkpoint_interval", prefs.checkpoint_interval);
@@ -839,6 +825,25 @@ save_settings ()
   profile_modify_string (PROFILE_SAVE, globals.conf_file, "SFTP", "sftp_open_file_uri", prefs.sftp_open_file_uri);
   profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "ssh_timeout", prefs.ssh_timeout);
   profile_modify_string (PROFILE_SAVE, globals.conf_file, "SFTP", "sftp_panel_background", prefs.sftp_panel_background);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "sftp_natural_sort", prefs.sftp_natural_sort);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "sftp_filter_mode", prefs.sftp_filter_mode);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "sftp_prefetch_dirs", prefs.sftp_prefetch_dirs);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "sftp_prefetch_per_minute", prefs.sftp_prefetch_per_minute);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "sftp_prefetch_ttl", prefs.sftp_prefetch_ttl);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "sftp_du_remote", prefs.sftp_du_remote);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "sftp_du_cache_ttl", prefs.sftp_du_cache_ttl);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "sftp_timeout", prefs.sftp_timeout);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "ssh_pool_size", prefs.ssh_pool_size);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "ssh_pool_idle_timeout", prefs.ssh_pool_idle_timeout);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "ssh_session_idle_timeout", prefs.ssh_session_idle_timeout);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "ssh_max_sessions", prefs.ssh_max_sessions);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "ssh_helper_channel", prefs.ssh_helper_channel);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "ssh_terminal_channel", prefs.ssh_terminal_channel);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "ssh_dns_cache_ttl", prefs.ssh_dns_cache_ttl);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "ssh_key_cache", prefs.ssh_key_cache);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "ssh_key_cache_ttl", prefs.ssh_key_cache_ttl);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "ssh_key_cache_idle", prefs.ssh_key_cache_idle);
+  profile_modify_int (PROFILE_SAVE, globals.conf_file, "SFTP", "ssh_key_cache_clear_on_lock", prefs.ssh_key_cache_clear_on_lock);
   //profile_modify_string (PROFILE_SAVE, globals.conf_file, "SFTP", "last_upload_dir", prefs.last_upload_dir);
   //profile_modify_string (PROFILE_SAVE, globals.conf_file, "SFTP", "last_download_dir", prefs.last_download_dir);
 }
@@ -153,9 +153,31 @@ struct _prefs
   char download_dir[512];
   char text_editor[128];
   char sftp_open_file_uri[1024];
-  int ssh_keepalive;
+  int ssh_keepalive;            /* seconds between keepalives of sftp sessions, unless set by the connection */
   int ssh_timeout;
   char sftp_panel_background[64];
+  int sftp_natural_sort;        /* sort file names like file2 < file10 */
+  int sftp_filter_mode;         /* FILTER_MODE_SUBSTRING, FILTER_MODE_REGEX or FILTER_MODE_FUZZY */
+  int sftp_prefetch_dirs;       /* subdirectories read in background after a listing, 0 to disable */
+  int sftp_prefetch_per_minute; /* maximum directories prefetched on the same host */
+  int sftp_prefetch_ttl;        /* seconds a prefetched directory can be used */
+  int sftp_du_remote;           /* compute directory sizes with du on the remote host when available */
+  int sftp_du_cache_ttl;        /* seconds computed directory sizes are shown */
+  int sftp_timeout;             /* seconds before a stuck sftp request closes the connection */
+  int ssh_pool_size;            /* sessions opened in advance and kept warm, 0 to disable */
+  int ssh_pool_idle_timeout;    /* seconds an unused warm session is kept open */
+  int ssh_session_idle_timeout; /* seconds before closing the session of a tab not used, 0 to disable (default).
+                                   Sessions are reopened when needed, so credentials of closed ones stay in memory */
+  int ssh_max_sessions;         /* sessions kept open, the least recently used are closed first, 0 for no limit (default).
+                                   Same as above for credentials */
+  int session_restore_parallel; /* connections opened at the same time when restoring a session */
+  int ssh_helper_channel;       /* run remote commands in a long-lived shell instead of a channel each */
+  int ssh_terminal_channel;     /* run ssh terminals in a channel of the sftp session instead of the ssh client */
+  int ssh_dns_cache_ttl;        /* seconds the addresses of a host are reused, 0 to disable */
+  int ssh_key_cache;            /* keep private keys unlocked in memory after the first use */
+  int ssh_key_cache_ttl;        /* seconds an unlocked key is kept, 0 until cleared */
+  int ssh_key_cache_idle;       /* seconds without keyboard activity before clearing the keys, 0 to disable */
+  int ssh_key_cache_clear_on_lock; /* clear the keys when the screen is locked */
   //char last_upload_dir[256];
   //char last_download_dir[256];
   
@@ -171,11 +193,6 @@ void log_reset ();
 void log_write (const char *fmt,...);
 gboolean doGTKMainIteration ();
 void notifyMessage (char *message);
-void timerStart (int seconds);
-void timerStop ();
-int timedOut ();
-void threadRequestAlarm ();
-void threadResetAlarm ();
 void addIdleGTKMainIteration ();
 void update_main_window_title ();
 void update_statusbar ();
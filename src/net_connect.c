@@ -0,0 +1,551 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file net_connect.c
+ * @brief Parallel resolution and connection to hosts with several addresses (happy eyeballs)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <glib.h>
+#include "main.h"
+#include "deadline.h"
+#include "net_connect.h"
+
+extern Prefs prefs;
+
+/* SDnsCacheEntry by host name */
+GHashTable *dnsCache = NULL;
+pthread_mutex_t mutexDnsCache = PTHREAD_MUTEX_INITIALIZER;
+
+/* call with cache mutex locked */
+SDnsCacheEntry *
+dns_cache_lookup (char *host)
+{
+  SDnsCacheEntry *e;
+
+  if (dnsCache == NULL)
+    dnsCache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+
+  if ((e = (SDnsCacheEntry *) g_hash_table_lookup (dnsCache, host)) != NULL && g_get_monotonic_time () >= e->expires)
+    {
+      g_hash_table_remove (dnsCache, host);
+      e = NULL;
+    }
+
+  return (e);
+}
+
+void
+dns_cache_store (char *host, SNetAddress *addresses, int n)
+{
+  SDnsCacheEntry *e;
+
+  if (prefs.ssh_dns_cache_ttl <= 0 || strlen (host) >= sizeof (e->host))
+    return;
+
+  e = g_new0 (SDnsCacheEntry, 1);
+  strcpy (e->host, host);
+  memcpy (e->addresses, addresses, n * sizeof (SNetAddress));
+  e->n = n;
+  e->expires = g_get_monotonic_time () + (gint64) prefs.ssh_dns_cache_ttl * G_USEC_PER_SEC;
+
+  pthread_mutex_lock (&mutexDnsCache);
+  dns_cache_lookup (host);
+  g_hash_table_replace (dnsCache, e->host, e);
+  pthread_mutex_unlock (&mutexDnsCache);
+}
+
+/**
+ * net_dns_cache_forget() - removes a host from the cache, e.g. when none of its addresses answered
+ */
+void
+net_dns_cache_forget (char *host)
+{
+  pthread_mutex_lock (&mutexDnsCache);
+
+  if (dnsCache)
+    g_hash_table_remove (dnsCache, host);
+
+  pthread_mutex_unlock (&mutexDnsCache);
+}
+
+void
+resolve_job_release (SResolveJob *job)
+{
+  int refcount, i;
+
+  pthread_mutex_lock (&job->mutex);
+  refcount = -- job->refcount;
+  pthread_mutex_unlock (&job->mutex);
+
+  if (refcount > 0)
+    return;
+
+  for (i = 0; i < 2; i++)
+    if (job->res[i])
+      freeaddrinfo (job->res[i]);
+
+  pthread_cond_destroy (&job->cond);
+  pthread_mutex_destroy (&job->mutex);
+  g_free (job);
+}
+
+void
+resolve_family (SResolveJob *job, int i)
+{
+  struct addrinfo hints, *res = NULL;
+  int rc;
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = i == 0 ? AF_INET6 : AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+
+  rc = getaddrinfo (job->host, NULL, &hints, &res);
+
+  pthread_mutex_lock (&job->mutex);
+
+  job->res[i] = rc == 0 ? res : NULL;
+  job->rc[i] = rc;
+  job->done[i] = 1;
+
+  /* a failed lookup doesn't start the resolution delay */
+  if (i == 1 && job->res[i])
+    job->ipv4_answered = g_get_monotonic_time ();
+
+  pthread_cond_signal (&job->cond);
+  pthread_mutex_unlock (&job->mutex);
+
+  resolve_job_release (job);
+}
+
+gpointer
+resolve_ipv6_thread (gpointer data)
+{
+  resolve_family ((SResolveJob *) data, 0);
+  return (NULL);
+}
+
+gpointer
+resolve_ipv4_thread (gpointer data)
+{
+  resolve_family ((SResolveJob *) data, 1);
+  return (NULL);
+}
+
+/**
+ * resolve_job_timedwait() - waits for a lookup to return, until the monotonic time until at most
+ * (call with job mutex locked)
+ */
+void
+resolve_job_timedwait (SResolveJob *job, gint64 until)
+{
+  struct timespec ts;
+  gint64 t;
+
+  /* the condition uses the real time clock */
+  clock_gettime (CLOCK_REALTIME, &ts);
+  t = (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000 + MAX (0, until - g_get_monotonic_time ());
+  ts.tv_sec = t / G_USEC_PER_SEC;
+  ts.tv_nsec = (t % G_USEC_PER_SEC) * 1000;
+
+  pthread_cond_timedwait (&job->cond, &job->mutex, &ts);
+}
+
+/**
+ * resolve_job_take() - adds the addresses of the families resolved since the last call
+ * The new addresses are interleaved with the untried ones, from next to n, so that the
+ * families keep alternating as suggested by RFC 8305.
+ * (call with job mutex locked)
+ * @return the new number of addresses
+ */
+int
+resolve_job_take (SResolveJob *job, SNetAddress *addresses, int n, int next)
+{
+  SNetAddress untried[NET_MAX_ADDRESSES];
+  struct addrinfo *ai[2] = { NULL, NULL };
+  int i, m, k = 0;
+
+  for (i = 0; i < 2; i++)
+    {
+      if (job->done[i] && !job->taken[i])
+        {
+          ai[i] = job->res[i];
+          job->taken[i] = 1;
+        }
+    }
+
+  if (ai[0] == NULL && ai[1] == NULL)
+    return (n);
+
+  m = n - next;
+  memcpy (untried, &addresses[next], m * sizeof (SNetAddress));
+  n = next;
+
+  while ((k < m || ai[0] || ai[1]) && n < NET_MAX_ADDRESSES)
+    {
+      if (k < m)
+        addresses[n++] = untried[k++];
+
+      for (i = 0; i < 2 && n < NET_MAX_ADDRESSES; i++)
+        {
+          if (ai[i] == NULL)
+            continue;
+
+          memcpy (&addresses[n].addr, ai[i]->ai_addr, ai[i]->ai_addrlen);
+          addresses[n].len = ai[i]->ai_addrlen;
+          n ++;
+
+          ai[i] = ai[i]->ai_next;
+        }
+    }
+
+  return (n);
+}
+
+/**
+ * net_resolve_start() - starts resolving IPv6 and IPv4 addresses of host at the same time
+ * @return the running job, NULL if the addresses were cached (their number in n)
+ */
+SResolveJob *
+net_resolve_start (char *host, SNetAddress *addresses, int *n)
+{
+  SDnsCacheEntry *e;
+  SResolveJob *job;
+
+  *n = 0;
+
+  pthread_mutex_lock (&mutexDnsCache);
+
+  if ((e = dns_cache_lookup (host)) != NULL)
+    {
+      *n = e->n;
+      memcpy (addresses, e->addresses, e->n * sizeof (SNetAddress));
+    }
+
+  pthread_mutex_unlock (&mutexDnsCache);
+
+  if (*n > 0)
+    {
+      log_debug ("%s found in dns cache: %d addresses\n", host, *n);
+      return (NULL);
+    }
+
+  job = g_new0 (SResolveJob, 1);
+  g_strlcpy (job->host, host, sizeof (job->host));
+  job->refcount = 3;
+  pthread_mutex_init (&job->mutex, NULL);
+  pthread_cond_init (&job->cond, NULL);
+
+  g_thread_unref (g_thread_new ("resolve6", resolve_ipv6_thread, job));
+  g_thread_unref (g_thread_new ("resolve4", resolve_ipv4_thread, job));
+
+  return (job);
+}
+
+/**
+ * net_resolve_wait() - waits for the first addresses worth trying
+ * IPv6 addresses are used as soon as they arrive, while IPv4 ones wait for IPv6 ones
+ * NET_RESOLUTION_DELAY_MSECS at most. The family still missing is added later with
+ * resolve_job_take(), while connecting. Failed lookups are waited for until d expires.
+ * @return number of addresses, 0 on errors (message in error)
+ */
+int
+net_resolve_wait (SResolveJob *job, SNetAddress *addresses, SDeadline *d, gboolean *cancel, char *error)
+{
+  gint64 wait_until;
+  int n, rc, remaining;
+
+  pthread_mutex_lock (&job->mutex);
+
+  while (!(job->done[0] && job->done[1]))
+    {
+      if (cancel && *cancel)
+        break;
+
+      if (deadline_expired (d))
+        break;
+
+      /* AAAA before A: connections start at once */
+      if (job->done[0] && job->res[0])
+        break;
+
+      wait_until = g_get_monotonic_time () + NET_POLL_MSECS * 1000;
+
+      /* A before AAAA: IPv6 is given a little time */
+      if (job->ipv4_answered)
+        {
+          if (g_get_monotonic_time () >= job->ipv4_answered + NET_RESOLUTION_DELAY_MSECS * 1000)
+            break;
+
+          wait_until = MIN (wait_until, job->ipv4_answered + NET_RESOLUTION_DELAY_MSECS * 1000);
+        }
+
+      if ((remaining = deadline_remaining (d)) >= 0)
+        wait_until = MIN (wait_until, g_get_monotonic_time () + (gint64) remaining * 1000);
+
+      resolve_job_timedwait (job, wait_until);
+    }
+
+  n = resolve_job_take (job, addresses, 0, 0);
+
+  if (n == 0)
+    {
+      rc = job->done[1] && job->rc[1] ? job->rc[1] : job->rc[0];
+
+      if (cancel && *cancel)
+        strcpy (error, "Cancelled");
+      else if (!job->done[0] || !job->done[1])
+        sprintf (error, "Can't resolve %s: timeout", job->host);
+      else
+        sprintf (error, "Can't resolve %s: %s", job->host, rc ? gai_strerror (rc) : "no address");
+    }
+
+  pthread_mutex_unlock (&job->mutex);
+
+  log_debug ("%s resolved: %d addresses\n", job->host, n);
+
+  return (n);
+}
+
+/**
+ * net_resolve_end() - caches the addresses if both lookups have returned, and releases the job
+ */
+void
+net_resolve_end (SResolveJob *job)
+{
+  SNetAddress addresses[NET_MAX_ADDRESSES];
+  int n = 0;
+
+  pthread_mutex_lock (&job->mutex);
+
+  /* a partial answer is not cached, next time the other family could arrive in time */
+  if (job->done[0] && job->done[1])
+    {
+      job->taken[0] = job->taken[1] = 0;
+      n = resolve_job_take (job, addresses, 0, 0);
+    }
+
+  pthread_mutex_unlock (&job->mutex);
+
+  if (n > 0)
+    dns_cache_store (job->host, addresses, n);
+
+  resolve_job_release (job);
+}
+
+/**
+ * net_connect_start() - starts a non-blocking connection to an address
+ * @return the socket, -1 on errors
+ */
+int
+net_connect_start (SNetAddress *address, int port, char *error)
+{
+  struct sockaddr_storage addr;
+  int fd;
+
+  memcpy (&addr, &address->addr, address->len);
+
+  if (addr.ss_family == AF_INET6)
+    ((struct sockaddr_in6 *) &addr)->sin6_port = htons (port);
+  else
+    ((struct sockaddr_in *) &addr)->sin_port = htons (port);
+
+  if ((fd = socket (addr.ss_family, SOCK_STREAM, 0)) < 0)
+    {
+      sprintf (error, "%s", strerror (errno));
+      return (-1);
+    }
+
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+  if (connect (fd, (struct sockaddr *) &addr, address->len) < 0 && errno != EINPROGRESS)
+    {
+      sprintf (error, "%s", strerror (errno));
+      close (fd);
+      return (-1);
+    }
+
+  return (fd);
+}
+
+/**
+ * net_connect() - opens a connected socket to host, racing its addresses
+ * A new address is tried every NET_ATTEMPT_DELAY_MSECS, or as soon as the previous attempts have failed,
+ * while the earlier attempts go on: the first to connect wins and the others are closed.
+ * The lookup still running when the first attempt starts goes on, and its addresses join the race (RFC 8305).
+ * @return the socket in blocking mode, -1 on errors (message in error)
+ */
+int
+net_connect (char *host, int port, int msecs, gboolean *cancel, SConnTiming *t, char *error)
+{
+  SNetAddress addresses[NET_MAX_ADDRESSES];
+  struct pollfd pfd[NET_MAX_ADDRESSES];
+  SResolveJob *job;
+  char last_error[256];
+  int n, i, next = 0, pending = 0, fd = -1, err, wait, resolving = 0;
+  gint64 last_start = 0;
+  socklen_t len;
+  SDeadline d;
+
+  deadline_start (&d, msecs);
+
+  if ((job = net_resolve_start (host, addresses, &n)) != NULL)
+    n = net_resolve_wait (job, addresses, &d, cancel, error);
+
+  conn_timing_mark (t, CONN_PHASE_DNS);
+
+  if (n == 0)
+    {
+      if (job)
+        net_resolve_end (job);
+
+      return (-1);
+    }
+
+  strcpy (last_error, "timeout");
+
+  while (fd < 0)
+    {
+      /* addresses of the family resolved later */
+      if (job)
+        {
+          pthread_mutex_lock (&job->mutex);
+          n = resolve_job_take (job, addresses, n, next);
+          resolving = !(job->done[0] && job->done[1]);
+          pthread_mutex_unlock (&job->mutex);
+        }
+
+      if (cancel && *cancel)
+        {
+          strcpy (last_error, "cancelled");
+          break;
+        }
+
+      if (next < n && (pending == 0 || g_get_monotonic_time () - last_start >= NET_ATTEMPT_DELAY_MSECS * 1000))
+        {
+          pfd[next].fd = net_connect_start (&addresses[next], port, last_error);
+          pfd[next].events = POLLOUT;
+          pfd[next].revents = 0;
+
+          if (pfd[next].fd >= 0)
+            pending ++;
+
+          last_start = g_get_monotonic_time ();
+          next ++;
+          continue;
+        }
+
+      /* every address failed */
+      if (pending == 0 && !resolving)
+        break;
+
+      if (deadline_expired (&d))
+        {
+          strcpy (last_error, "timeout");
+          break;
+        }
+
+      if ((wait = deadline_remaining (&d)) < 0 || wait > NET_POLL_MSECS)
+        wait = NET_POLL_MSECS;
+
+      if (next < n)
+        wait = MIN (wait, MAX (0, NET_ATTEMPT_DELAY_MSECS - (int) ((g_get_monotonic_time () - last_start) / 1000)));
+
+      /* addresses arriving while connecting are not kept waiting long */
+      if (resolving)
+        wait = MIN (wait, NET_RESOLUTION_DELAY_MSECS);
+
+      /* nothing left to try but the lookup still running */
+      if (pending == 0)
+        {
+          pthread_mutex_lock (&job->mutex);
+
+          if (!(job->done[0] && job->done[1]))
+            resolve_job_timedwait (job, g_get_monotonic_time () + (gint64) wait * 1000);
+
+          pthread_mutex_unlock (&job->mutex);
+          continue;
+        }
+
+      if (poll (pfd, next, wait) <= 0)
+        continue;
+
+      for (i = 0; i < next && fd < 0; i++)
+        {
+          if (pfd[i].fd < 0 || pfd[i].revents == 0)
+            continue;
+
+          err = 0;
+          len = sizeof (err);
+
+          if (getsockopt (pfd[i].fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+            err = errno;
+
+          if (err == 0)
+            {
+              fd = pfd[i].fd;
+              pfd[i].fd = -1;
+              log_debug ("%s: connected to address %d of %d\n", host, i + 1, n);
+            }
+          else
+            {
+              sprintf (last_error, "%s", strerror (err));
+              close (pfd[i].fd);
+              pfd[i].fd = -1;
+              pending --;
+            }
+        }
+    }
+
+  /* losers of the race */
+  for (i = 0; i < next; i++)
+    if (pfd[i].fd >= 0)
+      close (pfd[i].fd);
+
+  conn_timing_mark (t, CONN_PHASE_TCP);
+
+  if (job)
+    net_resolve_end (job);
+
+  if (fd < 0)
+    {
+      sprintf (error, "Can't connect to %s: %s", host, last_error);
+
+      if (next >= n && pending == 0)
+        net_dns_cache_forget (host);
+
+      return (-1);
+    }
+
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) & ~O_NONBLOCK);
+
+  return (fd);
+}
+
@@ -0,0 +1,67 @@
+
+#ifndef _NET_CONNECT_H
+#define _NET_CONNECT_H
+
+#include <glib.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "conn_stats.h"
+#include "deadline.h"
+
+/* Maximum addresses tried for a host */
+#define NET_MAX_ADDRESSES 16
+
+/* Milliseconds waited for IPv6 addresses once IPv4 ones have been resolved (RFC 8305),
+   and at most before addresses resolved while connecting join the race */
+#define NET_RESOLUTION_DELAY_MSECS 50
+
+/* Milliseconds before starting the connection to the next address (RFC 8305) */
+#define NET_ATTEMPT_DELAY_MSECS 250
+
+/* Milliseconds between checks for cancel while resolving and connecting */
+#define NET_POLL_MSECS 100
+
+/**
+ * struct NetAddress
+ * resolved address of a host, port not set
+ */
+typedef struct NetAddress {
+  struct sockaddr_storage addr;
+  socklen_t len;
+} SNetAddress;
+
+/**
+ * struct DnsCacheEntry
+ * addresses of a host, in the order they are tried
+ */
+typedef struct DnsCacheEntry {
+  char host[256];
+  SNetAddress addresses[NET_MAX_ADDRESSES];
+  int n;
+  gint64 expires; /* monotonic time */
+} SDnsCacheEntry;
+
+/**
+ * struct ResolveJob
+ * AAAA and A lookups running in parallel, released by the last of the connection and the two threads
+ */
+typedef struct ResolveJob {
+  char host[256];
+  struct addrinfo *res[2]; /* IPv6, IPv4 */
+  int rc[2];
+  int done[2];
+  int taken[2];            /* addresses already handed to the connection */
+  gint64 ipv4_answered;    /* monotonic time the A lookup returned addresses, 0 if not yet */
+  int refcount;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} SResolveJob;
+
+SResolveJob *net_resolve_start (char *host, SNetAddress *addresses, int *n);
+int net_resolve_wait (SResolveJob *job, SNetAddress *addresses, SDeadline *d, gboolean *cancel, char *error);
+void net_resolve_end (SResolveJob *job);
+void net_dns_cache_forget (char *host);
+int net_connect (char *host, int port, int msecs, gboolean *cancel, SConnTiming *t, char *error);
+
+#endif
+
@@ -0,0 +1,157 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file prompt_matcher.c
+ * @brief Detection of login prompts on the cursor line of a terminal
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "prompt_matcher.h"
+
+/**
+ * prompt_matcher_add() - adds to the trie the comma separated patterns of a kind
+ * Transitions to state 0 mean no edge until the automaton is completed.
+ */
+void
+prompt_matcher_add (SPromptMatcher *m, char *patterns, unsigned int kind)
+{
+  gchar **list, *pattern;
+  unsigned char *p;
+  int i, s;
+
+  list = g_strsplit (patterns, ",", -1);
+
+  for (i = 0; list[i]; i++)
+    {
+      pattern = g_ascii_strdown (g_strstrip (list[i]), -1);
+
+      if (pattern[0] == 0)
+        {
+          g_free (pattern);
+          continue;
+        }
+
+      s = 0;
+
+      for (p = (unsigned char *) pattern; *p; p++)
+        {
+          if (m->delta[s * 256 + *p] == 0)
+            m->delta[s * 256 + *p] = m->n_states ++;
+
+          s = m->delta[s * 256 + *p];
+        }
+
+      m->output[s] |= kind;
+
+      g_free (pattern);
+    }
+
+  g_strfreev (list);
+}
+
+/**
+ * prompt_matcher_new() - builds the automaton for the prompts of a protocol
+ * Patterns are comma separated and matched anywhere in the line, ignoring case.
+ */
+SPromptMatcher *
+prompt_matcher_new (char *user_prompts, char *password_prompts)
+{
+  SPromptMatcher *m;
+  int *fail, *queue, head = 0, tail = 0, max_states, r, s, c;
+
+  /* a state for every character at most, plus the root */
+  max_states = strlen (user_prompts) + strlen (password_prompts) + 1;
+
+  if (max_states > G_MAXUINT16)
+    return (NULL);
+
+  m = g_new0 (SPromptMatcher, 1);
+  m->delta = g_new0 (guint16, max_states * 256);
+  m->output = g_new0 (unsigned int, max_states);
+  m->n_states = 1;
+
+  prompt_matcher_add (m, user_prompts, PROMPT_USER);
+  prompt_matcher_add (m, password_prompts, PROMPT_PASSWORD);
+
+  fail = g_new0 (int, m->n_states);
+  queue = g_new0 (int, m->n_states);
+
+  /* children of the root fail to the root, missing edges of the root stay on it */
+  for (c = 0; c < 256; c++)
+    {
+      if ((s = m->delta[c]) != 0)
+        queue[tail++] = s;
+    }
+
+  /* breadth first, so the failure state of every parent is complete */
+  while (head < tail)
+    {
+      r = queue[head++];
+
+      for (c = 0; c < 256; c++)
+        {
+          if ((s = m->delta[r * 256 + c]) != 0)
+            {
+              fail[s] = m->delta[fail[r] * 256 + c];
+              m->output[s] |= m->output[fail[s]];
+              queue[tail++] = s;
+            }
+          else
+            m->delta[r * 256 + c] = m->delta[fail[r] * 256 + c];
+        }
+    }
+
+  g_free (fail);
+  g_free (queue);
+
+  return (m);
+}
+
+void
+prompt_matcher_free (SPromptMatcher *m)
+{
+  if (m == NULL)
+    return;
+
+  g_free (m->delta);
+  g_free (m->output);
+  g_free (m);
+}
+
+/**
+ * prompt_matcher_scan() - finds the prompts in a line
+ * @return PROMPT_* of every pattern found, 0 if none
+ */
+unsigned int
+prompt_matcher_scan (SPromptMatcher *m, const char *text)
+{
+  const unsigned char *p;
+  unsigned int found = 0;
+  int s = 0;
+
+  for (p = (const unsigned char *) text; *p; p++)
+    {
+      s = m->delta[s * 256 + g_ascii_tolower (*p)];
+      found |= m->output[s];
+    }
+
+  return (found);
+}
+
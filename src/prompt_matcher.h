@@ -0,0 +1,27 @@
+
+#ifndef _PROMPT_MATCHER_H
+#define _PROMPT_MATCHER_H
+
+#include <glib.h>
+
+/* Kinds of prompt, combined in the result of prompt_matcher_scan() */
+#define PROMPT_USER 1
+#define PROMPT_PASSWORD 2
+
+/**
+ * struct PromptMatcher
+ * Aho-Corasick automaton finding every prompt pattern in a single pass over a line
+ * Failure links are folded into the transitions, so each character costs one lookup.
+ */
+typedef struct PromptMatcher {
+  guint16 *delta;        /* next state, 256 entries per state */
+  unsigned int *output;  /* PROMPT_* of the patterns ending in every state */
+  int n_states;
+} SPromptMatcher;
+
+SPromptMatcher *prompt_matcher_new (char *user_prompts, char *password_prompts);
+void prompt_matcher_free (SPromptMatcher *m);
+unsigned int prompt_matcher_scan (SPromptMatcher *m, const char *text);
+
+#endif
+
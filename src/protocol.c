@@ -36,6 +36,8 @@ GtkWidget *protocol_combo = 0;
 GtkWidget *command_entry;
 GtkWidget *arguments_entry;
 GtkWidget *port_entry;
+GtkWidget *user_prompts_entry;
+GtkWidget *password_prompts_entry;
 GtkWidget *askuser_check;
 GtkWidget *askpassword_check;
 GtkWidget *disconnectclose_check;
@@ -205,9 +207,9 @@ check_standard_protocols (struct Protocol_List *p_pl)
 
   struct Protocol std_protocosls[] =
     {
-      { "telnet", PROT_TYPE_TELNET, "telnet", "%h %p", 23, PROT_FLAG_ASKUSER|PROT_FLAG_ASKPASSWORD, NULL }, 
-      { "ssh", PROT_TYPE_SSH, "ssh", "-p %p -l %u %h", 22, PROT_FLAG_ASKPASSWORD, NULL },
-      { "samba", PROT_TYPE_SAMBA, "smbclient", "//%h/%d -U %u%%%P", -1, PROT_FLAG_NO, NULL }
+      { "telnet", PROT_TYPE_TELNET, "telnet", "%h %p", 23, PROT_FLAG_ASKUSER|PROT_FLAG_ASKPASSWORD, PROT_USER_PROMPTS, PROT_PASSWORD_PROMPTS, NULL }, 
+      { "ssh", PROT_TYPE_SSH, "ssh", "-p %p -l %u %h", 22, PROT_FLAG_ASKPASSWORD, PROT_USER_PROMPTS, PROT_PASSWORD_PROMPTS, NULL },
+      { "samba", PROT_TYPE_SAMBA, "smbclient", "//%h/%d -U %u%%%P", -1, PROT_FLAG_NO, PROT_USER_PROMPTS, PROT_PASSWORD_PROMPTS, NULL }
     };
 
   n = sizeof (std_protocosls) / sizeof (struct Protocol);
@@ -318,6 +320,19 @@ load_protocols_from_file_xml (char *filename, struct Protocol_List *p_pl)
                     protocol.flags |= PROT_FLAG_DISCONNECTCLOSE;
                 }
             }
+
+          if (child = xml_node_get_child (node, "prompts"))
+            {
+              strcpy (protocol.user_prompts, NVL(xml_node_get_attribute (child, "user"), ""));
+              strcpy (protocol.password_prompts, NVL(xml_node_get_attribute (child, "password"), ""));
+            }
+
+          /* files saved by older versions */
+          if (protocol.user_prompts[0] == 0)
+            strcpy (protocol.user_prompts, PROT_USER_PROMPTS);
+
+          if (protocol.password_prompts[0] == 0)
+            strcpy (protocol.password_prompts, PROT_PASSWORD_PROMPTS);
             
           pl_append (p_pl, &protocol);
           n_loaded ++;
@@ -364,11 +379,13 @@ save_protocols_to_file_xml (char *filename, struct Protocol_List *p_pl)
                    "      <askpassword value='%d'/>\n"
                    "      <disconnectclose value='%d'/>\n"
                    "    </flags>\n"
+                   "    <prompts user='%s' password='%s'/>\n"
                    "  </protocol>\n",
                    p->name, p->command, p->port, p->args,
                    (p->flags & PROT_FLAG_ASKUSER) != 0,
                    (p->flags & PROT_FLAG_ASKPASSWORD) != 0,
-                   (p->flags & PROT_FLAG_DISCONNECTCLOSE) != 0);
+                   (p->flags & PROT_FLAG_DISCONNECTCLOSE) != 0,
+                   p->user_prompts, p->password_prompts);
 
       n_saved ++;
       p = p->next;
@@ -415,6 +432,9 @@ fill_protocol_entries (char *p_name, struct Protocol_List *p_pl)
 
       sprintf (s_port, "%d", p_prot->port);
       gtk_entry_set_text (GTK_ENTRY (port_entry), s_port);
+
+      gtk_entry_set_text (GTK_ENTRY (user_prompts_entry), p_prot->user_prompts);
+      gtk_entry_set_text (GTK_ENTRY (password_prompts_entry), p_prot->password_prompts);
       
       gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (askuser_check), p_prot->flags & PROT_FLAG_ASKUSER);
       gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (askpassword_check), p_prot->flags & PROT_FLAG_ASKPASSWORD);
@@ -527,6 +547,8 @@ prot_new_clicked_cb (GtkButton *button, gpointer user_data)
   p_pl = (struct Protocol_List *) user_data;
 
   memset (&prot_new, 0, sizeof (struct Protocol));
+  strcpy (prot_new.user_prompts, PROT_USER_PROMPTS);
+  strcpy (prot_new.password_prompts, PROT_PASSWORD_PROMPTS);
   
   if (query_name_new_protocol (prot_new.name, p_pl) != -1)
     {
@@ -585,6 +607,8 @@ prot_save_clicked_cb (GtkButton *button, gpointer user_data)
       strcpy (p_prot->command, gtk_entry_get_text (GTK_ENTRY (command_entry)));
       strcpy (p_prot->args, gtk_entry_get_text (GTK_ENTRY (arguments_entry)));
       p_prot->port = atoi (gtk_entry_get_text (GTK_ENTRY (port_entry)));
+      strcpy (p_prot->user_prompts, gtk_entry_get_text (GTK_ENTRY (user_prompts_entry)));
+      strcpy (p_prot->password_prompts, gtk_entry_get_text (GTK_ENTRY (password_prompts_entry)));
 /*
 flags = (flags & ~(PROT_FLAG_ASKPASSWORD)) | (x << 1)
       = 0011   & 1101                  | 0010     = 
@@ -772,6 +796,20 @@ manage_protocols (struct Protocol_List *p_pl)
   gtk_box_pack_start (GTK_BOX (entries_vbox), port_hbox, FALSE, FALSE, 0);
   g_signal_connect (G_OBJECT (GTK_ENTRY (port_entry)), "changed", G_CALLBACK (prot_changed_cb), NULL);
 
+  /* prompts, comma separated */
+
+  user_prompts_entry = gtk_entry_new ();
+  gtk_entry_set_max_length (GTK_ENTRY(user_prompts_entry), 255);
+  GtkWidget *user_prompts_hbox = create_entry_control (_("Username prompts"), user_prompts_entry);
+  gtk_box_pack_start (GTK_BOX (entries_vbox), user_prompts_hbox, FALSE, FALSE, 0);
+  g_signal_connect (G_OBJECT (GTK_ENTRY (user_prompts_entry)), "changed", G_CALLBACK (prot_changed_cb), NULL);
+
+  password_prompts_entry = gtk_entry_new ();
+  gtk_entry_set_max_length (GTK_ENTRY(password_prompts_entry), 255);
+  GtkWidget *password_prompts_hbox = create_entry_control (_("Password prompts"), password_prompts_entry);
+  gtk_box_pack_start (GTK_BOX (entries_vbox), password_prompts_hbox, FALSE, FALSE, 0);
+  g_signal_connect (G_OBJECT (GTK_ENTRY (password_prompts_entry)), "changed", G_CALLBACK (prot_changed_cb), NULL);
+
   /* connect signal now, after every control has been created */
 
   g_signal_connect (G_OBJECT (GTK_COMBO_BOX (protocol_combo)), "changed", G_CALLBACK (change_edit_protocol_cb), p_pl);
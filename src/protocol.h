@@ -13,6 +13,10 @@
 #define PROT_FLAG_DISCONNECTCLOSE 4
 #define PROT_FLAG_MASK 255
 
+/* Prompts detected while logging in, comma separated (see prompt_matcher.c) */
+#define PROT_USER_PROMPTS "login:,username:"
+#define PROT_PASSWORD_PROMPTS "password:"
+
 struct Protocol
   {
     char name[64];
@@ -21,6 +25,8 @@ struct Protocol
     char args[256];
     int port;
     unsigned int flags;
+    char user_prompts[256];
+    char password_prompts[256];
 
     struct Protocol *next;
   };
@@ -0,0 +1,686 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file search_window.c
+ * @brief Searches files in a remote directory tree
+ */
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include "main.h"
+#include "gui.h"
+#include "utils.h"
+#include "ssh.h"
+#include "sftp-panel.h"
+#include "async.h"
+#include "filter.h"
+#include "ssh_reaper.h"
+#include "search_window.h"
+
+extern GtkWidget *main_window;
+extern Globals globals;
+extern Prefs prefs;
+extern struct SSH_Info *p_ssh_current;
+extern GdkPixbuf *pixbuf_file, *pixbuf_dir;
+
+enum { SR_COL_ICON, SR_COL_PATH, SR_COL_SIZE, SR_COL_DATE, N_SEARCH_COLUMNS };
+
+/* Directory waiting to be read */
+typedef struct SearchDir {
+  char path[2048];
+  int depth;
+} SSearchDir;
+
+SSearchJob g_search_job;
+GThread *g_search_thread = NULL;
+
+gboolean gSearchWindow;
+GtkWidget *searchWindow = NULL;
+GtkListStore *ls_search;
+
+GtkWidget *entry_search_dir, *entry_search_name, *check_search_regex, *check_search_find;
+GtkWidget *spin_search_min_size, *spin_search_max_size, *spin_search_days, *spin_search_depth;
+GtkWidget *button_search_start, *button_search_stop, *label_search_status;
+
+/**
+ * search_check() - applies the predicates to a found file and queues it for the result list
+ */
+void
+search_check (SSearchJob *job, char *path, int type, long long unsigned int size, long unsigned int mtime)
+{
+  SSearchResult *r;
+  char *name;
+
+  name = strrchr (path, '/') ? strrchr (path, '/') + 1 : path;
+
+  if (!filter_match (&job->filter, name, NULL))
+    return;
+
+  /* size limits apply to regular files only */
+  if (job->min_size || job->max_size)
+    {
+      if (type == SSH_FILEXFER_TYPE_DIRECTORY)
+        return;
+
+      if (size < job->min_size || (job->max_size && size > job->max_size))
+        return;
+    }
+
+  if (job->newer_than && mtime < job->newer_than)
+    return;
+
+  r = g_new0 (SSearchResult, 1);
+  strncpy (r->path, path, sizeof (r->path) - 1);
+  r->type = type;
+  r->size = size;
+  r->mtime = mtime;
+
+  pthread_mutex_lock (&job->mutex);
+  g_ptr_array_add (job->pending, r);
+  pthread_mutex_unlock (&job->mutex);
+
+  if (++ job->matches >= SEARCH_MAX_RESULTS)
+    {
+      sprintf (job->error_s, "Search stopped after %d matches", job->matches);
+      job->cancel = TRUE;
+    }
+}
+
+/**
+ * search_node_ok() - checks that the node is still usable, must be called holding the ssh mutex
+ */
+int
+search_node_ok (SSearchJob *job)
+{
+  if (!ssh_list_contains (&globals.ssh_list, job->p_node) || !ssh_node_get_validity (job->p_node) || job->p_node->sftp == NULL)
+    {
+      strcpy (job->error_s, "Connection lost");
+      return (0);
+    }
+
+  return (1);
+}
+
+/**
+ * search_find_line() - parses a line printed by find
+ */
+void
+search_find_line (char *line, gpointer data)
+{
+  SSearchJob *job = (SSearchJob *) data;
+  char type;
+  long long unsigned int size;
+  double mtime;
+  int n;
+
+  if (sscanf (line, "%c %llu %lf %n", &type, &size, &mtime, &n) == 3 && line[n])
+    {
+      search_check (job, line + n, type == 'd' ? SSH_FILEXFER_TYPE_DIRECTORY : SSH_FILEXFER_TYPE_REGULAR,
+                    size, (long unsigned int) mtime);
+      job->found_lines ++;
+    }
+}
+
+/**
+ * search_find() - runs find on the remote host and parses its output while it is produced
+ * @return 0 if find ran, 1 if not available (an sftp walk is needed)
+ */
+int
+search_find (SSearchJob *job)
+{
+  char command[16384], quoted[8192], predicate[64];
+  int status;
+
+  sprintf (command, "find %s -mindepth 1 -maxdepth %d", shell_quote (quoted, job->root), job->max_depth);
+
+  /* server side predicates only reduce the output, results are checked again by search_check() */
+  if (job->filter.pattern[0] && job->filter.mode == FILTER_MODE_SUBSTRING)
+    {
+      strcat (command, " -name ");
+      strcat (command, shell_quote (quoted, job->filter.glob_pattern));
+    }
+
+  if (job->newer_than)
+    {
+      sprintf (predicate, " -mmin -%ld", (long) ((time (NULL) - job->newer_than) / 60 + 1));
+      strcat (command, predicate);
+    }
+
+  strcat (command, " -printf '%y %s %T@ %p\\n' 2>/dev/null");
+
+  log_write ("Remote search: %s\n", command);
+
+  status = ssh_node_exec_lines (job->p_node, command, search_find_line, job, &job->cancel);
+
+  log_write ("Remote search: exit status %d, %d lines\n", status, job->found_lines);
+
+  /* not found or not supporting -printf */
+  if (!job->cancel && status != 0 && job->found_lines == 0)
+    return (1);
+
+  return (0);
+}
+
+/**
+ * search_walk() - reads the tree breadth-first with sftp
+ * The ssh mutex is held while reading one directory, so that other operations can run between them
+ */
+void
+search_walk (SSearchJob *job)
+{
+  GQueue *queue;
+  SSearchDir *d, *sub;
+  sftp_dir dir;
+  sftp_attributes attributes;
+  char path[2048];
+
+  queue = g_queue_new ();
+
+  d = g_new0 (SSearchDir, 1);
+  strcpy (d->path, job->root);
+  g_queue_push_tail (queue, d);
+
+  while (!job->cancel && (d = (SSearchDir *) g_queue_pop_head (queue)) != NULL)
+    {
+      /* transfers use the same sftp sessions */
+      while (!job->cancel && async_is_transferring ())
+        g_usleep (G_USEC_PER_SEC / 5);
+
+      lockSSH (__func__, TRUE);
+
+      if (!search_node_ok (job))
+        {
+          lockSSH (__func__, FALSE);
+          g_free (d);
+          break;
+        }
+
+      if ((dir = sftp_opendir (job->p_node->sftp, d->path)) != NULL)
+        {
+          while (!job->cancel && (attributes = sftp_readdir (job->p_node->sftp, dir)) != NULL)
+            {
+              if (strcmp (attributes->name, ".") && strcmp (attributes->name, ".."))
+                {
+                  snprintf (path, sizeof (path), "%s/%s", strcmp (d->path, "/") ? d->path : "", attributes->name);
+
+                  search_check (job, path, attributes->type, attributes->size, attributes->mtime);
+
+                  if (attributes->type == SSH_FILEXFER_TYPE_DIRECTORY && d->depth + 1 < job->max_depth
+                      && job->dirs + g_queue_get_length (queue) < SEARCH_MAX_DIRS)
+                    {
+                      sub = g_new0 (SSearchDir, 1);
+                      strcpy (sub->path, path);
+                      sub->depth = d->depth + 1;
+                      g_queue_push_tail (queue, sub);
+                    }
+                }
+
+              sftp_attributes_free (attributes);
+            }
+
+          sftp_closedir (dir);
+          ssh_node_update_time (job->p_node);
+        }
+      else
+        {
+          log_debug ("Can't open %s: %s\n", d->path, ssh_get_error (job->p_node->session));
+        }
+
+      lockSSH (__func__, FALSE);
+
+      job->dirs ++;
+      g_free (d);
+    }
+
+  while ((d = (SSearchDir *) g_queue_pop_head (queue)) != NULL)
+    g_free (d);
+
+  g_queue_free (queue);
+}
+
+gpointer
+search_thread (gpointer data)
+{
+  SSearchJob *job = (SSearchJob *) data;
+
+  log_write ("%s BEGIN THREAD 0x%08x\n", __func__, pthread_self ());
+
+  if (!job->use_find || search_find (job) != 0)
+    {
+      if (job->use_find)
+        log_write ("Remote find not available, searching with sftp\n");
+
+      search_walk (job);
+    }
+
+  job->finished = TRUE;
+
+  log_write ("%s END: %d directories, %d matches\n", __func__, job->dirs, job->matches);
+
+  return (NULL);
+}
+
+void
+search_stop ()
+{
+  if (g_search_thread == NULL)
+    return;
+
+  g_search_job.cancel = TRUE;
+  g_thread_join (g_search_thread);
+  g_search_thread = NULL;
+
+  filter_free (&g_search_job.filter);
+  g_ptr_array_free (g_search_job.pending, TRUE);
+  pthread_mutex_destroy (&g_search_job.mutex);
+}
+
+/**
+ * search_flush() - moves the results found by the search thread to the list
+ */
+void
+search_flush ()
+{
+  GPtrArray *results;
+  SSearchResult *r;
+  GtkTreeIter iter;
+  GdkPixbuf *icon;
+  char size_s[32], date_s[64];
+  time_t mtime;
+  int i;
+
+  pthread_mutex_lock (&g_search_job.mutex);
+  results = g_search_job.pending;
+  g_search_job.pending = g_ptr_array_new_with_free_func (g_free);
+  pthread_mutex_unlock (&g_search_job.mutex);
+
+  for (i = 0; i < results->len; i++)
+    {
+      r = (SSearchResult *) g_ptr_array_index (results, i);
+
+      if (r->type == SSH_FILEXFER_TYPE_DIRECTORY)
+        {
+          icon = pixbuf_dir;
+          strcpy (size_s, "");
+        }
+      else
+        {
+          if ((icon = get_type_pixbuf (r->path)) == NULL)
+            icon = pixbuf_file;
+
+          bytes_to_human_readable (r->size, size_s);
+        }
+
+      mtime = r->mtime;
+      strftime (date_s, sizeof (date_s), DATE_FORMAT, localtime (&mtime));
+
+      gtk_list_store_append (ls_search, &iter);
+      gtk_list_store_set (ls_search, &iter,
+                          SR_COL_ICON, icon,
+                          SR_COL_PATH, r->path,
+                          SR_COL_SIZE, size_s,
+                          SR_COL_DATE, date_s,
+                          -1);
+    }
+
+  g_ptr_array_free (results, TRUE);
+}
+
+void
+search_update_status ()
+{
+  char status[1024];
+
+  if (g_search_thread == NULL)
+    return;
+
+  if (!g_search_job.finished)
+    {
+      sprintf (status, "Searching... %d folders, %d matches", g_search_job.dirs, g_search_job.matches);
+    }
+  else
+    {
+      if (g_search_job.error_s[0])
+        sprintf (status, "%s (%d matches)", g_search_job.error_s, g_search_job.matches);
+      else
+        sprintf (status, "%s: %d matches", g_search_job.cancel ? "Stopped" : "Done", g_search_job.matches);
+    }
+
+  gtk_label_set_text (GTK_LABEL (label_search_status), status);
+}
+
+void
+search_start_cb (GtkButton *button, gpointer user_data)
+{
+  int mode, days;
+
+  if (g_search_thread)
+    return;
+
+  if (!lt_ssh_ensure_connected (p_ssh_current, search_start_resume) || p_ssh_current->ssh_node == NULL)
+    {
+      /* started again once reconnected */
+      if (!ssh_revive_pending (p_ssh_current))
+        msgbox_error ("Not connected");
+
+      return;
+    }
+
+  memset (&g_search_job, 0, sizeof (SSearchJob));
+
+  g_search_job.p_node = p_ssh_current->ssh_node;
+  strncpy (g_search_job.root, gtk_entry_get_text (GTK_ENTRY (entry_search_dir)), sizeof (g_search_job.root) - 1);
+  trim (g_search_job.root);
+
+  if (g_search_job.root[0] == 0)
+    strcpy (g_search_job.root, p_ssh_current->directory);
+
+  sftp_normalize_directory (p_ssh_current, g_search_job.root);
+
+  mode = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (check_search_regex)) ? FILTER_MODE_REGEX : FILTER_MODE_SUBSTRING;
+
+  if (filter_compile (&g_search_job.filter, mode, gtk_entry_get_text (GTK_ENTRY (entry_search_name))) != 0)
+    {
+      msgbox_error ("%s", g_search_job.filter.error_s);
+      return;
+    }
+
+  g_search_job.min_size = (long long unsigned int) gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (spin_search_min_size)) * 1024;
+  g_search_job.max_size = (long long unsigned int) gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (spin_search_max_size)) * 1024;
+
+  if ((days = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (spin_search_days))) > 0)
+    g_search_job.newer_than = time (NULL) - days * 24 * 60 * 60;
+
+  g_search_job.max_depth = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (spin_search_depth));
+  g_search_job.use_find = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (check_search_find));
+
+  pthread_mutex_init (&g_search_job.mutex, NULL);
+  g_search_job.pending = g_ptr_array_new_with_free_func (g_free);
+
+  gtk_list_store_clear (ls_search);
+
+  log_write ("Searching '%s' in %s@%s:%s\n", g_search_job.filter.pattern, g_search_job.p_node->user, g_search_job.p_node->host, g_search_job.root);
+
+  g_search_thread = g_thread_new ("search", search_thread, &g_search_job);
+
+  gtk_widget_set_sensitive (button_search_start, FALSE);
+  gtk_widget_set_sensitive (button_search_stop, TRUE);
+}
+
+/* search started again once the session is back, if the window is still open */
+void
+search_start_resume ()
+{
+  if (searchWindow && gSearchWindow)
+    search_start_cb (NULL, NULL);
+}
+
+void
+search_stop_cb (GtkButton *button, gpointer user_data)
+{
+  g_search_job.cancel = TRUE;
+}
+
+/**
+ * search_row_activated_cb() - shows the folder of the double-clicked file in the sftp panel
+ */
+void
+search_row_activated_cb (GtkTreeView *tree_view, GtkTreePath *path, GtkTreeViewColumn *column, gpointer user_data)
+{
+  GtkTreeIter iter;
+  gchar *file;
+  char dir[2048];
+
+  if (!gtk_tree_model_get_iter (GTK_TREE_MODEL (ls_search), &iter, path))
+    return;
+
+  gtk_tree_model_get (GTK_TREE_MODEL (ls_search), &iter, SR_COL_PATH, &file, -1);
+
+  if (p_ssh_current && p_ssh_current->ssh_node == g_search_job.p_node)
+    {
+      strcpy (dir, file);
+      strcpy (dir, dirname (dir));
+      sftp_panel_change_directory (dir);
+    }
+  else
+    msgbox_info ("%s is on a different connection", file);
+
+  g_free (file);
+}
+
+gint
+search_window_delete_event_cb (GtkWidget *window, GdkEventAny *e, gpointer data)
+{
+  gSearchWindow = FALSE;
+
+  return TRUE;
+}
+
+GtkWidget *
+create_search_tree_view ()
+{
+  GtkCellRenderer *renderer;
+  GtkTreeViewColumn *column;
+  GtkWidget *tree_view;
+
+  tree_view = gtk_tree_view_new ();
+
+  // Path
+  column = gtk_tree_view_column_new ();
+  gtk_tree_view_column_set_title (column, _("File"));
+  gtk_tree_view_column_set_resizable (column, TRUE);
+  gtk_tree_view_column_set_sort_column_id (column, SR_COL_PATH);
+
+  renderer = gtk_cell_renderer_pixbuf_new ();
+  gtk_tree_view_column_pack_start (column, renderer, FALSE);
+  gtk_tree_view_column_set_attributes (column, renderer, "pixbuf", SR_COL_ICON, NULL);
+
+  renderer = gtk_cell_renderer_text_new ();
+  gtk_tree_view_column_pack_start (column, renderer, TRUE);
+  gtk_tree_view_column_set_attributes (column, renderer, "text", SR_COL_PATH, NULL);
+
+  gtk_tree_view_append_column (GTK_TREE_VIEW (tree_view), GTK_TREE_VIEW_COLUMN (column));
+
+  // Size
+  renderer = gtk_cell_renderer_text_new ();
+  column = gtk_tree_view_column_new_with_attributes (_("Size"), renderer, "text", SR_COL_SIZE, NULL);
+  gtk_tree_view_column_set_resizable (column, TRUE);
+  gtk_tree_view_append_column (GTK_TREE_VIEW (tree_view), GTK_TREE_VIEW_COLUMN (column));
+
+  // Date
+  renderer = gtk_cell_renderer_text_new ();
+  column = gtk_tree_view_column_new_with_attributes (_("Modified"), renderer, "text", SR_COL_DATE, NULL);
+  gtk_tree_view_column_set_resizable (column, TRUE);
+  gtk_tree_view_column_set_sort_column_id (column, SR_COL_DATE);
+  gtk_tree_view_append_column (GTK_TREE_VIEW (tree_view), GTK_TREE_VIEW_COLUMN (column));
+
+  ls_search = gtk_list_store_new (N_SEARCH_COLUMNS, GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
+  gtk_tree_view_set_model (GTK_TREE_VIEW (tree_view), GTK_TREE_MODEL (ls_search));
+
+  g_signal_connect (G_OBJECT (tree_view), "row-activated", G_CALLBACK (search_row_activated_cb), NULL);
+
+  return (tree_view);
+}
+
+GtkWidget *
+search_spin_new (GtkWidget *table, int row, char *label, double max, double value)
+{
+  GtkWidget *spin;
+
+  spin = gtk_spin_button_new_with_range (0, max, 1);
+  gtk_spin_button_set_value (GTK_SPIN_BUTTON (spin), value);
+
+  gtk_table_attach (GTK_TABLE (table), gtk_label_new (label), 2, 3, row, row+1, GTK_FILL, GTK_FILL, 5, 2);
+  gtk_table_attach (GTK_TABLE (table), spin, 3, 4, row, row+1, GTK_FILL, GTK_FILL, 5, 2);
+
+  return (spin);
+}
+
+/**
+ * search_window() - searches files under the current folder of the sftp panel
+ */
+void
+search_window (struct SSH_Info *p_ssh)
+{
+  GtkWidget *vbox, *table, *hbox, *scrolled_window, *tree_view, *button_close;
+  gint64 last_update;
+  gboolean finished;
+
+  if (searchWindow || !lt_ssh_is_connected (p_ssh) || p_ssh->ssh_node == NULL)
+    return;
+
+  searchWindow = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+
+  gtk_window_set_modal (GTK_WINDOW (searchWindow), TRUE);
+  gtk_window_set_transient_for (GTK_WINDOW (searchWindow), GTK_WINDOW (main_window));
+  gtk_window_set_title (GTK_WINDOW (searchWindow), _("Search files"));
+  gtk_container_set_border_width (GTK_CONTAINER (searchWindow), 5);
+
+  g_signal_connect (searchWindow, "delete_event", G_CALLBACK (search_window_delete_event_cb), NULL);
+
+#if (GTK_MAJOR_VERSION == 2)
+  vbox = gtk_vbox_new (FALSE, 5);
+#else
+  vbox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 5);
+#endif
+
+  // Predicates
+  table = gtk_table_new (4, 4, FALSE);
+
+  entry_search_dir = gtk_entry_new ();
+  gtk_entry_set_text (GTK_ENTRY (entry_search_dir), p_ssh->directory);
+  gtk_table_attach (GTK_TABLE (table), gtk_label_new (_("Look in")), 0, 1, 0, 1, GTK_FILL, GTK_FILL, 5, 2);
+  gtk_table_attach (GTK_TABLE (table), entry_search_dir, 1, 2, 0, 1, GTK_EXPAND | GTK_FILL, GTK_FILL, 5, 2);
+
+  entry_search_name = gtk_entry_new ();
+  gtk_entry_set_activates_default (GTK_ENTRY (entry_search_name), TRUE);
+  gtk_table_attach (GTK_TABLE (table), gtk_label_new (_("Name")), 0, 1, 1, 2, GTK_FILL, GTK_FILL, 5, 2);
+  gtk_table_attach (GTK_TABLE (table), entry_search_name, 1, 2, 1, 2, GTK_EXPAND | GTK_FILL, GTK_FILL, 5, 2);
+
+  check_search_regex = gtk_check_button_new_with_label (_("Regular expression"));
+  gtk_table_attach (GTK_TABLE (table), check_search_regex, 1, 2, 2, 3, GTK_FILL, GTK_FILL, 5, 2);
+
+  check_search_find = gtk_check_button_new_with_label (_("Use remote find when available"));
+  gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (check_search_find), TRUE);
+  gtk_table_attach (GTK_TABLE (table), check_search_find, 1, 2, 3, 4, GTK_FILL, GTK_FILL, 5, 2);
+
+  spin_search_min_size = search_spin_new (table, 0, _("Min size (KB)"), 1024 * 1024 * 1024, 0);
+  spin_search_max_size = search_spin_new (table, 1, _("Max size (KB)"), 1024 * 1024 * 1024, 0);
+  spin_search_days = search_spin_new (table, 2, _("Modified in last days"), 36500, 0);
+  spin_search_depth = search_spin_new (table, 3, _("Max depth"), 1000, 10);
+  gtk_spin_button_set_range (GTK_SPIN_BUTTON (spin_search_depth), 1, 1000);
+
+  gtk_box_pack_start (GTK_BOX (vbox), table, FALSE, FALSE, 0);
+
+  // Buttons
+#if (GTK_MAJOR_VERSION == 2)
+  hbox = gtk_hbox_new (FALSE, 5);
+#else
+  hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 5);
+#endif
+
+  label_search_status = gtk_label_new ("");
+  gtk_misc_set_alignment (GTK_MISC (label_search_status), 0, 0.5);
+  gtk_box_pack_start (GTK_BOX (hbox), label_search_status, TRUE, TRUE, 0);
+
+  button_search_start = gtk_button_new_from_stock (GTK_STOCK_FIND);
+  gtk_widget_set_can_default (button_search_start, TRUE);
+  g_signal_connect (G_OBJECT (button_search_start), "clicked", G_CALLBACK (search_start_cb), NULL);
+  gtk_box_pack_start (GTK_BOX (hbox), button_search_start, FALSE, FALSE, 0);
+
+  button_search_stop = gtk_button_new_from_stock (GTK_STOCK_STOP);
+  gtk_widget_set_sensitive (button_search_stop, FALSE);
+  g_signal_connect (G_OBJECT (button_search_stop), "clicked", G_CALLBACK (search_stop_cb), NULL);
+  gtk_box_pack_start (GTK_BOX (hbox), button_search_stop, FALSE, FALSE, 0);
+
+  button_close = gtk_button_new_from_stock (GTK_STOCK_CLOSE);
+  g_signal_connect (G_OBJECT (button_close), "clicked", G_CALLBACK (search_window_delete_event_cb), NULL);
+  gtk_box_pack_start (GTK_BOX (hbox), button_close, FALSE, FALSE, 0);
+
+  gtk_box_pack_start (GTK_BOX (vbox), hbox, FALSE, FALSE, 0);
+
+  // Results
+  scrolled_window = gtk_scrolled_window_new (NULL, NULL);
+  gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrolled_window), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+  gtk_scrolled_window_set_shadow_type (GTK_SCROLLED_WINDOW (scrolled_window), GTK_SHADOW_ETCHED_IN);
+
+  tree_view = create_search_tree_view ();
+  gtk_container_add (GTK_CONTAINER (scrolled_window), tree_view);
+
+  gtk_box_pack_start (GTK_BOX (vbox), scrolled_window, TRUE, TRUE, 0);
+
+  gtk_container_add (GTK_CONTAINER (searchWindow), vbox);
+
+  GdkScreen *screen;
+  screen = gtk_window_get_screen (GTK_WINDOW (main_window));
+  gtk_widget_set_size_request (GTK_WIDGET (searchWindow), gdk_screen_get_height (screen)/1.5, gdk_screen_get_height (screen)/1.8);
+  gtk_window_set_position (GTK_WINDOW (searchWindow), GTK_WIN_POS_CENTER_ON_PARENT);
+
+  gtk_widget_show_all (searchWindow);
+  gtk_widget_grab_default (button_search_start);
+  gtk_widget_grab_focus (entry_search_name);
+
+  gSearchWindow = TRUE;
+  last_update = 0;
+
+  /* results are moved to the list while the search thread goes on */
+  while (gSearchWindow)
+    {
+      if (g_search_thread && g_get_monotonic_time () - last_update > G_USEC_PER_SEC / 4)
+        {
+          /* read before flushing: nothing is queued after the thread has finished */
+          finished = g_search_job.finished;
+
+          search_flush ();
+          search_update_status ();
+
+          if (finished)
+            {
+              search_stop ();
+              gtk_widget_set_sensitive (button_search_start, TRUE);
+              gtk_widget_set_sensitive (button_search_stop, FALSE);
+            }
+
+          last_update = g_get_monotonic_time ();
+        }
+
+      while (gtk_events_pending ())
+        gtk_main_iteration ();
+
+      // Prevent from 100% cpu usage
+      g_usleep (3000);
+    }
+
+  search_stop ();
+
+  gtk_widget_destroy (searchWindow);
+  searchWindow = NULL;
+}
+
+/**
+ * sftp_panel_search() - search files from the sftp panel
+ */
+void
+sftp_panel_search ()
+{
+  search_window (p_ssh_current);
+}
+
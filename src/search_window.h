@@ -0,0 +1,50 @@
+
+#ifndef _SEARCH_WINDOW_H
+#define _SEARCH_WINDOW_H
+
+#include <gtk/gtk.h>
+#include <pthread.h>
+#include "ssh.h"
+#include "filter.h"
+
+/* Bounds of the breadth-first traversal */
+#define SEARCH_MAX_DIRS 100000
+#define SEARCH_MAX_RESULTS 10000
+
+/* Found file, queued by the search thread for the result list */
+typedef struct SearchResult {
+  char path[2048];
+  int type;
+  long long unsigned int size;
+  long unsigned int mtime;
+} SSearchResult;
+
+typedef struct SearchJob {
+  struct SSH_Node *p_node;
+  char root[1024];
+
+  /* predicates */
+  SFilter filter;
+  long long unsigned int min_size; /* bytes, 0 means no limit */
+  long long unsigned int max_size;
+  time_t newer_than; /* 0 means any time */
+  int max_depth;
+  int use_find; /* try a remote find before walking with sftp */
+
+  gboolean cancel;
+  gboolean finished;
+  int dirs;
+  int matches;
+  int found_lines; /* printed by remote find */
+  char error_s[512];
+
+  pthread_mutex_t mutex; /* protects pending */
+  GPtrArray *pending;
+} SSearchJob;
+
+void search_window (struct SSH_Info *p_ssh);
+void search_start_resume ();
+void sftp_panel_search ();
+
+#endif
+
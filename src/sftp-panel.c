@@ -28,7 +28,6 @@
 #include <dirent.h>
 #include <libgen.h>
 #include <fcntl.h>
-#include <fnmatch.h>
 
 #include "main.h"
 #include "gui.h"
@@ -38,6 +37,12 @@
 #include "xml.h"
 #include "terminal.h"
 #include "async.h"
+#include "filter.h"
+#include "search_window.h"
+#include "disk_usage.h"
+#include "deadline.h"
+#include "transfer_compression.h"
+#include "ssh_reaper.h"
 
 #ifdef __linux____DONT_USE
 #include <sys/inotify.h>
@@ -63,7 +68,8 @@ struct SSH_Info *p_ssh_current;
 GdkPixbuf *pixbuf_file, *pixbuf_dir;
 GtkTreeSelection *g_sftp_selection;
 GSList *g_selected_files = NULL;
-GList *g_filetypes;
+GHashTable *g_filetypes; /* struct Type by lower case extension */
+GHashTable *g_filetype_images; /* GdkPixbuf by image file, shared between types */
 
 char *transferStatusDesc[] = { "Ready", "In progress", "Paused", "Cancelled by user", "Cancelled for errors", "Completed", 0 };
 
@@ -80,11 +86,12 @@ GArray *mirrorFiles = NULL;
 
 char transfer_error[512];
 
-enum { COLUMN_FILE_ICON, COLUMN_FILE_NAME, COLUMN_FILE_SIZE, COLUMN_FILE_DATE, N_FILE_COLUMNS };
+enum { COLUMN_FILE_ICON, COLUMN_FILE_NAME, COLUMN_FILE_SIZE, COLUMN_FILE_DATE, COLUMN_FILE_ENTRY, COLUMN_FILE_SCORE, N_FILE_COLUMNS };
 enum { SORTID_ICON = 0, SORTID_NAME, SORTID_SIZE, SORTID_DATE };
   
-GtkListStore *list_store_fs;
+GtkListStore *list_store_fs; /* store currently shown in the tree view */
 GtkTreeModel *tree_model_fs;
+GtkListStore *list_store_empty; /* shown when there's no sftp connection */
 
 GtkActionEntry sftp_popup_menu_items [] = {
   { "CreateFolder", "folder", N_("_Create folder"), "", NULL, G_CALLBACK (sftp_panel_create_folder) },
@@ -94,6 +101,8 @@ GtkActionEntry sftp_popup_menu_items [] = {
   { "ChangeTime", "Change _Time", N_("Change _Time"), "", NULL, G_CALLBACK (sftp_panel_change_time) },
   { "CopyPathToClipboard", "edit-copy", N_("Copy _path to clipboard"), "", NULL, G_CALLBACK (sftp_panel_copy_path_clipboard) },
   { "Delete", "_Delete", N_("_Delete"), "", NULL, G_CALLBACK (sftp_panel_delete) },
+  { "Search", "edit-find", N_("_Search files..."), "", NULL, G_CALLBACK (sftp_panel_search) },
+  { "ComputeSizes", NULL, N_("Compute folder si_zes"), "", NULL, G_CALLBACK (sftp_panel_compute_sizes) },
   //{ "CopyNameTerminal", NULL, N_("C_opy name to terminal"), "", NULL, G_CALLBACK (sftp_panel_copy_name_terminal) },
   //{ "CopyPathTerminal", NULL, N_("C_opy file path to terminal"), "", NULL, G_CALLBACK (sftp_panel_copy_path_terminal) },
   { "Upload", NULL, N_("_Upload"), "", NULL, G_CALLBACK (sftp_upload_files) },
@@ -113,6 +122,8 @@ gchar *ui_sftp_popup_desc =
   "    <menuitem action='ChangeTime'/>"
   "    <menuitem action='CopyPathToClipboard'/>"
   "    <menuitem action='Delete'/>"
+  "    <menuitem action='Search'/>"
+  "    <menuitem action='ComputeSizes'/>"
   //"    <menuitem action='CopyNameTerminal'/>"
   //"    <menuitem action='CopyPathTerminal'/>"
   "    <separator />"
@@ -246,6 +257,7 @@ sftp_copy_file_upload (sftp_session sftp, struct TransferInfo *p_ti)
   int nread, nwritten;
   unsigned int buffer[prefs.sftp_buffer];
   struct stat fileStat;
+  SDeadline deadline;
   //int rc = 0;
 
   log_debug ("From: %s\n", p_ti->source);
@@ -268,14 +280,13 @@ sftp_copy_file_upload (sftp_session sftp, struct TransferInfo *p_ti)
 
   log_write ("Opening remote file for writing: %s\n", p_ti->destination);
 
-  // TODO: alarm is catched by thread but sftp_open() is not stopped
-  threadRequestAlarm ();
-  timerStart (2);  
+  deadline_watch (&deadline, sftp->session, "sftp_open", prefs.sftp_timeout * 1000);
 
   file = sftp_open (sftp, p_ti->destination, access_type, S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH);
 
-  threadResetAlarm ();
-  timerStop ();
+  /* files opened by external editors are transferred without a tab */
+  if (deadline_unwatch (&deadline) && p_ti->p_ssh)
+    ssh_node_set_validity (transfer_sftp_node (p_ti->p_ssh->ssh_node, sftp), 0);
 
   lockSSH (__func__, FALSE);
   //////////////////////////////
@@ -345,6 +356,7 @@ sftp_copy_file_download (sftp_session sftp, struct TransferInfo *p_ti)
   int nbytes, nwritten, rc;
   int fd;
   sftp_attributes attr;
+  SDeadline deadline;
   
   unsigned int n_blocks_read = 0;
   int blockCurrentSize = 0;
@@ -356,20 +368,15 @@ sftp_copy_file_download (sftp_session sftp, struct TransferInfo *p_ti)
 
   log_write ("Opening remote file for reading: %s\n", p_ti->source);
 
-  // TODO: alarm is catched by thread but sftp_open() is not stopped
-  threadRequestAlarm ();
-  timerStart (2);
+  deadline_watch (&deadline, sftp->session, "sftp_open", prefs.sftp_timeout * 1000);
 
   file = sftp_open (sftp, p_ti->source, access_type, 0);
 
-  UNLOCK_SSH
-
-  if (timedOut ()) {
-    log_write ("Timeout!\n");
-  }
+  /* files opened by external editors are transferred without a tab */
+  if (deadline_unwatch (&deadline) && p_ti->p_ssh)
+    ssh_node_set_validity (transfer_sftp_node (p_ti->p_ssh->ssh_node, sftp), 0);
 
-  threadResetAlarm ();
-  timerStop();
+  UNLOCK_SSH
 
   if (file == NULL) {
     return (transfer_set_error (p_ti, 1, "Can't open remote file:\n%s", p_ti->source));
@@ -502,6 +509,8 @@ upload_directory (struct SSH_Info *p_ssh, char *rootdir, char *destdir, STransfe
     return (transfer_set_error (p_ti, 1, "Not connected"));
 
   memset (&ti, 0, sizeof (struct TransferInfo));
+  ti.p_ssh = p_ssh;
+  ti.action = SFTP_ACTION_UPLOAD;
 
   log_debug ("Opening direcotry %s\n", rootdir);
   
@@ -558,7 +567,7 @@ upload_directory (struct SSH_Info *p_ssh, char *rootdir, char *destdir, STransfe
           sprintf (ti.source, "%s/%s", rootdir, entry->d_name);
           sprintf (ti.destination, "%s/%s", destdir_new, entry->d_name);
 
-          rc = sftp_copy_file_upload (p_ssh->ssh_node->sftp, &ti);
+          rc = transfer_copy_file (p_ssh, &ti);
         }
 
       if (rc != 0 || ti.state == TR_CANCELLED_USER)
@@ -672,7 +681,7 @@ download_directory (struct SSH_Info *p_ssh, char *rootdir, char *destdir, STrans
 
           log_debug ("Downloading %s\n", p_ti->source);
 
-          rc = sftp_copy_file_download (p_ssh->ssh_node->sftp, p_ti);
+          rc = transfer_copy_file (p_ssh, p_ti);
 
           // Store returned struct
           STransferInfo tmpTi;
@@ -821,7 +830,11 @@ saveMirrorFile (SMirrorFile *mf)
   
   log_write ("Uploading to %s: %s\n", mf->sshNode->host, mf->localFile);
 
-  rc = sftp_copy_file_upload (mf->sshNode->sftp, &ti);
+  /* the session could have been closed while the file was being edited */
+  if (ssh_node_revive (mf->sshNode) != 0 || mf->sshNode->sftp == NULL)
+    rc = 1;
+  else
+    rc = sftp_copy_file_upload (mf->sshNode->sftp, &ti);
   
   if (rc == 0) {
     log_write ("Uploaded %d bytes\n", ti.worked);
@@ -1094,7 +1107,7 @@ sftp_panel_open ()
   gchar *filename, *uri, filepath[2048], command[2048];
   gboolean success;
   
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_panel_open))
     return;
     
   log_debug ("Editor: %s\n", prefs.text_editor);
@@ -1143,7 +1156,7 @@ sftp_panel_create_folder ()
   char folder_name[1024];
   char folder_abs_path[2048];
   
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_panel_create_folder))
     return;
     
   create = query_value (_("Create folder"), _("Enter a name for the new folder"), "", folder_name, QUERY_FOLDER_NEW);
@@ -1189,7 +1202,7 @@ sftp_panel_create_file ()
   char file_abs_path[2048];
   sftp_file file;
   
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_panel_create_file))
     return;
     
   create = query_value (_("Create file"), _("Enter a name for the new file"), "", file_name, QUERY_FILE_NEW);
@@ -1234,7 +1247,7 @@ sftp_panel_rename ()
   char file_abs_path_new[2048];
   int n_worked = 0;
   
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_panel_rename))
     return;
 
   GSList *filelist = sftp_panel_get_selected_files ();
@@ -1330,7 +1343,7 @@ sftp_panel_delete ()
   char *filename;
   char file_abs_path[2048];
   
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_panel_delete))
     return;
 
   GSList *filelist = sftp_panel_get_selected_files ();
@@ -1396,7 +1409,7 @@ sftp_panel_change_time ()
   char *filename;
   char file_abs_path[2048];
   
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_panel_change_time))
     return;
 
   builder = gtk_builder_new ();
@@ -1540,7 +1553,7 @@ void sftp_panel_copy_name_terminal ()
 {
   char *filename;
   
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current))
     return;
 
   GSList *filelist = sftp_panel_get_selected_files ();
@@ -1563,7 +1576,7 @@ void sftp_panel_copy_path_terminal ()
 {
   char *filename, path[1024];
   
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_panel_copy_path_terminal))
     return;
 
   GSList *filelist = sftp_panel_get_selected_files ();
@@ -1590,7 +1603,7 @@ void sftp_panel_copy_path_clipboard ()
   int bufferSize, n = 0;
   const int extent = 512; // Initial extent
   
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_panel_copy_path_clipboard))
     return;
 
   buffer = (char *) malloc (extent);
@@ -1695,14 +1708,28 @@ refresh_panel_history ()
   }
 }
 
+/* directory to move to once the session is back */
+char gResumeDirectory[2048];
+
+void
+sftp_panel_change_directory_resume ()
+{
+  sftp_panel_change_directory (gResumeDirectory);
+}
+
 void
 sftp_panel_change_directory (char *path)
 {
   int rc;
   char dirbackup[2048];
   
-  if (!lt_ssh_is_connected (p_ssh_current))
-    return;
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_panel_change_directory_resume))
+    {
+      if (path)
+        g_strlcpy (gResumeDirectory, path, sizeof (gResumeDirectory));
+
+      return;
+    }
 
   if (path == NULL)
     return;
@@ -1799,7 +1826,7 @@ row_activated_sftp_cb (GtkTreeView *tree_view, GtkTreePath *path, GtkTreeViewCol
 void
 sftp_go_home_cb (GtkButton *button, gpointer user_data)
 {
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_go_home_resume))
     return;
 
   sftp_panel_change_directory (p_ssh_current->home);
@@ -1810,7 +1837,7 @@ sftp_go_up_cb (GtkButton *button, gpointer user_data)
 {
   char newpath[1024], *pc;
 
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_go_up_resume))
     return;
 
   strcpy (newpath, p_ssh_current->directory);
@@ -1904,7 +1931,7 @@ toggle_follow_cb (GtkToggleButton *togglebutton, gpointer user_data)
   
   log_debug ("toggled\n");
   
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_toggle_follow_resume))
     {
       follow_terminal_folder (FALSE);
     }
@@ -1924,7 +1951,7 @@ toggle_follow_cb (GtkToggleButton *togglebutton, gpointer user_data)
 void
 sftp_refresh_cb (GtkButton *button, gpointer user_data)
 {
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_refresh_resume))
     return;
 
   if (sftp_refresh_directory_list (p_ssh_current) != 0)
@@ -1938,13 +1965,52 @@ sftp_go_cb (GtkButton *button, gpointer user_data)
 {
   char *path;
 
-  if (!lt_ssh_is_connected (p_ssh_current))
+  if (!lt_ssh_ensure_connected (p_ssh_current, sftp_go_resume))
     return;
 
   path = (char *) gtk_entry_get_text (GTK_ENTRY (sftp_panel.entry_sftp_position));
   sftp_panel_change_directory (path);
 }
 
+/* actions run again once an evicted session is back (see lt_ssh_ensure_connected()) */
+
+void
+sftp_go_home_resume ()
+{
+  sftp_go_home_cb (NULL, NULL);
+}
+
+void
+sftp_go_up_resume ()
+{
+  sftp_go_up_cb (NULL, NULL);
+}
+
+void
+sftp_refresh_resume ()
+{
+  sftp_refresh_cb (NULL, NULL);
+}
+
+void
+sftp_go_resume ()
+{
+  sftp_go_cb (NULL, NULL);
+}
+
+void
+sftp_toggle_follow_resume ()
+{
+  toggle_follow_cb (NULL, NULL);
+}
+
+void
+sftp_follow_terminal_resume ()
+{
+  if (p_ssh_current && p_ssh_current->follow_terminal_folder)
+    follow_terminal_folder (TRUE);
+}
+
 void
 sftp_panel_show_filter (gboolean show)
 {
@@ -2007,6 +2073,10 @@ entry_filter_changed_cb (GtkWidget *widget, gpointer data)
     }
 }
 
+/**
+ * sort_name_compare_func() - compares two rows using the directory entries they point to
+ * (names are compared by the collation keys computed when reading the directory)
+ */
 int
 sort_name_compare_func (GtkTreeModel *model, 
                         GtkTreeIter *a,
@@ -2016,48 +2086,37 @@ sort_name_compare_func (GtkTreeModel *model,
   int sortcol = GPOINTER_TO_INT(userdata);
   struct Directory_Entry *e1, *e2;
   int ret = 0;
-  gchar *name1, *name2;
-  int size1, size2;
+  int score1, score2;
+
+  gtk_tree_model_get (model, a, COLUMN_FILE_ENTRY, &e1, COLUMN_FILE_SCORE, &score1, -1);
+  gtk_tree_model_get (model, b, COLUMN_FILE_ENTRY, &e2, COLUMN_FILE_SCORE, &score2, -1);
 
-  gtk_tree_model_get (model, a, COLUMN_FILE_NAME, &name1, -1);
-  gtk_tree_model_get (model, b, COLUMN_FILE_NAME, &name2, -1);
+  if (e1 == NULL || e2 == NULL)
+    return 0;
 
   switch (sortcol) {
     case SORTID_ICON:
     case SORTID_NAME:
       
-      ret = g_utf8_collate (name1, name2);
+      /* best fuzzy matches first (scores are 0 with other filters) */
+      if (score1 != score2)
+        ret = (score1 > score2) ? -1 : 1;
+      else if (e1->collate_key && e2->collate_key)
+        ret = strcmp (e1->collate_key, e2->collate_key);
+      else
+        ret = g_utf8_collate (e1->name, e2->name);
+
       break;
       
     case SORTID_SIZE:
-      e1 = dl_search_by_name (&p_ssh_current->dirlist, name1);
-      e2 = dl_search_by_name (&p_ssh_current->dirlist, name2);
-      
-      if (e1 && e2)
-        {
-          if (e1->size != e2->size)
-            {
-              ret = (e1->size > e2->size) ? 1 : -1;
-            }
-        }
-      else
-        ret = 0;
+      if (e1->size != e2->size)
+        ret = (e1->size > e2->size) ? 1 : -1;
         
       break;
       
     case SORTID_DATE:
-      e1 = dl_search_by_name (&p_ssh_current->dirlist, name1);
-      e2 = dl_search_by_name (&p_ssh_current->dirlist, name2);
-      
-      if (e1 && e2)
-        {
-          if (e1->mtime != e2->mtime)
-            {
-              ret = (e1->mtime > e2->mtime) ? 1 : -1;
-            }
-        }
-      else
-        ret = 0;
+      if (e1->mtime != e2->mtime)
+        ret = (e1->mtime > e2->mtime) ? 1 : -1;
         
       break;
       
@@ -2065,9 +2124,6 @@ sort_name_compare_func (GtkTreeModel *model,
       ret = 0;
   }
   
-  g_free (name1);
-  g_free (name2);
-  
   return ret;
 }
 
@@ -2084,7 +2140,7 @@ sftp_cell_tooltip_cb (GtkWidget *widget, gint x, gint y,
   GtkTreePath *path;
   struct Directory_Entry *e;
   char text[1024], tmp_s[32], perms[32];
-  gchar *name;
+  char dir_path[2048];
 
   if (!gtk_tree_view_get_tooltip_context (GTK_TREE_VIEW (widget), &x, &y, keyboard_tip, &model, 0, &iter))
     {
@@ -2100,9 +2156,9 @@ sftp_cell_tooltip_cb (GtkWidget *widget, gint x, gint y,
 
   if (gtk_tree_model_get_iter (model, &iter, path))
     {
-      gtk_tree_model_get (model, &iter, COLUMN_FILE_NAME, &name, -1);
+      gtk_tree_model_get (model, &iter, COLUMN_FILE_ENTRY, &e, -1);
 
-      if (e = dl_search_by_name (&p_ssh_current->dirlist, name))
+      if (e)
         {
           sprintf (text, _("<b>File:</b> %s\n"
                            "<b>Owner:</b> %s\n"
@@ -2117,9 +2173,15 @@ sftp_cell_tooltip_cb (GtkWidget *widget, gint x, gint y,
                    timestamp_to_date (DATE_FORMAT, e->mtime));
                    
           gtk_tooltip_set_markup (tooltip, text);
+
+          /* user could enter this directory soon */
+          if (is_directory (e) && strcmp (e->name, ".") && strcmp (e->name, "..") && lt_ssh_is_connected (p_ssh_current))
+            {
+              sprintf (dir_path, "%s/%s", strcmp (p_ssh_current->directory, "/") ? p_ssh_current->directory : "", e->name);
+              async_prefetch_request (p_ssh_current->ssh_node, dir_path, TRUE);
+            }
         }
 
-      g_free (name);
       return TRUE;
     }
 
@@ -2254,6 +2316,14 @@ ssh_additionals_cb (GtkAction *action, gpointer user_data)
         case ACTION_EXECUTE:
           //log_debug ("Executing on %s: %s\n", p_ssh_current->ssh_node->host, expanded);
           sftp_set_status ("Executing on %s: %s", p_ssh_current->ssh_node->host, expanded);
+
+          /* long outputs are shown while received */
+          if (SSHMenuItems[id].flags & OUTPUT)
+            {
+              show_command_output ("Output", p_ssh_current->ssh_node, expanded);
+              sftp_clear_status ();
+              break;
+            }
           
           rc = lt_ssh_exec (p_ssh_current, expanded, output, sizeof (output), error, sizeof (error));
           
@@ -2271,10 +2341,6 @@ ssh_additionals_cb (GtkAction *action, gpointer user_data)
               break;
             }
 
-//log_debug ("output=\n%s\n", output);         
-          if (SSHMenuItems[id].flags & OUTPUT)
-            show_output ("Output", output);
-            
           break;
           
         default:
@@ -2405,7 +2471,6 @@ create_sftp_panel ()
   GtkTreeViewColumn *column;
   //GtkTreeModel *tree_model;
   GtkTreeIter iter;
-  GtkTreeSortable *sortable;
 
   GtkWidget *tree_view = gtk_tree_view_new ();
   gtk_tree_view_set_headers_clickable (GTK_TREE_VIEW(tree_view), TRUE);
@@ -2460,19 +2525,13 @@ create_sftp_panel ()
   gtk_tree_view_column_set_sort_column_id (column, SORTID_DATE);
   gtk_tree_view_append_column (GTK_TREE_VIEW (tree_view), GTK_TREE_VIEW_COLUMN (column));
   
-  /* create list store */
-  
-  list_store_fs = gtk_list_store_new (N_FILE_COLUMNS, GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
-  
-  sortable = GTK_TREE_SORTABLE (list_store_fs);
- 
-  gtk_tree_sortable_set_sort_func (sortable, SORTID_NAME, sort_name_compare_func, GINT_TO_POINTER(SORTID_NAME), NULL);
-  gtk_tree_sortable_set_sort_func (sortable, SORTID_SIZE, sort_name_compare_func, GINT_TO_POINTER(SORTID_SIZE), NULL);
-  gtk_tree_sortable_set_sort_func (sortable, SORTID_DATE, sort_name_compare_func, GINT_TO_POINTER(SORTID_DATE), NULL);
+  /* create list store (every tab will have its own, see refresh_sftp_panel()) */
   
-  gtk_tree_sortable_set_sort_column_id (sortable, SORTID_NAME, GTK_SORT_ASCENDING);
+  list_store_empty = sftp_list_store_new ();
+  list_store_fs = list_store_empty;
 
   gtk_tree_view_set_model (GTK_TREE_VIEW (tree_view), GTK_TREE_MODEL (list_store_fs));
+  sftp_panel.tree_view = tree_view;
 
   /* selection */
   
@@ -2582,19 +2641,113 @@ create_sftp_panel ()
   return (GTK_WIDGET (gtk_builder_get_object (builder, "vbox_main")));
 }
 
+/**
+ * sftp_list_store_new() - creates an empty list store for the sftp panel
+ */
+GtkListStore *
+sftp_list_store_new ()
+{
+  GtkListStore *list_store;
+  GtkTreeSortable *sortable;
+
+  list_store = gtk_list_store_new (N_FILE_COLUMNS, GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_POINTER, G_TYPE_INT);
+  
+  sortable = GTK_TREE_SORTABLE (list_store);
+ 
+  gtk_tree_sortable_set_sort_func (sortable, SORTID_NAME, sort_name_compare_func, GINT_TO_POINTER(SORTID_NAME), NULL);
+  gtk_tree_sortable_set_sort_func (sortable, SORTID_SIZE, sort_name_compare_func, GINT_TO_POINTER(SORTID_SIZE), NULL);
+  gtk_tree_sortable_set_sort_func (sortable, SORTID_DATE, sort_name_compare_func, GINT_TO_POINTER(SORTID_DATE), NULL);
+  
+  gtk_tree_sortable_set_sort_column_id (sortable, SORTID_NAME, GTK_SORT_ASCENDING);
+
+  return (list_store);
+}
+
+/**
+ * sftp_panel_set_model() - shows list_store in the tree view, keeping the sort order chosen by the user
+ */
 void
-refresh_sftp_list_store (struct Directory_List *p_dl)
+sftp_panel_set_model (GtkListStore *list_store)
+{
+  gint sort_column_id;
+  GtkSortType order;
+
+  if (list_store == list_store_fs)
+    return;
+
+  if (gtk_tree_sortable_get_sort_column_id (GTK_TREE_SORTABLE (list_store_fs), &sort_column_id, &order))
+    gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (list_store), sort_column_id, order);
+
+  gtk_tree_view_set_model (GTK_TREE_VIEW (sftp_panel.tree_view), GTK_TREE_MODEL (list_store));
+
+  list_store_fs = list_store;
+  tree_model_fs = GTK_TREE_MODEL (list_store);
+}
+
+/**
+ * sftp_panel_release_model() - frees the rows cached for p_ssh
+ */
+void
+sftp_panel_release_model (struct SSH_Info *p_ssh)
+{
+  if (p_ssh->model.list_store == NULL)
+    return;
+
+  if (p_ssh->model.list_store == list_store_fs)
+    sftp_panel_set_model (list_store_empty);
+
+  g_object_unref (p_ssh->model.list_store);
+  filter_free (&p_ssh->model.filter);
+
+  p_ssh->model.list_store = NULL;
+  p_ssh->model.valid = 0;
+  p_ssh->model.filter.pattern[0] = 0;
+}
+
+/**
+ * sftp_panel_invalidate_model() - removes the rows cached for p_ssh, must be called before releasing its directory list
+ */
+void
+sftp_panel_invalidate_model (struct SSH_Info *p_ssh)
+{
+  if (p_ssh->model.list_store)
+    gtk_list_store_clear (p_ssh->model.list_store);
+
+  p_ssh->model.valid = 0;
+}
+
+/**
+ * sftp_panel_model_is_valid() - checks if cached rows still reflect directory list and filter
+ */
+int
+sftp_panel_model_is_valid (struct SSH_Info *p_ssh)
+{
+  struct Panel_Model *p_model = &p_ssh->model;
+
+  return (p_model->list_store != NULL && p_model->valid
+          && p_model->generation == p_ssh->dirlist.generation
+          && p_model->show_hidden_files == p_ssh->dirlist.show_hidden_files
+          && p_model->filter.mode == prefs.sftp_filter_mode
+          && !strcmp (p_model->filter.pattern, p_ssh->filter ? p_ssh->match_string : ""));
+}
+
+/**
+ * refresh_sftp_list_store() - fills list_store with the entries of p_dl matching p_filter
+ * @return 0 if all the entries have been read, 1 if stopped by user
+ */
+int
+refresh_sftp_list_store (GtkListStore *list_store, struct Directory_List *p_dl, SFilter *p_filter)
 {
   struct Directory_Entry *e;
   GtkTreeIter iter;
   GdkPixbuf *icon;
   char tmp_s[1024];
-  int n=0;
+  int n=0, score;
 
-  gtk_list_store_clear (list_store_fs);
+  gtk_list_store_clear (list_store);
 
   if (p_dl == NULL)
-    return;
+    return (0);
 
   sftp_set_status ("Refreshing...");
   sftp_spinner_start ();
@@ -2609,28 +2762,25 @@ refresh_sftp_list_store (struct Directory_List *p_dl)
       if (!p_dl->show_hidden_files && is_hidden_file (e))
         goto l_continue;
 
-      if (p_ssh_current && p_ssh_current->filter && p_ssh_current->match_string[0])
-        {
-          sprintf (tmp_s, "*%s*", p_ssh_current->match_string);
-          //log_debug ("match string: '%s'\n", tmp_s);
-          if (fnmatch (tmp_s, e->name, FNM_PATHNAME) != 0)
-            goto l_continue;
-        }
+      if (!filter_match (p_filter, e->name, &score))
+        goto l_continue;
 
       //sprintf (tmp_s, "%llu", e->size);
       
-      gtk_list_store_append (list_store_fs, &iter);
+      gtk_list_store_append (list_store, &iter);
 
       icon = is_directory (e) ? pixbuf_dir : get_type_pixbuf (e->name);
       
       if (icon == NULL)
         icon = pixbuf_file;
 
-      gtk_list_store_set (list_store_fs, &iter, 
+      gtk_list_store_set (list_store, &iter, 
                           COLUMN_FILE_ICON, icon, 
                           COLUMN_FILE_NAME, e->name, 
                           COLUMN_FILE_SIZE, bytes_to_human_readable (e->size, tmp_s), 
                           COLUMN_FILE_DATE, timestamp_to_date (DATE_FORMAT, e->mtime), 
+                          COLUMN_FILE_ENTRY, e,
+                          COLUMN_FILE_SCORE, score,
                           -1);
       
       if (n % 500 == 0)
@@ -2652,6 +2802,89 @@ l_continue:
   sftp_set_status ("%d file%s", n, n == 1 ? "" : "s");
   sftp_spinner_stop ();
   sftp_end ();
+
+  return (e ? 1 : 0);
+}
+
+/**
+ * narrow_sftp_list_store() - removes the rows of list_store not matching p_filter
+ * (p_filter must narrow the filter used to fill list_store, see filter_narrows())
+ * @return the number of rows left
+ */
+int
+narrow_sftp_list_store (GtkListStore *list_store, SFilter *p_filter)
+{
+  struct Directory_Entry *e;
+  GtkTreeIter iter;
+  gboolean valid;
+  GArray *iters, *scores;
+  int i, n=0, score;
+
+  iters = g_array_new (FALSE, FALSE, sizeof (GtkTreeIter));
+  scores = g_array_new (FALSE, FALSE, sizeof (int));
+
+  valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (list_store), &iter);
+
+  while (valid)
+    {
+      gtk_tree_model_get (GTK_TREE_MODEL (list_store), &iter, COLUMN_FILE_ENTRY, &e, -1);
+
+      if (e && filter_match (p_filter, e->name, &score))
+        {
+          if (p_filter->mode == FILTER_MODE_FUZZY)
+            {
+              g_array_append_val (iters, iter);
+              g_array_append_val (scores, score);
+            }
+
+          n ++;
+          valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (list_store), &iter);
+        }
+      else
+        valid = gtk_list_store_remove (list_store, &iter);
+    }
+
+  /* update ranks once the walk is done, since rows can be moved by sorting */
+  for (i=0; i<iters->len; i++)
+    gtk_list_store_set (list_store, &g_array_index (iters, GtkTreeIter, i), 
+                        COLUMN_FILE_SCORE, g_array_index (scores, int, i), -1);
+
+  g_array_free (iters, TRUE);
+  g_array_free (scores, TRUE);
+
+  return (n);
+}
+
+/**
+ * sftp_panel_update_entry() - shows again the row of e, if present
+ */
+void
+sftp_panel_update_entry (struct SSH_Info *p_ssh, struct Directory_Entry *e)
+{
+  struct Directory_Entry *row_e;
+  GtkTreeIter iter;
+  gboolean valid;
+  char tmp_s[64];
+
+  if (p_ssh->model.list_store == NULL)
+    return;
+
+  valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (p_ssh->model.list_store), &iter);
+
+  while (valid)
+    {
+      gtk_tree_model_get (GTK_TREE_MODEL (p_ssh->model.list_store), &iter, COLUMN_FILE_ENTRY, &row_e, -1);
+
+      if (row_e == e)
+        {
+          gtk_list_store_set (p_ssh->model.list_store, &iter, 
+                              COLUMN_FILE_SIZE, bytes_to_human_readable (e->size, tmp_s), 
+                              -1);
+          break;
+        }
+
+      valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (p_ssh->model.list_store), &iter);
+    }
 }
 
 /**
@@ -2661,14 +2894,19 @@ l_continue:
 void
 refresh_sftp_panel (struct SSH_Info *p_ssh)
 {
-  gboolean sensitive;
+  gboolean sensitive, connected;
+  SFilter filter;
+  int n;
 
   sftp_clear_status ();
 
+  /* a session closed while idle is reopened by the first action on the panel */
+  connected = lt_ssh_is_connected (p_ssh) || (p_ssh && p_ssh->ssh_node && p_ssh->ssh_node->evicted);
+
   /*if (!lt_ssh_is_connected (p_ssh))
     return;*/
   
-  if (lt_ssh_is_connected (p_ssh))
+  if (connected)
     {
       //log_debug ("Checking SSH connection host=%s@%s\n", p_ssh->ssh_node->user, p_ssh->ssh_node->host);
       sftp_panel.active = 1;
@@ -2698,16 +2936,56 @@ refresh_sftp_panel (struct SSH_Info *p_ssh)
   if (sftp_panel.active)
     {
       gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(sftp_panel.check_follow), 
-                                    lt_ssh_is_connected (p_ssh) && p_ssh->follow_terminal_folder);
+                                    connected && p_ssh->follow_terminal_folder);
     }
     
   p_ssh_current = p_ssh;
 
-  //log_debug ("Refresh list store\n");
-  
-  refresh_sftp_list_store (lt_ssh_is_connected (p_ssh) ? &p_ssh->dirlist : NULL);
+  if (connected)
+    {
+      if (p_ssh->model.list_store == NULL)
+        p_ssh->model.list_store = sftp_list_store_new ();
 
-  gtk_entry_set_text (GTK_ENTRY (sftp_panel.entry_sftp_position), lt_ssh_is_connected (p_ssh) ? p_ssh->directory : "");
+      sftp_panel_set_model (p_ssh->model.list_store);
+
+      /* rebuild rows only if the directory has been read again or filter changed */
+      if (sftp_panel_model_is_valid (p_ssh))
+        {
+          n = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (p_ssh->model.list_store), NULL);
+          sftp_set_status ("%d file%s", n, n == 1 ? "" : "s");
+        }
+      else if (filter_compile (&filter, prefs.sftp_filter_mode, p_ssh->filter ? p_ssh->match_string : "") != 0)
+        {
+          /* e.g. regular expression not completely typed yet: keep current rows */
+          sftp_set_status ("%s", filter.error_s);
+        }
+      else
+        {
+          if (p_ssh->model.valid 
+              && p_ssh->model.generation == p_ssh->dirlist.generation
+              && p_ssh->model.show_hidden_files == p_ssh->dirlist.show_hidden_files
+              && filter_narrows (&filter, &p_ssh->model.filter))
+            {
+              /* only check the rows matched by the previous filter */
+              n = narrow_sftp_list_store (p_ssh->model.list_store, &filter);
+              sftp_set_status ("%d file%s", n, n == 1 ? "" : "s");
+            }
+          else
+            {
+              //log_debug ("Refresh list store\n");
+              p_ssh->model.valid = refresh_sftp_list_store (p_ssh->model.list_store, &p_ssh->dirlist, &filter) == 0;
+              p_ssh->model.generation = p_ssh->dirlist.generation;
+              p_ssh->model.show_hidden_files = p_ssh->dirlist.show_hidden_files;
+            }
+
+          filter_free (&p_ssh->model.filter);
+          memcpy (&p_ssh->model.filter, &filter, sizeof (SFilter));
+        }
+    }
+  else
+    sftp_panel_set_model (list_store_empty);
+
+  gtk_entry_set_text (GTK_ENTRY (sftp_panel.entry_sftp_position), connected ? p_ssh->directory : "");
 
   sftp_panel_show_filter (p_ssh->filter);
 
@@ -2854,16 +3132,19 @@ count_load_additional_ssh_menu ()
   return (n_ssh_menu_items);
 }
 
+/**
+ * load_types() - reads the list of file types, images are loaded when first needed
+ */
 void
 load_types ()
 {
-  char filename[256], tmp_s[128], *pc;
+  char filename[256];
   struct Type *p_type;
   XML xmldoc;
   XMLNode *node;
-  GError *error = NULL;
   
-  g_filetypes = NULL;
+  g_filetypes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  g_filetype_images = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
   
   sprintf (filename, "%s/types.xml", globals.data_dir);
   
@@ -2881,20 +3162,14 @@ load_types ()
     {
       if (!strcmp (node->name, "type"))
         {
-          p_type = (struct Type *) malloc (sizeof (struct Type));
+          p_type = g_new0 (struct Type, 1);
           
-          strcpy (p_type->id, xml_node_get_attribute (node, "id"));
+          strncpy (p_type->id, xml_node_get_attribute (node, "id"), sizeof (p_type->id) - 1);
           sprintf (p_type->imagefile, "%s/types/%s", globals.img_dir, xml_node_get_value (node));
           
           //log_debug ("type.id=%s type.imagefile=%s\n", type.id, type.imagefile);
           
-          error = NULL;
-          p_type->image = gdk_pixbuf_new_from_file (p_type->imagefile, &error);
-          
-          if (p_type->image == NULL)
-            log_write ("Can't load %s\n", p_type->imagefile);
-          
-          g_filetypes = g_list_append (g_filetypes, p_type);
+          g_hash_table_replace (g_filetypes, g_ascii_strdown (p_type->id, -1), p_type);
         }
         
       node = node->next;
@@ -2904,10 +3179,14 @@ load_types ()
 GdkPixbuf *
 get_type_pixbuf (char *filename)
 {
-  GList *item;
   struct Type *p_type;
-  char *id;
+  char *id, key[32];
+  GError *error = NULL;
+  int i;
   
+  if (g_filetypes == NULL)
+    return (NULL);
+
   /* Get file extension */
   
   id = (char *) strrchr (filename, '.');
@@ -2916,31 +3195,47 @@ get_type_pixbuf (char *filename)
     id ++;
   else
     id = basename (filename);
+
+  for (i=0; id[i] && i < sizeof (key) - 1; i++)
+    key[i] = g_ascii_tolower (id[i]);
+
+  if (id[i])
+    return (NULL); /* longer than any type id */
+
+  key[i] = 0;
   
-  item = g_list_first (g_filetypes);
+  if ((p_type = (struct Type *) g_hash_table_lookup (g_filetypes, key)) == NULL)
+    return (NULL);
 
-  while (item)
+  if (!p_type->loaded)
     {
-      p_type = (struct Type *) item->data;
-      
-      //log_debug ("id=%s vs p_type->id=%s\n", id, p_type->id);
-
-      if (!strcasecmp (id, p_type->id))
-        return (p_type->image);
+      p_type->loaded = 1;
+      p_type->image = (GdkPixbuf *) g_hash_table_lookup (g_filetype_images, p_type->imagefile);
 
-      item = g_list_next (item);
+      if (p_type->image == NULL)
+        {
+          p_type->image = gdk_pixbuf_new_from_file (p_type->imagefile, &error);
+          
+          if (p_type->image)
+            g_hash_table_insert (g_filetype_images, g_strdup (p_type->imagefile), p_type->image);
+          else
+            {
+              log_write ("Can't load %s\n", p_type->imagefile);
+              g_error_free (error);
+            }
+        }
     }
     
-  return (NULL);
+  return (p_type->image);
 }
 
-void
-show_output (char *title, char *text)
+/**
+ * output_dialog_new() - creates the window showing the output of a command
+ */
+GtkWidget *
+output_dialog_new (char *title, GtkWidget **p_text_view)
 {
   GtkWidget *dialog;
-  gsize bytes_read, bytes_written;
-  GError *error = NULL;
-  gchar *utf8;
   PangoFontDescription *font_desc;
     
   dialog = gtk_dialog_new_with_buttons (title, GTK_WINDOW(main_window), 0,
@@ -2953,7 +3248,6 @@ show_output (char *title, char *text)
   //gtk_box_set_spacing (GTK_BOX(gtk_dialog_get_content_area (GTK_DIALOG (dialog))), 10);
   //gtk_container_set_border_width (GTK_CONTAINER (dialog), 5);
 
-  GtkTextBuffer *text_buffer;
   GtkWidget *text_scrolwin, *text_view;
 
   //GtkWidget *text_vbox = gtk_vbox_new (FALSE, 0);
@@ -2964,8 +3258,6 @@ show_output (char *title, char *text)
   gtk_text_view_set_wrap_mode (GTK_TEXT_VIEW (text_view), GTK_WRAP_WORD);
   gtk_text_view_set_left_margin (GTK_TEXT_VIEW (text_view), 2);
 
-  text_buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (text_view));
-
   text_scrolwin = gtk_scrolled_window_new (NULL, NULL);
   gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (text_scrolwin),GTK_POLICY_AUTOMATIC,GTK_POLICY_AUTOMATIC);
   gtk_scrolled_window_set_shadow_type (GTK_SCROLLED_WINDOW (text_scrolwin), GTK_SHADOW_IN);
@@ -2973,14 +3265,6 @@ show_output (char *title, char *text)
   gtk_widget_show (text_view);
   gtk_widget_show_all (text_scrolwin);
 
-  if (text != NULL && text[0] != 0)
-    {
-      //utf8 = g_convert (text, -1, "UTF8", "ISO-8859-1", &bytes_read, &bytes_written, &error);
-      utf8 = g_locale_to_utf8 (text, -1, &bytes_read, &bytes_written, &error);
-      gtk_text_buffer_insert_at_cursor (text_buffer, utf8, (int) bytes_written);
-      g_free (utf8);
-    }
- 
   gtk_widget_show_all (gtk_dialog_get_content_area (GTK_DIALOG (dialog)));
   gtk_box_pack_start (GTK_BOX(gtk_dialog_get_content_area (GTK_DIALOG (dialog))), text_scrolwin, TRUE, TRUE, 0);
   
@@ -2995,8 +3279,164 @@ show_output (char *title, char *text)
       pango_font_description_free (font_desc);
     }
 
-  gint result = gtk_dialog_run (GTK_DIALOG (dialog));
-  gtk_widget_destroy (dialog);
+  *p_text_view = text_view;
+
+  return (dialog);
+}
+
+void
+output_chunk_cb (const char *chunk, int len, int is_stderr, gpointer data)
+{
+  SOutputJob *job = (SOutputJob *) data;
+
+  pthread_mutex_lock (&job->mutex);
+  g_string_append_len (job->pending, chunk, len);
+  pthread_mutex_unlock (&job->mutex);
+}
+
+gpointer
+output_thread (gpointer data)
+{
+  SOutputJob *job = (SOutputJob *) data;
+  int status;
+
+  /* closing the window cancels the command */
+  status = ssh_node_exec_stream (job->p_node, job->command, output_chunk_cb, job, &job->cancel, 0);
+
+  pthread_mutex_lock (&job->mutex);
+  job->status = status;
+  job->finished = 1;
+  pthread_mutex_unlock (&job->mutex);
+
+  return (NULL);
+}
+
+/**
+ * output_insert() - appends to the window the received text that can be converted to utf-8
+ * Characters split between chunks are kept until the rest arrives.
+ */
+void
+output_insert (SOutputJob *job, int finished)
+{
+  GtkTextBuffer *text_buffer;
+  GtkTextIter end;
+  gsize bytes_read, bytes_written;
+  GError *error = NULL;
+  gchar *utf8;
+  gsize done = 0;
+
+  text_buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (job->text_view));
+
+  while (done < job->undecoded->len)
+    {
+      utf8 = g_locale_to_utf8 (job->undecoded->str + done, job->undecoded->len - done, &bytes_read, &bytes_written, &error);
+
+      if (utf8 == NULL)
+        {
+          g_clear_error (&error);
+
+          /* convert up to the first invalid or incomplete character */
+          if (bytes_read > 0)
+            utf8 = g_locale_to_utf8 (job->undecoded->str + done, bytes_read, &bytes_read, &bytes_written, NULL);
+        }
+
+      if (utf8)
+        {
+          gtk_text_buffer_get_end_iter (text_buffer, &end);
+          gtk_text_buffer_insert (text_buffer, &end, utf8, (int) bytes_written);
+          g_free (utf8);
+          done += bytes_read;
+          continue;
+        }
+
+      /* wait for the rest of a character unless it can't be one */
+      if (!finished && job->undecoded->len - done < 8)
+        break;
+
+      gtk_text_buffer_get_end_iter (text_buffer, &end);
+      gtk_text_buffer_insert (text_buffer, &end, "?", 1);
+      done ++;
+    }
+
+  g_string_erase (job->undecoded, 0, done);
+
+  if (done > 0)
+    {
+      gtk_text_buffer_get_end_iter (text_buffer, &end);
+      gtk_text_view_scroll_to_iter (GTK_TEXT_VIEW (job->text_view), &end, 0.0, FALSE, 0.0, 0.0);
+    }
+}
+
+gboolean
+output_refresh_cb (gpointer data)
+{
+  SOutputJob *job = (SOutputJob *) data;
+  char title[512];
+  int finished;
+
+  pthread_mutex_lock (&job->mutex);
+  finished = job->finished;
+  g_string_append_len (job->undecoded, job->pending->str, job->pending->len);
+  g_string_truncate (job->pending, 0);
+  pthread_mutex_unlock (&job->mutex);
+
+  output_insert (job, finished);
+
+  if (!finished)
+    return (TRUE);
+
+  if (job->status < 0)
+    sprintf (title, "%s (can't execute command)", job->title);
+  else
+    sprintf (title, "%s (exit status %d)", job->title, job->status);
+
+  gtk_window_set_title (GTK_WINDOW (job->dialog), title);
+
+  job->timeout_id = 0;
+
+  return (FALSE);
+}
+
+/**
+ * show_command_output() - runs command in background showing its output and errors as they are received
+ * Closing the window stops the command.
+ */
+void
+show_command_output (char *title, struct SSH_Node *p_node, char *command)
+{
+  SOutputJob *job;
+  GThread *thread;
+  char running[512];
+
+  job = g_new0 (SOutputJob, 1);
+  job->p_node = p_node;
+  job->command = g_strdup (command);
+  job->pending = g_string_new ("");
+  job->undecoded = g_string_new ("");
+  pthread_mutex_init (&job->mutex, NULL);
+  strcpy (job->title, title);
+
+  sprintf (running, "%s (running)", title);
+  job->dialog = output_dialog_new (running, &job->text_view);
+
+  thread = g_thread_new ("output", output_thread, job);
+  job->timeout_id = gdk_threads_add_timeout (OUTPUT_REFRESH_MSECS, output_refresh_cb, job);
+
+  gtk_dialog_run (GTK_DIALOG (job->dialog));
+
+  if (job->timeout_id)
+    g_source_remove (job->timeout_id);
+
+  job->cancel = TRUE;
+  g_thread_join (thread);
+
+  gtk_widget_destroy (job->dialog);
+
+  pthread_mutex_destroy (&job->mutex);
+  g_string_free (job->pending, TRUE);
+  g_string_free (job->undecoded, TRUE);
+  g_free (job->command);
+  g_free (job);
 }
 
 int
@@ -4,6 +4,7 @@
 
 #include <gtk/gtk.h>
 #include <time.h>
+#include <pthread.h>
 #include "ssh.h"
 
 #define SFTP_ACTION_UPLOAD 1
@@ -43,7 +44,8 @@ struct CustomMenuItem {
 struct Type {
   char id[32];
   char imagefile[256];
-  GdkPixbuf *image;
+  GdkPixbuf *image; /* owned by the image cache, NULL until first needed */
+  int loaded;
 };
 
 /* Info for transfer window */
@@ -99,6 +101,8 @@ struct SFTP_Panel {
   GtkWidget *spinner;
   GtkWidget *button_stop;
 
+  GtkWidget *tree_view;
+
   //pthread_mutex_t mutexQueue;
   GList *queue;
 };
@@ -114,6 +118,29 @@ typedef struct MirrorFile {
 
 void sftp_panel_mirror_dump ();
 
+/* Milliseconds between updates of a command output window */
+#define OUTPUT_REFRESH_MSECS 100
+
+/* Command running in background, its output is shown while received */
+typedef struct OutputJob {
+  struct SSH_Node *p_node;
+  char *command;
+  gboolean cancel;
+  int status;
+
+  /* shared with the thread */
+  pthread_mutex_t mutex;
+  GString *pending; /* received, not yet shown */
+  int finished;
+
+  /* used by main loop only */
+  GtkWidget *dialog;
+  GtkWidget *text_view;
+  GString *undecoded; /* incomplete characters at the end of last chunk */
+  char title[256];
+  guint timeout_id;
+} SOutputJob;
+
 #define SFTP_STATUS_IMMEDIATE 1
 #define SFTP_STATUS_IDLE 2
 
@@ -143,9 +170,22 @@ int sftp_copy_file_download (sftp_session sftp, struct TransferInfo *p_ti);
 //int transfer_sftp (int action, GSList *filelist, struct SSH_Info *p_ssh, char *local_directory);
 
 void follow_terminal_folder ();
+void sftp_panel_change_directory_resume ();
+void sftp_go_home_resume ();
+void sftp_go_up_resume ();
+void sftp_refresh_resume ();
+void sftp_go_resume ();
+void sftp_toggle_follow_resume ();
+void sftp_follow_terminal_resume ();
 void sftp_panel_show_filter (gboolean show);
 GtkWidget *create_sftp_panel ();
 void refresh_sftp_panel (struct SSH_Info *p_ssh);
+GtkListStore *sftp_list_store_new ();
+void sftp_panel_set_model (GtkListStore *list_store);
+void sftp_panel_release_model (struct SSH_Info *p_ssh);
+void sftp_panel_invalidate_model (struct SSH_Info *p_ssh);
+int sftp_panel_model_is_valid (struct SSH_Info *p_ssh);
+void sftp_panel_update_entry (struct SSH_Info *p_ssh, struct Directory_Entry *e);
 void refresh_current_sftp_panel ();
 int sftp_panel_count_selected_rows ();
 GSList *sftp_panel_get_selected_files ();
@@ -166,7 +206,7 @@ void load_additional_ssh_menu (char *filename);
 int count_load_additional_ssh_menu ();
 void load_types ();
 GdkPixbuf *get_type_pixbuf (char *filename);
-void show_output (char *title, char *text);
+void show_command_output (char *title, struct SSH_Node *p_node, char *command);
 
 int sftp_queue_length ();
 int sftp_queue_count (int *nUp, int *nDown);
@@ -27,6 +27,7 @@
 #include <sys/stat.h>
 #include <libgen.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <libssh/libssh.h> 
 #include "main.h"
 #include "utils.h"
@@ -34,6 +35,17 @@
 #include "ssh.h"
 #include "sftp-panel.h"
 #include "connection_list.h"
+#include "async.h"
+#include "deadline.h"
+#include "ssh_pool.h"
+#include "keepalive.h"
+#include "ssh_helper.h"
+#include "conn_stats.h"
+#include "net_connect.h"
+#include "key_cache.h"
+#include "jump_host.h"
+#include "ssh_reaper.h"
+#include "ssh_terminal.h"
 
 extern Globals globals;
 extern Prefs prefs;
@@ -124,8 +136,19 @@ ssh_list_remove (struct SSH_List *p_ssh_list, struct SSH_Node *p_node)
     }
 }
 
+/**
+ * ssh_auth_key() - identifies the sessions that can be shared: same user, server, route and options
+ * The server is written as in jump_host_get(), key must hold SSH_NODE_KEY_LEN bytes.
+ */
+void
+ssh_auth_key (struct SSH_Auth_Data *p_auth, char *key)
+{
+  sprintf (key, "%s@%s:%d|%s|%s|%s|%s|%d", p_auth->user, p_auth->host, p_auth->port,
+           p_auth->jump, p_auth->ciphers, p_auth->macs, p_auth->kex, p_auth->compression == CONN_COMPRESSION_ON);
+}
+
 struct SSH_Node *
-ssh_list_search (struct SSH_List *p_ssh_list, char *host, char *user)
+ssh_list_search (struct SSH_List *p_ssh_list, char *key)
 {
   struct SSH_Node *node;
 
@@ -133,7 +156,7 @@ ssh_list_search (struct SSH_List *p_ssh_list, char *host, char *user)
 
   while (node)
     {
-      if (!strcmp (node->host, host) && !strcmp (node->user, user))
+      if (!strcmp (node->key, key))
         return (node);
 
       node = node->next;
@@ -142,6 +165,24 @@ ssh_list_search (struct SSH_List *p_ssh_list, char *host, char *user)
   return (NULL);
 }
 
+int
+ssh_list_contains (struct SSH_List *p_ssh_list, struct SSH_Node *p_node)
+{
+  struct SSH_Node *node;
+
+  node = p_ssh_list->head;
+
+  while (node)
+    {
+      if (node == p_node)
+        return (1);
+
+      node = node->next;
+    }
+
+  return (0);
+}
+
 void
 ssh_list_dump (struct SSH_List *p_ssh_list)
 {
@@ -275,159 +316,265 @@ verify_knownhost (ssh_session session)
   return (verifyResult);
 }
 
+void
+establish_status (struct SSH_Auth_Data *p_auth, gboolean interactive, const char *fmt, ...)
+{
+  va_list ap;
+  char message[1024];
+
+  if (!interactive)
+    return;
+
+  va_start (ap, fmt);
+  vsnprintf (message, sizeof (message), fmt, ap);
+  va_end (ap);
+
+  if (p_auth->progress)
+    p_auth->progress (message, p_auth->progress_data);
+  else if (gui_is_main_thread ())
+    sftp_set_status ("%s", message);
+}
+
+void
+establish_spinner_refresh (gboolean interactive)
+{
+  /* a connecting thread leaves the main loop running by itself */
+  if (interactive && gui_is_main_thread ())
+    sftp_spinner_refresh ();
+}
+
+/* call with connection not yet shared */
+int
+establish_cancelled (struct SSH_Node *p_node, struct SSH_Auth_Data *p_auth, SConnTiming *t)
+{
+  if (p_auth->cancel == NULL || !*p_auth->cancel)
+    return (0);
+
+  log_write ("Connection to %s@%s cancelled\n", p_auth->user, p_auth->host);
+
+  strcpy (p_auth->error_s, "Cancelled");
+  p_auth->error_code = SSH_ERR_CANCELLED;
+
+  if (p_node->session)
+    {
+      ssh_disconnect (p_node->session);
+      ssh_free (p_node->session);
+      p_node->session = NULL;
+    }
+
+  conn_stats_add (p_auth->host, p_auth->port, t, 0);
+
+  return (1);
+}
+
 /**
- * Connect to server and add node to list.
- * Reuse an existing node if present.
+ * establish_algorithms() - sets the algorithms chosen for the connection, libssh defaults are kept for the others
+ * Lists not supported by libssh are ignored, so connections don't break when it's updated.
  */
-struct SSH_Node *
-ssh_node_connect (struct SSH_List *p_ssh_list, struct SSH_Auth_Data *p_auth)
+void
+establish_algorithms (ssh_session session, struct SSH_Auth_Data *p_auth)
+{
+  if (p_auth->ciphers[0])
+    {
+      if (ssh_options_set (session, SSH_OPTIONS_CIPHERS_C_S, p_auth->ciphers) < 0
+          || ssh_options_set (session, SSH_OPTIONS_CIPHERS_S_C, p_auth->ciphers) < 0)
+        log_write ("Ciphers not supported: %s\n", p_auth->ciphers);
+    }
+
+  if (p_auth->macs[0])
+    {
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 8, 0)
+      if (ssh_options_set (session, SSH_OPTIONS_HMAC_C_S, p_auth->macs) < 0
+          || ssh_options_set (session, SSH_OPTIONS_HMAC_S_C, p_auth->macs) < 0)
+        log_write ("MACs not supported: %s\n", p_auth->macs);
+#else
+      log_write ("MACs can't be chosen with this version of libssh\n");
+#endif
+    }
+
+  if (p_auth->kex[0] && ssh_options_set (session, SSH_OPTIONS_KEY_EXCHANGE, p_auth->kex) < 0)
+    log_write ("Key exchange algorithms not supported: %s\n", p_auth->kex);
+}
+
+/**
+ * ssh_node_establish() - opens the ssh and sftp sessions of a node
+ * When interactive is FALSE nothing is shown and hosts not already known are refused,
+ * so that it can run in a background thread on a node not yet in the list.
+ * @return 0 if ok, SSH_ERR_* otherwise (error message in p_auth)
+ */
+int
+ssh_node_establish (struct SSH_Node *p_node, struct SSH_Auth_Data *p_auth, gboolean interactive)
 {
-  struct SSH_Node node, *p_node = NULL;
   GError *error = NULL;
-  int rc, valid = 0;
+  SConnTiming timing;
+  int rc, fd;
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 6, 0)
+  SKeyCacheEntry *key;
+#endif
 
-  ////////////////////////////////
-  //lockSSH (__func__, TRUE);
+  log_write ("Creating a new ssh node for %s@%s\n", p_auth->user, p_auth->host);
+
+  conn_timing_start (&timing);
   
-  memset (&node, 0, sizeof (struct SSH_Node));
+  p_node->session = ssh_new ();
   
-  /* Check if there is an active node with the same user and host */
+  if (p_node->session == NULL)
+    {
+      strcpy (p_auth->error_s, "Can't create ssh session");
+      p_auth->error_code = SSH_ERR_CONNECT;
+      return (p_auth->error_code);
+    }
+  
+  ssh_options_set (p_node->session, SSH_OPTIONS_HOST, p_auth->host);
+  ssh_options_set (p_node->session, SSH_OPTIONS_USER, p_auth->user);
+  ssh_options_set (p_node->session, SSH_OPTIONS_PORT, &p_auth->port);
+  ssh_options_set (p_node->session, SSH_OPTIONS_TIMEOUT, &prefs.ssh_timeout);
+  establish_algorithms (p_node->session, p_auth);
+
+  if (p_auth->compression == CONN_COMPRESSION_ON)
+    ssh_options_set (p_node->session, SSH_OPTIONS_COMPRESSION, "yes");
+
+  establish_status (p_auth, interactive, "Connecting to %s@%s...", p_auth->user, p_auth->host);
+
+  if (p_auth->jump[0])
+    fd = jump_connect (p_auth, interactive, &timing);
+  else
+    fd = net_connect (p_auth->host, p_auth->port, prefs.ssh_timeout * 1000, p_auth->cancel, &timing, p_auth->error_s);
 
-  if (p_node = ssh_list_search (p_ssh_list, p_auth->host, p_auth->user))
+  if (fd < 0)
     {
-      log_write ("Found ssh node for %s@%s\n", p_auth->user, p_auth->host);
+      if (establish_cancelled (p_node, p_auth, &timing))
+        return (p_auth->error_code);
 
-      if (p_auth->mode == CONN_AUTH_MODE_PROMPT && strcmp (p_auth->password, p_node->password) != 0)
-        {
-          strcpy (p_auth->error_s, "Wrong password");
-          p_auth->error_code = SSH_ERR_AUTH;
-          
-          return (NULL);
-        }
-        
-      /* Check node validity */
-      
-      ssh_channel c;
-      
-      log_write ("Tryng to open a channel on %s@%s\n", p_auth->user, p_auth->host);
-      
-      sftp_spinner_refresh ();
-      
-      if (c = ssh_node_open_channel (p_node))
-        {
-          log_write ("Channel successfully opened, close it and return\n");
-          
-          ssh_channel_close (c);
-          ssh_channel_free (c);
-          ssh_node_ref (p_node);
-          return (p_node);
-        }
-      else
-        valid = 0;
-    
-      if (!valid) {
-        log_write ("Not a valid node for to %s@%s, recreate it\n", p_auth->user, p_auth->host);
-        node.refcount = p_node->refcount;
-        ssh_node_free (p_node);
-      }
+      p_auth->error_code = SSH_ERR_CONNECT;
+      ssh_free (p_node->session);
+      p_node->session = NULL;
+      conn_stats_add (p_auth->host, p_auth->port, &timing, 0);
+      return (p_auth->error_code);
     }
 
-  log_write ("Creating a new ssh node for %s@%s\n", p_auth->user, p_auth->host);
-  
-  node.session = ssh_new ();
-  
-  if (node.session == NULL)
-    return (NULL);
+  /* closed by libssh with the session */
+  ssh_options_set (p_node->session, SSH_OPTIONS_FD, &fd);
   
-  ssh_options_set (node.session, SSH_OPTIONS_HOST, p_auth->host);
-  ssh_options_set (node.session, SSH_OPTIONS_USER, p_auth->user);
-  ssh_options_set (node.session, SSH_OPTIONS_PORT, &p_auth->port);
-  ssh_options_set (node.session, SSH_OPTIONS_TIMEOUT, &prefs.ssh_timeout);
+  rc = ssh_connect (p_node->session);
 
-  sftp_set_status ("Connecting to %s@%s...", p_auth->user, p_auth->host);
-  
-  rc = ssh_connect (node.session);
+  conn_timing_mark (&timing, CONN_PHASE_KEX);
   
   if (rc != SSH_OK)
     {
-      sprintf (p_auth->error_s, "%s", ssh_get_error (node.session));
+      sprintf (p_auth->error_s, "%s", ssh_get_error (p_node->session));
       p_auth->error_code = SSH_ERR_CONNECT;
-      ssh_free (node.session);
-      return (NULL);
+      ssh_free (p_node->session);
+      p_node->session = NULL;
+      conn_stats_add (p_auth->host, p_auth->port, &timing, 0);
+      return (p_auth->error_code);
     }
     
+  if (establish_cancelled (p_node, p_auth, &timing))
+    return (p_auth->error_code);
+
   log_write ("Verifying the server's identity...\n");
 
-  if (verify_knownhost (node.session) < 0)
+  /* nobody can be asked about unknown or changed keys in background */
+  if (interactive)
+    rc = verify_knownhost (p_node->session);
+  else
+    rc = ssh_is_server_known (p_node->session) == SSH_SERVER_KNOWN_OK ? 0 : -1;
+
+  /* includes the time the user takes to answer */
+  conn_timing_mark (&timing, CONN_PHASE_HOSTKEY);
+
+  if (rc < 0)
     {
       log_write ("Host refused\n");
 
       p_auth->error_code = SSH_ERR_HOST_NOT_VERIFIED;
       sprintf (p_auth->error_s, "Host not verified: %s\n", p_auth->host);
 
-      ssh_disconnect (node.session);
-      ssh_free (node.session);
+      ssh_disconnect (p_node->session);
+      ssh_free (p_node->session);
+      p_node->session = NULL;
+      conn_stats_add (p_auth->host, p_auth->port, &timing, 0);
 
-      return (NULL);
+      return (p_auth->error_code);
     }
 
   log_write ("Host verified\n");
 
+  if (establish_cancelled (p_node, p_auth, &timing))
+    return (p_auth->error_code);
+
 l_auth:    
-  sftp_set_status ("Authenticating %s@%s...", p_auth->user, p_auth->host);
+  establish_status (p_auth, interactive, "Authenticating %s@%s...", p_auth->user, p_auth->host);
   
   /* get authentication methods */
-  while (ssh_userauth_none (node.session, NULL) == SSH_AUTH_AGAIN)
-    sftp_spinner_refresh ();
+  while (ssh_userauth_none (p_node->session, NULL) == SSH_AUTH_AGAIN)
+    establish_spinner_refresh (interactive);
   
   if (p_auth->mode == CONN_AUTH_MODE_KEY)
     {
       log_write ("Authentication by key\n");
-      sftp_spinner_refresh ();
+      establish_spinner_refresh (interactive);
 
-      if (p_auth->identityFile[0])
-        ssh_options_set (node.session, SSH_OPTIONS_IDENTITY, p_auth->identityFile);
-      
 #if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 6, 0)
-      rc = ssh_userauth_publickey_auto (node.session, NULL, NULL);
+      rc = SSH_AUTH_DENIED;
+
+      /* the key is read and decrypted only by the first connection */
+      if (p_auth->identityFile[0] && (key = key_cache_get (p_auth->identityFile, p_auth->password, p_auth->error_s)) != NULL)
+        {
+          rc = ssh_userauth_publickey (p_node->session, NULL, key->key);
+          key_cache_release (key);
+        }
+
+      /* agent and default identities */
+      if (rc != SSH_AUTH_SUCCESS)
+        {
+          if (p_auth->identityFile[0])
+            ssh_options_set (p_node->session, SSH_OPTIONS_IDENTITY, p_auth->identityFile);
+
+          rc = ssh_userauth_publickey_auto (p_node->session, NULL, NULL);
+        }
 #else
-      rc = ssh_userauth_autopubkey (node.session, NULL);
+      if (p_auth->identityFile[0])
+        ssh_options_set (p_node->session, SSH_OPTIONS_IDENTITY, p_auth->identityFile);
+      
+      rc = ssh_userauth_autopubkey (p_node->session, NULL);
 #endif
     }
   else
     {
-      sftp_spinner_refresh ();
-      node.auth_methods = ssh_userauth_list (node.session, NULL);
+      establish_spinner_refresh (interactive);
+      p_node->auth_methods = ssh_userauth_list (p_node->session, NULL);
       
-      log_write ("auth methods for %s@%s: %d\n", p_auth->user, p_auth->host, node.auth_methods);
+      log_write ("auth methods for %s@%s: %d\n", p_auth->user, p_auth->host, p_node->auth_methods);
       
-      if (node.auth_methods & SSH_AUTH_METHOD_PASSWORD)
+      if (p_node->auth_methods & SSH_AUTH_METHOD_PASSWORD)
         {
           gsize bytes_read, bytes_written;
           
-          //rc = ssh_userauth_password (node.session, NULL, p_auth->password);
-          sftp_spinner_refresh ();
-          rc = ssh_userauth_password (node.session, NULL, 
+          //rc = ssh_userauth_password (p_node->session, NULL, p_auth->password);
+          establish_spinner_refresh (interactive);
+          rc = ssh_userauth_password (p_node->session, NULL, 
                                       g_convert (p_auth->password, strlen (p_auth->password), 
                                                  "UTF8", "ISO-8859-1", &bytes_read, &bytes_written, &error)
                                      );
           
           log_write ("auth method password returns %d\n", rc);
         }
-      else if (node.auth_methods & SSH_AUTH_METHOD_INTERACTIVE)
+      else if (p_node->auth_methods & SSH_AUTH_METHOD_INTERACTIVE)
         {
-          sftp_spinner_refresh ();
-          rc = ssh_userauth_kbdint (node.session, NULL, NULL);
+          establish_spinner_refresh (interactive);
+          rc = ssh_userauth_kbdint (p_node->session, NULL, NULL);
           
           log_write ("auth method interactive: ssh_userauth_kbdint() returns %d\n", rc);
           
           if (rc == SSH_AUTH_INFO)
             {
-              sftp_spinner_refresh ();
-              ssh_userauth_kbdint_setanswer (node.session, 0, p_auth->password);
+              establish_spinner_refresh (interactive);
+              ssh_userauth_kbdint_setanswer (p_node->session, 0, p_auth->password);
 
-              sftp_spinner_refresh ();
-              rc = ssh_userauth_kbdint (node.session, NULL, NULL); 
+              establish_spinner_refresh (interactive);
+              rc = ssh_userauth_kbdint (p_node->session, NULL, NULL); 
               
               log_write ("auth method interactive: ssh_userauth_kbdint() returns %d\n", rc);
             }
@@ -440,76 +587,176 @@ l_auth:
         {
           sprintf (p_auth->error_s, "Unknown authentication method for server %s\n", p_auth->host);
           p_auth->error_code = SSH_ERR_UNKNOWN_AUTH_METHOD;
-          ssh_disconnect (node.session);
-          ssh_free (node.session);
-          return (NULL);
+          ssh_disconnect (p_node->session);
+          ssh_free (p_node->session);
+          p_node->session = NULL;
+          conn_timing_mark (&timing, CONN_PHASE_AUTH);
+          conn_stats_add (p_auth->host, p_auth->port, &timing, 0);
+          return (p_auth->error_code);
         }
     }
     
   if (rc != SSH_AUTH_SUCCESS)
     {
-      sprintf (p_auth->error_s, "Authentication error %d: %s", rc, ssh_get_error (node.session));
+      sprintf (p_auth->error_s, "Authentication error %d: %s", rc, ssh_get_error (p_node->session));
       
       if (rc == SSH_AUTH_AGAIN)
         {
           log_write ("%s: SSH_AUTH_AGAIN\n", p_auth->host);
-          sftp_spinner_refresh ();
+          establish_spinner_refresh (interactive);
           goto l_auth;
         }
       
       p_auth->error_code = SSH_ERR_AUTH;
-      ssh_disconnect (node.session);
-      ssh_free (node.session);
-      return (NULL);
+      ssh_disconnect (p_node->session);
+      ssh_free (p_node->session);
+      p_node->session = NULL;
+      conn_timing_mark (&timing, CONN_PHASE_AUTH);
+      conn_stats_add (p_auth->host, p_auth->port, &timing, 0);
+      return (p_auth->error_code);
     }
 
+  conn_timing_mark (&timing, CONN_PHASE_AUTH);
+
   /* create an sftp session */
 
-  sftp_set_status ("Creating sftp session on %s@%s...", p_auth->user, p_auth->host);
+  establish_status (p_auth, interactive, "Creating sftp session on %s@%s...", p_auth->user, p_auth->host);
 
-  node.sftp = sftp_new (node.session);
+  p_node->sftp = sftp_new (p_node->session);
   
-  if (node.sftp == NULL)
+  if (p_node->sftp == NULL)
     {
-      sprintf (p_auth->error_s, "%s", ssh_get_error (node.session));
-      node.sftp = NULL;
+      sprintf (p_auth->error_s, "%s", ssh_get_error (p_node->session));
+      p_node->sftp = NULL;
       //return (1);
     }
   else
     {
-      sftp_set_status ("Initializing SFTP session on %s@%s...", p_auth->user, p_auth->host);
+      establish_status (p_auth, interactive, "Initializing SFTP session on %s@%s...", p_auth->user, p_auth->host);
       
-      rc = sftp_init (node.sftp);
+      rc = sftp_init (p_node->sftp);
       
       if (rc != SSH_OK)
         {
-          sprintf (p_auth->error_s, "%d", sftp_get_error (node.sftp));
-          sftp_free (node.sftp);
-          node.sftp = NULL;
+          sprintf (p_auth->error_s, "%d", sftp_get_error (p_node->sftp));
+          sftp_free (p_node->sftp);
+          p_node->sftp = NULL;
           //return (2);
         }
         
-      sftp_set_status ("%s", rc == 0 ? "sftp connected" : p_auth->error_s);
+      establish_status (p_auth, interactive, "%s", rc == 0 ? "sftp connected" : p_auth->error_s);
+    }
+
+  conn_timing_mark (&timing, CONN_PHASE_SFTP);
+  conn_stats_add (p_auth->host, p_auth->port, &timing, 1);
+
+  ssh_auth_key (p_auth, p_node->key);
+
+  p_node->auth = g_memdup (p_auth, sizeof (struct SSH_Auth_Data));
+  p_node->auth->progress = NULL;
+  p_node->auth->progress_data = NULL;
+  p_node->auth->cancel = NULL;
+
+  return (0);
+}
+
+/**
+ * Connect to server and add node to list.
+ * Reuse an existing node if present.
+ */
+struct SSH_Node *
+ssh_node_connect (struct SSH_List *p_ssh_list, struct SSH_Auth_Data *p_auth)
+{
+  struct SSH_Node node, *p_node = NULL;
+  char key[SSH_NODE_KEY_LEN];
+
+  memset (&node, 0, sizeof (struct SSH_Node));
+  ssh_auth_key (p_auth, key);
+  
+  ////////////////////////////////
+  lockSSH (__func__, TRUE);
+
+  /* Check if there is an active node with the same user, host, route and options */
+
+  if (p_node = ssh_list_search (p_ssh_list, key))
+    {
+      log_write ("Found ssh node for %s@%s%s\n", p_auth->user, p_auth->host, p_node->refcount == 0 ? " (warm)" : "");
+
+      if (p_auth->mode == CONN_AUTH_MODE_PROMPT && strcmp (p_auth->password, p_node->password) != 0)
+        {
+          strcpy (p_auth->error_s, "Wrong password");
+          p_auth->error_code = SSH_ERR_AUTH;
+          
+          lockSSH (__func__, FALSE);
+          return (NULL);
+        }
+        
+      /* Check node validity: keepalives mark it invalid if the connection is lost */
+      
+      if (ssh_node_get_validity (p_node) && p_node->session && !keepalive_socket_closed (p_node->session))
+        {
+          log_write ("Node is valid, reuse it\n");
+          
+          ssh_node_ref (p_node);
+          keepalive_schedule (p_node, p_auth->keepalive_interval);
+
+          lockSSH (__func__, FALSE);
+          return (p_node);
+        }
+    
+      log_write ("Not a valid node for to %s@%s, recreate it\n", p_auth->user, p_auth->host);
     }
 
-  if (p_node)
-    memcpy (p_node, &node, sizeof (struct SSH_Node)); /* recreated */
+  lockSSH (__func__, FALSE);
+  ////////////////////////////////
+
+  /* the node is private while connecting, so other sessions aren't blocked meanwhile */
+  if (ssh_node_establish (&node, p_auth, TRUE) != 0)
+    return (NULL);
+
+  strcpy (node.user, p_auth->user);
+  strcpy (node.password, p_auth->password);
+  strcpy (node.host, p_auth->host);
+  node.port = p_auth->port;
+  node.valid = 1;
+
+  ////////////////////////////////
+  lockSSH (__func__, TRUE);
+
+  if (p_node = ssh_list_search (p_ssh_list, key))
+    {
+      if (ssh_node_get_validity (p_node) && p_node->session && !keepalive_socket_closed (p_node->session))
+        {
+          log_write ("Node for %s@%s opened in the meantime, reuse it\n", p_auth->user, p_auth->host);
+
+          ssh_node_free (&node);
+          ssh_node_ref (p_node);
+          keepalive_schedule (p_node, p_auth->keepalive_interval);
+
+          lockSSH (__func__, FALSE);
+          return (p_node);
+        }
+
+      /* recreated: shells of the tabs die with the old session, see ssh_node_free() */
+      node.refcount = p_node->refcount;
+      node.next = p_node->next;
+      ssh_node_free (p_node);
+      memcpy (p_node, &node, sizeof (struct SSH_Node));
+    }
   else
     p_node = ssh_list_append (p_ssh_list, &node); /* new node */
   
-  strcpy (p_node->user, p_auth->user);
-  strcpy (p_node->password, p_auth->password);
-  strcpy (p_node->host, p_auth->host);
-  p_node->port = p_auth->port;
-  
   p_node->refcount = node.refcount + 1;
-  p_node->valid = 1;
   
   ssh_node_update_time (p_node);
+  keepalive_schedule (p_node, p_auth->keepalive_interval);
 
-  //lockSSH (__func__, FALSE);
+  lockSSH (__func__, FALSE);
   ////////////////////////////////
 
+  /* one more session open, close the least recently used if over the limit */
+  ssh_reaper_request ();
+
   return (p_node);
 }
 
@@ -519,6 +766,26 @@ ssh_node_free (struct SSH_Node *p_ssh_node)
   ////////////////////////////////
   //lockSSH (__func__, TRUE);
 
+  /* channels can't outlive their session */
+  if (p_ssh_node->channels > 0)
+    ssh_terminal_node_lost (p_ssh_node);
+
+  ssh_node_helper_close (p_ssh_node);
+
+  if (p_ssh_node->compressed)
+    {
+      ssh_node_free (p_ssh_node->compressed);
+      g_free (p_ssh_node->compressed);
+      p_ssh_node->compressed = NULL;
+    }
+
+  if (p_ssh_node->auth)
+    {
+      memset (p_ssh_node->auth->password, 0, sizeof (p_ssh_node->auth->password));
+      g_free (p_ssh_node->auth);
+      p_ssh_node->auth = NULL;
+    }
+
   if (p_ssh_node->sftp)
     {
       sftp_free (p_ssh_node->sftp);
@@ -539,6 +806,10 @@ ssh_node_free (struct SSH_Node *p_ssh_node)
       p_ssh_node->session = NULL;
     }
     
+  keepalive_cancel (p_ssh_node);
+  dir_cache_free (p_ssh_node);
+  du_cache_free (p_ssh_node);
+
   p_ssh_node->refcount = 0;
   ssh_node_set_validity (p_ssh_node, 0);
   
@@ -550,6 +821,7 @@ void
 ssh_node_ref (struct SSH_Node *p_ssh_node)
 {
   p_ssh_node->refcount ++;
+  p_ssh_node->idle_since = 0;
 }
 
 void 
@@ -565,6 +837,10 @@ ssh_node_unref (struct SSH_Node *p_ssh_node)
 
       log_write ("Removed %d\n", nDel);
 
+      /* the session can be handed out again to the next tab on the same host */
+      if (ssh_pool_keep (p_ssh_node))
+        return;
+
       log_debug ("Removing node %s@%s\n", p_ssh_node->user, p_ssh_node->host);
       
       ssh_node_free (p_ssh_node);
@@ -583,14 +859,7 @@ ssh_node_get_validity (struct SSH_Node *p_ssh_node)
 {
   return (p_ssh_node->valid);
 }
-/*
-int sTimeout = 0;
-void 
-AlarmHandler (int sig) 
-{ 
-  sTimeout = 1; 
-} 
-*/
+
 ssh_channel
 ssh_node_open_channel (struct SSH_Node *p_node)
 {
@@ -607,26 +876,7 @@ ssh_node_open_channel (struct SSH_Node *p_node)
       ssh_node_set_validity (p_node, 0);
       return (NULL);
     }
-/*
-  signal (SIGALRM, AlarmHandler); 
-  sTimeout = 0; 
-  alarm (2); 
-*/
-  timerStart (2);
-
-  rc = ssh_channel_open_session (channel);
-  
-  if (timedOut ())
-    {
-      log_write ("Timeout!\n");
-      rc = SSH_ERROR;
-    }
-/* 
-  signal (SIGALRM, SIG_DFL);
-  sTimeout = 0; 
-  alarm (0); 
-*/
-  timerStop ();
+  rc = ssh_channel_open_session_deadline (channel, prefs.ssh_timeout * 1000);
 
   if (rc == SSH_ERROR)
     { 
@@ -645,34 +895,23 @@ ssh_node_open_channel (struct SSH_Node *p_node)
 int
 ssh_node_keepalive (struct SSH_Node *p_ssh_node)
 {
-  ssh_channel channel;
-  
   if (p_ssh_node->session == NULL)
     return (1);
     
   log_write ("[%s] %s\n", __func__, p_ssh_node->host);
 
-  channel = ssh_channel_new (p_ssh_node->session);
-  
-  if (channel == NULL)
-    return (2);
-    
-  if (ssh_channel_open_session (channel) == SSH_ERROR)
+  if (keepalive_socket_closed (p_ssh_node->session))
     {
-      ssh_channel_free (channel);
-      return (3);
+      ssh_node_set_validity (p_ssh_node, 0);
+      return (2);
     }
-/*
-  if (ssh_channel_request_env (p_ssh_node->channel, "__TEST", "test") == SSH_ERROR 
-      && ssh_get_error_code (p_ssh_node->session) == SSH_FATAL)
+
+  /* no channel is opened, the server just discards or acknowledges the message */
+  if (keepalive_send (p_ssh_node->session) != SSH_OK)
     {
-      //ssh_channel_close (channel);
-      //ssh_channel_free (channel);
-      return (4);
+      ssh_node_set_validity (p_ssh_node, 0);
+      return (3);
     }
-*/ 
-  ssh_channel_close (channel);
-  ssh_channel_free (channel);
     
   return (0);
 }
@@ -686,45 +925,299 @@ ssh_node_update_time (struct SSH_Node *p_ssh_node)
   log_write ("%s: timestamp updated\n", p_ssh_node->host);
 }
 
-/* Directory list functions */
-
-void
-dl_init (struct Directory_List *p_dl)
+/**
+ * ssh_node_prefetch_allowed() - checks per host limits before reading a directory in background
+ */
+int
+ssh_node_prefetch_allowed (struct SSH_Node *p_ssh_node)
 {
-  p_dl->head = NULL;
-  p_dl->tail = NULL;
-  
-  p_dl->count = 0;
-}
+  time_t now = time (NULL);
 
-void
-dl_release_chain (struct Directory_Entry *p_head)
-{
-  if (p_head)
+  /* don't add load to a server already slow */
+  if (p_ssh_node->list_msecs > SSH_PREFETCH_SLOW_MSECS)
+    return (0);
+
+  if (now - p_ssh_node->prefetch_window >= 60)
     {
-      dl_release_chain (p_head->next);
-      free (p_head);
+      p_ssh_node->prefetch_window = now;
+      p_ssh_node->prefetch_count = 0;
     }
-}
 
-void
-dl_release (struct Directory_List *p_dl)
-{
-  if (!p_dl->head)
-    return;
+  if (p_ssh_node->prefetch_count >= prefs.sftp_prefetch_per_minute)
+    return (0);
 
-  dl_release_chain (p_dl->head);
+  p_ssh_node->prefetch_count ++;
 
-  p_dl->head = 0;
-  p_dl->tail = 0;
+  return (1);
 }
 
+/* Directory cache functions (call with ssh mutex locked) */
+
 void
-dl_append (struct Directory_List *p_dl, struct Directory_Entry *p_new)
+cached_directory_free (gpointer data)
 {
-  struct Directory_Entry *p_new_decl;
+  struct Cached_Directory *p_cd = (struct Cached_Directory *) data;
 
-  p_new_decl = (struct Directory_Entry *) malloc (sizeof (struct Directory_Entry));
+  dl_release (&p_cd->dirlist);
+  g_free (p_cd);
+}
+
+gboolean
+cached_directory_is_stale (gpointer key, gpointer value, gpointer user_data)
+{
+  struct Cached_Directory *p_cd = (struct Cached_Directory *) value;
+
+  return (time (NULL) - p_cd->time > prefs.sftp_prefetch_ttl);
+}
+
+/**
+ * dir_cache_put() - stores a directory list read in background, p_dl is emptied
+ */
+void
+dir_cache_put (struct SSH_Node *p_node, char *path, struct Directory_List *p_dl)
+{
+  struct Cached_Directory *p_cd;
+
+  if (p_node->dir_cache == NULL)
+    p_node->dir_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, cached_directory_free);
+
+  g_hash_table_foreach_remove (p_node->dir_cache, cached_directory_is_stale, NULL);
+
+  if (g_hash_table_size (p_node->dir_cache) >= SSH_DIR_CACHE_MAX)
+    {
+      dl_release (p_dl);
+      return;
+    }
+
+  p_cd = g_new0 (struct Cached_Directory, 1);
+  dl_move (&p_cd->dirlist, p_dl);
+  p_cd->time = time (NULL);
+
+  g_hash_table_replace (p_node->dir_cache, g_strdup (path), p_cd);
+}
+
+/**
+ * dir_cache_take() - removes the list of path from cache and moves its entries to p_dl
+ * @return 1 if found and not expired, 0 otherwise
+ */
+int
+dir_cache_take (struct SSH_Node *p_node, char *path, struct Directory_List *p_dl)
+{
+  struct Cached_Directory *p_cd;
+  int found = 0;
+
+  if (p_node->dir_cache == NULL)
+    return (0);
+
+  if ((p_cd = (struct Cached_Directory *) g_hash_table_lookup (p_node->dir_cache, path)) == NULL)
+    return (0);
+
+  if (!cached_directory_is_stale (NULL, p_cd, NULL))
+    {
+      memset (p_dl, 0, sizeof (struct Directory_List));
+      dl_move (p_dl, &p_cd->dirlist);
+      found = 1;
+    }
+
+  /* a list is used once, refreshing reads the directory again */
+  g_hash_table_remove (p_node->dir_cache, path);
+
+  return (found);
+}
+
+int
+dir_cache_contains (struct SSH_Node *p_node, char *path)
+{
+  return (p_node->dir_cache && g_hash_table_lookup (p_node->dir_cache, path) != NULL);
+}
+
+void
+dir_cache_free (struct SSH_Node *p_node)
+{
+  if (p_node->dir_cache)
+    g_hash_table_destroy (p_node->dir_cache);
+
+  p_node->dir_cache = NULL;
+}
+
+/* Directory size functions (main thread only) */
+
+void
+du_cache_put (struct SSH_Node *p_node, char *path, long long unsigned int size)
+{
+  struct Directory_Size *p_ds;
+
+  if (p_node->du_cache == NULL)
+    p_node->du_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  p_ds = g_new0 (struct Directory_Size, 1);
+  p_ds->size = size;
+  p_ds->time = time (NULL);
+
+  g_hash_table_replace (p_node->du_cache, g_strdup (path), p_ds);
+}
+
+/**
+ * du_cache_lookup() - gets the size of path computed by the last "compute sizes"
+ * @return 1 if found and not expired, 0 otherwise
+ */
+int
+du_cache_lookup (struct SSH_Node *p_node, char *path, long long unsigned int *size)
+{
+  struct Directory_Size *p_ds;
+
+  if (p_node->du_cache == NULL)
+    return (0);
+
+  if ((p_ds = (struct Directory_Size *) g_hash_table_lookup (p_node->du_cache, path)) == NULL)
+    return (0);
+
+  if (time (NULL) - p_ds->time > prefs.sftp_du_cache_ttl)
+    {
+      g_hash_table_remove (p_node->du_cache, path);
+      return (0);
+    }
+
+  *size = p_ds->size;
+
+  return (1);
+}
+
+void
+du_cache_free (struct SSH_Node *p_node)
+{
+  if (p_node->du_cache)
+    g_hash_table_destroy (p_node->du_cache);
+
+  p_node->du_cache = NULL;
+}
+
+/**
+ * dl_apply_du_cache() - shows the computed sizes for subdirectories of directory
+ */
+void
+dl_apply_du_cache (struct SSH_Node *p_node, struct Directory_List *p_dl, char *directory)
+{
+  struct Directory_Entry *e;
+  char path[2048];
+
+  if (p_node->du_cache == NULL || g_hash_table_size (p_node->du_cache) == 0)
+    return;
+
+  for (e = p_dl->head; e; e = e->next)
+    {
+      if (!is_directory (e))
+        continue;
+
+      sprintf (path, "%s/%s", strcmp (directory, "/") ? directory : "", e->name);
+      du_cache_lookup (p_node, path, &e->size);
+    }
+}
+
+/* Directory list functions */
+
+void
+dl_init (struct Directory_List *p_dl)
+{
+  p_dl->head = NULL;
+  p_dl->tail = NULL;
+  
+  p_dl->count = 0;
+}
+
+void
+dl_release_chain (struct Directory_Entry *p_head)
+{
+  if (p_head)
+    {
+      dl_release_chain (p_head->next);
+      g_free (p_head->collate_key);
+      free (p_head);
+    }
+}
+
+void
+dl_release (struct Directory_List *p_dl)
+{
+  if (!p_dl->head)
+    return;
+
+  dl_release_chain (p_dl->head);
+
+  p_dl->head = 0;
+  p_dl->tail = 0;
+  p_dl->count = 0;
+}
+
+/**
+ * dl_move() - moves the entries of p_src to p_dest (which must be empty)
+ */
+void
+dl_move (struct Directory_List *p_dest, struct Directory_List *p_src)
+{
+  p_dest->head = p_src->head;
+  p_dest->tail = p_src->tail;
+  p_dest->count = p_src->count;
+
+  p_src->head = 0;
+  p_src->tail = 0;
+  p_src->count = 0;
+}
+
+/**
+ * dl_read() - appends the entries of an open directory to p_dl
+ * @param interactive shows progress in the sftp panel and can be stopped by user (gui thread only)
+ * @return the number of entries read
+ */
+int
+dl_read (struct SSH_Node *p_node, sftp_dir dir, struct Directory_List *p_dl, char *path, gboolean interactive)
+{
+  struct Directory_Entry entry;
+  sftp_attributes attributes;
+  int n = 0;
+
+  while ((attributes = sftp_readdir (p_node->sftp, dir)) != NULL)
+    {
+      if (interactive && sftp_stoped_by_user ())
+        {
+          sftp_attributes_free (attributes);
+          break;
+        }
+
+      memset (&entry, 0, sizeof (struct Directory_Entry));
+
+      strcpy (entry.name, attributes->name);
+      entry.type = attributes->type;
+      entry.size = attributes->size;
+      entry.mtime = attributes->mtime;
+      //log_debug ("appending %s\n", entry.name);
+      strcpy (entry.owner, attributes->owner ? attributes->owner : "?");
+      strcpy (entry.group, attributes->group ? attributes->group : "?");
+      entry.permissions = attributes->permissions;
+
+      if (prefs.sftp_natural_sort)
+        entry.collate_key = g_utf8_collate_key_for_filename (entry.name, -1);
+      else
+        entry.collate_key = g_utf8_collate_key (entry.name, -1);
+
+      dl_append (p_dl, &entry);
+
+      sftp_attributes_free (attributes);
+      n ++;
+      
+      if (interactive && (n >= 200) && (n % 100 == 0))
+        sftp_set_status (_("Reading directory %s (%d files)..."), path, n);
+    }
+
+  return (n);
+}
+
+void
+dl_append (struct Directory_List *p_dl, struct Directory_Entry *p_new)
+{
+  struct Directory_Entry *p_new_decl;
+
+  p_new_decl = (struct Directory_Entry *) malloc (sizeof (struct Directory_Entry));
 
   memset (p_new_decl, 0, sizeof (struct Directory_Entry));
   memcpy (p_new_decl, p_new, sizeof (struct Directory_Entry));
@@ -795,19 +1288,24 @@ dl_dump (struct Directory_List *p_dl)
 void
 lt_ssh_init (struct SSH_Info *p_ssh)
 {
+  sftp_panel_release_model (p_ssh);
   memset (p_ssh, 0, sizeof (struct SSH_Info));
 }
 
+/**
+ * lt_ssh_connect() - connects p_ssh to a node of the list, opening it if needed
+ * Can run in a thread other than the main one: message boxes are shown in the main loop
+ * and progress goes to p_auth->progress.
+ * @return 0 if ok, SSH_ERR_* otherwise
+ */
 int
 lt_ssh_connect (struct SSH_Info *p_ssh, struct SSH_List *p_ssh_list, struct SSH_Auth_Data *p_auth)
 {
   struct SSH_Node *p_node;
   int rc = 0;
 
-  ////////////////////////////////
-  lockSSH (__func__, TRUE);
-  
-  sftp_spinner_start ();
+  if (gui_is_main_thread ())
+    sftp_spinner_start ();
   
   if ((p_node = ssh_node_connect (p_ssh_list, p_auth)) == NULL)
     {
@@ -817,15 +1315,23 @@ lt_ssh_connect (struct SSH_Info *p_ssh, struct SSH_List *p_ssh_list, struct SSH_
     }
   else
     {
+      ////////////////////////////////
+      lockSSH (__func__, TRUE);
+
       p_ssh->ssh_node = p_node;
+
+      lockSSH (__func__, FALSE);
+      ////////////////////////////////
+
+      /* takes the ssh mutex while reading */
       lt_ssh_getenv (p_ssh, "HOME", p_ssh->home);
     }
     
-  sftp_clear_status ();
-  sftp_spinner_stop ();
-
-  lockSSH (__func__, FALSE);
-  ////////////////////////////////
+  if (gui_is_main_thread ())
+    {
+      sftp_clear_status ();
+      sftp_spinner_stop ();
+    }
 
   return (rc);
 }
@@ -879,78 +1385,34 @@ lt_ssh_is_connected (struct SSH_Info *p_ssh)
   return (connected);
 }
 
+/**
+ * lt_ssh_getenv() - reads a variable of the remote environment, value must hold 1024 bytes
+ */
 int
 lt_ssh_getenv (struct SSH_Info *p_ssh, char *variable, char *value)
 {
-  ssh_channel channel;
-  char stmt[256];
-  int rc;
-  char buffer[256];
-  unsigned int nbytes;
+  GString *output, *error;
+  char command[256];
+  int status;
 
-  ////////////////////////////////
-  //lockSSH (__func__, TRUE);
+  sprintf (command, "echo ${%s}", variable);
 
-  if ((channel = ssh_node_open_channel (p_ssh->ssh_node)) == NULL)
-    return (1);
-  
-  sprintf (stmt, "echo ${%s}", variable);
-  
-  log_debug ("%s\n", stmt);
-  
-  rc = ssh_channel_request_exec (channel, stmt);
+  output = g_string_new ("");
+  error = g_string_new ("");
 
-  if (rc != SSH_OK)
+  if ((status = ssh_node_exec_buffer (p_ssh->ssh_node, command, output, error, NULL, prefs.sftp_timeout * 1000)) >= 0)
     {
-      log_write ("Error: can't execute statement: %s\n", stmt);
-      ssh_channel_close (channel);
-      ssh_channel_free (channel);
-      ssh_node_set_validity (p_ssh->ssh_node, 0);
-      return (rc);
-    }
-
-  strcpy (value, "");
-  
-  log_debug ("Reading...\n");
-
-  nbytes = ssh_channel_read (channel, buffer, sizeof (buffer), 0);
-
-  while (nbytes > 0)
-    {
-      log_debug ("Read %d bytes\n", nbytes);
-      
-      buffer [nbytes] = 0;
-      strcat (value, buffer);
-      nbytes = ssh_channel_read (channel, buffer, sizeof (buffer), 0);
-    }
-
-  if (nbytes < 0)
-    {
-      log_write ("Error: can't execute statement: %s\n", stmt);
-      ssh_channel_close (channel);
-      ssh_channel_free (channel);
-      ssh_node_set_validity (p_ssh->ssh_node, 0);
-      return (SSH_ERROR);
+      g_strlcpy (value, output->str, 1024);
+      trim (value);
+      log_debug ("%s=%s\n", variable, value);
     }
-    
-  log_debug ("Value successfully read\n");
-
-  trim (value);
-
-  log_debug ("%s=%s\n", variable, value);
-  
-  log_write ("Closing channel on %s@%s\n", p_ssh->ssh_node->user, p_ssh->ssh_node->host);
-  
-  ssh_channel_send_eof (channel);
-  ssh_channel_close (channel);
-  ssh_channel_free (channel);
-  
-  ssh_node_update_time (p_ssh->ssh_node);
+  else
+    log_write ("Error: can't read %s on %s@%s\n", variable, p_ssh->ssh_node->user, p_ssh->ssh_node->host);
 
-  //lockSSH (__func__, FALSE);
-  ////////////////////////////////
+  g_string_free (output, TRUE);
+  g_string_free (error, TRUE);
 
-  return (0);
+  return (status < 0 ? 1 : 0);
 }
 /*
 int
@@ -1009,17 +1471,24 @@ sftp_normalize_directory (struct SSH_Info *p_ssh, char *path)
 int
 sftp_refresh_directory_list (struct SSH_Info *p_ssh)
 {
-  int n, nh = 0, retCode=0;
-  struct Directory_Entry entry;
+  int retCode=0;
   sftp_dir dir;
-  sftp_attributes attributes;
   char /*home[256],*/ *tmp;
+  struct Directory_List prefetched;
+  SDeadline deadline;
+  gint64 start;
+
+  /* the session could have been closed while idle, the main thread lists it again once reopened */
+  lt_ssh_ensure_connected (p_ssh, sftp_refresh_resume);
 
   ////////////////////////////////
   lockSSH (__func__, TRUE);
 
   if (!lt_ssh_is_connected (p_ssh))
-    return (1);
+    {
+      lockSSH (__func__, FALSE);
+      return (1);
+    }
   
   log_debug ("$HOME=%s\n", p_ssh->home);
 
@@ -1031,71 +1500,69 @@ sftp_refresh_directory_list (struct SSH_Info *p_ssh)
   else
     strcpy (p_ssh->directory, p_ssh->home);
 
+  /* use the list read in background, if any */
+
+  if (dir_cache_take (p_ssh->ssh_node, p_ssh->directory, &prefetched))
+    {
+      log_debug ("Prefetched %s\n", p_ssh->directory);
+
+      /* panel rows point to the entries being released */
+      sftp_panel_invalidate_model (p_ssh);
+
+      dl_release (&p_ssh->dirlist);
+      dl_move (&p_ssh->dirlist, &prefetched);
+      p_ssh->dirlist.generation ++;
+
+      dl_apply_du_cache (p_ssh->ssh_node, &p_ssh->dirlist, p_ssh->directory);
+
+      update_statusbar ();
+
+      lockSSH (__func__, FALSE);
+
+      async_prefetch_subdirectories (p_ssh);
+
+      return (0);
+    }
+
   sftp_set_status (_("Opening directory %s..."), p_ssh->directory);
   
-  /* set timeout */
-/*
-  signal (SIGALRM, AlarmHandler); 
-  sTimeout = 0; 
-  alarm (2); 
-*/
-  timerStart (2);
-  
+  start = g_get_monotonic_time ();
+
+  deadline_watch (&deadline, p_ssh->ssh_node->session, "sftp_opendir", prefs.sftp_timeout * 1000);
+
   dir = sftp_opendir (p_ssh->ssh_node->sftp, p_ssh->directory[0] ? p_ssh->directory : ".");
 
-  if (timedOut ())
+  if (deadline_unwatch (&deadline))
     {
-      log_write ("Timeout!\n");
+      /* the socket has been shut down */
+      if (dir)
+        sftp_closedir (dir);
+
       dir = NULL;
+      ssh_node_set_validity (p_ssh->ssh_node, 0);
     }
-/*    
-  signal (SIGALRM, SIG_DFL);
-  sTimeout = 0; 
-  alarm (0); 
-*/
-  timerStop ();
   
   if (dir)
     {
+      /* panel rows point to the entries being released */
+      sftp_panel_invalidate_model (p_ssh);
+
       dl_release (&p_ssh->dirlist);
+      p_ssh->dirlist.generation ++;
 
       sftp_set_status (_("Reading directory %s..."), p_ssh->directory);
       
       sftp_spinner_start ();
       sftp_begin ();
       
-      n = 0;
-      while ((attributes = sftp_readdir (p_ssh->ssh_node->sftp, dir)) != NULL)
-        {
-          if (sftp_stoped_by_user ())
-            break;
-
-          memset (&entry, 0, sizeof (struct Directory_Entry));
-
-          strcpy (entry.name, attributes->name);
-          entry.type = attributes->type;
-          entry.size = attributes->size;
-          entry.mtime = attributes->mtime;
-          //log_debug ("appending %s\n", entry.name);
-          strcpy (entry.owner, attributes->owner ? attributes->owner : "?");
-          strcpy (entry.group, attributes->group ? attributes->group : "?");
-          entry.permissions = attributes->permissions;
-
-          dl_append (&p_ssh->dirlist, &entry);
-
-          sftp_attributes_free (attributes);
-          n ++;
-          
-          if (is_hidden_file (&entry))
-            nh ++;
-          
-          if ((n >= 200) && (n % 100 == 0))
-            sftp_set_status (_("Reading directory %s (%d files)..."), p_ssh->directory, n);
-        }
+      dl_read (p_ssh->ssh_node, dir, &p_ssh->dirlist, p_ssh->directory, TRUE);
 
       sftp_closedir (dir);
       
+      p_ssh->ssh_node->list_msecs = (g_get_monotonic_time () - start) / 1000;
       ssh_node_update_time (p_ssh->ssh_node);
+
+      dl_apply_du_cache (p_ssh->ssh_node, &p_ssh->dirlist, p_ssh->directory);
       
       //sftp_set_status (_("%d file%s in %s (%d hidden)"), n, n != 1 ? "s" : "", p_ssh->directory, nh);
       update_statusbar ();
@@ -1110,89 +1577,287 @@ sftp_refresh_directory_list (struct SSH_Info *p_ssh)
 
   lockSSH (__func__, FALSE);
   ////////////////////////////////
+
+  if (retCode == 0)
+    async_prefetch_subdirectories (p_ssh);
   
   return (retCode);
 }
 
+/**
+ * sftp_prefetch_directory() - reads path in background and keeps it in the node cache
+ * (called with ssh mutex locked, doesn't touch the gui)
+ */
 int
-lt_ssh_exec (struct SSH_Info *p_ssh, char *command, char *output, int outlen, char *error, int errlen)
+sftp_prefetch_directory (struct SSH_Node *p_node, char *path)
 {
+  sftp_dir dir;
+  struct Directory_List dl;
+  gint64 start;
+
+  start = g_get_monotonic_time ();
+
+  if ((dir = sftp_opendir (p_node->sftp, path)) == NULL)
+    return (1);
+
+  memset (&dl, 0, sizeof (struct Directory_List));
+  dl_read (p_node, dir, &dl, path, FALSE);
+
+  sftp_closedir (dir);
+
+  p_node->list_msecs = (g_get_monotonic_time () - start) / 1000;
+
+  log_debug ("%s:%s %d files in %d ms\n", p_node->host, path, dl.count, p_node->list_msecs);
+
+  dir_cache_put (p_node, path, &dl);
+
+  return (0);
+}
+
+/**
+ * ssh_node_exec_channel() - runs command on a channel of its own (see ssh_node_exec_stream())
+ */
+int
+ssh_node_exec_channel (struct SSH_Node *p_node, char *command, SSHExecCallback chunk_cb, gpointer data, gboolean *cancel, int timeout)
+{
+  ssh_session session;
   ssh_channel channel;
-  int rc;
-  char buffer[32];
-  unsigned int nbytes;
+  char out[16384], err[4096];
+  int nout, nerr, eof = 0, expired = 0, status = -1;
+  SDeadline d;
 
-  ////////////////////////////////
   lockSSH (__func__, TRUE);
 
-  if ((channel = ssh_node_open_channel (p_ssh->ssh_node)) == NULL)
-    return (1);
-  
-  //ssh_channel_request_shell (channel);
-  
-  rc = ssh_channel_request_exec (channel, command);
+  if (!ssh_list_contains (&globals.ssh_list, p_node) || !ssh_node_get_validity (p_node)
+      || (channel = ssh_node_open_channel (p_node)) == NULL)
+    {
+      lockSSH (__func__, FALSE);
+      return (-1);
+    }
 
-  if (rc != SSH_OK)
+  if (ssh_channel_request_exec_deadline (channel, command, prefs.ssh_timeout * 1000) != SSH_OK)
     {
-      log_debug ("error\n");
+      ssh_channel_close (channel);
+      ssh_channel_free (channel);
+      lockSSH (__func__, FALSE);
+      return (-1);
     }
 
+  session = p_node->session;
 
-  /* Read output */
-  
-  strcpy (output, "");
-  
-  nbytes = ssh_channel_read (channel, buffer, sizeof (buffer), 0);
+  lockSSH (__func__, FALSE);
+
+  deadline_start (&d, timeout);
 
-  while (nbytes > 0)
+  while (!(cancel && *cancel))
     {
-      buffer [nbytes] = 0;
-      strcat (output, buffer);
-      nbytes = ssh_channel_read (channel, buffer, sizeof (buffer), 0);
-      
-      if (strlen (output) + nbytes > outlen)
+      lockSSH (__func__, TRUE);
+
+      /* the channel has been freed with the session of the node */
+      if (!ssh_list_contains (&globals.ssh_list, p_node) || p_node->session != session)
+        {
+          lockSSH (__func__, FALSE);
+          log_write ("Session closed while running: %s\n", command);
+          channel = NULL;
+          break;
+        }
+
+      nout = ssh_channel_read_nonblocking (channel, out, sizeof (out), 0);
+      nerr = nout >= 0 ? ssh_channel_read_nonblocking (channel, err, sizeof (err), 1) : 0;
+      eof = ssh_channel_is_eof (channel);
+
+      lockSSH (__func__, FALSE);
+
+      if (nout < 0 || nerr < 0)
         break;
-    }
 
-  /* Read error */
-  
-  strcpy (error, "");
-  
-  nbytes = ssh_channel_read (channel, buffer, sizeof (buffer), 1);
+      if (nout > 0)
+        chunk_cb (out, nout, 0, data);
 
-  while (nbytes > 0)
-    {
-      buffer [nbytes] = 0;
-      strcat (error, buffer);
-      nbytes = ssh_channel_read (channel, buffer, sizeof (buffer), 1);
-      
-      //printf ("%d > %d\n", (int) strlen (error) + nbytes, errlen);
-      
-      if (strlen (error) + nbytes > errlen)
+      if (nerr > 0)
+        chunk_cb (err, nerr, 1, data);
+
+      if (nout > 0 || nerr > 0)
+        {
+          deadline_start (&d, timeout);
+          continue;
+        }
+
+      if (eof)
         break;
-    }  
 
-/*
-  if (nbytes < 0)
-    {
-      
-    }*/
+      if ((expired = deadline_expired (&d)))
+        {
+          log_write ("Command not responding, closing it: %s\n", command);
+          break;
+        }
+
+      g_usleep (G_USEC_PER_SEC / 50);
+    }
+
+  if (channel == NULL)
+    return (-1);
+
+  lockSSH (__func__, TRUE);
+
+  if (!(cancel && *cancel) && !expired)
+    status = ssh_channel_get_exit_status (channel);
 
   ssh_channel_send_eof (channel);
   ssh_channel_close (channel);
   ssh_channel_free (channel);
-  
-  if (rc == SSH_OK)
+  ssh_node_update_time (p_node);
+
+  lockSSH (__func__, FALSE);
+
+  return (status);
+}
+
+/**
+ * ssh_node_exec_stream() - runs command and passes its output to chunk_cb as soon as it is received
+ * The command runs in the helper shell of the node if enabled and free, on a channel of its own otherwise.
+ * Standard output and error are read alternately, chunk_cb is called in the calling thread.
+ * The ssh mutex is taken only while reading, so the command can last long in a background thread.
+ * The command is abandoned when cancelled or when silent for timeout milliseconds (0 for no limit).
+ * @return exit status of the command, -1 if it could not be run, has failed or has been cancelled
+ */
+int
+ssh_node_exec_stream (struct SSH_Node *p_node, char *command, SSHExecCallback chunk_cb, gpointer data, gboolean *cancel, int timeout)
+{
+  int rc, status = -1;
+
+  if (prefs.ssh_helper_channel)
     {
-      ssh_node_update_time (p_ssh->ssh_node);
-      rc = 0;
+      rc = ssh_node_helper_stream (p_node, command, chunk_cb, data, cancel, timeout, &status);
+
+      /* a command possibly run is never run again */
+      if (rc == SSH_HELPER_OK)
+        return (status);
+      else if (rc == SSH_HELPER_FAILED)
+        return (-1);
     }
 
-  ////////////////////////////////
-  lockSSH (__func__, FALSE);
+  return (ssh_node_exec_channel (p_node, command, chunk_cb, data, cancel, timeout));
+}
+
+/* Output of a command collected by ssh_node_exec_buffer() */
+typedef struct ExecBuffers {
+  GString *output;
+  GString *error;
+} SExecBuffers;
+
+void
+exec_buffer_chunk (const char *chunk, int len, int is_stderr, gpointer data)
+{
+  SExecBuffers *b = (SExecBuffers *) data;
+
+  g_string_append_len (is_stderr ? b->error : b->output, chunk, len);
+}
+
+/**
+ * ssh_node_exec_buffer() - runs command collecting the whole output, buffers grow as needed
+ * @return exit status of the command, -1 if it could not be run or has been cancelled
+ */
+int
+ssh_node_exec_buffer (struct SSH_Node *p_node, char *command, GString *output, GString *error, gboolean *cancel, int timeout)
+{
+  SExecBuffers b;
+
+  b.output = output;
+  b.error = error;
+
+  return (ssh_node_exec_stream (p_node, command, exec_buffer_chunk, &b, cancel, timeout));
+}
+
+/* Line splitting for ssh_node_exec_lines() */
+typedef struct ExecLines {
+  void (*line_cb) (char *line, gpointer data);
+  gpointer data;
+  GString *partial;
+} SExecLines;
+
+void
+exec_lines_chunk (const char *chunk, int len, int is_stderr, gpointer data)
+{
+  SExecLines *l = (SExecLines *) data;
+  char *line, *nl;
+
+  if (is_stderr)
+    return;
+
+  g_string_append_len (l->partial, chunk, len);
+  line = l->partial->str;
+
+  while ((nl = strchr (line, '\n')) != NULL)
+    {
+      *nl = 0;
+      l->line_cb (line, l->data);
+      line = nl + 1;
+    }
+
+  g_string_erase (l->partial, 0, line - l->partial->str);
+}
+
+/**
+ * ssh_node_exec_lines() - runs command and passes every line of its output to line_cb as soon as it is received
+ * The ssh mutex is taken only while reading, so the command can last long in a background thread.
+ * @return exit status of the command, -1 if it could not be run or has been cancelled
+ */
+int
+ssh_node_exec_lines (struct SSH_Node *p_node, char *command, void (*line_cb) (char *line, gpointer data), gpointer data, gboolean *cancel)
+{
+  SExecLines l;
+  int status;
+
+  l.line_cb = line_cb;
+  l.data = data;
+  l.partial = g_string_new ("");
+
+  /* the command can be quiet for long, cancel stops it */
+  status = ssh_node_exec_stream (p_node, command, exec_lines_chunk, &l, cancel, 0);
+
+  g_string_free (l.partial, TRUE);
+
+  return (status);
+}
+
+/**
+ * lt_ssh_exec_buffer() - runs command on the node of a tab collecting its whole output
+ * Called by the main thread: a command silent for prefs.ssh_timeout seconds is abandoned.
+ * @return 0 if the command has been executed, not zero otherwise
+ */
+int
+lt_ssh_exec_buffer (struct SSH_Info *p_ssh, char *command, GString *output, GString *error)
+{
+  return (ssh_node_exec_buffer (p_ssh->ssh_node, command, output, error, NULL, prefs.ssh_timeout * 1000) < 0 ? 1 : 0);
+}
+
+/**
+ * lt_ssh_exec() - runs command copying its output to fixed size buffers, truncated if longer
+ */
+int
+lt_ssh_exec (struct SSH_Info *p_ssh, char *command, char *output, int outlen, char *error, int errlen)
+{
+  GString *out, *err;
+  int rc;
+
+  out = g_string_new ("");
+  err = g_string_new ("");
+
+  rc = lt_ssh_exec_buffer (p_ssh, command, out, err);
+
+  if (out->len >= outlen || err->len >= errlen)
+    log_write ("Output of %s truncated\n", command);
+
+  g_strlcpy (output, out->str, outlen);
+  g_strlcpy (error, err->str, errlen);
+
+  g_string_free (out, TRUE);
+  g_string_free (err, TRUE);
 
   return (rc);
 }
+
 /*
 int
 lt_mount (struct SSH_Info *p_ssh, char *source, char *target, char *error)
@@ -2,14 +2,24 @@
 #ifndef _SSH_H
 #define _SSH_H
 
+#include <gtk/gtk.h>
 #include <libssh/libssh.h> 
 #include <libssh/sftp.h>
 #include <time.h>
+#include "filter.h"
+#include "conn_stats.h"
 
 #define SSH_ERR_CONNECT 1
 #define SSH_ERR_AUTH 2
 #define SSH_ERR_UNKNOWN_AUTH_METHOD 3
 #define SSH_ERR_HOST_NOT_VERIFIED 4
+#define SSH_ERR_CANCELLED 5
+
+/* Prefetch is suspended on hosts taking longer to list a directory */
+#define SSH_PREFETCH_SLOW_MSECS 1000
+
+/* Maximum number of prefetched directories kept for every host */
+#define SSH_DIR_CACHE_MAX 64
 
 struct Directory_Entry
   {
@@ -20,6 +30,7 @@ struct Directory_Entry
     char owner[32];
     char group[32];
     uint32_t permissions;   
+    char *collate_key; /* computed once, used for sorting by name */
 
     struct Directory_Entry *next;
   };
@@ -31,12 +42,42 @@ struct Directory_List
 
     int show_hidden_files;
     int count;
+    unsigned int generation; /* incremented every time the list is read again */
+  };
+
+struct Cached_Directory
+  {
+    struct Directory_List dirlist;
+    time_t time;
+  };
+
+struct Directory_Size
+  {
+    long long unsigned int size; /* recursive size */
+    time_t time;
+  };
+
+/**
+ * struct Panel_Model
+ * sftp panel rows built from a directory list
+ * Kept per tab and swapped into the tree view when switching tabs
+ */
+struct Panel_Model
+  {
+    GtkListStore *list_store;
+    int valid;
+    unsigned int generation; /* directory list generation the rows were built from */
+    int show_hidden_files;
+    SFilter filter; /* pattern is empty if filter is off */
   };
  
+/* Length of the key identifying the sessions that can be shared (user, server, jump host and options) */
+#define SSH_NODE_KEY_LEN 1280
+
 /**
  * struct SSH_Node
  * ssh/sftp information node
- * Shared between tabs connected to the same host and user
+ * Shared between tabs connected to the same host and user, through the same route and with the same options
  */ 
 struct SSH_Node
   {
@@ -48,10 +89,35 @@ struct SSH_Node
     char user[32];
     char password[32];
     int port;
+    char key[SSH_NODE_KEY_LEN]; /* see ssh_auth_key() */
     
     int refcount;
     int valid;
     time_t last;
+    time_t idle_since; /* not used by any tab, kept warm by the connection pool */
+    time_t evicted;    /* session closed while idle, reopened when needed (see ssh_reaper.c) */
+    int channels;      /* shells running on the session, which can't be closed while idle */
+
+    /* prefetched directory lists (struct Cached_Directory by path) */
+    GHashTable *dir_cache;
+    time_t prefetch_window;
+    int prefetch_count;
+    int list_msecs; /* time taken by last directory listing */
+
+    /* recursive sizes of directories (struct Directory_Size by path), used by main thread only */
+    GHashTable *du_cache;
+
+    /* shell running commands without opening a channel each time (see ssh_helper.c) */
+    ssh_channel helper;
+    char helper_mark[40];
+    unsigned int helper_run; /* command running in the helper, 0 if free */
+
+    /* parameters the node has been established with, to open more sessions to the same server */
+    struct SSH_Auth_Data *auth;
+
+    /* compressed session used by transfers in auto compression mode (see transfer_compression.c) */
+    struct SSH_Node *compressed;
+
     struct SSH_Node *next;
   };
   
@@ -81,9 +147,18 @@ struct SSH_Info
     /* toggle flags */
     int follow_terminal_folder;
     int filter;
+    int compression; /* CONN_COMPRESSION_* of the connection */
     char match_string[1024];
+
+    struct Panel_Model model;
   };
   
+/* Receives the phases of a connection (called by the connecting thread) */
+typedef void (*SSHProgressCallback) (const char *message, gpointer data);
+
+/* Receives a chunk of the output of a command, is_stderr is 1 for standard error */
+typedef void (*SSHExecCallback) (const char *chunk, int len, int is_stderr, gpointer data);
+
 struct SSH_Auth_Data
   {
     char host[32];
@@ -93,6 +168,15 @@ struct SSH_Auth_Data
     int sftp_enabled;
     int mode;
     char identityFile[512];
+    int keepalive_interval; /* seconds, 0 for no keepalives */
+    char ciphers[256];      /* algorithms in order of preference, comma separated, empty for defaults */
+    char macs[256];
+    char kex[256];
+    int compression;        /* compress the whole session (CONN_COMPRESSION_ON only) */
+    char jump[256];         /* jump host (see jump_auth()), empty to connect directly */
+    SSHProgressCallback progress; /* status bar is used if NULL */
+    gpointer progress_data;
+    gboolean *cancel;       /* set by another thread to stop connecting */
     
     int error_code;
     char error_s[512];
@@ -102,9 +186,12 @@ void ssh_list_init (struct SSH_List *p_ssh_list);
 void ssh_list_release_chain (struct SSH_Node *p_head);
 void ssh_list_release (struct SSH_List *p_ssh_list);
 struct SSH_Node *ssh_list_append (struct SSH_List *p_ssh_list, struct SSH_Node *p_new);
-struct SSH_Node *ssh_list_search (struct SSH_List *p_ssh_list, char *host, char *user);
+struct SSH_Node *ssh_list_search (struct SSH_List *p_ssh_list, char *key);
+void ssh_auth_key (struct SSH_Auth_Data *p_auth, char *key);
 void ssh_list_dump (struct SSH_List *p_ssh_list);
+int ssh_list_contains (struct SSH_List *p_ssh_list, struct SSH_Node *p_node);
 
+int ssh_node_establish (struct SSH_Node *p_node, struct SSH_Auth_Data *p_auth, gboolean interactive);
 struct SSH_Node *ssh_node_connect (struct SSH_List *p_ssh_list, struct SSH_Auth_Data *p_auth);
 void ssh_node_free (struct SSH_Node *p_ssh_node);
 void ssh_node_ref (struct SSH_Node *p_ssh_node);
@@ -114,11 +201,24 @@ int ssh_node_get_validity (struct SSH_Node *p_ssh_node);
 ssh_channel ssh_node_open_channel (struct SSH_Node *p_node);
 int ssh_node_keepalive (struct SSH_Node *p_ssh_node);
 void ssh_node_update_time (struct SSH_Node *p_ssh_node);
+int ssh_node_prefetch_allowed (struct SSH_Node *p_ssh_node);
+
+void dir_cache_put (struct SSH_Node *p_node, char *path, struct Directory_List *p_dl);
+int dir_cache_take (struct SSH_Node *p_node, char *path, struct Directory_List *p_dl);
+int dir_cache_contains (struct SSH_Node *p_node, char *path);
+void dir_cache_free (struct SSH_Node *p_node);
+
+void du_cache_put (struct SSH_Node *p_node, char *path, long long unsigned int size);
+int du_cache_lookup (struct SSH_Node *p_node, char *path, long long unsigned int *size);
+void du_cache_free (struct SSH_Node *p_node);
+void dl_apply_du_cache (struct SSH_Node *p_node, struct Directory_List *p_dl, char *directory);
 
 void dl_init (struct Directory_List *p_dl);
 void dl_release_chain (struct Directory_Entry *p_head);
 void dl_release (struct Directory_List *p_dl);
 void dl_append (struct Directory_List *p_dl, struct Directory_Entry *p_new);
+void dl_move (struct Directory_List *p_dest, struct Directory_List *p_src);
+int dl_read (struct SSH_Node *p_node, sftp_dir dir, struct Directory_List *p_dl, char *path, gboolean interactive);
 void ssh_list_remove (struct SSH_List *p_ssh_list, struct SSH_Node *p_node);
 void dl_dump (struct Directory_List *p_dl);
 void ssh_list_keepalive (struct SSH_List *p_ssh_list);
@@ -135,7 +235,12 @@ int lt_ssh_getenv (struct SSH_Info *p_ssh, char *variable, char *value);
 void sftp_normalize_directory (struct SSH_Info *p_ssh, char *path);
 //int lt_sftp_create (struct SSH_Info *p_ssh);
 int sftp_refresh_directory_list (struct SSH_Info *p_ssh);
+int sftp_prefetch_directory (struct SSH_Node *p_node, char *path);
 int lt_ssh_exec (struct SSH_Info *p_ssh, char *command, char *output, int outlen, char *error, int errlen);
+int lt_ssh_exec_buffer (struct SSH_Info *p_ssh, char *command, GString *output, GString *error);
+int ssh_node_exec_stream (struct SSH_Node *p_node, char *command, SSHExecCallback chunk_cb, gpointer data, gboolean *cancel, int timeout);
+int ssh_node_exec_buffer (struct SSH_Node *p_node, char *command, GString *output, GString *error, gboolean *cancel, int timeout);
+int ssh_node_exec_lines (struct SSH_Node *p_node, char *command, void (*line_cb) (char *line, gpointer data), gpointer data, gboolean *cancel);
 
 #endif
 
@@ -0,0 +1,287 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file ssh_helper.c
+ * @brief Long-lived shell running commands on a node without opening a channel each time
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <libssh/libssh.h>
+#include "main.h"
+#include "utils.h"
+#include "ssh.h"
+#include "deadline.h"
+#include "ssh_helper.h"
+
+extern Globals globals;
+extern Prefs prefs;
+
+/* identifies the commands run in helpers, see SSH_Node.helper_run */
+unsigned int helperRuns = 0;
+
+/**
+ * ssh_node_helper_open() - starts the helper shell of a node if not running (call with ssh mutex locked)
+ * @return 0 if ok, 1 otherwise
+ */
+int
+ssh_node_helper_open (struct SSH_Node *p_node)
+{
+  ssh_channel channel;
+
+  if (p_node->helper && ssh_channel_is_open (p_node->helper) && !ssh_channel_is_eof (p_node->helper))
+    return (0);
+
+  ssh_node_helper_close (p_node);
+
+  if ((channel = ssh_node_open_channel (p_node)) == NULL)
+    return (1);
+
+  if (ssh_channel_request_exec_deadline (channel, SSH_HELPER_SHELL, prefs.ssh_timeout * 1000) != SSH_OK)
+    {
+      log_write ("Can't start helper shell on %s@%s\n", p_node->user, p_node->host);
+      ssh_channel_close (channel);
+      ssh_channel_free (channel);
+      return (1);
+    }
+
+  /* delimits the output of commands, unlikely to be printed by them */
+  sprintf (p_node->helper_mark, "__LTERM_%08X%08X__", g_random_int (), g_random_int ());
+  p_node->helper = channel;
+
+  log_write ("Helper shell started on %s@%s\n", p_node->user, p_node->host);
+
+  return (0);
+}
+
+/* call with ssh mutex locked */
+void
+ssh_node_helper_close (struct SSH_Node *p_node)
+{
+  /* a command still running finds out that the helper is gone */
+  p_node->helper_run = 0;
+
+  if (p_node->helper == NULL)
+    return;
+
+  if (p_node->session && ssh_is_connected (p_node->session))
+    {
+      ssh_channel_send_eof (p_node->helper);
+      ssh_channel_close (p_node->helper);
+    }
+
+  ssh_channel_free (p_node->helper);
+  p_node->helper = NULL;
+}
+
+/**
+ * helper_flush() - passes to chunk_cb the output received before the delimiter line
+ * The end of buf that could be the beginning of the delimiter is kept for the next call.
+ * @return 1 when the whole delimiter line has been received, with the exit status in status if not NULL
+ */
+int
+helper_flush (GString *buf, char *mark, int is_stderr, SSHExecCallback chunk_cb, gpointer data, int *status)
+{
+  char *p;
+  gsize keep;
+
+  if ((p = strstr (buf->str, mark)) != NULL)
+    {
+      if (p > buf->str)
+        chunk_cb (buf->str, p - buf->str, is_stderr, data);
+
+      g_string_erase (buf, 0, p - buf->str);
+
+      if (strchr (buf->str + strlen (mark), '\n') == NULL)
+        return (0);
+
+      if (status)
+        *status = atoi (buf->str + strlen (mark));
+
+      g_string_truncate (buf, 0);
+      return (1);
+    }
+
+  keep = MIN (buf->len, strlen (mark) - 1);
+
+  if (buf->len > keep)
+    {
+      chunk_cb (buf->str, buf->len - keep, is_stderr, data);
+      g_string_erase (buf, 0, buf->len - keep);
+    }
+
+  return (0);
+}
+
+/**
+ * ssh_node_helper_stream() - runs command in the helper shell of a node passing its output to chunk_cb
+ * The command runs in a subshell, so it can't change the shell for the next ones, and is followed
+ * by a delimiter line on both stdout and stderr reporting its exit status.
+ * As for commands on their own channel, the ssh mutex is taken only while writing and reading.
+ * Meanwhile the helper is busy and other commands get SSH_HELPER_NOT_SENT.
+ * The shell is closed when cancelled, on errors or when no data is received for timeout milliseconds (0 for no limit).
+ * @return SSH_HELPER_OK with the exit status in status, SSH_HELPER_NOT_SENT or SSH_HELPER_FAILED
+ */
+int
+ssh_node_helper_stream (struct SSH_Node *p_node, char *command, SSHExecCallback chunk_cb, gpointer data,
+                        gboolean *cancel, int timeout, int *status)
+{
+  GString *script, *out, *err;
+  char *quoted, *out_mark, *err_mark;
+  char buffer[16384];
+  unsigned int run;
+  int nbytes, got, eof, done_out = 0, done_err = 0, rc = SSH_HELPER_OK;
+  SDeadline d;
+
+  lockSSH (__func__, TRUE);
+
+  if (!ssh_list_contains (&globals.ssh_list, p_node) || !ssh_node_get_validity (p_node)
+      || p_node->helper_run || ssh_node_helper_open (p_node) != 0)
+    {
+      lockSSH (__func__, FALSE);
+      return (SSH_HELPER_NOT_SENT);
+    }
+
+  quoted = g_malloc (strlen (command) * 4 + 3);
+  shell_quote (quoted, command);
+
+  /* eval keeps syntax errors inside the command, the subshell keeps cd, exit, etc. inside it
+     and /dev/null keeps next commands out of its input */
+  script = g_string_new ("");
+  g_string_append_printf (script, "( eval %s ) </dev/null; printf '\\n%%s %%d\\n' %s $?; printf '\\n%%s\\n' %s >&2\n",
+                          quoted, p_node->helper_mark, p_node->helper_mark);
+  g_free (quoted);
+
+  /* part of the script could have been sent anyway */
+  if (ssh_channel_write (p_node->helper, script->str, script->len) != script->len)
+    {
+      log_write ("Can't write to helper shell on %s@%s\n", p_node->user, p_node->host);
+      g_string_free (script, TRUE);
+      ssh_node_helper_close (p_node);
+      lockSSH (__func__, FALSE);
+      return (SSH_HELPER_FAILED);
+    }
+
+  g_string_free (script, TRUE);
+
+  if ((run = ++ helperRuns) == 0)
+    run = ++ helperRuns;
+
+  p_node->helper_run = run;
+
+  out_mark = g_strdup_printf ("\n%s ", p_node->helper_mark);
+  err_mark = g_strdup_printf ("\n%s", p_node->helper_mark);
+
+  lockSSH (__func__, FALSE);
+
+  out = g_string_new ("");
+  err = g_string_new ("");
+
+  deadline_start (&d, timeout);
+
+  while (!(done_out && done_err))
+    {
+      if (cancel && *cancel)
+        {
+          rc = SSH_HELPER_FAILED;
+          break;
+        }
+
+      lockSSH (__func__, TRUE);
+
+      /* closed with its node in the meantime */
+      if (!ssh_list_contains (&globals.ssh_list, p_node) || p_node->helper_run != run)
+        {
+          lockSSH (__func__, FALSE);
+          log_write ("Helper shell closed while running: %s\n", command);
+          run = 0;
+          rc = SSH_HELPER_FAILED;
+          break;
+        }
+
+      got = 0;
+
+      if ((nbytes = ssh_channel_read_nonblocking (p_node->helper, buffer, sizeof (buffer), 0)) > 0)
+        {
+          g_string_append_len (out, buffer, nbytes);
+          got = 1;
+        }
+
+      if (nbytes >= 0 && (nbytes = ssh_channel_read_nonblocking (p_node->helper, buffer, sizeof (buffer), 1)) > 0)
+        {
+          g_string_append_len (err, buffer, nbytes);
+          got = 1;
+        }
+
+      eof = nbytes < 0 || (!got && ssh_channel_is_eof (p_node->helper));
+
+      lockSSH (__func__, FALSE);
+
+      if (!done_out)
+        done_out = helper_flush (out, out_mark, 0, chunk_cb, data, status);
+
+      if (!done_err)
+        done_err = helper_flush (err, err_mark, 1, chunk_cb, data, NULL);
+
+      if (eof)
+        {
+          log_write ("Helper shell terminated while running: %s\n", command);
+          rc = SSH_HELPER_FAILED;
+          break;
+        }
+
+      if (got)
+        {
+          deadline_start (&d, timeout);
+          continue;
+        }
+
+      if (deadline_expired (&d))
+        {
+          log_write ("Helper shell not responding, closing it: %s\n", command);
+          rc = SSH_HELPER_FAILED;
+          break;
+        }
+
+      g_usleep (G_USEC_PER_SEC / 50);
+    }
+
+  lockSSH (__func__, TRUE);
+
+  if (run && ssh_list_contains (&globals.ssh_list, p_node) && p_node->helper_run == run)
+    {
+      p_node->helper_run = 0;
+
+      /* the command could be still running */
+      if (rc != SSH_HELPER_OK)
+        ssh_node_helper_close (p_node);
+      else
+        ssh_node_update_time (p_node);
+    }
+
+  lockSSH (__func__, FALSE);
+
+  g_string_free (out, TRUE);
+  g_string_free (err, TRUE);
+  g_free (out_mark);
+  g_free (err_mark);
+
+  return (rc);
+}
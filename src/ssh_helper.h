@@ -0,0 +1,22 @@
+
+#ifndef _SSH_HELPER_H
+#define _SSH_HELPER_H
+
+#include <glib.h>
+#include "ssh.h"
+
+/* Shell started on the helper channel */
+#define SSH_HELPER_SHELL "exec /bin/sh"
+
+/* Results of ssh_node_helper_stream() */
+#define SSH_HELPER_OK 0
+#define SSH_HELPER_NOT_SENT 1  /* command not run, can be sent another way */
+#define SSH_HELPER_FAILED 2    /* command could have been run, or be still running */
+
+int ssh_node_helper_open (struct SSH_Node *p_node);
+void ssh_node_helper_close (struct SSH_Node *p_node);
+int ssh_node_helper_stream (struct SSH_Node *p_node, char *command, SSHExecCallback chunk_cb, gpointer data,
+                            gboolean *cancel, int timeout, int *status);
+
+#endif
+
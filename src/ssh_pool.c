@@ -0,0 +1,291 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file ssh_pool.c
+ * @brief Sessions opened in advance for recent connections
+ */
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "ssh.h"
+#include "protocol.h"
+#include "connection_list.h"
+#include "async.h"
+#include "ssh_pool.h"
+#include "keepalive.h"
+#include "ssh_helper.h"
+#include "ssh_reaper.h"
+
+extern Globals globals;
+extern Prefs prefs;
+extern struct Protocol_List g_prot_list;
+extern GList *g_recent_connections_list;
+
+GThreadPool *poolConnectors = NULL;
+
+/**
+ * ssh_pool_open() - opens a session and leaves it unused in the list
+ * The session is private until added to the list, so the ssh mutex isn't held while connecting.
+ * @return 0 if a session with the same key is in the list, SSH_ERR_* otherwise
+ */
+int
+ssh_pool_open (struct SSH_Auth_Data *p_auth)
+{
+  struct SSH_Node node, *p_node;
+  char key[SSH_NODE_KEY_LEN];
+  int found;
+
+  ssh_auth_key (p_auth, key);
+
+  lockSSH (__func__, TRUE);
+  found = ssh_list_search (&globals.ssh_list, key) != NULL;
+  lockSSH (__func__, FALSE);
+
+  if (found)
+    return (0);
+
+  log_write ("Warming up %s@%s\n", p_auth->user, p_auth->host);
+
+  memset (&node, 0, sizeof (struct SSH_Node));
+
+  if (ssh_node_establish (&node, p_auth, FALSE) != 0)
+    {
+      log_write ("Can't warm up %s@%s: %s\n", p_auth->user, p_auth->host, p_auth->error_s);
+      return (p_auth->error_code);
+    }
+
+  lockSSH (__func__, TRUE);
+
+  /* a tab could have connected in the meantime */
+  if (ssh_list_search (&globals.ssh_list, key))
+    {
+      ssh_node_free (&node);
+    }
+  else
+    {
+      strcpy (node.user, p_auth->user);
+      strcpy (node.password, p_auth->password);
+      strcpy (node.host, p_auth->host);
+      node.port = p_auth->port;
+      node.refcount = 0;
+      node.valid = 1;
+      node.idle_since = time (NULL);
+
+      p_node = ssh_list_append (&globals.ssh_list, &node);
+      ssh_node_update_time (p_node);
+      keepalive_schedule (p_node, p_auth->keepalive_interval);
+
+      /* the first commands on the node won't wait for a channel */
+      if (prefs.ssh_helper_channel)
+        ssh_node_helper_open (p_node);
+
+      log_write ("Session for %s@%s is warm\n", p_auth->user, p_auth->host);
+    }
+
+  lockSSH (__func__, FALSE);
+
+  ssh_reaper_request ();
+
+  return (0);
+}
+
+void
+ssh_pool_connect (gpointer data, gpointer user_data)
+{
+  struct SSH_Auth_Data *p_auth = (struct SSH_Auth_Data *) data;
+
+  if (globals.running)
+    ssh_pool_open (p_auth);
+
+  g_free (p_auth);
+}
+
+/**
+ * ssh_pool_auth_data() - fills p_auth for a connection that can log on without asking anything
+ * @return 0 if ok, 1 if connection isn't ssh or credentials aren't saved
+ */
+int
+ssh_pool_auth_data (struct Connection *p_conn, struct SSH_Auth_Data *p_auth)
+{
+  struct Protocol *p_prot;
+  char *user, *password;
+
+  if ((p_prot = get_protocol (&g_prot_list, p_conn->protocol)) == NULL || p_prot->type != PROT_TYPE_SSH)
+    return (1);
+
+  /* same credentials used by connection_log_on_param() */
+  user = p_conn->auth_mode == CONN_AUTH_MODE_SAVE && p_conn->auth_user[0] ? p_conn->auth_user : p_conn->user;
+  password = p_conn->auth_mode == CONN_AUTH_MODE_SAVE && p_conn->auth_password[0] ? p_conn->auth_password : p_conn->password;
+
+  /* users who type their password are not logged in behind their back */
+  if (user[0] == 0 || (p_conn->auth_mode != CONN_AUTH_MODE_KEY && password[0] == 0))
+    return (1);
+
+  memset (p_auth, 0, sizeof (struct SSH_Auth_Data));
+
+  strcpy (p_auth->host, p_conn->host);
+  strcpy (p_auth->user, user);
+  strcpy (p_auth->password, password);
+  p_auth->port = p_conn->port;
+  p_auth->mode = p_conn->auth_mode;
+  p_auth->sftp_enabled = 1;
+  strcpy (p_auth->identityFile, p_conn->identityFile);
+  p_auth->keepalive_interval = p_conn->sshOptions.flagKeepAlive ? p_conn->sshOptions.keepAliveInterval : prefs.ssh_keepalive;
+  strcpy (p_auth->ciphers, p_conn->sshOptions.ciphers);
+  strcpy (p_auth->macs, p_conn->sshOptions.macs);
+  strcpy (p_auth->kex, p_conn->sshOptions.kex);
+  p_auth->compression = p_conn->sshOptions.compression;
+  strcpy (p_auth->jump, p_conn->sshOptions.jumpHost);
+
+  return (0);
+}
+
+/**
+ * ssh_pool_warm() - opens in background a session for a connection with saved credentials
+ */
+void
+ssh_pool_warm (struct Connection *p_conn)
+{
+  struct SSH_Auth_Data *p_auth;
+
+  if (poolConnectors == NULL || prefs.ssh_pool_size <= 0)
+    return;
+
+  p_auth = g_new0 (struct SSH_Auth_Data, 1);
+
+  if (ssh_pool_auth_data (p_conn, p_auth) != 0)
+    {
+      g_free (p_auth);
+      return;
+    }
+
+  g_thread_pool_push (poolConnectors, p_auth, NULL);
+}
+
+int
+ssh_pool_count_idle ()
+{
+  struct SSH_Node *node;
+  int n = 0;
+
+  for (node = globals.ssh_list.head; node; node = node->next)
+    {
+      if (node->refcount == 0 && node->idle_since)
+        n ++;
+    }
+
+  return (n);
+}
+
+/**
+ * ssh_pool_keep() - keeps open a session no more used by tabs (call with ssh mutex locked)
+ * @return TRUE if the node has been kept, FALSE if it must be released
+ */
+gboolean
+ssh_pool_keep (struct SSH_Node *p_node)
+{
+  if (prefs.ssh_pool_size <= 0 || !globals.running)
+    return (FALSE);
+
+  if (!ssh_node_get_validity (p_node) || p_node->session == NULL)
+    return (FALSE);
+
+  if (ssh_pool_count_idle () >= prefs.ssh_pool_size)
+    return (FALSE);
+
+  log_write ("Keeping %s@%s warm\n", p_node->user, p_node->host);
+
+  p_node->idle_since = time (NULL);
+
+  return (TRUE);
+}
+
+/**
+ * ssh_pool_check() - closes warm sessions unused for too long or no more valid
+ * (runs in the main loop, as the sftp panel caches attached to nodes)
+ */
+gboolean
+ssh_pool_check (gpointer data)
+{
+  struct SSH_Node *node, *next;
+
+  lockSSH (__func__, TRUE);
+
+  for (node = globals.ssh_list.head; node; node = next)
+    {
+      next = node->next;
+
+      if (node->refcount != 0 || node->idle_since == 0)
+        continue;
+
+      if (ssh_node_get_validity (node) && time (NULL) - node->idle_since < prefs.ssh_pool_idle_timeout)
+        continue;
+
+      log_write ("Closing unused session %s@%s\n", node->user, node->host);
+
+      ssh_node_free (node);
+      ssh_list_remove (&globals.ssh_list, node);
+    }
+
+  lockSSH (__func__, FALSE);
+
+  return (TRUE);
+}
+
+/**
+ * ssh_pool_start() - opens sessions for the most recent connections
+ */
+void
+ssh_pool_start ()
+{
+  GList *item;
+  int n = 0;
+
+  if (prefs.ssh_pool_size <= 0)
+    return;
+
+  log_write ("Starting connection pool: %d sessions\n", prefs.ssh_pool_size);
+
+  poolConnectors = g_thread_pool_new (ssh_pool_connect, NULL, SSH_POOL_MAX_CONNECTING, FALSE, NULL);
+
+  g_timeout_add_seconds (SSH_POOL_CHECK_INTERVAL, ssh_pool_check, NULL);
+
+  /* last used are at the end */
+  for (item = g_list_last (g_recent_connections_list); item && n < prefs.ssh_pool_size; item = g_list_previous (item))
+    {
+      ssh_pool_warm ((struct Connection *) item->data);
+      n ++;
+    }
+}
+
+/**
+ * ssh_pool_stop() - waits for the sessions being opened
+ */
+void
+ssh_pool_stop ()
+{
+  if (poolConnectors == NULL)
+    return;
+
+  g_thread_pool_free (poolConnectors, TRUE, TRUE);
+  poolConnectors = NULL;
+}
+
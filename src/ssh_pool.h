@@ -0,0 +1,24 @@
+
+#ifndef _SSH_POOL_H
+#define _SSH_POOL_H
+
+#include <gtk/gtk.h>
+#include "ssh.h"
+#include "connection_list.h"
+
+/* Maximum number of sessions being opened at the same time */
+#define SSH_POOL_MAX_CONNECTING 4
+
+/* Seconds between checks of unused sessions */
+#define SSH_POOL_CHECK_INTERVAL 30
+
+void ssh_pool_start ();
+void ssh_pool_stop ();
+int ssh_pool_open (struct SSH_Auth_Data *p_auth);
+int ssh_pool_auth_data (struct Connection *p_conn, struct SSH_Auth_Data *p_auth);
+void ssh_pool_warm (struct Connection *p_conn);
+gboolean ssh_pool_keep (struct SSH_Node *p_node);
+int ssh_pool_count_idle ();
+
+#endif
+
@@ -0,0 +1,415 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file ssh_reaper.c
+ * @brief Closes idle sessions and keeps the number of open ones within a limit
+ */
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "main.h"
+#include "gui.h"
+#include "ssh.h"
+#include "async.h"
+#include "keepalive.h"
+#include "sftp-panel.h"
+#include "ssh_reaper.h"
+
+extern Globals globals;
+extern Prefs prefs;
+extern struct SSH_Info *p_ssh_current;
+
+/* SReviveJob running, used by the main thread only */
+GList *reviveJobs = NULL;
+
+/**
+ * ssh_reaper_evictable() - checks if the session of a node can be closed (call with ssh mutex locked)
+ * Nodes used by tabs keep their place in the list and are reconnected by ssh_node_revive().
+ */
+gboolean
+ssh_reaper_evictable (struct SSH_Node *p_node)
+{
+  if (p_node->session == NULL || p_node->evicted)
+    return (FALSE);
+
+  /* just opened or still in use */
+  if (time (NULL) - p_node->last < SSH_REAPER_MIN_IDLE)
+    return (FALSE);
+
+  if (p_node->refcount == 0)
+    return (TRUE);
+
+  /* shells and transfers read the session by themselves and wouldn't survive a reconnection */
+  if (p_node->channels > 0 || async_is_transferring ())
+    return (FALSE);
+
+  return (p_node->auth != NULL);
+}
+
+/**
+ * ssh_reaper_count_live() - number of open sessions in the list (call with ssh mutex locked)
+ */
+int
+ssh_reaper_count_live ()
+{
+  struct SSH_Node *node;
+  int n = 0;
+
+  for (node = globals.ssh_list.head; node; node = node->next)
+    {
+      if (node->session)
+        n ++;
+    }
+
+  return (n);
+}
+
+/**
+ * ssh_node_evict() - closes the session of a node (call with ssh mutex locked, in the main loop)
+ * Unused nodes are removed, the others stay in the list with their references until needed again.
+ */
+void
+ssh_node_evict (struct SSH_Node *p_node)
+{
+  struct SSH_Auth_Data *auth;
+  int refcount;
+
+  if (p_node->refcount == 0)
+    {
+      log_write ("Closing unused session %s@%s\n", p_node->user, p_node->host);
+
+      ssh_node_free (p_node);
+      ssh_list_remove (&globals.ssh_list, p_node);
+      return;
+    }
+
+  log_write ("Closing idle session %s@%s, used %ld seconds ago\n", p_node->user, p_node->host, (long) (time (NULL) - p_node->last));
+
+  /* ssh_node_free() releases everything: keep what tabs and reconnection need */
+  auth = p_node->auth;
+  refcount = p_node->refcount;
+  p_node->auth = NULL;
+
+  ssh_node_free (p_node);
+
+  p_node->auth = auth;
+  p_node->refcount = refcount;
+  p_node->evicted = time (NULL);
+}
+
+/**
+ * ssh_reaper_lru() - node to be evicted first: unused ones, then the least recently used
+ * (call with ssh mutex locked)
+ */
+struct SSH_Node *
+ssh_reaper_lru ()
+{
+  struct SSH_Node *node, *lru = NULL;
+
+  for (node = globals.ssh_list.head; node; node = node->next)
+    {
+      if (!ssh_reaper_evictable (node))
+        continue;
+
+      if (lru == NULL
+          || (node->refcount == 0 && lru->refcount != 0)
+          || ((node->refcount == 0) == (lru->refcount == 0) && node->last < lru->last))
+        lru = node;
+    }
+
+  return (lru);
+}
+
+/* call with ssh mutex locked */
+void
+ssh_reaper_enforce_budget ()
+{
+  struct SSH_Node *p_node;
+  int n;
+
+  if (prefs.ssh_max_sessions <= 0)
+    return;
+
+  /* sessions in use can keep the count above the limit for a while */
+  while ((n = ssh_reaper_count_live ()) > prefs.ssh_max_sessions && (p_node = ssh_reaper_lru ()) != NULL)
+    {
+      log_write ("%d sessions open, limit is %d\n", n, prefs.ssh_max_sessions);
+      ssh_node_evict (p_node);
+    }
+}
+
+/**
+ * ssh_reaper_check() - closes sessions of tabs unused for too long and enforces the limit
+ * (runs in the main loop, as the sftp panel caches attached to nodes)
+ */
+gboolean
+ssh_reaper_check (gpointer data)
+{
+  struct SSH_Node *node, *next;
+
+  lockSSH (__func__, TRUE);
+
+  if (prefs.ssh_session_idle_timeout > 0)
+    {
+      for (node = globals.ssh_list.head; node; node = next)
+        {
+          next = node->next;
+
+          /* unused nodes are closed by the connection pool */
+          if (node->refcount == 0 || !ssh_reaper_evictable (node))
+            continue;
+
+          if (time (NULL) - node->last >= prefs.ssh_session_idle_timeout)
+            ssh_node_evict (node);
+        }
+    }
+
+  ssh_reaper_enforce_budget ();
+
+  lockSSH (__func__, FALSE);
+
+  return (TRUE);
+}
+
+gboolean
+ssh_reaper_budget_cb (gpointer data)
+{
+  lockSSH (__func__, TRUE);
+  ssh_reaper_enforce_budget ();
+  lockSSH (__func__, FALSE);
+
+  return (FALSE);
+}
+
+/**
+ * ssh_reaper_request() - enforces the limit as soon as possible, after a session has been opened
+ * (can be called by any thread, without ssh mutex)
+ */
+void
+ssh_reaper_request ()
+{
+  if (prefs.ssh_max_sessions > 0)
+    gdk_threads_add_idle (ssh_reaper_budget_cb, NULL);
+}
+
+/**
+ * ssh_node_revive() - reopens the session of an evicted node with the parameters it was established with
+ * (call without ssh mutex, the node is private while connecting)
+ * @return 0 if the node has a session, SSH_ERR_* or 1 otherwise
+ */
+int
+ssh_node_revive (struct SSH_Node *p_node)
+{
+  struct SSH_Node node;
+  struct SSH_Auth_Data auth;
+  int rc = 0;
+
+  lockSSH (__func__, TRUE);
+
+  if (!ssh_list_contains (&globals.ssh_list, p_node) || !p_node->evicted)
+    {
+      rc = ssh_list_contains (&globals.ssh_list, p_node) ? 0 : 1;
+      lockSSH (__func__, FALSE);
+      return (rc);
+    }
+
+  memcpy (&auth, p_node->auth, sizeof (struct SSH_Auth_Data));
+
+  lockSSH (__func__, FALSE);
+
+  log_write ("Reconnecting %s@%s\n", auth.user, auth.host);
+
+  memset (&node, 0, sizeof (struct SSH_Node));
+
+  rc = ssh_node_establish (&node, &auth, gui_is_main_thread ());
+  memset (auth.password, 0, sizeof (auth.password));
+
+  if (rc != 0)
+    {
+      log_write ("Can't reconnect %s@%s: %s\n", auth.user, auth.host, auth.error_s);
+      return (rc);
+    }
+
+  lockSSH (__func__, TRUE);
+
+  if (!ssh_list_contains (&globals.ssh_list, p_node) || !p_node->evicted)
+    {
+      /* released or reconnected by another thread in the meantime */
+      rc = ssh_list_contains (&globals.ssh_list, p_node) ? 0 : 1;
+      ssh_node_free (&node);
+    }
+  else
+    {
+      memset (p_node->auth->password, 0, sizeof (p_node->auth->password));
+      g_free (p_node->auth);
+
+      p_node->session = node.session;
+      p_node->sftp = node.sftp;
+      p_node->auth_methods = node.auth_methods;
+      p_node->auth = node.auth;
+      p_node->evicted = 0;
+
+      ssh_node_set_validity (p_node, 1);
+      ssh_node_update_time (p_node);
+      keepalive_schedule (p_node, p_node->auth->keepalive_interval);
+
+      log_write ("Session %s@%s reconnected\n", p_node->user, p_node->host);
+    }
+
+  lockSSH (__func__, FALSE);
+
+  ssh_reaper_request ();
+
+  return (rc);
+}
+
+gboolean
+ssh_revive_done_cb (gpointer data)
+{
+  SReviveJob *job = (SReviveJob *) data;
+
+  reviveJobs = g_list_remove (reviveJobs, job);
+
+  sftp_spinner_stop ();
+
+  if (job->rc != 0)
+    sftp_set_status ("Can't reconnect to %s", job->host);
+  else
+    {
+      sftp_clear_status ();
+
+      /* the action goes on only if its tab is still the current one */
+      if (job->resume && job->p_ssh == p_ssh_current && job->p_ssh->ssh_node == job->p_node)
+        job->resume ();
+    }
+
+  g_free (job);
+
+  return (FALSE);
+}
+
+gpointer
+ssh_revive_thread (gpointer data)
+{
+  SReviveJob *job = (SReviveJob *) data;
+
+  job->rc = ssh_node_revive (job->p_node);
+
+  gdk_threads_add_idle (ssh_revive_done_cb, job);
+
+  return (NULL);
+}
+
+/**
+ * ssh_revive_async() - reconnects the evicted node of a tab in background, then runs resume
+ * Like connections of tabs, the main thread doesn't wait. One reconnection runs per node,
+ * a new action while it runs replaces the one to be resumed.
+ */
+void
+ssh_revive_async (struct SSH_Info *p_ssh, void (*resume) ())
+{
+  GList *item;
+  SReviveJob *job;
+
+  for (item = reviveJobs; item; item = g_list_next (item))
+    {
+      job = (SReviveJob *) item->data;
+
+      if (job->p_node == p_ssh->ssh_node)
+        {
+          job->p_ssh = p_ssh;
+          job->resume = resume;
+          return;
+        }
+    }
+
+  job = g_new0 (SReviveJob, 1);
+  job->p_node = p_ssh->ssh_node;
+  job->p_ssh = p_ssh;
+  job->resume = resume;
+  strcpy (job->host, p_ssh->ssh_node->host);
+
+  reviveJobs = g_list_append (reviveJobs, job);
+
+  sftp_set_status ("Reconnecting to %s...", job->host);
+  sftp_spinner_start ();
+
+  g_thread_unref (g_thread_new ("revive", ssh_revive_thread, job));
+}
+
+/**
+ * ssh_revive_pending() - checks if the node of a tab is being reconnected (main thread only)
+ */
+gboolean
+ssh_revive_pending (struct SSH_Info *p_ssh)
+{
+  GList *item;
+
+  for (item = reviveJobs; item; item = g_list_next (item))
+    if (p_ssh && ((SReviveJob *) item->data)->p_node == p_ssh->ssh_node)
+      return (TRUE);
+
+  return (FALSE);
+}
+
+/**
+ * lt_ssh_ensure_connected() - like lt_ssh_is_connected(), reconnecting the node if evicted
+ * Called by user actions, so it also marks the node as used. Call without ssh mutex.
+ * The main thread doesn't wait for the reconnection: 0 is returned and resume, if not NULL,
+ * is called once the session is back.
+ */
+int
+lt_ssh_ensure_connected (struct SSH_Info *p_ssh, void (*resume) ())
+{
+  if (p_ssh && p_ssh->ssh_node && p_ssh->ssh_node->evicted)
+    {
+      if (gui_is_main_thread ())
+        {
+          ssh_revive_async (p_ssh, resume);
+          return (0);
+        }
+
+      ssh_node_revive (p_ssh->ssh_node);
+    }
+
+  if (!lt_ssh_is_connected (p_ssh))
+    return (0);
+
+  lockSSH (__func__, TRUE);
+  ssh_node_update_time (p_ssh->ssh_node);
+  lockSSH (__func__, FALSE);
+
+  return (1);
+}
+
+/**
+ * ssh_reaper_start() - checks periodically idle sessions
+ */
+void
+ssh_reaper_start ()
+{
+  if (prefs.ssh_session_idle_timeout <= 0 && prefs.ssh_max_sessions <= 0)
+    return;
+
+  log_write ("Closing sessions idle for %d seconds, at most %d open\n", prefs.ssh_session_idle_timeout, prefs.ssh_max_sessions);
+
+  g_timeout_add_seconds (SSH_REAPER_CHECK_INTERVAL, ssh_reaper_check, NULL);
+}
+
@@ -0,0 +1,36 @@
+
+#ifndef _SSH_REAPER_H
+#define _SSH_REAPER_H
+
+#include <gtk/gtk.h>
+#include "ssh.h"
+
+/* Seconds between checks of idle sessions */
+#define SSH_REAPER_CHECK_INTERVAL 10
+
+/* Sessions used in the last seconds are never closed */
+#define SSH_REAPER_MIN_IDLE 60
+
+/**
+ * struct ReviveJob
+ * evicted session reopened in background for an action of the main thread
+ */
+typedef struct ReviveJob {
+  struct SSH_Node *p_node;
+  struct SSH_Info *p_ssh;  /* tab of the action */
+  void (*resume) ();       /* action run again once reconnected, NULL if none */
+  char host[32];
+  int rc;
+} SReviveJob;
+
+void ssh_reaper_start ();
+void ssh_reaper_request ();
+int ssh_reaper_count_live ();
+void ssh_node_evict (struct SSH_Node *p_node);
+int ssh_node_revive (struct SSH_Node *p_node);
+void ssh_revive_async (struct SSH_Info *p_ssh, void (*resume) ());
+gboolean ssh_revive_pending (struct SSH_Info *p_ssh);
+int lt_ssh_ensure_connected (struct SSH_Info *p_ssh, void (*resume) ());
+
+#endif
+
@@ -0,0 +1,477 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file ssh_terminal.c
+ * @brief Terminals running on a channel of the libssh session, without the ssh client
+ */
+
+#include <gtk/gtk.h>
+#include <vte/vte.h>
+#include <stdio.h>
+#include <string.h>
+#include <libssh/libssh.h>
+#include "main.h"
+#include "gui.h"
+#include "ssh.h"
+#include "async.h"
+#include "deadline.h"
+#include "ssh_terminal.h"
+
+extern Prefs prefs;
+
+/* SSshTerminal of all the tabs, changed in the main loop with ssh mutex locked */
+GList *sshTerminals = NULL;
+
+/* STerminalWatch by socket, used in the main loop only */
+GHashTable *terminalWatches = NULL;
+
+guint terminalTimer = 0;
+guint terminalFlush = 0;
+
+void ssh_terminal_poll_all ();
+
+/**
+ * ssh_terminal_supported() - checks if a connection can run in a channel of its sftp session
+ * Options handled by the ssh client only need the external process.
+ */
+gboolean
+ssh_terminal_supported (struct Connection *p_conn)
+{
+  if (!prefs.ssh_terminal_channel)
+    return (FALSE);
+
+  if (p_conn->sshOptions.x11Forwarding || p_conn->sshOptions.agentForwarding)
+    return (FALSE);
+
+  if (p_conn->user_options[0] != 0)
+    return (FALSE);
+
+  return (TRUE);
+}
+
+void
+terminal_watch_free (gpointer data)
+{
+  STerminalWatch *w = (STerminalWatch *) data;
+
+  g_source_remove (w->source_id);
+  g_io_channel_unref (w->channel);
+  g_free (w);
+}
+
+gboolean
+ssh_terminal_io_cb (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+  ssh_terminal_poll_all ();
+
+  return (TRUE);
+}
+
+/**
+ * ssh_terminal_watch_update() - watches the sockets of the sessions with terminals
+ * (call in the main loop with ssh mutex locked)
+ * Sockets with data queued by libssh are also watched for writing.
+ */
+void
+ssh_terminal_watch_update ()
+{
+  GHashTable *watches;
+  GList *item;
+  SSshTerminal *t;
+  STerminalWatch *w;
+  GIOCondition condition;
+  socket_t fd;
+
+  watches = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, terminal_watch_free);
+
+  for (item = sshTerminals; item; item = item->next)
+    {
+      t = (SSshTerminal *) item->data;
+
+      if (t->channel == NULL || t->p_node->session == NULL || (fd = ssh_get_fd (t->p_node->session)) < 0)
+        continue;
+
+      if (g_hash_table_lookup (watches, GINT_TO_POINTER (fd)))
+        continue;
+
+      condition = G_IO_IN | G_IO_HUP | G_IO_ERR;
+
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 7, 0)
+      if (ssh_get_poll_flags (t->p_node->session) & SSH_WRITE_PENDING)
+        condition |= G_IO_OUT;
+#endif
+
+      if (terminalWatches && (w = g_hash_table_lookup (terminalWatches, GINT_TO_POINTER (fd))) != NULL && w->condition == condition)
+        {
+          g_hash_table_steal (terminalWatches, GINT_TO_POINTER (fd));
+        }
+      else
+        {
+          w = g_new0 (STerminalWatch, 1);
+          w->channel = g_io_channel_unix_new (fd);
+          w->condition = condition;
+          w->source_id = g_io_add_watch (w->channel, condition, ssh_terminal_io_cb, NULL);
+        }
+
+      g_hash_table_insert (watches, GINT_TO_POINTER (fd), w);
+    }
+
+  /* sockets no more used by terminals */
+  if (terminalWatches)
+    g_hash_table_destroy (terminalWatches);
+
+  terminalWatches = watches;
+}
+
+gboolean
+ssh_terminal_timer_cb (gpointer data)
+{
+  terminalTimer = 0;
+  ssh_terminal_poll_all ();
+
+  return (FALSE);
+}
+
+/**
+ * ssh_terminal_schedule() - sets the time of the next exchange not woken by the sockets
+ */
+void
+ssh_terminal_schedule (int msecs)
+{
+  if (terminalTimer)
+    g_source_remove (terminalTimer);
+
+  terminalTimer = sshTerminals ? gdk_threads_add_timeout (msecs, ssh_terminal_timer_cb, NULL) : 0;
+}
+
+gboolean
+ssh_terminal_flush_cb (gpointer data)
+{
+  terminalFlush = 0;
+  ssh_terminal_poll_all ();
+
+  return (FALSE);
+}
+
+/* typed keys and text sent by the program, sent as soon as the main loop is idle */
+void
+ssh_terminal_commit_cb (VteTerminal *vteterminal, gchar *text, guint size, gpointer user_data)
+{
+  struct ConnectionTab *p_ct = (struct ConnectionTab *) user_data;
+
+  if (p_ct->ssh_terminal == NULL)
+    return;
+
+  g_string_append_len (p_ct->ssh_terminal->input, text, size);
+
+  if (terminalFlush == 0)
+    terminalFlush = gdk_threads_add_idle (ssh_terminal_flush_cb, NULL);
+}
+
+void
+ssh_terminal_size_cb (GtkWidget *widget, GtkAllocation *allocation, gpointer user_data)
+{
+  struct ConnectionTab *p_ct = (struct ConnectionTab *) user_data;
+
+  if (p_ct->ssh_terminal == NULL)
+    return;
+
+  p_ct->ssh_terminal->new_cols = vte_terminal_get_column_count (VTE_TERMINAL (p_ct->vte));
+  p_ct->ssh_terminal->new_rows = vte_terminal_get_row_count (VTE_TERMINAL (p_ct->vte));
+
+  if (terminalFlush == 0)
+    terminalFlush = gdk_threads_add_idle (ssh_terminal_flush_cb, NULL);
+}
+
+/**
+ * ssh_terminal_exchange() - sends typed text and pty size, and reads the output of a terminal
+ * (call with ssh mutex locked and the session in non-blocking mode)
+ * @return 0 if ok, 1 if the channel has been closed
+ */
+int
+ssh_terminal_exchange (SSshTerminal *t)
+{
+  char buffer[16384];
+  int nbytes = 0;
+
+  if (t->input->len > 0)
+    {
+      /* what doesn't fit in the window of the channel is sent when the server enlarges it */
+      if ((nbytes = ssh_channel_write (t->channel, t->input->str, t->input->len)) > 0)
+        g_string_erase (t->input, 0, nbytes);
+    }
+
+  if (nbytes >= 0 && (t->new_cols != t->cols || t->new_rows != t->rows) && t->new_cols > 0 && t->new_rows > 0)
+    {
+      ssh_channel_change_pty_size (t->channel, t->new_cols, t->new_rows);
+      t->cols = t->new_cols;
+      t->rows = t->new_rows;
+    }
+
+  while (nbytes >= 0 && t->output->len < SSH_TERMINAL_MAX_READ)
+    {
+      if ((nbytes = ssh_channel_read_nonblocking (t->channel, buffer, sizeof (buffer), 0)) > 0)
+        g_string_append_len (t->output, buffer, nbytes);
+      else if (nbytes == 0 && (nbytes = ssh_channel_read_nonblocking (t->channel, buffer, sizeof (buffer), 1)) > 0)
+        g_string_append_len (t->output, buffer, nbytes);
+      else
+        break;
+    }
+
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 7, 0)
+  if (nbytes >= 0 && (ssh_get_poll_flags (t->p_node->session) & SSH_WRITE_PENDING))
+    ssh_blocking_flush (t->p_node->session, 0);
+#endif
+
+  if (nbytes < 0 || (nbytes == 0 && ssh_channel_is_eof (t->channel)) || !ssh_node_get_validity (t->p_node))
+    return (1);
+
+  return (0);
+}
+
+/**
+ * ssh_terminal_poll_all() - exchanges data between the vtes and the shell channels of all the tabs
+ * (runs in the main loop, woken by the sockets of the sessions)
+ * The ssh mutex is never waited for: when busy the exchange is tried again shortly.
+ */
+void
+ssh_terminal_poll_all ()
+{
+  GList *item, *closed = NULL;
+  SSshTerminal *t;
+  int more = 0;
+
+  if (sshTerminals == NULL)
+    return;
+
+  if (!trylockSSH (__func__))
+    {
+      /* sockets stay readable while others use the sessions, don't spin on them */
+      if (terminalWatches)
+        g_hash_table_remove_all (terminalWatches);
+
+      ssh_terminal_schedule (SSH_TERMINAL_POLL_MSECS);
+      return;
+    }
+
+  for (item = sshTerminals; item; item = item->next)
+    {
+      t = (SSshTerminal *) item->data;
+
+      if (t->channel == NULL || t->p_node->session == NULL)
+        {
+          closed = g_list_append (closed, t->p_ct);
+          continue;
+        }
+
+      ssh_set_blocking (t->p_node->session, 0);
+
+      if (ssh_terminal_exchange (t))
+        closed = g_list_append (closed, t->p_ct);
+      else if (t->output->len >= SSH_TERMINAL_MAX_READ)
+        more = 1;
+
+      ssh_set_blocking (t->p_node->session, 1);
+    }
+
+  ssh_terminal_watch_update ();
+
+  lockSSH (__func__, FALSE);
+
+  for (item = sshTerminals; item; item = item->next)
+    {
+      t = (SSshTerminal *) item->data;
+
+      if (t->output->len > 0)
+        vte_terminal_feed (VTE_TERMINAL (t->p_ct->vte), t->output->str, t->output->len);
+
+      g_string_truncate (t->output, 0);
+    }
+
+  for (item = closed; item; item = item->next)
+    {
+      log_write ("Shell channel closed: %s\n", ((struct ConnectionTab *) item->data)->connection.name);
+      connection_tab_exited ((struct ConnectionTab *) item->data);
+    }
+
+  g_list_free (closed);
+
+  ssh_terminal_schedule (more ? SSH_TERMINAL_POLL_MSECS : SSH_TERMINAL_IDLE_MSECS);
+}
+
+/**
+ * ssh_terminal_open() - starts a shell on a new channel of the session of a logged tab
+ * Tabs on the same node share its connection, so duplicating a tab opens just a channel.
+ * @return 0 if ok, 1 otherwise
+ */
+int
+ssh_terminal_open (struct ConnectionTab *p_ct)
+{
+  struct SSH_Node *p_node = p_ct->ssh_info.ssh_node;
+  ssh_channel channel;
+  SSshTerminal *t;
+  SDeadline deadline;
+  int cols, rows, rc;
+
+  if (p_node == NULL)
+    return (1);
+
+  cols = vte_terminal_get_column_count (VTE_TERMINAL (p_ct->vte));
+  rows = vte_terminal_get_row_count (VTE_TERMINAL (p_ct->vte));
+
+  lockSSH (__func__, TRUE);
+
+  if ((channel = ssh_node_open_channel (p_node)) == NULL)
+    {
+      lockSSH (__func__, FALSE);
+      return (1);
+    }
+
+  deadline_watch (&deadline, p_node->session, "shell", prefs.ssh_timeout * 1000);
+
+  rc = ssh_channel_request_pty_size (channel, SSH_TERMINAL_TYPE, cols, rows);
+
+  if (rc == SSH_OK)
+    rc = ssh_channel_request_shell (channel);
+
+  if (deadline_unwatch (&deadline))
+    ssh_node_set_validity (p_node, 0);
+
+  if (rc != SSH_OK)
+    {
+      log_write ("Can't start shell on %s@%s: %s\n", p_node->user, p_node->host, ssh_get_error (p_node->session));
+      ssh_channel_close (channel);
+      ssh_channel_free (channel);
+      lockSSH (__func__, FALSE);
+      return (1);
+    }
+
+  ssh_node_update_time (p_node);
+  p_node->channels ++;
+
+  t = g_new0 (SSshTerminal, 1);
+  t->p_ct = p_ct;
+  t->p_node = p_node;
+  t->channel = channel;
+  t->input = g_string_new ("");
+  t->output = g_string_new ("");
+  t->cols = t->new_cols = cols;
+  t->rows = t->new_rows = rows;
+
+  p_ct->ssh_terminal = t;
+  sshTerminals = g_list_append (sshTerminals, t);
+
+  ssh_terminal_watch_update ();
+
+  lockSSH (__func__, FALSE);
+
+  t->commit_handler = g_signal_connect (p_ct->vte, "commit", G_CALLBACK (ssh_terminal_commit_cb), p_ct);
+  t->size_handler = g_signal_connect_after (p_ct->vte, "size-allocate", G_CALLBACK (ssh_terminal_size_cb), p_ct);
+
+  ssh_terminal_schedule (SSH_TERMINAL_IDLE_MSECS);
+
+  log_write ("Shell started on a channel of %s@%s\n", p_node->user, p_node->host);
+
+  return (0);
+}
+
+/**
+ * ssh_terminal_close() - closes the shell channel of a tab, if any
+ * Must be called before the tab releases its node.
+ */
+void
+ssh_terminal_close (struct ConnectionTab *p_ct)
+{
+  SSshTerminal *t = p_ct->ssh_terminal;
+
+  if (t == NULL)
+    return;
+
+  g_signal_handler_disconnect (p_ct->vte, t->commit_handler);
+  g_signal_handler_disconnect (p_ct->vte, t->size_handler);
+
+  lockSSH (__func__, TRUE);
+
+  /* already freed if the session has been closed */
+  if (t->channel)
+    {
+      if (t->p_node->session && ssh_is_connected (t->p_node->session) && ssh_channel_is_open (t->channel))
+        {
+          ssh_channel_send_eof (t->channel);
+          ssh_channel_close (t->channel);
+        }
+
+      ssh_channel_free (t->channel);
+
+      if (t->p_node->channels > 0)
+        t->p_node->channels --;
+    }
+
+  sshTerminals = g_list_remove (sshTerminals, t);
+
+  ssh_terminal_watch_update ();
+
+  lockSSH (__func__, FALSE);
+
+  g_string_free (t->input, TRUE);
+  g_string_free (t->output, TRUE);
+  g_free (t);
+
+  p_ct->ssh_terminal = NULL;
+
+  if (sshTerminals == NULL)
+    ssh_terminal_schedule (0);
+}
+
+gboolean
+ssh_terminal_lost_cb (gpointer data)
+{
+  ssh_terminal_poll_all ();
+
+  return (FALSE);
+}
+
+/**
+ * ssh_terminal_node_lost() - frees the shell channels of a node whose session is going to be freed
+ * (call with ssh mutex locked, by any thread)
+ * Their tabs are told by the main loop, as for a shell that has terminated.
+ */
+void
+ssh_terminal_node_lost (struct SSH_Node *p_node)
+{
+  GList *item;
+  SSshTerminal *t;
+
+  for (item = sshTerminals; item; item = item->next)
+    {
+      t = (SSshTerminal *) item->data;
+
+      if (t->p_node != p_node || t->channel == NULL)
+        continue;
+
+      log_write ("Closing shell channel of %s on %s@%s\n", t->p_ct->connection.name, p_node->user, p_node->host);
+
+      ssh_channel_free (t->channel);
+      t->channel = NULL;
+    }
+
+  p_node->channels = 0;
+
+  gdk_threads_add_idle (ssh_terminal_lost_cb, NULL);
+}
+
@@ -0,0 +1,54 @@
+
+#ifndef _SSH_TERMINAL_H
+#define _SSH_TERMINAL_H
+
+#include <gtk/gtk.h>
+#include <libssh/libssh.h>
+#include "ssh.h"
+#include "gui.h"
+
+/* Terminal type requested for the remote pty */
+#define SSH_TERMINAL_TYPE "xterm-256color"
+
+/* Milliseconds before the next exchange when the ssh mutex is busy or output is left to read */
+#define SSH_TERMINAL_POLL_MSECS 20
+
+/* Milliseconds between exchanges not woken by the socket, for output read by other users of the session */
+#define SSH_TERMINAL_IDLE_MSECS 250
+
+/* Maximum bytes shown at each read, the rest is left for the next one */
+#define SSH_TERMINAL_MAX_READ (256 * 1024)
+
+/**
+ * struct SshTerminal
+ * shell channel opened on the session of a node and shown by the vte of a tab
+ */
+typedef struct SshTerminal {
+  struct ConnectionTab *p_ct;
+  struct SSH_Node *p_node;
+  ssh_channel channel; /* NULL if the session has been closed under it */
+  GString *input;      /* typed and not yet sent */
+  GString *output;     /* read and not yet shown */
+  int cols, rows;      /* size of the remote pty */
+  int new_cols, new_rows;
+  gulong commit_handler;
+  gulong size_handler;
+} SSshTerminal;
+
+/**
+ * struct TerminalWatch
+ * socket of a session with terminals, watched by the main loop
+ */
+typedef struct TerminalWatch {
+  GIOChannel *channel;
+  GIOCondition condition;
+  guint source_id;
+} STerminalWatch;
+
+gboolean ssh_terminal_supported (struct Connection *p_conn);
+int ssh_terminal_open (struct ConnectionTab *p_ct);
+void ssh_terminal_close (struct ConnectionTab *p_ct);
+void ssh_terminal_node_lost (struct SSH_Node *p_node);
+
+#endif
+
@@ -35,6 +35,10 @@
 #include "gui.h"
 #include "utils.h"
 #include "terminal.h"
+#include "ssh_pool.h"
+#include "ssh_terminal.h"
+#include "jump_host.h"
+#include "prompt_matcher.h"
 
 extern Globals globals;
 extern Prefs prefs;
@@ -43,6 +47,15 @@ extern struct Protocol_List g_prot_list;
 extern struct ConnectionTab *p_current_connection_tab;
 extern GList *connection_tab_list;
 
+int connectJobsRunning = 0; /* connections in background, shown by the spinner */
+
+GList *restoreRequests = NULL; /* SRestoreRequest waiting to be logged on */
+int restoreRunning = 0;        /* requests whose first tab is logging on */
+
+int log_on_end (struct ConnectionTab *p_conn_tab, int rc);
+int log_on_connected (struct ConnectionTab *p_conn_tab, struct SSH_Auth_Data *p_auth, int ask, int login_rc);
+int log_on_terminal (struct ConnectionTab *p_conn_tab, struct SSH_Auth_Data *p_auth);
+
 char *auth_state_desc[] = { "AUTH_STATE_NOT_LOGGED", "AUTH_STATE_GOT_USER", "AUTH_STATE_GOT_PASSWORD", "AUTH_STATE_LOGGED" };
 
 gboolean
@@ -113,203 +126,337 @@ terminal_new (struct ConnectionTab *p_connection_tab, char *directory)
   return (success);
 }
 
+/* shows a phase of the connection in the tab (runs in the main loop) */
+gboolean
+connect_job_progress_cb (gpointer data)
+{
+  SConnectProgress *p = (SConnectProgress *) data;
+
+  if (g_list_find (connection_tab_list, p->p_ct) && p->p_ct->connect_job)
+    terminal_write_ex (p->p_ct, "%s\n\r", p->message);
+
+  g_free (p->message);
+  g_free (p);
+
+  return (FALSE);
+}
+
+/* called by the connecting thread */
+void
+connect_job_progress (const char *message, gpointer data)
+{
+  SConnectProgress *p;
+
+  p = g_new0 (SConnectProgress, 1);
+  p->p_ct = (struct ConnectionTab *) data;
+  p->message = g_strdup (message);
+
+  g_idle_add (connect_job_progress_cb, p);
+}
+
+/**
+ * terminal_connect_end() - stops showing the connection of a tab in progress
+ */
+void
+terminal_connect_end (struct ConnectionTab *p_ct)
+{
+  p_ct->connect_job = NULL;
+
+  if (p_ct->cancel_button)
+    gtk_widget_hide (p_ct->cancel_button);
+
+  if (-- connectJobsRunning == 0)
+    {
+      sftp_spinner_stop ();
+      sftp_clear_status ();
+    }
+}
+
+/**
+ * connect_job_done_cb() - gives the connection to its tab, or releases it if nobody waits anymore
+ * (runs in the main loop)
+ */
+gboolean
+connect_job_done_cb (gpointer data)
+{
+  SConnectJob *job = (SConnectJob *) data;
+  struct ConnectionTab *p_ct = job->p_ct;
+  struct SSH_Auth_Data auth;
+  int rc, ask;
+
+  /* cancelled, or tab closed while connecting */
+  if (job->abandoned || g_list_find (connection_tab_list, p_ct) == NULL || p_ct->connect_job != job)
+    {
+      log_write ("Connection to %s no more needed\n", job->auth.host);
+
+      if (job->rc == 0)
+        lt_ssh_disconnect (&job->ssh_info);
+
+      g_free (job);
+      return (FALSE);
+    }
+
+  terminal_connect_end (p_ct);
+
+  p_ct->ssh_info.ssh_node = job->ssh_info.ssh_node;
+  strcpy (p_ct->ssh_info.home, job->ssh_info.home);
+  strcpy (p_ct->ssh_info.error_s, job->ssh_info.error_s);
+
+  memcpy (&auth, &job->auth, sizeof (struct SSH_Auth_Data));
+  rc = job->rc;
+  ask = job->ask;
+
+  memset (job->auth.password, 0, sizeof (job->auth.password));
+  g_free (job);
+
+  log_on_connected (p_ct, &auth, ask, rc);
+
+  memset (auth.password, 0, sizeof (auth.password));
+
+  return (FALSE);
+}
+
+gpointer
+connect_job_thread (gpointer data)
+{
+  SConnectJob *job = (SConnectJob *) data;
+
+  job->rc = lt_ssh_connect (&job->ssh_info, &globals.ssh_list, &job->auth);
+
+  g_idle_add (connect_job_done_cb, job);
+
+  return (NULL);
+}
+
+/**
+ * terminal_connect_cancel() - stops waiting for the connection of a tab, ending its log on
+ * The connection, if opened anyway, is released by connect_job_done_cb().
+ */
+void
+terminal_connect_cancel (struct ConnectionTab *p_ct)
+{
+  SConnectJob *job = p_ct->connect_job;
+
+  if (job == NULL)
+    return;
+
+  job->cancel = TRUE;
+  job->abandoned = 1;
+
+  terminal_connect_end (p_ct);
+
+  strcpy (p_ct->ssh_info.error_s, "Cancelled");
+  terminal_write_ex (p_ct, _("Cancelled\n\r"));
+  tabSetConnectionStatus (p_ct, TAB_CONN_STATUS_DISCONNECTED);
+
+  log_on_end (p_ct, SSH_ERR_CANCELLED);
+}
+
+void
+cancel_button_clicked_cb (GtkButton *button, gpointer user_data)
+{
+  terminal_connect_cancel ((struct ConnectionTab *) user_data);
+}
+
+/**
+ * terminal_connect_async() - connects a tab in a background thread
+ * Returns at once: the log on goes on in connect_job_done_cb() when the thread has ended.
+ * Other tabs stay usable meanwhile; the connection can be cancelled from the tab label.
+ */
+void
+terminal_connect_async (struct ConnectionTab *p_conn_tab, struct SSH_Auth_Data *p_auth, int ask)
+{
+  SConnectJob *job;
+
+  job = g_new0 (SConnectJob, 1);
+  memcpy (&job->auth, p_auth, sizeof (struct SSH_Auth_Data));
+  job->auth.progress = connect_job_progress;
+  job->auth.progress_data = p_conn_tab;
+  job->auth.cancel = &job->cancel;
+  job->p_ct = p_conn_tab;
+  job->ask = ask;
+
+  p_conn_tab->connect_job = job;
+
+  if (p_conn_tab->cancel_button)
+    gtk_widget_show (p_conn_tab->cancel_button);
+
+  if (connectJobsRunning ++ == 0)
+    sftp_spinner_start ();
+
+  g_thread_unref (g_thread_new ("connect", connect_job_thread, job));
+}
+
+/**
+ * log_on_end() - ends the log on of a tab, at once or when its connection has ended
+ * @return rc
+ */
 int
-terminal_connect_ssh (struct ConnectionTab *p_conn_tab, struct SSH_Auth_Data *p_auth)
+log_on_end (struct ConnectionTab *p_conn_tab, int rc)
+{
+  p_conn_tab->enter_key_relogging = 0;
+
+  connection_tab_logged_on (p_conn_tab, rc);
+
+  return (rc);
+}
+
+/**
+ * log_on_connect() - opens the ssh session of a tab in background
+ * @param ask credentials have been typed by the user, asked again if wrong
+ * @return LOG_ON_PENDING
+ */
+int
+log_on_connect (struct ConnectionTab *p_conn_tab, struct SSH_Auth_Data *p_auth, int ask)
 {
-  int login_rc = 0;
-  
   terminal_write_ex (p_conn_tab, _("Connecting to %s...\n\r"), p_conn_tab->connection.host);
+
+  terminal_connect_async (p_conn_tab, p_auth, ask);
+
+  return (LOG_ON_PENDING);
+}
+
+/**
+ * log_on_ask() - asks username and password, then connects
+ * @return LOG_ON_PENDING if connecting, the result of log_on() otherwise
+ */
+int
+log_on_ask (struct ConnectionTab *p_conn_tab, struct SSH_Auth_Data *p_auth)
+{
+  int rc;
+
+  log_write ("Prompt username and password\n");
+
+  rc = show_login_mask (p_conn_tab, p_auth);
   
-  login_rc = lt_ssh_connect (&p_conn_tab->ssh_info, &globals.ssh_list, p_auth);
-  
+  log_debug ("show_login_mask() returns %d\n", rc);
+
+  if (rc != 0) // cancel
+    {
+      tabSetConnectionStatus (p_conn_tab, TAB_CONN_STATUS_DISCONNECTED);
+      return (log_on_end (p_conn_tab, 1));
+    }
+
+  if (!p_auth->sftp_enabled)
+    {
+      strcpy (p_conn_tab->connection.user, p_auth->user);
+      strcpy (p_conn_tab->connection.password, p_auth->password);
+
+      return (log_on_terminal (p_conn_tab, p_auth));
+    }
+
+  return (log_on_connect (p_conn_tab, p_auth, 1));
+}
+
+/**
+ * log_on_connected() - goes on with the log on of a tab once its ssh session has been opened, or not
+ * (called by connect_job_done_cb())
+ * @return LOG_ON_PENDING if connecting again, the result of log_on() otherwise
+ */
+int
+log_on_connected (struct ConnectionTab *p_conn_tab, struct SSH_Auth_Data *p_auth, int ask, int login_rc)
+{
   log_debug ("login_rc = %d\n", login_rc);
-  
+
   if (login_rc == 0)
     {
       strcpy (p_conn_tab->connection.user, p_auth->user[0] ? p_auth->user : "");
       strcpy (p_conn_tab->connection.password, p_auth->password[0] ? p_auth->password : "");
+
+      add_recent_connection (&(p_conn_tab->connection));
     }
   else if (login_rc == SSH_ERR_CONNECT)
     {
       msgbox_error ("Can't connect to %s", p_conn_tab->connection.host);
     }
-  else if (login_rc == SSH_ERR_UNKNOWN_AUTH_METHOD)
+  else if (login_rc != SSH_ERR_UNKNOWN_AUTH_METHOD)
+    {
+      log_write ("ssh: %d %s\n", login_rc, p_conn_tab->ssh_info.error_s);
+    }
+
+  if (ask)
     {
-      //break;
+      if (login_rc == SSH_ERR_CONNECT)
+        return (log_on_end (p_conn_tab, 1));
+
+      if (login_rc != 0 && login_rc != SSH_ERR_CANCELLED && login_rc != SSH_ERR_UNKNOWN_AUTH_METHOD
+          && login_rc != SSH_ERR_HOST_NOT_VERIFIED)
+        {
+          p_conn_tab->auth_attempt ++;
+
+          if (p_conn_tab->auth_attempt < 3)
+            return (log_on_ask (p_conn_tab, p_auth));
+
+          login_rc = 1;
+        }
     }
   else
+    log_write ("ssh: %s\n", login_rc == 0 ? "authentication ok" : p_conn_tab->ssh_info.error_s);
+
+  if (login_rc == SSH_ERR_CANCELLED)
     {
-      log_write ("ssh: %d %s\n", login_rc, login_rc == 0 ? "" : p_conn_tab->ssh_info.error_s);
+      tabSetConnectionStatus (p_conn_tab, TAB_CONN_STATUS_DISCONNECTED);
+      return (log_on_end (p_conn_tab, 1));
     }
 
-  if (login_rc == 0)
+  if (login_rc)
     {
-      add_recent_connection (&(p_conn_tab->connection));
+      msgbox_error ("%s", p_conn_tab->ssh_info.error_s);
+      return (log_on_end (p_conn_tab, 1));
     }
-                  
-  return (login_rc);
+
+  return (log_on_terminal (p_conn_tab, p_auth));
 }
 
 /**
- * log_on() - starts a connection with the given protocol (called by connection_log_on())
+ * log_on_terminal() - runs the shell of a tab, on a channel of its session or with the command of the protocol
  * @return 0 if ok, not zero otherwise
  */
 int
-log_on (struct ConnectionTab *p_conn_tab)
+log_on_terminal (struct ConnectionTab *p_conn_tab, struct SSH_Auth_Data *p_auth)
 {
-  char expanded_args[1024], temp[64];
-  char /*params[64][512],*/ **p_params;
-  int i, ret;
-  int rc = 0, login_rc = 0;
+  char expanded_args[2048], temp[320];
+  char **p_params;
+  int ret, rc = 0;
   struct Protocol *p_prot;
-  struct SSH_Auth_Data auth;
+  struct SSH_Auth_Data jump_auth_data;
   gboolean success;
   char error_msg[1024];
-  
+
   if ((p_prot = get_protocol (&g_prot_list, p_conn_tab->connection.protocol)) == NULL)
     {
       msgbox_error ("Protocol not found: %s", p_conn_tab->connection.protocol);
-      return (1);
+      return (log_on_end (p_conn_tab, 1));
     }
-    
-  p_conn_tab->auth_attempt = 0;
-  p_conn_tab->auth_state = AUTH_STATE_NOT_LOGGED;
 
-  /* check if command is installed */
-
-  if (!check_command (p_prot->command))
+  /* already authenticated: open a shell on the same connection */
+  if (p_prot->type == PROT_TYPE_SSH && ssh_terminal_supported (&p_conn_tab->connection)
+      && lt_ssh_is_connected (&p_conn_tab->ssh_info))
     {
-      msgbox_error ("Command not found: %s", p_prot->command);
-      return (1);
-    }
-    
-  log_write ("[%s] server:%s protocol:%s\n", __func__, p_conn_tab->connection.host, p_prot->name);
-
-  tabSetConnectionStatus (p_conn_tab, TAB_CONN_STATUS_CONNECTING);
-
-  if (p_prot->type == PROT_TYPE_SSH)
-    {      
-      log_write ("Init ssh\n");
-      
-      lt_ssh_init (&p_conn_tab->ssh_info);
-      memset (&auth, 0, sizeof (struct SSH_Auth_Data));
-      
-      strcpy (auth.host, p_conn_tab->connection.host);
-      auth.port = p_conn_tab->connection.port; 
-      auth.mode = p_conn_tab->connection.auth_mode;  
-
-      if (p_conn_tab->connection.user[0])
-        strcpy (auth.user, p_conn_tab->connection.user);
-        
-      if (p_conn_tab->connection.password[0])
-        strcpy (auth.password, p_conn_tab->connection.password); 
-        
-      if (p_conn_tab->connection.identityFile[0])
-        strcpy (auth.identityFile, p_conn_tab->connection.identityFile); 
-             
-      if (p_conn_tab->connection.auth_mode == CONN_AUTH_MODE_KEY)
+      if (ssh_terminal_open (p_conn_tab) == 0)
         {
-          auth.mode = CONN_AUTH_MODE_KEY;
-          
-          log_write ("Log in with key authentication and user %s\n", 
-                     p_conn_tab->connection.user[0] == 0 ? "unknown" : p_conn_tab->connection.user);
-          
-          if (p_conn_tab->connection.user[0] == 0)
-            {
-              log_write ("Prompt for username\n");
-              rc = show_login_mask (p_conn_tab, &auth);
-              strcpy (p_conn_tab->connection.user, auth.user);
-              strcpy (p_conn_tab->connection.password, auth.password);
-            }
-          else
-            {
-              rc = 0;
-              auth.sftp_enabled = 1;
-            }
-     
-          if (rc == 0)
-            {
-              if (auth.sftp_enabled)
-                {
-                  log_write ("SFTP enabled\n");
-                  login_rc = terminal_connect_ssh (p_conn_tab, &auth);
-                }
-            }
-          else /* cancel */
-            {
-              tabSetConnectionStatus (p_conn_tab, TAB_CONN_STATUS_DISCONNECTED);
-              return (1);
-            }
-        }
-      else if (p_conn_tab->connection.auth_mode == CONN_AUTH_MODE_SAVE || p_conn_tab->enter_key_relogging
-          || (p_conn_tab->connection.user[0] && p_conn_tab->connection.password[0]))
-        {
-          if (p_conn_tab->enter_key_relogging)
-            log_write ("Log in again with the same username and password (Enter key pressed).\n");
-          else
-            log_write ("Log in with saved username and password.\n");
+          tabSetConnectionStatus (p_conn_tab, TAB_CONN_STATUS_CONNECTED);
+          tabSetFlag (p_conn_tab, TAB_LOGGED);
+          p_conn_tab->auth_state = AUTH_STATE_LOGGED;
+          p_conn_tab->type = CONNECTION_REMOTE;
+          p_conn_tab->pid = 0;
 
-          login_rc = terminal_connect_ssh (p_conn_tab, &auth);
-                      
-          log_write ("ssh: %s\n", login_rc == 0 ? "authentication ok" : p_conn_tab->ssh_info.error_s);
+          return (log_on_end (p_conn_tab, 0));
         }
-      else
-        {
-          while (p_conn_tab->auth_attempt < 3)
-            {
-              log_write ("Prompt username and password\n");
 
-              rc = show_login_mask (p_conn_tab, &auth);
-              
-              log_debug ("show_login_mask() returns %d\n", rc);
-              
-              if (rc == 0 && !auth.sftp_enabled)
-                {
-                  strcpy (p_conn_tab->connection.user, auth.user);
-                  strcpy (p_conn_tab->connection.password, auth.password);
-                  rc = 0;
-                  break;
-                }
-
-              if (rc == 0)
-                { 
-                  login_rc = terminal_connect_ssh (p_conn_tab, &auth);
-                  
-                  if (login_rc == 0)
-                    break;
-                  else if (login_rc == SSH_ERR_CONNECT)
-                    return (1);
-                  else if (login_rc == SSH_ERR_UNKNOWN_AUTH_METHOD)
-                    break;
-                  else if (login_rc == SSH_ERR_HOST_NOT_VERIFIED)
-                    break;
-                  else
-                    p_conn_tab->auth_attempt ++;
-                }
-              else // cancel
-                {
-                  tabSetConnectionStatus (p_conn_tab, TAB_CONN_STATUS_DISCONNECTED);
-                  return (1);
-                }
-            }
-
-          if (p_conn_tab->auth_attempt >= 3)
-            login_rc = 1;
-        }
-
-      p_conn_tab->enter_key_relogging = 0;
+      log_write ("Can't open shell channel, running %s\n", p_prot->command);
+    }
 
-      if (login_rc)
-        {
-          msgbox_error ("%s", p_conn_tab->ssh_info.error_s);
-          return (1);
-        }
+  if (!check_command (p_prot->command))
+    {
+      msgbox_error ("Command not found: %s", p_prot->command);
+      return (log_on_end (p_conn_tab, 1));
     }
 
   ret = expand_args (&p_conn_tab->connection, p_prot->args, p_prot->command, expanded_args);
   
   if (ret)
-    return 1;
+    return (log_on_end (p_conn_tab, 1));
 
   // Add SSH options
 
@@ -328,6 +475,32 @@ log_on (struct ConnectionTab *p_conn_tab)
       strcat (expanded_args, temp);
     } 
 
+    /* same algorithms of the sftp session */
+    if (p_conn_tab->connection.sshOptions.ciphers[0]) {
+      strcat (expanded_args, " -c ");
+      strcat (expanded_args, p_conn_tab->connection.sshOptions.ciphers);
+    }
+
+    if (p_conn_tab->connection.sshOptions.macs[0]) {
+      strcat (expanded_args, " -m ");
+      strcat (expanded_args, p_conn_tab->connection.sshOptions.macs);
+    }
+
+    if (p_conn_tab->connection.sshOptions.kex[0]) {
+      strcat (expanded_args, " -o KexAlgorithms=");
+      strcat (expanded_args, p_conn_tab->connection.sshOptions.kex);
+    }
+
+    if (p_conn_tab->connection.sshOptions.compression == CONN_COMPRESSION_ON)
+      strcat (expanded_args, " -C");
+
+    /* connection names are resolved, as the ssh client doesn't know them */
+    if (p_conn_tab->connection.sshOptions.jumpHost[0]
+        && jump_auth (p_conn_tab->connection.sshOptions.jumpHost, p_auth, &jump_auth_data) == 0) {
+      sprintf (temp, " -J %s@%s:%d", jump_auth_data.user, jump_auth_data.host, jump_auth_data.port);
+      strcat (expanded_args, temp);
+    }
+
     if (p_conn_tab->connection.auth_mode == CONN_AUTH_MODE_KEY
         && p_conn_tab->connection.identityFile[0])
       {
@@ -439,9 +612,122 @@ log_on (struct ConnectionTab *p_conn_tab)
       rc = 2;
     }
 
+  return (log_on_end (p_conn_tab, rc));
+}
+
+/**
+ * log_on() - starts a connection with the given protocol (called by connection_log_on())
+ * The ssh session is opened in background: the result is given to connection_tab_logged_on() in any case.
+ * @return LOG_ON_PENDING if connecting, 0 if ok, not zero otherwise
+ */
+int
+log_on (struct ConnectionTab *p_conn_tab)
+{
+  int rc = 0;
+  struct Protocol *p_prot;
+  struct SSH_Auth_Data auth;
   
+  if ((p_prot = get_protocol (&g_prot_list, p_conn_tab->connection.protocol)) == NULL)
+    {
+      msgbox_error ("Protocol not found: %s", p_conn_tab->connection.protocol);
+      return (log_on_end (p_conn_tab, 1));
+    }
+    
+  p_conn_tab->auth_attempt = 0;
+  p_conn_tab->auth_state = AUTH_STATE_NOT_LOGGED;
 
-  return (rc);
+  /* check if command is installed, unless the shell runs in a channel of the session */
+
+  if (!(p_prot->type == PROT_TYPE_SSH && ssh_terminal_supported (&p_conn_tab->connection))
+      && !check_command (p_prot->command))
+    {
+      msgbox_error ("Command not found: %s", p_prot->command);
+      return (log_on_end (p_conn_tab, 1));
+    }
+    
+  log_write ("[%s] server:%s protocol:%s\n", __func__, p_conn_tab->connection.host, p_prot->name);
+
+  tabSetConnectionStatus (p_conn_tab, TAB_CONN_STATUS_CONNECTING);
+
+  memset (&auth, 0, sizeof (struct SSH_Auth_Data));
+
+  if (p_prot->type == PROT_TYPE_SSH)
+    {      
+      log_write ("Init ssh\n");
+      
+      lt_ssh_init (&p_conn_tab->ssh_info);
+      
+      strcpy (auth.host, p_conn_tab->connection.host);
+      auth.port = p_conn_tab->connection.port; 
+      auth.mode = p_conn_tab->connection.auth_mode;  
+
+      if (p_conn_tab->connection.user[0])
+        strcpy (auth.user, p_conn_tab->connection.user);
+        
+      if (p_conn_tab->connection.password[0])
+        strcpy (auth.password, p_conn_tab->connection.password); 
+        
+      if (p_conn_tab->connection.identityFile[0])
+        strcpy (auth.identityFile, p_conn_tab->connection.identityFile); 
+
+      /* same interval of the ssh client when set for the connection */
+      auth.keepalive_interval = p_conn_tab->connection.sshOptions.flagKeepAlive ? 
+                                  p_conn_tab->connection.sshOptions.keepAliveInterval : prefs.ssh_keepalive;
+
+      strcpy (auth.ciphers, p_conn_tab->connection.sshOptions.ciphers);
+      strcpy (auth.macs, p_conn_tab->connection.sshOptions.macs);
+      strcpy (auth.kex, p_conn_tab->connection.sshOptions.kex);
+      auth.compression = p_conn_tab->connection.sshOptions.compression;
+      strcpy (auth.jump, p_conn_tab->connection.sshOptions.jumpHost);
+      p_conn_tab->ssh_info.compression = p_conn_tab->connection.sshOptions.compression;
+             
+      if (p_conn_tab->connection.auth_mode == CONN_AUTH_MODE_KEY)
+        {
+          auth.mode = CONN_AUTH_MODE_KEY;
+          
+          log_write ("Log in with key authentication and user %s\n", 
+                     p_conn_tab->connection.user[0] == 0 ? "unknown" : p_conn_tab->connection.user);
+          
+          if (p_conn_tab->connection.user[0] == 0)
+            {
+              log_write ("Prompt for username\n");
+              rc = show_login_mask (p_conn_tab, &auth);
+              strcpy (p_conn_tab->connection.user, auth.user);
+              strcpy (p_conn_tab->connection.password, auth.password);
+            }
+          else
+            {
+              rc = 0;
+              auth.sftp_enabled = 1;
+            }
+     
+          if (rc != 0) /* cancel */
+            {
+              tabSetConnectionStatus (p_conn_tab, TAB_CONN_STATUS_DISCONNECTED);
+              return (log_on_end (p_conn_tab, 1));
+            }
+
+          if (auth.sftp_enabled)
+            {
+              log_write ("SFTP enabled\n");
+              return (log_on_connect (p_conn_tab, &auth, 0));
+            }
+        }
+      else if (p_conn_tab->connection.auth_mode == CONN_AUTH_MODE_SAVE || p_conn_tab->enter_key_relogging
+          || (p_conn_tab->connection.user[0] && p_conn_tab->connection.password[0]))
+        {
+          if (p_conn_tab->enter_key_relogging)
+            log_write ("Log in again with the same username and password (Enter key pressed).\n");
+          else
+            log_write ("Log in with saved username and password.\n");
+
+          return (log_on_connect (p_conn_tab, &auth, 0));
+        }
+      else
+        return (log_on_ask (p_conn_tab, &auth));
+    }
+
+  return (log_on_terminal (p_conn_tab, &auth));
 }
 
 
@@ -672,8 +958,12 @@ asked_for_password (struct ConnectionTab *p_ct, char *log_on_data)
   return (feed_child);
 }
 
+/**
+ * check_log_in_state() - answers the prompts found on the cursor line while logging in
+ * @prompts: PROMPT_* found by the prompt matcher of the tab
+ */
 int
-check_log_in_state (struct ConnectionTab *p_ct, char *line)
+check_log_in_state (struct ConnectionTab *p_ct, unsigned int prompts)
 {
   int feed_child;
   //char label[256];
@@ -684,7 +974,7 @@ check_log_in_state (struct ConnectionTab *p_ct, char *line)
   if (/*p_ct->logged*/tabGetFlag (p_ct, TAB_LOGGED))
     return 1;
 
-  log_debug ("state = %s line = '%s'\n", auth_state_desc[p_ct->auth_state], line);
+  log_debug ("state = %s prompts = %u\n", auth_state_desc[p_ct->auth_state], prompts);
 
   //p_prot = get_protocol (&g_prot_list, p_ct->connection.protocol);
   vteterminal = VTE_TERMINAL(p_ct->vte);
@@ -698,7 +988,7 @@ check_log_in_state (struct ConnectionTab *p_ct, char *line)
   switch (p_ct->auth_state) {
 
     case AUTH_STATE_NOT_LOGGED:
-      if (strstr (line, "login:") || strstr (line, "username:"))
+      if (prompts & PROMPT_USER)
         {
           log_debug ("Server asking user\n");
           
@@ -715,7 +1005,7 @@ check_log_in_state (struct ConnectionTab *p_ct, char *line)
             }
         }
 
-      if (strstr (line, "password:"))
+      if (prompts & PROMPT_PASSWORD)
         {
           feed_child = asked_for_password (p_ct, log_on_data);
 
@@ -733,7 +1023,7 @@ check_log_in_state (struct ConnectionTab *p_ct, char *line)
       break;
 
     case AUTH_STATE_GOT_USER:
-      if (strstr (line, "password:"))
+      if (prompts & PROMPT_PASSWORD)
         {
           feed_child = asked_for_password (p_ct, log_on_data);
 
@@ -750,7 +1040,7 @@ check_log_in_state (struct ConnectionTab *p_ct, char *line)
       break;
 
     case AUTH_STATE_GOT_PASSWORD:
-      if (strstr (line, "login:") || strstr (line, "username:"))
+      if (prompts & PROMPT_USER)
         {
           p_ct->auth_state = AUTH_STATE_NOT_LOGGED;
           strcpy (p_ct->connection.user, "");
@@ -770,7 +1060,7 @@ check_log_in_state (struct ConnectionTab *p_ct, char *line)
               p_ct->auth_state = AUTH_STATE_GOT_USER;
             }
         }
-      else if (strstr (line, "password:"))
+      else if (prompts & PROMPT_PASSWORD)
         {
           strcpy (p_ct->connection.password, "");
 
@@ -794,6 +1084,10 @@ check_log_in_state (struct ConnectionTab *p_ct, char *line)
           
           //p_ct->logged = 1;
           tabSetFlag (p_ct, TAB_LOGGED);
+
+          /* prompts are no more looked for */
+          prompt_matcher_free (p_ct->prompt_matcher);
+          p_ct->prompt_matcher = NULL;
           feed_child = 0;
           p_ct->auth_state = AUTH_STATE_LOGGED;
         }
@@ -821,6 +1115,70 @@ check_log_in_state (struct ConnectionTab *p_ct, char *line)
   return 1;
 }
 
+/**
+ * session_restore_next() - logs on the first tab of the next requests, session_restore_parallel at most at a time
+ */
+void
+session_restore_next ()
+{
+  SRestoreRequest *pReq;
+  struct ConnectionTab *p_ct;
+
+  while (restoreRequests && restoreRunning < MAX (prefs.session_restore_parallel, 1))
+    {
+      pReq = (SRestoreRequest *) restoreRequests->data;
+      restoreRequests = g_list_delete_link (restoreRequests, restoreRequests);
+
+      /* tabs closed while waiting are skipped */
+      while (pReq->tabs && g_list_find (connection_tab_list, pReq->tabs->data) == NULL)
+        pReq->tabs = g_list_delete_link (pReq->tabs, pReq->tabs);
+
+      if (pReq->tabs == NULL)
+        {
+          g_free (pReq);
+          continue;
+        }
+
+      p_ct = (struct ConnectionTab *) pReq->tabs->data;
+      pReq->tabs = g_list_delete_link (pReq->tabs, pReq->tabs);
+
+      p_ct->restore = pReq;
+      restoreRunning ++;
+
+      /* may end at once, calling session_restore_logged_on() */
+      connection_tab_log_on (p_ct);
+    }
+}
+
+/**
+ * session_restore_logged_on() - logs on the other tabs of a request once the first one has ended
+ * (called by connection_tab_logged_on(), also for a tab being closed)
+ * The session is found already open, otherwise each tab tries on its own.
+ */
+void
+session_restore_logged_on (struct ConnectionTab *p_ct)
+{
+  SRestoreRequest *pReq = p_ct->restore;
+  GList *item;
+
+  if (pReq == NULL)
+    return;
+
+  p_ct->restore = NULL;
+  restoreRunning --;
+
+  for (item = g_list_first (pReq->tabs); item; item = g_list_next (item))
+    {
+      if (g_list_find (connection_tab_list, item->data))
+        connection_tab_log_on ((struct ConnectionTab *) item->data);
+    }
+
+  g_list_free (pReq->tabs);
+  g_free (pReq);
+
+  session_restore_next ();
+}
+
 int
 load_session_file (char *filename)
 {
@@ -832,6 +1190,11 @@ load_session_file (char *filename)
   struct Connection_List cl;
   struct Connection *c;
   GList *list = NULL;
+  GHashTable *requests;
+  GList *requestList = NULL;
+  SRestoreRequest *pReq, *pSame;
+  struct SSH_Auth_Data auth;
+  char key[SSH_NODE_KEY_LEN];
   
   if (filename)
     strcpy (f, filename);
@@ -869,6 +1232,9 @@ load_session_file (char *filename)
 
   log_write ("Loaded: %d\n", g_list_length (list));
   
+  /* tabs are added at once, connections are opened in parallel */
+  requests = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
   item = g_list_first (list);
 
   while (item)
@@ -878,10 +1244,50 @@ load_session_file (char *filename)
       if (!memcmp (c->name, LOCAL_SHELL_TAG, strlen (LOCAL_SHELL_TAG)))
         connection_new_terminal_dir (c->directory);
       else
-        connection_log_on_param (c);
+        {
+          p_ct = connection_tab_new ();
+          p_ct->type = CONNECTION_REMOTE;
+          connection_copy (&p_ct->connection, c);
+          tabResetFlag (p_ct, TAB_LOGGED);
+
+          connection_tab_prepare (p_ct);
+          tabSetConnectionStatus (p_ct, TAB_CONN_STATUS_CONNECTING);
+
+          pReq = g_new0 (SRestoreRequest, 1);
+
+          if (ssh_pool_auth_data (c, &auth) == 0)
+            {
+              /* tabs with the same key share the session */
+              ssh_auth_key (&auth, key);
+              memset (auth.password, 0, sizeof (auth.password));
+
+              if ((pSame = (SRestoreRequest *) g_hash_table_lookup (requests, key)) != NULL)
+                {
+                  pSame->tabs = g_list_append (pSame->tabs, p_ct);
+                  g_free (pReq);
+                  pReq = NULL;
+                }
+              else
+                g_hash_table_insert (requests, g_strdup (key), pReq);
+            }
+
+          if (pReq)
+            {
+              pReq->tabs = g_list_append (pReq->tabs, p_ct);
+              requestList = g_list_append (requestList, pReq);
+            }
+        }
       
       item = g_list_next (item);
     }
+
+  /* started after grouping, so that every request has all of its tabs */
+  restoreRequests = g_list_concat (restoreRequests, requestList);
+  g_hash_table_destroy (requests);
+
+  session_restore_next ();
+
+  update_screen_info ();
     
   add_recent_session (filename);
 
@@ -3,8 +3,37 @@
 #define _TERMINAL_H
 
 #include "gui.h"
+#include "ssh.h"
+
+/* Restored tabs sharing the session on their host, logged on after the first one */
+typedef struct RestoreRequest {
+  GList *tabs;
+} SRestoreRequest;
+
+/* log_on() is waiting for the connection, its result will be given to connection_tab_logged_on() */
+#define LOG_ON_PENDING -1
+
+/* Connection of a tab opened by a background thread */
+typedef struct ConnectJob {
+  struct ConnectionTab *p_ct;
+  struct SSH_Auth_Data auth;
+  struct SSH_Info ssh_info;
+  int rc;
+  int ask;       /* credentials typed by the user, asked again if wrong */
+  gboolean cancel;
+  int abandoned; /* nobody waits for the result */
+} SConnectJob;
+
+/* Phase of a connection to be shown in a tab */
+typedef struct ConnectProgress {
+  struct ConnectionTab *p_ct;
+  char *message;
+} SConnectProgress;
 
 gboolean terminal_new (struct ConnectionTab *p_connection_tab, char *directory);
+void terminal_connect_async (struct ConnectionTab *p_conn_tab, struct SSH_Auth_Data *p_auth, int ask);
+void terminal_connect_cancel (struct ConnectionTab *p_ct);
+void cancel_button_clicked_cb (GtkButton *button, gpointer user_data);
 int log_on (struct ConnectionTab *p_conn_tab);
 void session_load ();
 void session_save ();
@@ -15,8 +44,9 @@ int check_log_in_parameter (int auth, char *auth_param, char *param, char *defau
                         char *label, int query_type, char *log_on_data);
 int asked_for_user (struct ConnectionTab *p_ct, char *log_on_data);
 int asked_for_password (struct ConnectionTab *p_ct, char *log_on_data);
-int check_log_in_state (struct ConnectionTab *p_ct, char *line);
+int check_log_in_state (struct ConnectionTab *p_ct, unsigned int prompts);
 int load_session_file (char *filename);
+void session_restore_logged_on (struct ConnectionTab *p_ct);
 int save_session_file (char *filename);
 void terminal_write_ex (struct ConnectionTab *p_ct, const char *fmt, ...);
 void terminal_write (const char *fmt, ...);
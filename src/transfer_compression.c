@@ -0,0 +1,360 @@
+
+/**
+ * Copyright (C) 2009-2018 Fabio Leone
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * @file transfer_compression.c
+ * @brief Transfers of compressible files through a second, compressed session
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+#include "main.h"
+#include "async.h"
+#include "ssh.h"
+#include "connection_list.h"
+#include "sftp-panel.h"
+#include "deadline.h"
+#include "conn_stats.h"
+#include "keepalive.h"
+#include "transfer_compression.h"
+
+extern Globals globals;
+extern Prefs prefs;
+
+/**
+ * compression_by_extension() - tells from the name if a file compresses well
+ * @return 1 if it does, 0 if it doesn't, -1 if unknown
+ */
+int
+compression_by_extension (char *filename)
+{
+  char *dot, pattern[64];
+  gchar *ext;
+  int rc = -1;
+
+  if ((dot = strrchr (filename, '.')) == NULL || strchr (dot, '/') || strlen (dot) > sizeof (pattern) - 3)
+    return (-1);
+
+  ext = g_ascii_strdown (dot + 1, -1);
+  sprintf (pattern, ",%s,", ext);
+  g_free (ext);
+
+  if (strstr ("," COMPRESSION_EXT_YES ",", pattern))
+    rc = 1;
+  else if (strstr ("," COMPRESSION_EXT_NO ",", pattern))
+    rc = 0;
+
+  return (rc);
+}
+
+/**
+ * compression_entropy() - Shannon entropy of data, in bits per byte
+ */
+double
+compression_entropy (unsigned char *data, int len)
+{
+  int count[256], i;
+  double p, h = 0;
+
+  memset (count, 0, sizeof (count));
+
+  for (i = 0; i < len; i++)
+    count[data[i]] ++;
+
+  for (i = 0; i < 256; i++)
+    {
+      if (count[i] == 0)
+        continue;
+
+      p = (double) count[i] / len;
+      h -= p * log2 (p);
+    }
+
+  return (h);
+}
+
+/**
+ * compression_sample() - reads the beginning of the source file of a transfer
+ * @return bytes read, negative on errors
+ */
+int
+compression_sample (struct SSH_Node *p_node, STransferInfo *p_ti, unsigned char *buffer)
+{
+  sftp_file file;
+  SDeadline deadline;
+  int fd, len;
+
+  if (p_ti->action == SFTP_ACTION_UPLOAD)
+    {
+      if ((fd = open (p_ti->source, O_RDONLY)) < 0)
+        return (-1);
+
+      len = read (fd, buffer, COMPRESSION_SAMPLE_BYTES);
+      close (fd);
+
+      return (len);
+    }
+
+  lockSSH (__func__, TRUE);
+
+  deadline_watch (&deadline, p_node->session, "sftp_open", prefs.sftp_timeout * 1000);
+
+  if ((file = sftp_open (p_node->sftp, p_ti->source, O_RDONLY, 0)) != NULL)
+    {
+      len = sftp_read (file, buffer, COMPRESSION_SAMPLE_BYTES);
+      sftp_close (file);
+    }
+  else
+    len = -1;
+
+  if (deadline_unwatch (&deadline))
+    ssh_node_set_validity (p_node, 0);
+
+  lockSSH (__func__, FALSE);
+
+  return (len);
+}
+
+/**
+ * compression_compressible() - tells if the file of a transfer is worth compressing
+ */
+gboolean
+compression_compressible (struct SSH_Node *p_node, STransferInfo *p_ti)
+{
+  unsigned char *buffer;
+  struct stat st;
+  double entropy = 8;
+  int len, rc;
+
+  if (p_ti->action == SFTP_ACTION_UPLOAD && (stat (p_ti->source, &st) != 0 || st.st_size < COMPRESSION_MIN_SIZE))
+    return (FALSE);
+
+  if ((rc = compression_by_extension (p_ti->source)) >= 0)
+    return (rc == 1);
+
+  buffer = g_malloc (COMPRESSION_SAMPLE_BYTES);
+
+  if ((len = compression_sample (p_node, p_ti, buffer)) > 0)
+    {
+      entropy = compression_entropy (buffer, len);
+      log_debug ("%s: %.2f bits per byte\n", p_ti->source, entropy);
+    }
+
+  g_free (buffer);
+
+  return (len > 0 && entropy < COMPRESSION_MAX_ENTROPY);
+}
+
+/**
+ * compression_preferred() - tells from the rates measured on the host if compression is faster
+ * Compression is assumed to help until enough transfers have been measured; then some
+ * compressible files are still sent the other way to follow changes of the link.
+ */
+gboolean
+compression_preferred (struct SSH_Node *p_node)
+{
+  double mbps[2];
+  int samples[2];
+
+  if (conn_stats_transfer_rates (p_node->host, p_node->port, mbps, samples) != 0)
+    return (TRUE);
+
+  if (samples[1] >= COMPRESSION_MIN_SAMPLES && samples[0] * COMPRESSION_PROBE_RATIO < samples[1])
+    return (FALSE);
+
+  if (samples[0] >= COMPRESSION_MIN_SAMPLES && samples[1] * COMPRESSION_PROBE_RATIO < samples[0])
+    return (TRUE);
+
+  if (samples[0] < COMPRESSION_MIN_SAMPLES || samples[1] < COMPRESSION_MIN_SAMPLES)
+    return (TRUE);
+
+  return (mbps[1] >= mbps[0]);
+}
+
+/**
+ * compression_session() - compressed session to the server of a node, opened if needed
+ * It is used only by the transfer thread and released with the node.
+ * @return the sftp session, NULL if it can't be opened
+ */
+sftp_session
+compression_session (struct SSH_Node *p_node)
+{
+  struct SSH_Auth_Data auth;
+  struct SSH_Node *p_compressed, *p_old = NULL;
+
+  lockSSH (__func__, TRUE);
+
+  if (p_node->compressed && ssh_node_get_validity (p_node->compressed) && p_node->compressed->sftp)
+    {
+      lockSSH (__func__, FALSE);
+      return (p_node->compressed->sftp);
+    }
+
+  if (p_node->auth == NULL)
+    {
+      lockSSH (__func__, FALSE);
+      return (NULL);
+    }
+
+  memcpy (&auth, p_node->auth, sizeof (struct SSH_Auth_Data));
+
+  lockSSH (__func__, FALSE);
+
+  auth.compression = CONN_COMPRESSION_ON;
+  auth.sftp_enabled = 1;
+
+  log_write ("Opening compressed session to %s@%s\n", auth.user, auth.host);
+
+  p_compressed = g_new0 (struct SSH_Node, 1);
+
+  if (ssh_node_establish (p_compressed, &auth, FALSE) != 0 || p_compressed->sftp == NULL)
+    {
+      log_write ("Can't open compressed session to %s@%s: %s\n", auth.user, auth.host, auth.error_s);
+      ssh_node_free (p_compressed);
+      g_free (p_compressed);
+      return (NULL);
+    }
+
+  strcpy (p_compressed->user, auth.user);
+  strcpy (p_compressed->host, auth.host);
+  p_compressed->port = auth.port;
+  p_compressed->valid = 1;
+
+  lockSSH (__func__, TRUE);
+
+  p_old = p_node->compressed;
+  p_node->compressed = p_compressed;
+
+  if (p_old)
+    {
+      ssh_node_free (p_old);
+      g_free (p_old);
+    }
+
+  /* a dead connection is noticed before the next transfer, as for the node itself */
+  keepalive_schedule (p_compressed, auth.keepalive_interval);
+
+  lockSSH (__func__, FALSE);
+
+  return (p_compressed->sftp);
+}
+
+/**
+ * compression_session_close() - releases the compressed session of a node, if any
+ */
+void
+compression_session_close (struct SSH_Node *p_node)
+{
+  lockSSH (__func__, TRUE);
+
+  if (p_node->compressed)
+    {
+      log_write ("Closing compressed session to %s@%s\n", p_node->compressed->user, p_node->compressed->host);
+
+      ssh_node_free (p_node->compressed);
+      g_free (p_node->compressed);
+      p_node->compressed = NULL;
+    }
+
+  lockSSH (__func__, FALSE);
+}
+
+/**
+ * transfer_sftp_node() - node of p_node owning an sftp session, the compressed one or p_node itself
+ */
+struct SSH_Node *
+transfer_sftp_node (struct SSH_Node *p_node, sftp_session sftp)
+{
+  if (p_node->compressed && p_node->compressed->sftp == sftp)
+    return (p_node->compressed);
+
+  return (p_node);
+}
+
+/**
+ * transfer_copy_file() - uploads or downloads a file, through the compressed session when it's worth it
+ * In auto mode the rates of compressible files, with and without compression, are recorded for the host.
+ * @return 0 if ok, the transfer error otherwise
+ */
+int
+transfer_copy_file (struct SSH_Info *p_ssh, STransferInfo *p_ti)
+{
+  struct SSH_Node *p_node = p_ssh->ssh_node;
+  sftp_session sftp = p_node->sftp, compressed_sftp;
+  gboolean compressible = FALSE, compressed = FALSE;
+  guint64 worked = p_ti->worked;
+  gint64 start;
+  int rc;
+
+  if (p_ssh->compression == CONN_COMPRESSION_AUTO && compression_compressible (p_node, p_ti))
+    {
+      compressible = TRUE;
+
+      if (compression_preferred (p_node) && (compressed_sftp = compression_session (p_node)) != NULL)
+        {
+          sftp = compressed_sftp;
+          compressed = TRUE;
+        }
+    }
+
+  if (compressible)
+    log_write ("%s %s %s compression\n", p_ti->action == SFTP_ACTION_UPLOAD ? "Uploading" : "Downloading",
+               p_ti->source, compressed ? "with" : "without");
+
+  start = g_get_monotonic_time ();
+
+  if (p_ti->action == SFTP_ACTION_UPLOAD)
+    rc = sftp_copy_file_upload (sftp, p_ti);
+  else
+    rc = sftp_copy_file_download (sftp, p_ti);
+
+  /* the compressed session may be dead: drop it and try once more on the node one */
+  if (rc != 0 && compressed && p_ti->state == TR_CANCELLED_ERRORS)
+    {
+      log_write ("Transfer of %s failed with compression, retrying without\n", p_ti->source);
+
+      compression_session_close (p_node);
+
+      compressed = FALSE;
+      sftp = p_node->sftp;
+      p_ti->worked = worked;
+      p_ti->result = 0;
+      p_ti->errorDesc[0] = 0;
+      p_ti->state = TR_IN_PROGRESS;
+
+      start = g_get_monotonic_time ();
+
+      if (p_ti->action == SFTP_ACTION_UPLOAD)
+        rc = sftp_copy_file_upload (sftp, p_ti);
+      else
+        rc = sftp_copy_file_download (sftp, p_ti);
+    }
+
+  if (rc == 0 && compressible)
+    conn_stats_add_transfer (p_node->host, p_node->port, compressed, p_ti->worked - worked, g_get_monotonic_time () - start);
+
+  return (rc);
+}
+
@@ -0,0 +1,33 @@
+
+#ifndef _TRANSFER_COMPRESSION_H
+#define _TRANSFER_COMPRESSION_H
+
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+#include "ssh.h"
+#include "sftp-panel.h"
+
+/* Extensions of files always (or never) worth compressing, other files are sampled */
+#define COMPRESSION_EXT_YES "txt,log,out,csv,tsv,json,xml,html,htm,css,js,sql,sh,c,h,cpp,py,java,md,conf,cfg,ini,yaml,yml,svg,tar,dump"
+#define COMPRESSION_EXT_NO "gz,tgz,bz2,tbz,xz,txz,zst,lz4,lzma,z,zip,7z,rar,jar,war,ear,apk,deb,rpm,jpg,jpeg,png,gif,webp,mp3,mp4,mkv,avi,mov,ogg,flac,pdf,docx,xlsx,pptx,odt,iso"
+
+/* Bytes read from the beginning of a file to estimate how well it compresses */
+#define COMPRESSION_SAMPLE_BYTES 65536
+
+/* Bits per byte under which a sample is considered compressible (8 is random data) */
+#define COMPRESSION_MAX_ENTROPY 6.5
+
+/* Smaller uploads aren't worth the second session */
+#define COMPRESSION_MIN_SIZE (256 * 1024)
+
+/* Compressible transfers per mode needed before comparing their rates */
+#define COMPRESSION_MIN_SAMPLES 3
+
+/* A compressible file is sent uncompressed every this many, to keep measuring the plain rate */
+#define COMPRESSION_PROBE_RATIO 8
+
+struct SSH_Node *transfer_sftp_node (struct SSH_Node *p_node, sftp_session sftp);
+int transfer_copy_file (struct SSH_Info *p_ssh, STransferInfo *p_ti);
+
+#endif
+
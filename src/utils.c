@@ -272,6 +272,36 @@ trim (char *s)
   rtrim (s);
 }
 
+/**
+ * shell_quote() - writes s in single quotes to be passed as one argument to a remote shell
+ * (dest must be at least 4 times the length of s + 3)
+ */
+char *
+shell_quote (char *dest, const char *s)
+{
+  char *d = dest;
+
+  *d++ = '\'';
+
+  while (*s)
+    {
+      if (*s == '\'')
+        {
+          strcpy (d, "'\\''");
+          d += 4;
+        }
+      else
+        *d++ = *s;
+
+      s ++;
+    }
+
+  *d++ = '\'';
+  *d = 0;
+
+  return (dest);
+}
+
 void
 list_init (char *list)
 {